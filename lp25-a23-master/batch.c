@@ -0,0 +1,439 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS is not exposed by strict compilers
+
+#include <batch.h>
+#include <sync.h>
+#include <dispatcher.h>
+#include <durable.h>
+#include <file-properties.h>
+#include <filter.h>
+#include <messages.h>
+#include <processes.h>
+#include <stats.h>
+#include <utility.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+/*!
+ * @brief now_ns returns the monotonic time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief split_job_line splits a line of the batch file into words, in place
+ * Words are separated by blanks; a word between double quotes may contain blanks.
+ * @param line is the line, modified
+ * @param words is an array of BATCH_MAX_WORDS words to fill
+ * @return the number of words, -1 if there are too many or a quote is not closed
+ */
+static int split_job_line(char *line, char **words) {
+    int count = 0;
+    char *cursor = line;
+    while (true) {
+        while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n') {
+            cursor++;
+        }
+        if (*cursor == '\0' || *cursor == '#') {
+            return count;
+        }
+        if (count == BATCH_MAX_WORDS) {
+            return -1;
+        }
+        if (*cursor == '"') {
+            words[count++] = ++cursor;
+            cursor = strchr(cursor, '"');
+            if (!cursor) {
+                return -1;
+            }
+        } else {
+            words[count++] = cursor;
+            cursor += strcspn(cursor, " \t\r\n");
+            if (*cursor == '\0') {
+                return count;
+            }
+        }
+        *cursor++ = '\0';
+    }
+}
+
+/*!
+ * @brief parse_job makes the configuration of a job from the words of its line
+ * The options of the command line are the defaults of every job, the options of the line are parsed over them.
+ * @param the_config is the configuration of the batch
+ * @param job_config receives the configuration of the job
+ * @param words are the words of the line: source, destination and options, in any order
+ * @param words_count is the number of words
+ * @return 0 when ok, -1 if the line is invalid
+ */
+static int parse_job(configuration_t *the_config, configuration_t *job_config, char **words, int words_count) {
+    char *argv[BATCH_MAX_WORDS + 2];
+    argv[0] = "lp25-backup";
+    for (int i=0; i<words_count; ++i) {
+        argv[i + 1] = words[i];
+    }
+    argv[words_count + 1] = NULL;
+
+    *job_config = *the_config;
+    job_config->batch_path[0] = '\0';
+    size_t rules_count = the_filter ? the_filter->rules_count : 0;
+    optind = 0;
+    if (set_configuration(job_config, words_count + 1, argv) == -1) {
+        return -1;
+    }
+    if ((the_filter ? the_filter->rules_count : 0) != rules_count) {
+        fprintf(stderr, "Error: filter rules apply to all the jobs, give them on the command line\n");
+        return -1;
+    }
+    // The copies of all the jobs are queued to the same copier pool, whether a job asked for them or not
+    if (job_config->is_dry_run != the_config->is_dry_run) {
+        fprintf(stderr, "Error: --dry-run applies to all the jobs, give it on the command line\n");
+        return -1;
+    }
+    // Jobs are plain runs sharing the pools of the batch
+    if (job_config->batch_path[0] != '\0' || job_config->serve_path[0] != '\0' || job_config->connect_path[0] != '\0'
+        || job_config->is_watching || job_config->is_resuming || job_config->is_streaming || job_config->memory_limit > 0
+        || job_config->plan_output_path[0] != '\0' || job_config->apply_path[0] != '\0' || job_config->extra_destinations_count > 0
+        || job_config->destination_manifest_path[0] != '\0' || job_config->manifest_output_path[0] != '\0' || job_config->dir_index_path[0] != '\0') {
+        fprintf(stderr, "Error: a job is a single source and destination, without modes of their own (watch, serve, streaming, plans, manifests...)\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief load_batch reads the jobs of the batch file
+ * Each line holds the source, the destination and the options of a job; blank lines and lines starting with # are skipped.
+ * @param the_config is the configuration of the batch
+ * @param configs receives the array of the configurations of the jobs
+ * @param jobs receives the array of the jobs
+ * @param jobs_count receives the number of jobs
+ * @return 0 when ok, -1 if the file cannot be read or a line is invalid
+ */
+static int load_batch(configuration_t *the_config, configuration_t **configs, batch_job_t **jobs, size_t *jobs_count) {
+    FILE *file = fopen(the_config->batch_path, "r");
+    if (!file) {
+        perror(the_config->batch_path);
+        return -1;
+    }
+    *configs = NULL;
+    *jobs = NULL;
+    *jobs_count = 0;
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    unsigned int line_number = 0;
+    int result = 0;
+    while (result == 0 && getline(&line, &line_size, file) != -1) {
+        line_number++;
+        char *words[BATCH_MAX_WORDS];
+        int words_count = split_job_line(line, words);
+        if (words_count == 0) {
+            continue;
+        }
+        if (*jobs_count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            configuration_t *bigger_configs = realloc(*configs, capacity * sizeof(configuration_t));
+            if (bigger_configs) {
+                *configs = bigger_configs;
+            }
+            batch_job_t *bigger_jobs = realloc(*jobs, capacity * sizeof(batch_job_t));
+            if (bigger_jobs) {
+                *jobs = bigger_jobs;
+            }
+            if (!bigger_configs || !bigger_jobs) {
+                perror("Failed allocating memory to the jobs");
+                result = -1;
+                break;
+            }
+        }
+        if (words_count == -1 || parse_job(the_config, &(*configs)[*jobs_count], words, words_count) == -1) {
+            fprintf(stderr, "Error: invalid job at line %u of %s\n", line_number, the_config->batch_path);
+            result = -1;
+            break;
+        }
+        batch_job_t *job = &(*jobs)[(*jobs_count)++];
+        memset(job, 0, sizeof(batch_job_t));
+        job->line = line_number;
+    }
+    free(line);
+    fclose(file);
+    if (result == 0 && *jobs_count == 0) {
+        fprintf(stderr, "Error: no job in %s\n", the_config->batch_path);
+        result = -1;
+    }
+    return result;
+}
+
+/*!
+ * @brief list_job lists the source and the destination of a job, without analyzing their files yet
+ * @return the number of entries listed, 0 if the job cannot run
+ */
+static unsigned long list_job(configuration_t *job_config, batch_job_t *job) {
+    if (!directory_exists(job_config->source) || !directory_exists(job_config->destination) || !is_directory_writable(job_config->destination)) {
+        fprintf(stderr, "Error: job at line %u: %s or %s does not exist or is not writable\n", job->line, job_config->source, job_config->destination);
+        job->has_failed = true;
+        return 0;
+    }
+    make_list(&job->source, job_config->source);
+    make_list(&job->destination, job_config->destination);
+    for (files_list_entry_t *cursor=job->source.head; cursor!=NULL; cursor=cursor->next) {
+        job->entries_count++;
+    }
+    for (files_list_entry_t *cursor=job->destination.head; cursor!=NULL; cursor=cursor->next) {
+        job->entries_count++;
+    }
+    return job->entries_count;
+}
+
+/*!
+ * @brief analyze_wave analyzes the entries of several jobs with a single analyzer pool
+ * Entries are taken from the jobs in turn, so that each job gets its share of the analyzers. If an entry
+ * cannot be analyzed, the entries are analyzed again here, one job at a time, so only its job fails.
+ * @param the_config is the configuration of the batch
+ * @param jobs is the array of the jobs of the wave
+ * @param jobs_count is the number of jobs of the wave
+ */
+static void analyze_wave(configuration_t *the_config, batch_job_t *jobs, size_t jobs_count) {
+    size_t entries_count = 0;
+    for (size_t j=0; j<jobs_count; ++j) {
+        entries_count += jobs[j].has_failed ? 0 : jobs[j].entries_count;
+    }
+    files_list_entry_t **entries = malloc((entries_count ? entries_count : 1) * sizeof(files_list_entry_t *));
+    files_list_entry_t **cursors = calloc(jobs_count ? jobs_count * 2 : 1, sizeof(files_list_entry_t *));
+    bool is_analyzed = false;
+    if (entries && cursors) {
+        for (size_t j=0; j<jobs_count; ++j) {
+            cursors[2 * j] = jobs[j].has_failed ? NULL : jobs[j].source.head;
+            cursors[2 * j + 1] = jobs[j].has_failed ? NULL : jobs[j].destination.head;
+        }
+        size_t count = 0;
+        while (count < entries_count) {
+            for (size_t j=0; j<jobs_count; ++j) {
+                files_list_entry_t **cursor = cursors[2 * j] ? &cursors[2 * j] : &cursors[2 * j + 1];
+                if (*cursor) {
+                    entries[count++] = *cursor;
+                    *cursor = (*cursor)->next;
+                }
+            }
+        }
+        SET_PROGRESS_PHASE(PROGRESS_ANALYZING);
+        is_analyzed = the_config->is_parallel && analyze_entries_parallel(entries, entries_count, false, the_config) == 0;
+    }
+    free(entries);
+    free(cursors);
+
+    for (size_t j=0; j<jobs_count && !is_analyzed; ++j) {
+        files_list_t *lists[2] = {&jobs[j].source, &jobs[j].destination};
+        for (int l=0; l<2 && !jobs[j].has_failed; ++l) {
+            for (files_list_entry_t *cursor=lists[l]->head; cursor!=NULL && !jobs[j].has_failed; cursor=cursor->next) {
+                if (get_file_stats(cursor) == -1) {
+                    fprintf(stderr, "Error: job at line %u: cannot analyze %s\n", jobs[j].line, cursor->path_and_name);
+                    jobs[j].has_failed = true;
+                }
+            }
+        }
+    }
+}
+
+/*!
+ * @brief compare_differences orders differences for qsort: directories in path order, then files largest first
+ */
+static int compare_differences(const void *lhs, const void *rhs) {
+    files_list_entry_t *left = *(files_list_entry_t **)lhs;
+    files_list_entry_t *right = *(files_list_entry_t **)rhs;
+    if (left->entry_type != right->entry_type) {
+        return left->entry_type == DOSSIER ? -1 : 1;
+    }
+    if (left->entry_type == DOSSIER) {
+        return strcmp(left->path_and_name, right->path_and_name);
+    }
+    return left->size < right->size ? 1 : (left->size > right->size ? -1 : 0);
+}
+
+/*!
+ * @brief diff_job finds the entries of the source of a job that must be copied to its destination
+ * @param job_config is the configuration of the job
+ * @param job is the job, whose lists are analyzed
+ */
+static void diff_job(configuration_t *job_config, batch_job_t *job) {
+    size_t capacity = 0;
+    for (files_list_entry_t *cursor=job->source.head; cursor!=NULL; cursor=cursor->next) {
+        capacity++;
+    }
+    job->differences = malloc((capacity ? capacity : 1) * sizeof(files_list_entry_t *));
+    if (!job->differences) {
+        job->has_failed = true;
+        return;
+    }
+    for (files_list_entry_t *cursor=job->source.head; cursor!=NULL; cursor=cursor->next) {
+        char *relative_path = cursor->path_and_name + strlen(job_config->source);
+        while (*relative_path == '/') {
+            relative_path++;
+        }
+        char *destination_path = concat_path(NULL, job_config->destination, relative_path);
+        uint64_t lookup_start = start_stats_timer();
+        files_list_entry_t *destination_entry = destination_path ? find_entry_by_name(&job->destination, destination_path) : NULL;
+        stop_stats_timer(STATS_DIFF, lookup_start);
+        free(destination_path);
+        if (!destination_entry || mismatch(cursor, destination_entry, job_config)) {
+            job->differences[job->differences_count++] = cursor;
+            job->bytes_to_copy += cursor->entry_type == FICHIER ? cursor->size : 0;
+        }
+    }
+    qsort(job->differences, job->differences_count, sizeof(files_list_entry_t *), compare_differences);
+
+    if (job_config->is_verbose || job_config->is_dry_run) {
+        printf("\nDIFFERENCES LIST OF %s:\n", job_config->destination);
+        for (size_t i=0; i<job->differences_count; ++i) {
+            printf("%s\n", job->differences[i]->path_and_name);
+        }
+    }
+}
+
+/*!
+ * @brief copy_wave copies the differences of the jobs of a wave
+ * Directories are created here first, so that files always have a parent. Files are then sent to the
+ * copier pool one job after the other, so that every job gets its share of the copiers, each job sending
+ * its largest files first. Without copiers, the files are copied here in the same order.
+ * @param configs is the array of the configurations of all the jobs
+ * @param jobs is the array of all the jobs
+ * @param first is the index of the first job of the wave
+ * @param last is the index after the last job of the wave
+ * @param counters is the array of the counters of all the jobs
+ * @param copier_config is the configuration of the copier pool, NULL when there is no pool
+ */
+static void copy_wave(configuration_t *configs, batch_job_t *jobs, size_t first, size_t last, job_counters_t *counters, copier_configuration_t *copier_config) {
+    uint64_t total_size = 0;
+    for (size_t j=first; j<last; ++j) {
+        total_size += jobs[j].has_failed ? 0 : jobs[j].bytes_to_copy;
+    }
+    STATS_ADD(bytes_to_copy, total_size);
+    SET_PROGRESS_PHASE(PROGRESS_COPYING);
+
+    for (size_t j=first; j<last; ++j) {
+        __atomic_store_n(&counters[j].finished_ns, now_ns(), __ATOMIC_RELAXED);
+        while (!jobs[j].has_failed && jobs[j].next_difference < jobs[j].differences_count && jobs[j].differences[jobs[j].next_difference]->entry_type == DOSSIER) {
+            copy_entry_to_destination(jobs[j].differences[jobs[j].next_difference++], &configs[j]);
+            __atomic_fetch_add(&counters[j].copied_entries, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    bool has_pending = true;
+    while (has_pending) {
+        has_pending = false;
+        for (size_t j=first; j<last; ++j) {
+            batch_job_t *job = &jobs[j];
+            if (job->has_failed || job->next_difference == job->differences_count) {
+                continue;
+            }
+            files_list_entry_t *entry = job->differences[job->next_difference++];
+            has_pending = has_pending || job->next_difference < job->differences_count;
+            if (copier_config && send_job_copy_command(copier_config->message_queue_id, MSG_TYPE_TO_COPIERS, entry, (int)j) != -1) {
+                continue;
+            }
+            copy_entry_to_destination(entry, &configs[j]);
+            __atomic_fetch_add(&counters[j].copied_entries, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&counters[j].copied_bytes, entry->size, __ATOMIC_RELAXED);
+            __atomic_store_n(&counters[j].finished_ns, now_ns(), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*!
+ * @brief run_batch runs the jobs of a batch file on shared analyzer and copier pools
+ * The copier pool is created once for the whole batch. Jobs are listed, analyzed and compared in waves
+ * of about BATCH_WAVE_ENTRIES entries, all the jobs of a wave sharing one analyzer pool; the copies of a
+ * wave are queued to the copier pool, which copies them while the next wave is listed and analyzed.
+ * A line is printed for each job once all are done.
+ * @param the_config is the configuration of the batch, with the batch file in batch_path
+ * @return 0 when all the jobs succeeded, -1 otherwise
+ */
+int run_batch(configuration_t *the_config) {
+    configuration_t *configs = NULL;
+    batch_job_t *jobs = NULL;
+    size_t jobs_count = 0;
+    if (load_batch(the_config, &configs, &jobs, &jobs_count) == -1) {
+        free(configs);
+        free(jobs);
+        return -1;
+    }
+    job_counters_t *counters = mmap(NULL, jobs_count * sizeof(job_counters_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (counters == MAP_FAILED) {
+        perror("Failed allocating the counters of the jobs");
+        free(configs);
+        free(jobs);
+        return -1;
+    }
+    memset(counters, 0, jobs_count * sizeof(job_counters_t));
+    for (size_t j=0; j<jobs_count; ++j) {
+        configs[j].job_failed_copies = &counters[j].failed_copies;
+    }
+    uint64_t start_ns = now_ns();
+
+    copier_configuration_t copier_config;
+    int copiers_count = 0;
+    int max_copiers = the_config->processes_count > 0 ? the_config->processes_count : 1;
+    pid_t *copiers_pids = the_config->is_parallel && !the_config->is_dry_run ? malloc(max_copiers * sizeof(pid_t)) : NULL;
+    if (copiers_pids) {
+        copiers_count = start_job_copier_pool(the_config, configs, counters, &copier_config, copiers_pids, max_copiers, BATCH_QUEUE_DEPTH);
+    }
+
+    for (size_t first=0; first<jobs_count; ) {
+        SET_PROGRESS_PHASE(PROGRESS_LISTING);
+        size_t last = first;
+        unsigned long wave_entries = 0;
+        while (last < jobs_count && (last == first || wave_entries < BATCH_WAVE_ENTRIES)) {
+            wave_entries += list_job(&configs[last], &jobs[last]);
+            last++;
+        }
+        analyze_wave(the_config, &jobs[first], last - first);
+        SET_PROGRESS_PHASE(PROGRESS_COMPARING);
+        for (size_t j=first; j<last; ++j) {
+            if (!jobs[j].has_failed) {
+                diff_job(&configs[j], &jobs[j]);
+            }
+        }
+        if (!the_config->is_dry_run) {
+            copy_wave(configs, jobs, first, last, counters, copiers_count > 0 ? &copier_config : NULL);
+        }
+        // Copy commands hold their own copy of the entries
+        for (size_t j=first; j<last; ++j) {
+            free(jobs[j].differences);
+            jobs[j].differences = NULL;
+            clear_files_list(&jobs[j].source);
+            clear_files_list(&jobs[j].destination);
+        }
+        first = last;
+    }
+
+    if (copiers_count > 0) {
+        stop_copier_pool(&copier_config, copiers_pids, copiers_count);
+    }
+    int result = finish_durable_writes(the_config);
+
+    for (size_t j=0; j<jobs_count; ++j) {
+        uint64_t finished_ns = counters[j].finished_ns > start_ns ? counters[j].finished_ns - start_ns : 0;
+        // A job whose copies failed did not leave its destination in sync
+        bool has_failed = jobs[j].has_failed || counters[j].failed_copies > 0;
+        printf("job %u: %s -> %s entries=%lu differences=%lu bytes_to_copy=%lu copied_entries=%lu copied_bytes=%lu failed_copies=%lu finished_ms=%.1f status=%s\n",
+               jobs[j].line, configs[j].source, configs[j].destination, jobs[j].entries_count, (unsigned long)jobs[j].differences_count,
+               (unsigned long)jobs[j].bytes_to_copy, (unsigned long)counters[j].copied_entries, (unsigned long)counters[j].copied_bytes,
+               (unsigned long)counters[j].failed_copies, finished_ns / 1e6, has_failed ? "failed" : "ok");
+        if (has_failed) {
+            result = -1;
+        }
+    }
+
+    munmap(counters, jobs_count * sizeof(job_counters_t));
+    free(copiers_pids);
+    free(configs);
+    free(jobs);
+    return result;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <configuration.h>
+#include <files-list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BATCH_MAX_WORDS 64 // Words of a job line: source, destination and options
+#define BATCH_QUEUE_DEPTH 64 // Files waiting in the MQ of the copier pool before the scheduler blocks
+#define BATCH_WAVE_ENTRIES 65536 // Entries listed at once: jobs are analyzed in waves, so memory does not grow with the batch
+
+typedef struct {
+    unsigned int line; // Line of the job in the batch file
+    files_list_t source;
+    files_list_t destination;
+    files_list_entry_t **differences; // Entries of the source list to copy, directories first, then files largest first
+    size_t differences_count;
+    size_t next_difference; // Next difference to send to the copier pool
+    unsigned long entries_count; // Entries listed in both trees
+    uint64_t bytes_to_copy;
+    bool has_failed;
+} batch_job_t;
+
+int run_batch(configuration_t *the_config);
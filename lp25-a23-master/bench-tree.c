@@ -0,0 +1,242 @@
+#define _DEFAULT_SOURCE // utimensat and st_mtim with strict compilers
+
+#include <bench-tree.h>
+#include <defines.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BENCH_WRITE_BUFFER_SIZE 65536
+#define BENCH_SPARSE_BLOCK_SIZE 4096
+#define BENCH_MODIFIED_MTIME_OFFSET 10000000 // Modified files get mtimes after all the generated ones
+
+typedef enum { BENCH_GENERATE, BENCH_MODIFY } bench_walk_mode_t;
+
+/*!
+ * @brief init_bench_tree_parameters sets the default workload: 1,360 files (about 110 MB) in 85 directories
+ * @param parameters is a pointer to the parameters to initialize
+ */
+void init_bench_tree_parameters(bench_tree_parameters_t *parameters) {
+    parameters->seed = 25;
+    parameters->depth = 3;
+    parameters->fanout = 4;
+    parameters->files_per_dir = 16;
+    parameters->min_size = 1024;
+    parameters->max_size = 256 << 10;
+    parameters->large_percent = 0;
+    parameters->large_size = 64 << 20;
+    parameters->sparse_percent = 0;
+    parameters->modified_percent = 10;
+}
+
+/*!
+ * @brief mix is the splitmix64 generator: it returns the next pseudo-random number of the state
+ * The same seed always gives the same sequence, whatever the platform.
+ */
+static uint64_t mix(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*!
+ * @brief draw_file_size picks the size of a regular file
+ * The power of two is drawn uniformly, then the size within it, so small files are as frequent as big ones
+ * on a logarithmic scale.
+ */
+static uint64_t draw_file_size(bench_tree_parameters_t *parameters, uint64_t *state) {
+    uint64_t min_size = parameters->min_size > 0 ? parameters->min_size : 1;
+    if (parameters->max_size <= min_size) {
+        return parameters->max_size;
+    }
+    int octaves = 0;
+    while (octaves < 62 && (min_size << (octaves + 1)) <= parameters->max_size) {
+        octaves++;
+    }
+    uint64_t low = min_size << (mix(state) % (octaves + 1));
+    uint64_t size = low + mix(state) % low;
+    return size > parameters->max_size ? parameters->max_size : size;
+}
+
+/*!
+ * @brief fill_buffer fills a buffer with pseudo-random bytes
+ */
+static void fill_buffer(uint8_t *buffer, size_t size, uint64_t *state) {
+    for (size_t i=0; i<size; i+=sizeof(uint64_t)) {
+        uint64_t value = mix(state);
+        memcpy(buffer + i, &value, size - i < sizeof(uint64_t) ? size - i : sizeof(uint64_t));
+    }
+}
+
+/*!
+ * @brief set_mtime sets the access and modification times of a file to a fixed date
+ */
+static int set_mtime(char *path, time_t seconds, long nanoseconds) {
+    struct timespec times[2] = {{.tv_sec=seconds, .tv_nsec=nanoseconds}, {.tv_sec=seconds, .tv_nsec=nanoseconds}};
+    return utimensat(AT_FDCWD, path, times, 0);
+}
+
+/*!
+ * @brief write_bench_file creates a file with pseudo-random content
+ * Sparse files only get a few blocks written, at the start, the middle and the end.
+ * @return 0 when ok, -1 in case of error
+ */
+static int write_bench_file(char *path, uint64_t size, bool is_sparse, uint64_t *state, uint8_t *buffer) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Error creating benchmark file");
+        return -1;
+    }
+
+    int result = 0;
+    if (is_sparse) {
+        uint64_t offsets[3] = {0, size / 2, size > BENCH_SPARSE_BLOCK_SIZE ? size - BENCH_SPARSE_BLOCK_SIZE : 0};
+        if (ftruncate(fd, size) == -1) {
+            result = -1;
+        }
+        for (int i=0; i<3 && result==0; ++i) {
+            size_t length = size - offsets[i] < BENCH_SPARSE_BLOCK_SIZE ? size - offsets[i] : BENCH_SPARSE_BLOCK_SIZE;
+            fill_buffer(buffer, length, state);
+            if (pwrite(fd, buffer, length, offsets[i]) != (ssize_t)length) {
+                result = -1;
+            }
+        }
+    } else {
+        for (uint64_t written=0; written<size && result==0; ) {
+            size_t length = size - written < BENCH_WRITE_BUFFER_SIZE ? size - written : BENCH_WRITE_BUFFER_SIZE;
+            fill_buffer(buffer, length, state);
+            ssize_t count = write(fd, buffer, length);
+            if (count <= 0) {
+                result = -1;
+            } else {
+                written += count;
+            }
+        }
+    }
+
+    if (close(fd) == -1 || result == -1) {
+        perror("Error writing benchmark file");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief walk_bench_dir generates or modifies one directory of the tree, then its subdirectories
+ * Each file and directory has its own seed derived from its parent's, so a file is always generated the
+ * same way and modify_bench_tree finds the same sizes without reading the tree.
+ * @return 0 when ok, -1 in case of error
+ */
+static int walk_bench_dir(bench_tree_parameters_t *parameters, char *path, int level, uint64_t dir_seed, bench_walk_mode_t mode,
+                          uint64_t generation, bench_tree_stats_t *stats, uint8_t *buffer) {
+    if (mode == BENCH_GENERATE) {
+        if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+            perror("Error creating benchmark directory");
+            return -1;
+        }
+        stats->directories_count++;
+    }
+
+    char child_path[PATH_SIZE];
+    for (int i=0; i<parameters->files_per_dir; ++i) {
+        uint64_t state = dir_seed ^ (0x1000ULL + i);
+        mix(&state);
+        uint64_t file_state = mix(&state);
+        bool is_large = (int)(mix(&state) % 100) < parameters->large_percent;
+        bool is_sparse = is_large && (int)(mix(&state) % 100) < parameters->sparse_percent;
+        uint64_t size = is_large ? parameters->large_size : draw_file_size(parameters, &state);
+        time_t mtime = BENCH_BASE_MTIME + mix(&state) % BENCH_MODIFIED_MTIME_OFFSET;
+
+        if (snprintf(child_path, sizeof(child_path), "%s/f%04d.dat", path, i) >= (int)sizeof(child_path)) {
+            return -1;
+        }
+
+        if (mode == BENCH_GENERATE) {
+            if (write_bench_file(child_path, size, is_sparse, &file_state, buffer) == -1 || set_mtime(child_path, mtime, 0) == -1) {
+                return -1;
+            }
+        } else {
+            uint64_t change_state = file_state ^ (generation * 0xd1b54a32d192ed03ULL);
+            if ((int)(mix(&change_state) % 100) >= parameters->modified_percent) {
+                continue;
+            }
+            // Same size, new content and mtime: the change must be found by MD5 or by mtime
+            int fd = open(child_path, O_WRONLY);
+            if (fd == -1) {
+                perror("Error opening benchmark file");
+                return -1;
+            }
+            uint8_t patch[16];
+            fill_buffer(patch, sizeof(patch), &change_state);
+            uint64_t offset = size > sizeof(patch) ? mix(&change_state) % (size - sizeof(patch)) : 0;
+            size_t length = size < sizeof(patch) ? size : sizeof(patch);
+            bool is_written = pwrite(fd, patch, length, offset) == (ssize_t)length;
+            if (close(fd) == -1 || !is_written || set_mtime(child_path, BENCH_BASE_MTIME + BENCH_MODIFIED_MTIME_OFFSET + generation, 0) == -1) {
+                perror("Error modifying benchmark file");
+                return -1;
+            }
+        }
+        stats->files_count++;
+        stats->bytes_count += size;
+    }
+
+    if (level >= parameters->depth) {
+        return 0;
+    }
+    for (int i=0; i<parameters->fanout; ++i) {
+        uint64_t state = dir_seed ^ (0x100000ULL + i);
+        uint64_t child_seed = mix(&state);
+        if (snprintf(child_path, sizeof(child_path), "%s/d%03d", path, i) >= (int)sizeof(child_path)) {
+            return -1;
+        }
+        if (walk_bench_dir(parameters, child_path, level + 1, child_seed, mode, generation, stats, buffer) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief start_bench_walk runs walk_bench_dir on the whole tree
+ */
+static int start_bench_walk(bench_tree_parameters_t *parameters, char *root, bench_walk_mode_t mode, uint64_t generation, bench_tree_stats_t *stats) {
+    uint8_t *buffer = malloc(BENCH_WRITE_BUFFER_SIZE);
+    if (!buffer) {
+        perror("\nFailed allocating memory to benchmark buffer");
+        return -1;
+    }
+    memset(stats, 0, sizeof(bench_tree_stats_t));
+    uint64_t state = parameters->seed;
+    int result = walk_bench_dir(parameters, root, 0, mix(&state), mode, generation, stats, buffer);
+    free(buffer);
+    return result;
+}
+
+/*!
+ * @brief generate_bench_tree creates a reproducible tree: the same parameters always give the same
+ * names, sizes, contents and mtimes
+ * @param parameters is a pointer to the shape of the tree
+ * @param root is the directory to create the tree in (created if needed)
+ * @param stats receives the number of files, directories and bytes created
+ * @return 0 when ok, -1 in case of error
+ */
+int generate_bench_tree(bench_tree_parameters_t *parameters, char *root, bench_tree_stats_t *stats) {
+    return start_bench_walk(parameters, root, BENCH_GENERATE, 0, stats);
+}
+
+/*!
+ * @brief modify_bench_tree changes modified_percent of the files of a generated tree, keeping their size
+ * @param parameters is a pointer to the parameters the tree was generated with
+ * @param root is the root of the tree
+ * @param generation selects which files are modified and how; use a new value for each round
+ * @param stats receives the number of files and bytes modified
+ * @return 0 when ok, -1 in case of error
+ */
+int modify_bench_tree(bench_tree_parameters_t *parameters, char *root, uint64_t generation, bench_tree_stats_t *stats) {
+    return start_bench_walk(parameters, root, BENCH_MODIFY, generation, stats);
+}
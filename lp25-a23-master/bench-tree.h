@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BENCH_BASE_MTIME 1600000000 // Generated files get fixed mtimes from this date, so that trees are reproducible
+
+typedef struct {
+    uint64_t seed;
+    int depth; // Levels of directories below the root
+    int fanout; // Subdirectories per directory
+    int files_per_dir;
+    uint64_t min_size; // Regular file sizes are spread log-uniformly between min_size and max_size
+    uint64_t max_size;
+    int large_percent; // Share of files of large_size bytes
+    uint64_t large_size;
+    int sparse_percent; // Share of large files written as sparse files
+    int modified_percent; // Share of files changed by modify_bench_tree
+} bench_tree_parameters_t;
+
+typedef struct {
+    uint64_t files_count;
+    uint64_t directories_count;
+    uint64_t bytes_count; // Apparent size of the files
+} bench_tree_stats_t;
+
+void init_bench_tree_parameters(bench_tree_parameters_t *parameters);
+int generate_bench_tree(bench_tree_parameters_t *parameters, char *root, bench_tree_stats_t *stats);
+int modify_bench_tree(bench_tree_parameters_t *parameters, char *root, uint64_t generation, bench_tree_stats_t *stats);
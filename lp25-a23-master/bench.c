@@ -0,0 +1,314 @@
+#define _DEFAULT_SOURCE // wait4
+#define _XOPEN_SOURCE 700 // nftw
+
+#include <bench-tree.h>
+#include <utility.h>
+#include <errno.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define BENCH_MAX_ARGUMENTS 16
+
+typedef enum {DEPTH, FANOUT, FILES, MIN_SIZE, MAX_SIZE, LARGE_PERCENT, LARGE_SIZE, SPARSE_PERCENT, MODIFIED_PERCENT, SEED, REPETITIONS, STRACE, GENERATE_ONLY} bench_opt_values;
+
+typedef struct {
+    char *name;
+    char *option; // Option given to lp25-backup, NULL for none
+    bool is_full; // The destination is emptied first
+} bench_scenario_t;
+
+static bench_scenario_t scenarios[] = {
+    {.name="full", .option=NULL, .is_full=true},
+    {.name="incremental", .option=NULL, .is_full=false},
+    {.name="date-size-only", .option="--date-size-only", .is_full=false},
+    {.name="no-parallel", .option="--no-parallel", .is_full=false},
+};
+
+/*!
+ * @brief display_bench_help displays a brief manual for the benchmark usage
+ * @param my_name is the name of the binary file
+ */
+void display_bench_help(char *my_name) {
+    printf("%s [options] lp25-backup_binary work_dir\n", my_name);
+    printf("Generates a tree in work_dir/source, then runs full, incremental, --date-size-only and --no-parallel\n");
+    printf("synchronizations to work_dir/destination and writes one CSV line per run on stdout.\n");
+    printf("Options: \t--depth=<n> levels of directories (default 3)\n");
+    printf("         \t--fanout=<n> subdirectories per directory (default 4)\n");
+    printf("         \t--files=<n> files per directory (default 16)\n");
+    printf("         \t--min-size=<size> --max-size=<size> range of regular file sizes (default 1K to 256K)\n");
+    printf("         \t--large-percent=<n> share of files of --large-size=<size> bytes (default 0%%, 64M)\n");
+    printf("         \t--sparse-percent=<n> share of large files created sparse (default 0%%)\n");
+    printf("         \t--modified-percent=<n> share of files modified before each incremental run (default 10%%)\n");
+    printf("         \t--seed=<n> seed of the tree (default 25)\n");
+    printf("         \t--repetitions=<n> runs of each scenario (default 1)\n");
+    printf("         \t--strace counts syscalls with strace -f -c (slows the runs down)\n");
+    printf("         \t--generate-only creates work_dir/source and exits\n");
+}
+
+/*!
+ * @brief remove_entry removes one entry for nftw
+ */
+static int remove_entry(const char *path, const struct stat *statbuf, int type, struct FTW *ftw) {
+    return remove(path);
+}
+
+/*!
+ * @brief empty_directory removes a tree and creates its root again
+ * @return 0 when ok, -1 in case of error
+ */
+static int empty_directory(char *path) {
+    if (nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS) == -1 && errno != ENOENT) {
+        perror("Error removing benchmark destination");
+        return -1;
+    }
+    if (mkdir(path, 0755) == -1) {
+        perror("Error creating benchmark destination");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_strace_total reads the number of syscalls from a strace -c summary
+ * @return the number of syscalls, -1 if the summary cannot be read
+ */
+static long read_strace_total(char *summary_path) {
+    FILE *summary = fopen(summary_path, "r");
+    if (!summary) {
+        return -1;
+    }
+    long total = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), summary)) {
+        // The last line reads "100.00 seconds usecs/call calls [errors] total"
+        char *tokens[8];
+        int count = 0;
+        for (char *token=strtok(line, " \t\n"); token && count<8; token=strtok(NULL, " \t\n")) {
+            tokens[count++] = token;
+        }
+        if (count >= 5 && strcmp(tokens[count - 1], "total") == 0) {
+            total = atol(tokens[3]);
+        }
+    }
+    fclose(summary);
+    return total;
+}
+
+/*!
+ * @brief run_scenario runs lp25-backup once and prints its CSV line
+ * @return the exit status of lp25-backup, -1 if it could not be run
+ */
+static int run_scenario(bench_scenario_t *scenario, int repetition, char *binary, char *work_dir, bench_tree_stats_t *tree_stats, bool uses_strace) {
+    char source[PATH_SIZE];
+    char destination[PATH_SIZE];
+    char summary_path[PATH_SIZE];
+    snprintf(source, sizeof(source), "%s/source", work_dir);
+    snprintf(destination, sizeof(destination), "%s/destination", work_dir);
+    snprintf(summary_path, sizeof(summary_path), "%s/strace.txt", work_dir);
+
+    char *arguments[BENCH_MAX_ARGUMENTS];
+    int count = 0;
+    if (uses_strace) {
+        arguments[count++] = "strace";
+        arguments[count++] = "-f";
+        arguments[count++] = "-c";
+        arguments[count++] = "-o";
+        arguments[count++] = summary_path;
+    }
+    arguments[count++] = binary;
+    if (scenario->option) {
+        arguments[count++] = scenario->option;
+    }
+    arguments[count++] = source;
+    arguments[count++] = destination;
+    arguments[count] = NULL;
+
+    fflush(stdout);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Error forking benchmark run");
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd != -1) {
+            dup2(null_fd, STDOUT_FILENO);
+        }
+        execvp(arguments[0], arguments);
+        perror("Error running lp25-backup");
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) == -1) {
+        perror("Error waiting for benchmark run");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double wall_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    int exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    printf("%s,%d,%.6f,%lu,%lu,%.1f,%.2f,", scenario->name, repetition, wall_seconds, tree_stats->files_count, tree_stats->bytes_count,
+           tree_stats->files_count / wall_seconds, tree_stats->bytes_count / wall_seconds / 1e6);
+    long syscalls = uses_strace ? read_strace_total(summary_path) : -1;
+    if (syscalls >= 0) {
+        printf("%ld", syscalls);
+    }
+    printf(",%ld,%.6f,%.6f,%d\n", usage.ru_maxrss, usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6, exit_status);
+    fflush(stdout);
+    return exit_status;
+}
+
+/*!
+ * @brief parse_percent reads a percentage option
+ * @return 0 when ok, -1 if the value is not between 0 and 100
+ */
+static int parse_percent(char *text, int *percent) {
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < 0 || value > 100) {
+        return -1;
+    }
+    *percent = (int)value;
+    return 0;
+}
+
+/*!
+ * @brief main generates the benchmark tree and runs every scenario on it
+ * Throughputs are given for the whole source tree, since every run must at least scan all of it. The page
+ * cache is not dropped: runs measure the synchronization itself rather than the disk.
+ * @return 0 when all runs succeeded, 1 else
+ */
+int main(int argc, char *argv[]) {
+    bench_tree_parameters_t parameters;
+    init_bench_tree_parameters(&parameters);
+    int repetitions = 1;
+    bool uses_strace = false;
+    bool is_generate_only = false;
+    bool is_valid = true;
+
+    static struct option my_opts[] = {
+    {.name="depth",.has_arg=1,.flag=0,.val=DEPTH},
+    {.name="fanout",.has_arg=1,.flag=0,.val=FANOUT},
+    {.name="files",.has_arg=1,.flag=0,.val=FILES},
+    {.name="min-size",.has_arg=1,.flag=0,.val=MIN_SIZE},
+    {.name="max-size",.has_arg=1,.flag=0,.val=MAX_SIZE},
+    {.name="large-percent",.has_arg=1,.flag=0,.val=LARGE_PERCENT},
+    {.name="large-size",.has_arg=1,.flag=0,.val=LARGE_SIZE},
+    {.name="sparse-percent",.has_arg=1,.flag=0,.val=SPARSE_PERCENT},
+    {.name="modified-percent",.has_arg=1,.flag=0,.val=MODIFIED_PERCENT},
+    {.name="seed",.has_arg=1,.flag=0,.val=SEED},
+    {.name="repetitions",.has_arg=1,.flag=0,.val=REPETITIONS},
+    {.name="strace",.has_arg=0,.flag=0,.val=STRACE},
+    {.name="generate-only",.has_arg=0,.flag=0,.val=GENERATE_ONLY},
+    {.name=0,.has_arg=0,.flag=0,.val=0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", my_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'h':
+            display_bench_help(argv[0]);
+            return 0;
+            case DEPTH:
+            parameters.depth = atoi(optarg);
+            break;
+            case FANOUT:
+            parameters.fanout = atoi(optarg);
+            break;
+            case FILES:
+            parameters.files_per_dir = atoi(optarg);
+            break;
+            case MIN_SIZE:
+            is_valid = is_valid && parse_size(optarg, &parameters.min_size) == 0;
+            break;
+            case MAX_SIZE:
+            is_valid = is_valid && parse_size(optarg, &parameters.max_size) == 0;
+            break;
+            case LARGE_PERCENT:
+            is_valid = is_valid && parse_percent(optarg, &parameters.large_percent) == 0;
+            break;
+            case LARGE_SIZE:
+            is_valid = is_valid && parse_size(optarg, &parameters.large_size) == 0;
+            break;
+            case SPARSE_PERCENT:
+            is_valid = is_valid && parse_percent(optarg, &parameters.sparse_percent) == 0;
+            break;
+            case MODIFIED_PERCENT:
+            is_valid = is_valid && parse_percent(optarg, &parameters.modified_percent) == 0;
+            break;
+            case SEED:
+            parameters.seed = strtoull(optarg, NULL, 10);
+            break;
+            case REPETITIONS:
+            repetitions = atoi(optarg);
+            break;
+            case STRACE:
+            uses_strace = true;
+            break;
+            case GENERATE_ONLY:
+            is_generate_only = true;
+            break;
+            default:
+            is_valid = false;
+        }
+    }
+    if (!is_valid || argc - optind != 2 || parameters.depth < 0 || parameters.fanout < 0 || parameters.files_per_dir < 0 || repetitions < 1) {
+        display_bench_help(argv[0]);
+        return 1;
+    }
+    char *binary = argv[optind];
+    char *work_dir = argv[optind + 1];
+
+    char source[PATH_SIZE];
+    char destination[PATH_SIZE];
+    snprintf(source, sizeof(source), "%s/source", work_dir);
+    snprintf(destination, sizeof(destination), "%s/destination", work_dir);
+    if ((mkdir(work_dir, 0755) == -1 && errno != EEXIST) || empty_directory(source) == -1) {
+        return 1;
+    }
+
+    bench_tree_stats_t tree_stats;
+    if (generate_bench_tree(&parameters, source, &tree_stats) == -1) {
+        fprintf(stderr, "Error generating the benchmark tree\n");
+        return 1;
+    }
+    fprintf(stderr, "Generated %lu files (%lu bytes) in %lu directories\n", tree_stats.files_count, tree_stats.bytes_count, tree_stats.directories_count);
+    if (is_generate_only) {
+        return 0;
+    }
+
+    printf("scenario,repetition,wall_seconds,files,bytes,files_per_second,mb_per_second,syscalls,peak_rss_kb,user_seconds,system_seconds,exit_status\n");
+    int result = 0;
+    uint64_t generation = 0;
+    for (size_t i=0; i<sizeof(scenarios)/sizeof(scenarios[0]); ++i) {
+        for (int repetition=1; repetition<=repetitions; ++repetition) {
+            bench_tree_stats_t modified_stats;
+            if (scenarios[i].is_full) {
+                if (empty_directory(destination) == -1) {
+                    return 1;
+                }
+            } else if (modify_bench_tree(&parameters, source, ++generation, &modified_stats) == -1) {
+                fprintf(stderr, "Error modifying the benchmark tree\n");
+                return 1;
+            }
+            if (run_scenario(&scenarios[i], repetition, binary, work_dir, &tree_stats, uses_strace) != 0) {
+                result = 1;
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,251 @@
+#define _DEFAULT_SOURCE // st_mtim is not exposed by strict compilers
+
+#include <compare.h>
+#include <dispatcher.h>
+#include <file-properties.h>
+#include <filter.h>
+#include <streaming.h>
+#include <utility.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <openssl/md5.h>
+
+static const char *kind_names[COMPARE_KINDS_COUNT] = {"added", "removed", "content", "mode", "mtime", "type"};
+
+/*!
+ * @brief report_difference writes a difference to the report, one line per difference: kind, tab, relative path
+ * Directories end with a /. The report goes to stdout as the walk finds the differences.
+ * @param context is a pointer to the comparison context
+ * @param kind is the kind of the difference
+ * @param relative_path is the path relative to the roots of both trees
+ * @param is_directory is true for a directory
+ */
+static void report_difference(compare_context_t *context, compare_kind_t kind, char *relative_path, bool is_directory) {
+    context->counts[kind]++;
+    printf("%s\t%s%s\n", kind_names[kind], relative_path, is_directory ? "/" : "");
+}
+
+/*!
+ * @brief same_mtime tells whether two modification times are equal to the nanosecond
+ */
+static bool same_mtime(struct timespec lhs, struct timespec rhs) {
+    return lhs.tv_sec == rhs.tv_sec && lhs.tv_nsec == rhs.tv_nsec;
+}
+
+/*!
+ * @brief flush_pending_pairs hashes the pending pairs and reports those whose contents differ
+ * Source and destination files are hashed together by the analyzer pool, largest first, so that both
+ * trees are read at once. Destination files whose sum comes from the manifest are not read.
+ * @param context is a pointer to the comparison context
+ */
+static void flush_pending_pairs(compare_context_t *context) {
+    if (context->pending_count == 0) {
+        return;
+    }
+    files_list_entry_t **entries = malloc(2 * context->pending_count * sizeof(files_list_entry_t *));
+    size_t entries_count = 0;
+    for (size_t i=0; entries && i<context->pending_count; ++i) {
+        entries[entries_count++] = &context->pending[i].source;
+        if (!context->pending[i].is_destination_cached) {
+            entries[entries_count++] = &context->pending[i].destination;
+        }
+    }
+
+    // A failed batch is hashed again here, file by file, to know which ones cannot be read
+    if (!entries || !context->the_config->is_parallel || analyze_entries_parallel(entries, entries_count, true, context->the_config) == -1) {
+        for (size_t i=0; i<context->pending_count; ++i) {
+            compare_pair_t *pair = &context->pending[i];
+            if (get_file_stats(&pair->source) == -1 || (!pair->is_destination_cached && get_file_stats(&pair->destination) == -1)) {
+                perror(pair->relative_path);
+                context->errors_count++;
+                pair->relative_path[0] = '\0';
+            }
+        }
+    }
+    free(entries);
+
+    for (size_t i=0; i<context->pending_count; ++i) {
+        compare_pair_t *pair = &context->pending[i];
+        if (pair->relative_path[0] != '\0' && memcmp(pair->source.md5sum, pair->destination.md5sum, MD5_DIGEST_LENGTH) != 0) {
+            report_difference(context, COMPARE_CONTENT, pair->relative_path, false);
+        }
+        free(pair->relative_path);
+    }
+    context->pending_count = 0;
+}
+
+/*!
+ * @brief compare_files compares two files, reporting their metadata differences at once and queuing them for
+ * hashing when their sizes match
+ * @param context is a pointer to the comparison context
+ * @param relative_path is the path of both files relative to the roots of the trees
+ * @param source_path is the path of the source file
+ * @param source_stat holds its properties
+ * @param destination_path is the path of the destination file
+ * @param destination_stat holds its properties
+ */
+static void compare_files(compare_context_t *context, char *relative_path, char *source_path, struct stat *source_stat, char *destination_path, struct stat *destination_stat) {
+    context->files_compared++;
+    if ((source_stat->st_mode & 07777) != (destination_stat->st_mode & 07777)) {
+        report_difference(context, COMPARE_MODE, relative_path, false);
+    }
+    if (!same_mtime(source_stat->st_mtim, destination_stat->st_mtim)) {
+        report_difference(context, COMPARE_MTIME, relative_path, false);
+    }
+    if (source_stat->st_size != destination_stat->st_size) {
+        report_difference(context, COMPARE_CONTENT, relative_path, false);
+        return;
+    }
+    // Without MD5 sums, files of the same size and mtime are taken as equal, as by a synchronization
+    if (!context->the_config->uses_md5 && !context->the_config->is_paranoid) {
+        return;
+    }
+
+    compare_pair_t *pair = &context->pending[context->pending_count];
+    pair->relative_path = strdup(relative_path);
+    if (!pair->relative_path) {
+        perror(relative_path);
+        context->errors_count++;
+        return;
+    }
+    strncpy(pair->source.path_and_name, source_path, PATH_SIZE - 1);
+    pair->source.path_and_name[PATH_SIZE - 1] = '\0';
+    strncpy(pair->destination.path_and_name, destination_path, PATH_SIZE - 1);
+    pair->destination.path_and_name[PATH_SIZE - 1] = '\0';
+
+    // The manifest sum stands for the file only while the file still has the size and mtime it recorded
+    files_list_entry_t recorded;
+    pair->is_destination_cached = context->manifest && find_manifest_entry(context->manifest, relative_path, &recorded) == 0
+        && recorded.entry_type == FICHIER && recorded.size == (uint64_t)destination_stat->st_size && same_mtime(recorded.mtime, destination_stat->st_mtim);
+    if (pair->is_destination_cached) {
+        memcpy(pair->destination.md5sum, recorded.md5sum, sizeof(pair->destination.md5sum));
+        context->cached_sums++;
+    }
+    if (++context->pending_count == COMPARE_BATCH_PAIRS) {
+        flush_pending_pairs(context);
+    }
+}
+
+/*!
+ * @brief compare_directory compares a directory of both trees, merging their sorted entries in one pass
+ * Entries present on one side only are reported without walking their subtree.
+ * @param context is a pointer to the comparison context
+ * @param source_dir is the path of the directory in the source
+ * @param destination_dir is the path of the directory in the destination
+ * @param relative_dir is the path of the directory relative to the roots, "" for the roots
+ * @return 0 when ok, -1 if a directory cannot be read
+ */
+static int compare_directory(compare_context_t *context, char *source_dir, char *destination_dir, char *relative_dir) {
+    char **source_names = NULL;
+    char **destination_names = NULL;
+    int source_count = list_sorted_entries(source_dir, &source_names);
+    int destination_count = list_sorted_entries(destination_dir, &destination_names);
+    if (source_count == -1 || destination_count == -1) {
+        free_sorted_entries(source_names, source_count);
+        free_sorted_entries(destination_names, destination_count);
+        context->errors_count++;
+        return -1;
+    }
+
+    int i = 0;
+    int j = 0;
+    while (i < source_count || j < destination_count) {
+        int order = i == source_count ? 1 : (j == destination_count ? -1 : strcmp(source_names[i], destination_names[j]));
+        char *name = order <= 0 ? source_names[i] : destination_names[j];
+        char *relative_path = relative_dir[0] == '\0' ? strdup(name) : concat_path(NULL, relative_dir, name);
+        char *source_path = order <= 0 ? concat_path(NULL, source_dir, name) : NULL;
+        char *destination_path = order >= 0 ? concat_path(NULL, destination_dir, name) : NULL;
+        i += order <= 0;
+        j += order >= 0;
+        if (!relative_path || (order <= 0 && !source_path) || (order >= 0 && !destination_path)) {
+            context->errors_count++;
+            free(relative_path);
+            free(source_path);
+            free(destination_path);
+            continue;
+        }
+
+        struct stat source_stat;
+        struct stat destination_stat;
+        bool has_source = source_path && stat(source_path, &source_stat) == 0;
+        bool has_destination = destination_path && stat(destination_path, &destination_stat) == 0;
+        if ((source_path && !has_source) || (destination_path && !has_destination)) {
+            perror(relative_path);
+            context->errors_count++;
+        } else if (is_excluded(relative_path, S_ISDIR(has_source ? source_stat.st_mode : destination_stat.st_mode))) {
+            // Excluded entries are left out of the comparison, as out of a synchronization
+        } else if (!has_destination) {
+            report_difference(context, COMPARE_ADDED, relative_path, S_ISDIR(source_stat.st_mode));
+        } else if (!has_source) {
+            report_difference(context, COMPARE_REMOVED, relative_path, S_ISDIR(destination_stat.st_mode));
+        } else if (S_ISDIR(source_stat.st_mode) != S_ISDIR(destination_stat.st_mode)) {
+            report_difference(context, COMPARE_TYPE, relative_path, S_ISDIR(source_stat.st_mode));
+        } else if (S_ISDIR(source_stat.st_mode)) {
+            if ((source_stat.st_mode & 07777) != (destination_stat.st_mode & 07777)) {
+                report_difference(context, COMPARE_MODE, relative_path, true);
+            }
+            compare_directory(context, source_path, destination_path, relative_path);
+        } else {
+            compare_files(context, relative_path, source_path, &source_stat, destination_path, &destination_stat);
+        }
+        free(relative_path);
+        free(source_path);
+        free(destination_path);
+    }
+
+    free_sorted_entries(source_names, source_count);
+    free_sorted_entries(destination_names, destination_count);
+    return 0;
+}
+
+/*!
+ * @brief compare_trees verifies that the destination matches the source, without copying anything
+ * Only the differences are written, to stdout, as they are found (@see report_difference); files of the same
+ * size are compared by MD5 sum. With --dest-manifest, the sums it recorded are trusted for the destination
+ * files whose size and mtime did not change since, unless --paranoid asks to hash every file again.
+ * @param the_config is a pointer to the program configuration
+ * @return COMPARE_IDENTICAL, COMPARE_DIFFERENT, or COMPARE_FAILED if an entry could not be read
+ */
+int compare_trees(configuration_t *the_config) {
+    compare_context_t context;
+    memset(&context, 0, sizeof(context));
+    context.the_config = the_config;
+    context.pending = malloc(COMPARE_BATCH_PAIRS * sizeof(compare_pair_t));
+    if (!context.pending) {
+        perror("\nFailed allocating memory to compared files");
+        return COMPARE_FAILED;
+    }
+
+    manifest_t manifest;
+    if (!the_config->is_paranoid && the_config->destination_manifest_path[0] != '\0' && open_manifest(&manifest, the_config->destination_manifest_path) == 0) {
+        context.manifest = &manifest;
+    }
+
+    compare_directory(&context, the_config->source, the_config->destination, "");
+    flush_pending_pairs(&context);
+    fflush(stdout);
+
+    if (context.manifest) {
+        close_manifest(context.manifest);
+    }
+    free(context.pending);
+
+    unsigned long differences_count = 0;
+    for (int kind=0; kind<COMPARE_KINDS_COUNT; ++kind) {
+        differences_count += context.counts[kind];
+    }
+    if (the_config->is_verbose) {
+        fprintf(stderr, "%lu files compared (%lu destination sums from the manifest), %lu differences:", context.files_compared, context.cached_sums, differences_count);
+        for (int kind=0; kind<COMPARE_KINDS_COUNT; ++kind) {
+            fprintf(stderr, " %s=%lu", kind_names[kind], context.counts[kind]);
+        }
+        fprintf(stderr, ", %lu errors\n", context.errors_count);
+    }
+    if (context.errors_count > 0) {
+        return COMPARE_FAILED;
+    }
+    return differences_count > 0 ? COMPARE_DIFFERENT : COMPARE_IDENTICAL;
+}
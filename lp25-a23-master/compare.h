@@ -0,0 +1,36 @@
+#pragma once
+
+#include <configuration.h>
+#include <files-list.h>
+#include <manifest.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define COMPARE_BATCH_PAIRS 1024 // Files of the same size hashed together by the analyzer pool before their sums are compared
+
+// Exit statuses of --compare-only, as those of diff
+#define COMPARE_IDENTICAL 0
+#define COMPARE_DIFFERENT 1
+#define COMPARE_FAILED 2
+
+typedef enum { COMPARE_ADDED, COMPARE_REMOVED, COMPARE_CONTENT, COMPARE_MODE, COMPARE_MTIME, COMPARE_TYPE, COMPARE_KINDS_COUNT } compare_kind_t;
+
+typedef struct {
+    char *relative_path;
+    files_list_entry_t source;
+    files_list_entry_t destination;
+    bool is_destination_cached; // The sum of the destination file was taken from the manifest
+} compare_pair_t;
+
+typedef struct {
+    configuration_t *the_config;
+    manifest_t *manifest; // Sums of the destination files trusted while their size and mtime match, NULL when not used
+    compare_pair_t *pending; // Pairs waiting for their sums, COMPARE_BATCH_PAIRS at most
+    size_t pending_count;
+    unsigned long counts[COMPARE_KINDS_COUNT];
+    unsigned long files_compared;
+    unsigned long cached_sums;
+    unsigned long errors_count;
+} compare_context_t;
+
+int compare_trees(configuration_t *the_config);
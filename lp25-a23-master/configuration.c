@@ -4,8 +4,10 @@
 #include <getopt.h>
 #include <stdio.h>
 #include <string.h>
+#include <utility.h>
+#include <filter.h>
 
-typedef enum {DATE_SIZE_ONLY, NO_PARALLEL, DRY_RUN} long_opt_values;
+typedef enum {DATE_SIZE_ONLY, NO_PARALLEL, DRY_RUN, DELTA_THRESHOLD, STREAMING, DIR_INDEX, DEST_MANIFEST, WRITE_MANIFEST, MEMORY_LIMIT, WATCH, DEBOUNCE, STATS, TRACE, PROGRESS, PROGRESS_INTERVAL, READ_LIMIT, WRITE_LIMIT, READ_IOPS, WRITE_IOPS, IO_LIMITS, IO_CLASS, IO_ORDER, NO_SYNC, CHECKPOINT, RESUME, PLAN_OUT, APPLY, EXCLUDE, INCLUDE, FILTER_FROM, LINK_DEST, SERVE, CONNECT, BATCH, COMPARE_ONLY, PARANOID} long_opt_values;
 
 /*!
  * @brief function display_help displays a brief manual for the program usage
@@ -13,11 +15,43 @@ typedef enum {DATE_SIZE_ONLY, NO_PARALLEL, DRY_RUN} long_opt_values;
  * This function is provided with its code, you don't have to implement nor modify it.
  */
 void display_help(char *my_name) {
-    printf("%s [options] source_dir destination_dir\n", my_name);
+    printf("%s [options] source_dir destination_dir [destination_dir...]\n", my_name);
     printf("Options: \t-n <processes count>\tnumber of processes for file calculations\n");
     printf("         \t-h display help (this text)\n");
     printf("         \t--date_size_only disables MD5 calculation for files\n");
     printf("         \t--no-parallel disables parallel computing (cancels values of option -n)\n");
+    printf("         \t--delta-threshold=<size> updates existing files of at least <size> bytes (K, M, G suffixes) by rewriting only changed blocks\n");
+    printf("         \t--streaming copies differences while the trees are still being walked, without building full lists\n");
+    printf("         \t--dir-index=<file> keeps a directory index in <file> (outside both trees) to skip directories unchanged since the last run (implies --streaming)\n");
+    printf("         \t--write-manifest=<file> writes a binary manifest of the destination after the run\n");
+    printf("         \t--dest-manifest=<file> uses a manifest instead of walking the destination (only for destinations written by this tool alone)\n");
+    printf("         \t--memory-limit=<size> lists and compares trees of any size within <size> of memory, using sorted runs in $TMPDIR\n");
+    printf("         \t--watch keeps the destination synchronized with inotify after the first run, until SIGINT or SIGTERM\n");
+    printf("         \t--debounce=<ms> waits for <ms> milliseconds without changes before applying them in watch mode (default 500)\n");
+    printf("         \t--serve=<socket> keeps both trees indexed in memory and synchronizes the changes seen by inotify on each sync request\n");
+    printf("         \t--connect=<socket> [request] sends sync (default), rescan, status or stop to a server instead of synchronizing\n");
+    printf("         \t--batch=<file> runs the jobs of <file>, one per line: source destination [options], on shared analyzer and copier pools\n");
+    printf("         \t--compare-only writes the differences (added, removed, content, mode, mtime, type) to stdout instead of copying them,\n");
+    printf("         \t            exiting with 0 when the trees match, 1 when they differ and 2 on errors; sums of --dest-manifest are reused\n");
+    printf("         \t--paranoid hashes every file compared by --compare-only, ignoring the manifest and --date-size-only\n");
+    printf("         \t--stats=<file> writes phase timings and counters of the run to <file> as JSON\n");
+    printf("         \t--trace=<file> records the directories listed, files analyzed and copied by each process into <file> (Chrome trace format)\n");
+    printf("         \t--progress[=lines] reports progress, throughput and ETA on stderr, as one line per report with =lines or when stderr is not a terminal\n");
+    printf("         \t--progress-interval=<ms> reports progress every <ms> milliseconds (default 1000)\n");
+    printf("         \t--read-limit=<size> and --write-limit=<size> limit the bytes read and written per second by all processes together (e.g. 50M)\n");
+    printf("         \t--read-iops=<count> and --write-iops=<count> limit the read and write operations per second\n");
+    printf("         \t--io-limits=<file> reads the limits from <file> (lines read=, write=, read-iops=, write-iops=), again whenever it changes or on SIGHUP\n");
+    printf("         \t--io-class=<class> sets the I/O scheduling class of all processes: idle or best-effort[:0-7]\n");
+    printf("         \t--io-order=<order> hashes and copies files in path (default), inode or extent (first physical block) order, faster on rotational disks\n");
+    printf("         \t--checkpoint=<size> syncs the destination and renames the copied files into place every <size> bytes (default 256M)\n");
+    printf("         \t--resume finishes the interrupted run recorded in the journal of the destination, without listing nor comparing again\n");
+    printf("         \t--exclude=<pattern> and --include=<pattern> skip or keep the entries matching <pattern> on both sides, the first matching rule deciding\n");
+    printf("         \t            /pattern is anchored at the root, pattern/ only matches directories, *, ** (across /), ? and [...] are wildcards\n");
+    printf("         \t--filter-from=<file> adds the rules of <file>, one per line: + pattern, - pattern or pattern (exclude)\n");
+    printf("         \t--link-dest=<dir> hard links the files unchanged since the snapshot <dir> instead of copying them\n");
+    printf("         \t--plan-out=<file> writes the differences to <file> as JSON lines (operation, path, size, mode, mtime) instead of copying them\n");
+    printf("         \t--apply=<file> copies the differences of a plan written by --plan-out with -n copier processes, without listing nor comparing again\n");
+    printf("         \t--no-sync renames copied files into place right away, without syncing the destination\n");
 }
 
 /*!
@@ -29,11 +63,45 @@ void init_configuration(configuration_t *the_config) {
     the_config->source[sizeof(the_config->source) - 1] = '\0';
     strncpy(the_config->destination, "", sizeof(the_config->destination));
     the_config->destination[sizeof(the_config->destination) - 1] = '\0';
+    the_config->extra_destinations_count = 0;
     the_config->processes_count = 4;        
     the_config->is_parallel = true;
     the_config->uses_md5 = true;
     the_config->is_verbose = false;
     the_config->is_dry_run = false;
+    the_config->is_streaming = false;
+    the_config->dir_index_path[0] = '\0';
+    the_config->destination_manifest_path[0] = '\0';
+    the_config->manifest_output_path[0] = '\0';
+    the_config->delta_threshold = 0;
+    the_config->memory_limit = 0;
+    the_config->is_watching = false;
+    the_config->debounce_ms = 500;
+    the_config->stats_path[0] = '\0';
+    the_config->trace_path[0] = '\0';
+    the_config->is_reporting_progress = false;
+    the_config->is_progress_line_mode = false;
+    the_config->progress_interval_ms = 1000;
+    the_config->read_limit = 0;
+    the_config->write_limit = 0;
+    the_config->read_iops = 0;
+    the_config->write_iops = 0;
+    the_config->io_limits_path[0] = '\0';
+    the_config->io_class[0] = '\0';
+    the_config->io_order = IO_ORDER_PATH;
+    the_config->is_syncing = true;
+    the_config->checkpoint_bytes = 256ULL << 20;
+    the_config->is_resuming = false;
+    the_config->plan_output_path[0] = '\0';
+    the_config->apply_path[0] = '\0';
+    the_config->link_dest_path[0] = '\0';
+    the_config->serve_path[0] = '\0';
+    the_config->connect_path[0] = '\0';
+    strcpy(the_config->client_request, "sync");
+    the_config->batch_path[0] = '\0';
+    the_config->is_comparing_only = false;
+    the_config->is_paranoid = false;
+    the_config->job_failed_copies = NULL;
 }
 
 /*!
@@ -49,6 +117,39 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
     {.name="date-size-only",.has_arg=0,.flag=0,.val=DATE_SIZE_ONLY},
     {.name="no-parallel",.has_arg=0,.flag=0,.val=NO_PARALLEL},                  
     {.name="dry-run",.has_arg=0,.flag=0,.val=DRY_RUN},
+    {.name="delta-threshold",.has_arg=1,.flag=0,.val=DELTA_THRESHOLD},
+    {.name="streaming",.has_arg=0,.flag=0,.val=STREAMING},
+    {.name="dir-index",.has_arg=1,.flag=0,.val=DIR_INDEX},
+    {.name="dest-manifest",.has_arg=1,.flag=0,.val=DEST_MANIFEST},
+    {.name="write-manifest",.has_arg=1,.flag=0,.val=WRITE_MANIFEST},
+    {.name="memory-limit",.has_arg=1,.flag=0,.val=MEMORY_LIMIT},
+    {.name="watch",.has_arg=0,.flag=0,.val=WATCH},
+    {.name="debounce",.has_arg=1,.flag=0,.val=DEBOUNCE},
+    {.name="stats",.has_arg=1,.flag=0,.val=STATS},
+    {.name="trace",.has_arg=1,.flag=0,.val=TRACE},
+    {.name="progress",.has_arg=2,.flag=0,.val=PROGRESS},
+    {.name="progress-interval",.has_arg=1,.flag=0,.val=PROGRESS_INTERVAL},
+    {.name="read-limit",.has_arg=1,.flag=0,.val=READ_LIMIT},
+    {.name="write-limit",.has_arg=1,.flag=0,.val=WRITE_LIMIT},
+    {.name="read-iops",.has_arg=1,.flag=0,.val=READ_IOPS},
+    {.name="write-iops",.has_arg=1,.flag=0,.val=WRITE_IOPS},
+    {.name="io-limits",.has_arg=1,.flag=0,.val=IO_LIMITS},
+    {.name="io-class",.has_arg=1,.flag=0,.val=IO_CLASS},
+    {.name="io-order",.has_arg=1,.flag=0,.val=IO_ORDER},
+    {.name="no-sync",.has_arg=0,.flag=0,.val=NO_SYNC},
+    {.name="checkpoint",.has_arg=1,.flag=0,.val=CHECKPOINT},
+    {.name="resume",.has_arg=0,.flag=0,.val=RESUME},
+    {.name="plan-out",.has_arg=1,.flag=0,.val=PLAN_OUT},
+    {.name="apply",.has_arg=1,.flag=0,.val=APPLY},
+    {.name="exclude",.has_arg=1,.flag=0,.val=EXCLUDE},
+    {.name="include",.has_arg=1,.flag=0,.val=INCLUDE},
+    {.name="filter-from",.has_arg=1,.flag=0,.val=FILTER_FROM},
+    {.name="link-dest",.has_arg=1,.flag=0,.val=LINK_DEST},
+    {.name="serve",.has_arg=1,.flag=0,.val=SERVE},
+    {.name="connect",.has_arg=1,.flag=0,.val=CONNECT},
+    {.name="batch",.has_arg=1,.flag=0,.val=BATCH},
+    {.name="compare-only",.has_arg=0,.flag=0,.val=COMPARE_ONLY},
+    {.name="paranoid",.has_arg=0,.flag=0,.val=PARANOID},
     {.name=0,.has_arg=0,.flag=0,.val=0}, 
     };
 
@@ -78,16 +179,218 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
             case DRY_RUN:
             the_config->is_dry_run = true;
             break;
+            case DELTA_THRESHOLD:
+            if (parse_size(optarg, &the_config->delta_threshold) == -1) {
+                fprintf(stderr, "Error: invalid size for --delta-threshold: %s\n", optarg);
+                return -1;
+            }
+            break;
+            case STREAMING:
+            the_config->is_streaming = true;
+            break;
+            case DIR_INDEX:
+            strncpy(the_config->dir_index_path, optarg, sizeof(the_config->dir_index_path) - 1);
+            the_config->dir_index_path[sizeof(the_config->dir_index_path) - 1] = '\0';
+            the_config->is_streaming = true;
+            break;
+            case DEST_MANIFEST:
+            strncpy(the_config->destination_manifest_path, optarg, sizeof(the_config->destination_manifest_path) - 1);
+            the_config->destination_manifest_path[sizeof(the_config->destination_manifest_path) - 1] = '\0';
+            break;
+            case WRITE_MANIFEST:
+            strncpy(the_config->manifest_output_path, optarg, sizeof(the_config->manifest_output_path) - 1);
+            the_config->manifest_output_path[sizeof(the_config->manifest_output_path) - 1] = '\0';
+            break;
+            case MEMORY_LIMIT:
+            if (parse_size(optarg, &the_config->memory_limit) == -1) {
+                fprintf(stderr, "Error: invalid size for --memory-limit: %s\n", optarg);
+                return -1;
+            }
+            break;
+            case WATCH:
+            the_config->is_watching = true;
+            break;
+            case DEBOUNCE:
+            the_config->debounce_ms = atoi(optarg);
+            break;
+            case STATS:
+            strncpy(the_config->stats_path, optarg, sizeof(the_config->stats_path) - 1);
+            the_config->stats_path[sizeof(the_config->stats_path) - 1] = '\0';
+            break;
+            case TRACE:
+            strncpy(the_config->trace_path, optarg, sizeof(the_config->trace_path) - 1);
+            the_config->trace_path[sizeof(the_config->trace_path) - 1] = '\0';
+            break;
+            case PROGRESS:
+            if (optarg && strcmp(optarg, "lines") != 0) {
+                fprintf(stderr, "Error: invalid mode for --progress: %s\n", optarg);
+                return -1;
+            }
+            the_config->is_reporting_progress = true;
+            the_config->is_progress_line_mode = optarg != NULL;
+            break;
+            case PROGRESS_INTERVAL:
+            the_config->progress_interval_ms = atoi(optarg);
+            if (the_config->progress_interval_ms == 0) {
+                fprintf(stderr, "Error: invalid interval for --progress-interval: %s\n", optarg);
+                return -1;
+            }
+            break;
+            case READ_LIMIT:
+            if (parse_size(optarg, &the_config->read_limit) == -1) {
+                fprintf(stderr, "Error: invalid size for --read-limit: %s\n", optarg);
+                return -1;
+            }
+            break;
+            case WRITE_LIMIT:
+            if (parse_size(optarg, &the_config->write_limit) == -1) {
+                fprintf(stderr, "Error: invalid size for --write-limit: %s\n", optarg);
+                return -1;
+            }
+            break;
+            case READ_IOPS:
+            the_config->read_iops = strtoull(optarg, NULL, 10);
+            break;
+            case WRITE_IOPS:
+            the_config->write_iops = strtoull(optarg, NULL, 10);
+            break;
+            case IO_LIMITS:
+            strncpy(the_config->io_limits_path, optarg, sizeof(the_config->io_limits_path) - 1);
+            the_config->io_limits_path[sizeof(the_config->io_limits_path) - 1] = '\0';
+            break;
+            case IO_CLASS:
+            strncpy(the_config->io_class, optarg, sizeof(the_config->io_class) - 1);
+            the_config->io_class[sizeof(the_config->io_class) - 1] = '\0';
+            break;
+            case IO_ORDER:
+            if (parse_io_order(optarg, &the_config->io_order) == -1) {
+                fprintf(stderr, "Error: invalid order for --io-order: %s\n", optarg);
+                return -1;
+            }
+            break;
+            case RESUME:
+            the_config->is_resuming = true;
+            break;
+            case PLAN_OUT:
+            strncpy(the_config->plan_output_path, optarg, sizeof(the_config->plan_output_path) - 1);
+            the_config->plan_output_path[sizeof(the_config->plan_output_path) - 1] = '\0';
+            break;
+            case APPLY:
+            strncpy(the_config->apply_path, optarg, sizeof(the_config->apply_path) - 1);
+            the_config->apply_path[sizeof(the_config->apply_path) - 1] = '\0';
+            break;
+            case EXCLUDE:
+            case INCLUDE:
+            if (add_filter_rule(optarg, opt == INCLUDE) == -1) {
+                return -1;
+            }
+            break;
+            case FILTER_FROM:
+            if (load_filter_rules(optarg) == -1) {
+                return -1;
+            }
+            break;
+            case LINK_DEST:
+            strncpy(the_config->link_dest_path, optarg, sizeof(the_config->link_dest_path) - 1);
+            the_config->link_dest_path[sizeof(the_config->link_dest_path) - 1] = '\0';
+            break;
+            case SERVE:
+            strncpy(the_config->serve_path, optarg, sizeof(the_config->serve_path) - 1);
+            the_config->serve_path[sizeof(the_config->serve_path) - 1] = '\0';
+            break;
+            case CONNECT:
+            strncpy(the_config->connect_path, optarg, sizeof(the_config->connect_path) - 1);
+            the_config->connect_path[sizeof(the_config->connect_path) - 1] = '\0';
+            break;
+            case BATCH:
+            strncpy(the_config->batch_path, optarg, sizeof(the_config->batch_path) - 1);
+            the_config->batch_path[sizeof(the_config->batch_path) - 1] = '\0';
+            break;
+            case COMPARE_ONLY:
+            the_config->is_comparing_only = true;
+            break;
+            case PARANOID:
+            the_config->is_paranoid = true;
+            break;
+            case NO_SYNC:
+            the_config->is_syncing = false;
+            break;
+            case CHECKPOINT:
+            if (parse_size(optarg, &the_config->checkpoint_bytes) == -1 || the_config->checkpoint_bytes == 0) {
+                fprintf(stderr, "Error: invalid size for --checkpoint: %s\n", optarg);
+                return -1;
+            }
+            break;
             default: 
             printf("unexpected case!\n"); 
         
         }   
     }
     
-    if (argc - optind != 2) {
+    // A plan is either written or applied, once
+    bool is_planning = the_config->plan_output_path[0] != '\0';
+    bool is_applying = the_config->apply_path[0] != '\0';
+    if ((is_planning || is_applying) && (the_config->is_watching || the_config->is_resuming || (is_planning && is_applying))) {
+        fprintf(stderr, "Error: --plan-out and --apply cannot be combined with each other, --watch or --resume\n");
+        return -1;
+    }
+
+    // A client only sends its request, the server has its own source and destination
+    if (the_config->connect_path[0] != '\0') {
+        if (argc - optind > 1) {
+            fprintf(stderr, "Error: --connect takes a single request\n");
+            return -1;
+        }
+        if (argc - optind == 1) {
+            strncpy(the_config->client_request, argv[optind], sizeof(the_config->client_request) - 1);
+            the_config->client_request[sizeof(the_config->client_request) - 1] = '\0';
+        }
+        return 0;
+    }
+    // The sources and destinations of a batch are in its jobs
+    if (the_config->batch_path[0] != '\0') {
+        if (argc - optind > 0 || the_config->serve_path[0] != '\0' || the_config->is_watching || the_config->is_resuming || is_planning || is_applying) {
+            fprintf(stderr, "Error: --batch takes no directory and cannot be combined with --serve, --watch, --resume, --plan-out or --apply\n");
+            return -1;
+        }
+        return 0;
+    }
+    // A comparison writes nothing, to a single destination
+    if (the_config->is_paranoid && !the_config->is_comparing_only) {
+        fprintf(stderr, "Error: --paranoid only applies to --compare-only\n");
+        return -1;
+    }
+    if (the_config->is_comparing_only && (the_config->serve_path[0] != '\0' || the_config->is_watching || the_config->is_resuming || is_planning || is_applying
+        || the_config->manifest_output_path[0] != '\0' || argc - optind > 2)) {
+        fprintf(stderr, "Error: --compare-only cannot be combined with --serve, --watch, --resume, --plan-out, --apply, --write-manifest or several destinations\n");
+        return -1;
+    }
+    // The server applies the changes itself, on request
+    if (the_config->serve_path[0] != '\0' && (the_config->is_watching || the_config->is_resuming || is_planning || is_applying || argc - optind > 2)) {
+        fprintf(stderr, "Error: --serve cannot be combined with --watch, --resume, --plan-out, --apply or several destinations\n");
+        return -1;
+    }
+
+    if (argc - optind < 2) {
         fprintf(stderr, "Error: Please provide both source and destination directories.\n");
         return -1;
     }
+    if (argc - optind > MAX_DESTINATIONS + 1) {
+        fprintf(stderr, "Error: at most %d destination directories can be synchronized at once.\n", MAX_DESTINATIONS);
+        return -1;
+    }
+    // The source is read once for all the destinations, which is only done by a run with full lists
+    if (argc - optind > 2 && (the_config->is_streaming || the_config->memory_limit > 0 || the_config->is_watching || the_config->is_resuming
+        || is_planning || is_applying || the_config->destination_manifest_path[0] != '\0' || the_config->manifest_output_path[0] != '\0')) {
+        fprintf(stderr, "Error: several destinations cannot be combined with --streaming, --dir-index, --memory-limit, --watch, --resume, --plan-out, --apply or manifests\n");
+        return -1;
+    }
+
+    // The manifest is written from the full source list, which these modes never build
+    if (the_config->manifest_output_path[0] != '\0' && (the_config->is_streaming || the_config->memory_limit > 0 || the_config->serve_path[0] != '\0' || is_applying)) {
+        fprintf(stderr, "Error: --write-manifest cannot be combined with --streaming, --dir-index, --memory-limit, --serve or --apply\n");
+        return -1;
+    }
 
     //  !!Copy the source and destination directories into the configuration, need to make different controls for when have more or less than 2 directorys
     strncpy(the_config->source, argv[optind], sizeof(the_config->source) - 1);
@@ -96,6 +399,12 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
     strncpy(the_config->destination, argv[optind + 1], sizeof(the_config->destination) - 1);
     the_config->destination[sizeof(the_config->destination) - 1] = '\0';
 
+    for (int i=optind + 2; i<argc; ++i) {
+        char *extra_destination = the_config->extra_destinations[the_config->extra_destinations_count++];
+        strncpy(extra_destination, argv[i], sizeof(the_config->extra_destinations[0]) - 1);
+        extra_destination[sizeof(the_config->extra_destinations[0]) - 1] = '\0';
+    }
+
     return 0;
 
 
@@ -2,15 +2,53 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <io-order.h>
+
+#define MAX_DESTINATIONS 8 // Destinations synchronized from a single read of the source
 
 typedef struct {
     char source[1024];
     char destination[1024];
+    char extra_destinations[MAX_DESTINATIONS - 1][1024]; // Destinations after the first one
+    int extra_destinations_count;
     uint8_t processes_count;
     bool is_parallel;
     bool uses_md5;
     bool is_verbose;    
     bool is_dry_run;
+    bool is_streaming;
+    char dir_index_path[1024]; // Directory index of the last run, empty when disabled
+    char destination_manifest_path[1024]; // Manifest used instead of walking the destination, empty when disabled
+    char manifest_output_path[1024]; // Manifest of the destination written after the run, empty when disabled
+    uint64_t delta_threshold; // Files at least this large are updated with a block delta, 0 disables it
+    uint64_t memory_limit; // Memory budget of the external-memory mode, 0 keeps whole lists in memory
+    bool is_watching; // Keep the destination synchronized after the first run
+    unsigned int debounce_ms; // Quiet time before changes seen in watch mode are applied
+    char stats_path[1024]; // JSON statistics written at exit, empty when disabled
+    char trace_path[1024]; // Chrome trace written at exit, empty when disabled
+    bool is_reporting_progress;
+    bool is_progress_line_mode; // One key=value line per report instead of a status line rewritten in place
+    unsigned int progress_interval_ms;
+    uint64_t read_limit; // Bytes per second read by all the processes together, 0 for no limit
+    uint64_t write_limit;
+    uint64_t read_iops; // Read operations per second, 0 for no limit
+    uint64_t write_iops;
+    char io_limits_path[1024]; // Control file overriding the limits, reloaded when it changes or on SIGHUP; empty when disabled
+    char io_class[32]; // I/O scheduling class of all the processes, empty to keep the inherited one
+    io_order_t io_order; // Order in which files are hashed and copied
+    bool is_syncing; // Copied files are made durable before they replace the destination ones
+    uint64_t checkpoint_bytes; // Bytes copied between two syncs of the destination
+    bool is_resuming; // Finish the run recorded in the journal of the destination instead of starting over
+    char plan_output_path[1024]; // Plan of the differences written instead of copying them, empty when disabled
+    char apply_path[1024]; // Plan applied instead of listing and comparing the trees, empty when disabled
+    char link_dest_path[1024]; // Previous snapshot whose unchanged files are hard linked instead of copied, empty when disabled
+    char serve_path[1024]; // Socket of the resident server answering sync requests, empty when disabled
+    char connect_path[1024]; // Socket of the server the request is sent to, empty when not a client
+    char client_request[32];
+    char batch_path[1024]; // Jobs run on shared pools instead of a single source and destination, empty when disabled
+    bool is_comparing_only; // Report the differences and exit with a status instead of copying them
+    bool is_paranoid; // Compare the sums of all the files of the same size, trusting no recorded sum
+    uint64_t *job_failed_copies; // Shared counter of the failed copies of the batch job of this configuration, NULL outside a batch
 } configuration_t;
 
 void init_configuration(configuration_t *the_config);
@@ -0,0 +1,395 @@
+#include <delta.h>
+#include <defines.h>
+#include <throttle.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Number of weak checksum collisions that are verified before giving up on a position
+#define DELTA_MAX_CANDIDATES 16
+
+/*!
+ * @brief rolling_checksum computes the rsync weak checksum of a block
+ * The low 16 bits are the sum of the bytes, the high 16 bits the sum of the running sums,
+ * so that the checksum of the next window can be derived in O(1) (@see make_delta_plan)
+ * @param data is a pointer to the block
+ * @param length is the size of the block
+ * @return the weak checksum of the block
+ */
+uint32_t rolling_checksum(const unsigned char *data, size_t length) {
+    uint32_t a = 0;
+    uint32_t b = 0;
+
+    for (size_t i=0; i<length; ++i) {
+        a += data[i];
+        b += (uint32_t)(length - i) * data[i];
+    }
+
+    return (a & 0xffff) | ((b & 0xffff) << 16);
+}
+
+/*!
+ * @brief add_delta_operation appends an operation to a plan, merging it with the previous one when contiguous
+ * @param plan is a pointer to the plan
+ * @param source_offset is the offset of the data in the source file
+ * @param length is the number of bytes of the operation
+ * @param destination_offset is the offset of the matching data in the old destination, -1 for literal data
+ * @return 0 when ok, -1 if memory could not be allocated
+ */
+static int add_delta_operation(delta_plan_t *plan, uint64_t source_offset, uint64_t length, int64_t destination_offset) {
+    if (length == 0) {
+        return 0;
+    }
+
+    if (plan->count > 0) {
+        delta_operation_t *last = &plan->operations[plan->count - 1];
+        if (last->source_offset + last->length == source_offset) {
+            if (last->destination_offset == -1 && destination_offset == -1) {
+                last->length += length;
+                return 0;
+            }
+            if (last->destination_offset != -1 && destination_offset != -1 && last->destination_offset + (int64_t)last->length == destination_offset) {
+                last->length += length;
+                return 0;
+            }
+        }
+    }
+
+    if (plan->count == plan->capacity) {
+        size_t new_capacity = plan->capacity ? plan->capacity * 2 : 64;
+        delta_operation_t *operations = realloc(plan->operations, new_capacity * sizeof(delta_operation_t));
+        if (!operations) {
+            perror("\nFailed allocating memory to delta plan");
+            return -1;
+        }
+        plan->operations = operations;
+        plan->capacity = new_capacity;
+    }
+
+    plan->operations[plan->count].source_offset = source_offset;
+    plan->operations[plan->count].length = length;
+    plan->operations[plan->count].destination_offset = destination_offset;
+    plan->count++;
+    if (destination_offset != -1 && (uint64_t)destination_offset != source_offset) {
+        plan->in_place = false;
+    }
+    return 0;
+}
+
+/*!
+ * @brief make_delta_plan finds which parts of the source already exist in the old destination
+ * The destination is cut in blocks indexed by their weak checksum. The source is then scanned with a
+ * rolling window: each position whose checksum is in the index is verified byte by byte (both files are
+ * local, so a direct comparison is cheaper and more exact than a strong hash) and becomes a match,
+ * everything else becomes literal data.
+ * @param source is the mapped source file
+ * @param source_size is the size of the source file
+ * @param destination is the mapped old destination file
+ * @param destination_size is the size of the old destination file
+ * @param block_size is the size of the blocks of the destination index
+ * @param plan is a pointer to the plan to fill (must be zeroed)
+ * @return 0 when ok, -1 in case of error
+ */
+int make_delta_plan(const unsigned char *source, uint64_t source_size, const unsigned char *destination, uint64_t destination_size, size_t block_size, delta_plan_t *plan) {
+    if (!source || !destination || !plan || block_size == 0) {
+        return -1;
+    }
+
+    plan->in_place = true;
+
+    size_t blocks_count = destination_size / block_size;
+    size_t buckets_count = 1;
+    while (buckets_count < blocks_count * 2) {
+        buckets_count <<= 1;
+    }
+
+    uint32_t *weak_sums = malloc(sizeof(uint32_t) * (blocks_count + 1));
+    int32_t *buckets = malloc(sizeof(int32_t) * buckets_count);
+    int32_t *chain = malloc(sizeof(int32_t) * (blocks_count + 1));
+    if (!weak_sums || !buckets || !chain) {
+        perror("\nFailed allocating memory to delta index");
+        free(weak_sums);
+        free(buckets);
+        free(chain);
+        return -1;
+    }
+
+    memset(buckets, -1, sizeof(int32_t) * buckets_count);
+    // Insert in reverse order so that each chain starts with the lowest block index
+    for (size_t i=blocks_count; i>0; --i) {
+        size_t block = i - 1;
+        weak_sums[block] = rolling_checksum(destination + block * block_size, block_size);
+        size_t bucket = weak_sums[block] & (buckets_count - 1);
+        chain[block] = buckets[bucket];
+        buckets[bucket] = (int32_t)block;
+    }
+
+    int result = 0;
+    uint64_t position = 0;
+    uint64_t literal_start = 0;
+
+    if (blocks_count > 0 && source_size >= block_size) {
+        uint32_t a = 0;
+        uint32_t b = 0;
+        for (size_t i=0; i<block_size; ++i) {
+            a += source[i];
+            b += (uint32_t)(block_size - i) * source[i];
+        }
+
+        while (result == 0) {
+            uint32_t weak = (a & 0xffff) | ((b & 0xffff) << 16);
+            int64_t match = -1;
+
+            // The block at the same offset is the usual match for files modified in place: try it first
+            uint64_t aligned = position / block_size;
+            if (position % block_size == 0 && aligned < blocks_count && weak_sums[aligned] == weak
+                && memcmp(source + position, destination + aligned * block_size, block_size) == 0) {
+                match = (int64_t)aligned;
+            }
+
+            int candidates = 0;
+            for (int32_t block = buckets[weak & (buckets_count - 1)]; match == -1 && block != -1 && candidates < DELTA_MAX_CANDIDATES; block = chain[block]) {
+                if (weak_sums[block] != weak) {
+                    continue;
+                }
+                candidates++;
+                if (memcmp(source + position, destination + (uint64_t)block * block_size, block_size) == 0) {
+                    match = block;
+                }
+            }
+
+            if (match != -1) {
+                if (add_delta_operation(plan, literal_start, position - literal_start, -1) == -1
+                    || add_delta_operation(plan, position, block_size, match * (int64_t)block_size) == -1) {
+                    result = -1;
+                    break;
+                }
+                position += block_size;
+                literal_start = position;
+                if (position + block_size > source_size) {
+                    break;
+                }
+                a = 0;
+                b = 0;
+                for (size_t i=0; i<block_size; ++i) {
+                    a += source[position + i];
+                    b += (uint32_t)(block_size - i) * source[position + i];
+                }
+            } else {
+                if (position + block_size >= source_size) {
+                    break;
+                }
+                unsigned char out = source[position];
+                unsigned char in = source[position + block_size];
+                a = a - out + in;
+                b = b - (uint32_t)block_size * out + a;
+                position++;
+            }
+        }
+    }
+
+    if (result == 0 && add_delta_operation(plan, literal_start, source_size - literal_start, -1) == -1) {
+        result = -1;
+    }
+
+    free(weak_sums);
+    free(buckets);
+    free(chain);
+    return result;
+}
+
+/*!
+ * @brief clear_delta_plan frees the operations of a plan
+ * @param plan is a pointer to the plan to clear
+ */
+void clear_delta_plan(delta_plan_t *plan) {
+    if (!plan) {
+        return;
+    }
+    free(plan->operations);
+    plan->operations = NULL;
+    plan->count = 0;
+    plan->capacity = 0;
+}
+
+/*!
+ * @brief write_all writes a whole buffer at a given offset, retrying on short writes
+ * @param fd is the file descriptor to write to
+ * @param data is the buffer to write
+ * @param length is the size of the buffer
+ * @param offset is the position in the file
+ * @return 0 when ok, -1 in case of error
+ */
+static int write_all(int fd, const unsigned char *data, uint64_t length, uint64_t offset) {
+    while (length > 0) {
+        uint64_t chunk = the_throttle && length > THROTTLE_CHUNK_SIZE ? THROTTLE_CHUNK_SIZE : length;
+        throttle_io(THROTTLE_WRITE_BYTES, chunk);
+        ssize_t written = pwrite(fd, data, chunk, offset);
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        length -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+/*!
+ * @brief apply_delta_in_place rewrites only the literal ranges of the destination, then adjusts its size
+ * Only valid when all the matched blocks are at the same offset in both files (@see delta_plan_t)
+ * @return 0 when ok, -1 in case of error
+ */
+static int apply_delta_in_place(int destination_fd, const unsigned char *source, uint64_t source_size, delta_plan_t *plan, uint64_t *written_bytes) {
+    for (size_t i=0; i<plan->count; ++i) {
+        delta_operation_t *operation = &plan->operations[i];
+        if (operation->destination_offset != -1) {
+            continue;
+        }
+        if (write_all(destination_fd, source + operation->source_offset, operation->length, operation->source_offset) == -1) {
+            return -1;
+        }
+        *written_bytes += operation->length;
+    }
+    return ftruncate(destination_fd, source_size);
+}
+
+/*!
+ * @brief apply_delta_to_temp builds the new file in a temporary file next to the destination, then renames it
+ * Used when blocks moved, because rewriting them in place would overwrite data still to be read
+ * @return 0 when ok, -1 in case of error
+ */
+static int apply_delta_to_temp(char *destination_path, const unsigned char *source, const unsigned char *destination, delta_plan_t *plan, mode_t mode, uint64_t *written_bytes) {
+    char temp_path[PATH_SIZE];
+    char *file_name = strrchr(destination_path, '/');
+    int dir_length = file_name ? (int)(file_name - destination_path + 1) : 0;
+    file_name = file_name ? file_name + 1 : destination_path;
+    if (snprintf(temp_path, sizeof(temp_path), "%.*s.%s.lp25-delta.XXXXXX", dir_length, destination_path, file_name) >= (int)sizeof(temp_path)) {
+        return -1;
+    }
+
+    int temp_fd = mkstemp(temp_path);
+    if (temp_fd == -1) {
+        perror("Error creating delta temporary file");
+        return -1;
+    }
+
+    uint64_t offset = 0;
+    for (size_t i=0; i<plan->count; ++i) {
+        delta_operation_t *operation = &plan->operations[i];
+        const unsigned char *data = operation->destination_offset == -1 ? source + operation->source_offset : destination + operation->destination_offset;
+        if (write_all(temp_fd, data, operation->length, offset) == -1) {
+            perror("Error writing delta temporary file");
+            close(temp_fd);
+            unlink(temp_path);
+            return -1;
+        }
+        offset += operation->length;
+    }
+    *written_bytes += offset;
+
+    if (fchmod(temp_fd, mode & 07777) == -1 || close(temp_fd) == -1 || rename(temp_path, destination_path) == -1) {
+        perror("Error replacing destination with delta temporary file");
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief delta_copy_file updates an existing destination file from the source, rewriting only what changed
+ * When the changed blocks did not move (in place modifications, appends, truncations), only they are written
+ * into the destination. Otherwise, or when the destination has other hard links, the file is rebuilt in a
+ * temporary file renamed into place.
+ * @param source_path is the path to the source file
+ * @param destination_path is the path to the existing destination file
+ * @param source_size is the size of the source file
+ * @param mode is the access mode to give to the destination
+ * @param written_bytes is a pointer receiving the number of bytes written to the destination (may be NULL)
+ * @return 0 when ok, -1 if the delta could not be applied (the caller shall fall back to a full copy)
+ */
+int delta_copy_file(char *source_path, char *destination_path, uint64_t source_size, mode_t mode, uint64_t *written_bytes) {
+    uint64_t written = 0;
+    if (!source_path || !destination_path || source_size == 0) {
+        return -1;
+    }
+
+    int source_fd = open(source_path, O_RDONLY);
+    if (source_fd == -1) {
+        return -1;
+    }
+    int destination_fd = open(destination_path, O_RDWR);
+    if (destination_fd == -1) {
+        close(source_fd);
+        return -1;
+    }
+
+    struct stat destination_stat;
+    if (fstat(destination_fd, &destination_stat) == -1 || destination_stat.st_size == 0) {
+        close(source_fd);
+        close(destination_fd);
+        return -1;
+    }
+    uint64_t destination_size = destination_stat.st_size;
+
+    unsigned char *source = mmap(NULL, source_size, PROT_READ, MAP_SHARED, source_fd, 0);
+    unsigned char *destination = mmap(NULL, destination_size, PROT_READ, MAP_SHARED, destination_fd, 0);
+    if (source == MAP_FAILED || destination == MAP_FAILED) {
+        if (source != MAP_FAILED) {
+            munmap(source, source_size);
+        }
+        if (destination != MAP_FAILED) {
+            munmap(destination, destination_size);
+        }
+        close(source_fd);
+        close(destination_fd);
+        return -1;
+    }
+    madvise(source, source_size, MADV_SEQUENTIAL);
+    // Both files are read through the mappings while the plan is made, so their reads are accounted first
+    for (uint64_t offset=0; the_throttle && offset<source_size + destination_size; offset+=THROTTLE_CHUNK_SIZE) {
+        uint64_t remaining = source_size + destination_size - offset;
+        throttle_io(THROTTLE_READ_BYTES, remaining < THROTTLE_CHUNK_SIZE ? remaining : THROTTLE_CHUNK_SIZE);
+    }
+
+    size_t block_size = DELTA_MIN_BLOCK_SIZE;
+    while (destination_size / block_size > DELTA_MAX_BLOCKS) {
+        block_size *= 2;
+    }
+
+    delta_plan_t plan = {0};
+    int result = make_delta_plan(source, source_size, destination, destination_size, block_size, &plan);
+    // A file hard linked to other names (e.g. by --link-dest to a previous snapshot) is never written in place
+    if (destination_stat.st_nlink > 1) {
+        plan.in_place = false;
+    }
+    if (result == 0) {
+        if (plan.in_place) {
+            munmap(destination, destination_size);
+            destination = NULL;
+            result = apply_delta_in_place(destination_fd, source, source_size, &plan, &written);
+            if (result == 0) {
+                result = fchmod(destination_fd, mode & 07777);
+            }
+        } else {
+            result = apply_delta_to_temp(destination_path, source, destination, &plan, mode, &written);
+        }
+    }
+
+    clear_delta_plan(&plan);
+    munmap(source, source_size);
+    if (destination) {
+        munmap(destination, destination_size);
+    }
+    close(source_fd);
+    close(destination_fd);
+
+    if (written_bytes) {
+        *written_bytes = written;
+    }
+    return result;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define DELTA_MIN_BLOCK_SIZE 65536
+#define DELTA_MAX_BLOCKS (1 << 20)
+
+typedef struct {
+    uint64_t source_offset;
+    uint64_t length;
+    int64_t destination_offset; // Offset of the matching block in the old destination, -1 for literal data
+} delta_operation_t;
+
+typedef struct {
+    delta_operation_t *operations;
+    size_t count;
+    size_t capacity;
+    bool in_place; // true when every matched block stays at its offset, so only literals need writing
+} delta_plan_t;
+
+uint32_t rolling_checksum(const unsigned char *data, size_t length);
+int make_delta_plan(const unsigned char *source, uint64_t source_size, const unsigned char *destination, uint64_t destination_size, size_t block_size, delta_plan_t *plan);
+void clear_delta_plan(delta_plan_t *plan);
+int delta_copy_file(char *source_path, char *destination_path, uint64_t source_size, mode_t mode, uint64_t *written_bytes);
@@ -0,0 +1,249 @@
+#include <dir-index.h>
+#include <defines.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*!
+ * @brief init_dir_index initializes an empty index
+ * @param index is a pointer to the index to initialize
+ */
+void init_dir_index(dir_index_t *index) {
+    index->records = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
+
+/*!
+ * @brief clear_dir_index frees all the records of an index
+ * @param index is a pointer to the index to clear
+ */
+void clear_dir_index(dir_index_t *index) {
+    if (!index) {
+        return;
+    }
+    for (size_t i=0; i<index->count; ++i) {
+        free(index->records[i].path);
+    }
+    free(index->records);
+    init_dir_index(index);
+}
+
+/*!
+ * @brief add_dir_index_record appends a copy of a record to an index (its path is duplicated)
+ * @param index is a pointer to the index
+ * @param record is a pointer to the record to add
+ * @return 0 when ok, -1 if memory could not be allocated
+ */
+int add_dir_index_record(dir_index_t *index, dir_index_record_t *record) {
+    if (!index || !record || !record->path) {
+        return -1;
+    }
+
+    if (index->count == index->capacity) {
+        size_t new_capacity = index->capacity ? index->capacity * 2 : 256;
+        dir_index_record_t *records = realloc(index->records, new_capacity * sizeof(dir_index_record_t));
+        if (!records) {
+            perror("\nFailed allocating memory to directory index");
+            return -1;
+        }
+        index->records = records;
+        index->capacity = new_capacity;
+    }
+
+    index->records[index->count] = *record;
+    index->records[index->count].path = strdup(record->path);
+    if (!index->records[index->count].path) {
+        return -1;
+    }
+    index->count++;
+    return 0;
+}
+
+/*!
+ * @brief compare_records compares two records by path for qsort and bsearch
+ */
+static int compare_records(const void *lhs, const void *rhs) {
+    return strcmp(((const dir_index_record_t *)lhs)->path, ((const dir_index_record_t *)rhs)->path);
+}
+
+/*!
+ * @brief sort_dir_index sorts the records of an index by path so that they can be looked up
+ * @param index is a pointer to the index to sort
+ */
+void sort_dir_index(dir_index_t *index) {
+    if (index && index->count > 1) {
+        qsort(index->records, index->count, sizeof(dir_index_record_t), compare_records);
+    }
+}
+
+/*!
+ * @brief find_dir_index_record looks up the record of a directory in a sorted index
+ * @param index is a pointer to the index
+ * @param relative_path is the path of the directory relative to the tree root
+ * @return a pointer to the record, NULL if the directory is not in the index
+ */
+dir_index_record_t *find_dir_index_record(dir_index_t *index, char *relative_path) {
+    if (!index || !relative_path || index->count == 0) {
+        return NULL;
+    }
+    dir_index_record_t key;
+    key.path = relative_path;
+    return bsearch(&key, index->records, index->count, sizeof(dir_index_record_t), compare_records);
+}
+
+/*!
+ * @brief find_dir_index_children finds the records of all the directories below a directory
+ * Paths sharing a prefix are contiguous once sorted, so they are found by two binary searches.
+ * Direct children are the records of the range whose path has no '/' after the prefix.
+ * @param index is a pointer to the sorted index
+ * @param relative_path is the path of the parent directory relative to the tree root
+ * @param first is a pointer receiving the position of the first record of the range
+ * @return the number of records in the range
+ */
+size_t find_dir_index_children(dir_index_t *index, char *relative_path, size_t *first) {
+    *first = 0;
+    if (!index || !relative_path) {
+        return 0;
+    }
+
+    char prefix[PATH_SIZE];
+    size_t prefix_length = 0;
+    if (relative_path[0] != '\0') {
+        if (snprintf(prefix, sizeof(prefix), "%s/", relative_path) >= (int)sizeof(prefix)) {
+            return 0;
+        }
+        prefix_length = strlen(prefix);
+    } else {
+        prefix[0] = '\0';
+    }
+
+    size_t low = 0;
+    size_t high = index->count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (strcmp(index->records[middle].path, prefix) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    // The root record ("") is not one of its own children
+    if (prefix_length == 0 && low < index->count && index->records[low].path[0] == '\0') {
+        low++;
+    }
+    *first = low;
+
+    high = index->count;
+    size_t begin = low;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (strncmp(index->records[middle].path, prefix, prefix_length) == 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low - begin;
+}
+
+/*!
+ * @brief load_dir_index loads an index saved by save_dir_index
+ * A missing index file is not an error: the index is then empty and every directory is walked.
+ * @param index is a pointer to the (initialized) index to fill
+ * @param index_path is the path to the index file
+ * @return 0 when ok, -1 if the file exists but cannot be read
+ */
+int load_dir_index(dir_index_t *index, char *index_path) {
+    FILE *file = fopen(index_path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    char magic[16];
+    unsigned long count = 0;
+    if (fscanf(file, "%15s %lu", magic, &count) != 2 || strcmp(magic, DIR_INDEX_MAGIC) != 0) {
+        fprintf(stderr, "Directory index %s is invalid, ignoring it\n", index_path);
+        fclose(file);
+        return -1;
+    }
+
+    char path[PATH_SIZE];
+    for (unsigned long i=0; i<count; ++i) {
+        dir_index_record_t record;
+        char files_digest[DIGEST_SIZE * 2 + 1];
+        char summary[DIGEST_SIZE * 2 + 1];
+        long long source_sec, destination_sec;
+        long source_nsec, destination_nsec;
+        unsigned long path_length;
+        if (fscanf(file, "%lld %ld %lld %ld %32s %32s %lu", &source_sec, &source_nsec, &destination_sec, &destination_nsec, files_digest, summary, &path_length) != 7
+            || path_length >= PATH_SIZE || fgetc(file) != ' ' || fread(path, 1, path_length, file) != path_length) {
+            fprintf(stderr, "Directory index %s is truncated, ignoring it\n", index_path);
+            clear_dir_index(index);
+            fclose(file);
+            return -1;
+        }
+        path[path_length] = '\0';
+        for (int j=0; j<DIGEST_SIZE; ++j) {
+            sscanf(files_digest + j * 2, "%2hhx", &record.files_digest[j]);
+            sscanf(summary + j * 2, "%2hhx", &record.summary[j]);
+        }
+        record.source_mtime.tv_sec = source_sec;
+        record.source_mtime.tv_nsec = source_nsec;
+        record.destination_mtime.tv_sec = destination_sec;
+        record.destination_mtime.tv_nsec = destination_nsec;
+        record.path = path;
+        if (add_dir_index_record(index, &record) == -1) {
+            clear_dir_index(index);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+    sort_dir_index(index);
+    return 0;
+}
+
+/*!
+ * @brief save_dir_index writes an index to a file, replacing the previous one atomically
+ * Each record is a line; the path comes last, prefixed by its length, so it may contain any character.
+ * @param index is a pointer to the index to save
+ * @param index_path is the path to the index file
+ * @return 0 when ok, -1 in case of error
+ */
+int save_dir_index(dir_index_t *index, char *index_path) {
+    char temp_path[PATH_SIZE];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", index_path) >= (int)sizeof(temp_path)) {
+        return -1;
+    }
+
+    FILE *file = fopen(temp_path, "w");
+    if (!file) {
+        perror("Error creating directory index");
+        return -1;
+    }
+
+    fprintf(file, "%s %lu\n", DIR_INDEX_MAGIC, (unsigned long)index->count);
+    for (size_t i=0; i<index->count; ++i) {
+        dir_index_record_t *record = &index->records[i];
+        fprintf(file, "%lld %ld %lld %ld ", (long long)record->source_mtime.tv_sec, record->source_mtime.tv_nsec,
+                (long long)record->destination_mtime.tv_sec, record->destination_mtime.tv_nsec);
+        for (int j=0; j<DIGEST_SIZE; ++j) {
+            fprintf(file, "%02x", record->files_digest[j]);
+        }
+        fputc(' ', file);
+        for (int j=0; j<DIGEST_SIZE; ++j) {
+            fprintf(file, "%02x", record->summary[j]);
+        }
+        fprintf(file, " %lu %s\n", (unsigned long)strlen(record->path), record->path);
+    }
+
+    if (fclose(file) != 0 || rename(temp_path, index_path) == -1) {
+        perror("Error writing directory index");
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
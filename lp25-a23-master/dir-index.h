@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define DIR_INDEX_MAGIC "LP25DIX1"
+#define DIGEST_SIZE 16
+
+typedef struct {
+    char *path; // Path of the directory relative to the tree root, "" for the root
+    struct timespec source_mtime;
+    struct timespec destination_mtime;
+    uint8_t files_digest[DIGEST_SIZE]; // Hash of the names, sizes, mtimes and MD5 sums of the files of the directory
+    uint8_t summary[DIGEST_SIZE]; // Hash of files_digest and of the summaries of the subdirectories
+} dir_index_record_t;
+
+typedef struct {
+    dir_index_record_t *records; // Sorted by path (strcmp) once loaded or finalized
+    size_t count;
+    size_t capacity;
+} dir_index_t;
+
+void init_dir_index(dir_index_t *index);
+void clear_dir_index(dir_index_t *index);
+int add_dir_index_record(dir_index_t *index, dir_index_record_t *record);
+void sort_dir_index(dir_index_t *index);
+dir_index_record_t *find_dir_index_record(dir_index_t *index, char *relative_path);
+size_t find_dir_index_children(dir_index_t *index, char *relative_path, size_t *first);
+int load_dir_index(dir_index_t *index, char *index_path);
+int save_dir_index(dir_index_t *index, char *index_path);
@@ -0,0 +1,312 @@
+#define _DEFAULT_SOURCE // st_mtim is not exposed by strict compilers
+
+#include <dispatcher.h>
+#include <file-properties.h>
+#include <io-order.h>
+#include <messages.h>
+#include <processes.h>
+#include <stats.h>
+#include <trace.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/msg.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*!
+ * @brief read_cpu_sample reads the CPU time counters of the whole system
+ * @param sample is a pointer to the sample to fill
+ * @return 0 when ok, -1 if /proc/stat cannot be read
+ */
+int read_cpu_sample(cpu_sample_t *sample) {
+    FILE *file = fopen("/proc/stat", "r");
+    if (!file) {
+        return -1;
+    }
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+    int fields = fscanf(file, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal);
+    fclose(file);
+    if (fields != 8) {
+        return -1;
+    }
+    sample->busy = user + nice + system + irq + softirq + steal;
+    sample->iowait = iowait;
+    sample->total = sample->busy + idle + iowait;
+    return 0;
+}
+
+/*!
+ * @brief now_ns returns the monotonic time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief sift_down restores the max-heap property of files sizes below a position
+ */
+static void sift_down(files_list_entry_t **heap, size_t count, size_t position) {
+    while (2 * position + 1 < count) {
+        size_t child = 2 * position + 1;
+        if (child + 1 < count && heap[child + 1]->size > heap[child]->size) {
+            child++;
+        }
+        if (heap[position]->size >= heap[child]->size) {
+            break;
+        }
+        files_list_entry_t *swap = heap[position];
+        heap[position] = heap[child];
+        heap[child] = swap;
+        position = child;
+    }
+}
+
+/*!
+ * @brief next_job takes the next file to hash: the largest one, or the next one in I/O order
+ * @param jobs is the array of pending files, a max-heap on sizes when is_heap is true
+ * @param count is a pointer to the number of pending files
+ * @param next is a pointer to the position of the next file when jobs are in I/O order
+ */
+static files_list_entry_t *next_job(files_list_entry_t **jobs, size_t *count, size_t *next, bool is_heap) {
+    if (!is_heap) {
+        return *next < *count ? jobs[(*next)++] : NULL;
+    }
+    if (*count == 0) {
+        return NULL;
+    }
+    files_list_entry_t *largest = jobs[0];
+    jobs[0] = jobs[--(*count)];
+    sift_down(jobs, *count, 0);
+    return largest;
+}
+
+/*!
+ * @brief adapt_analyzers_count adds or removes an analyzer depending on the CPU and I/O wait shares since the last sample
+ * Hashing is CPU bound on fast storage and I/O bound on slow storage: analyzers are added while neither the
+ * CPUs nor the storage are saturated, and removed when one of them is, since more concurrent readers
+ * then only add contention and seeks.
+ * @return the new number of active analyzers
+ */
+static int adapt_analyzers_count(int active, int max_active, cpu_sample_t *previous, cpu_sample_t *current) {
+    uint64_t total = current->total - previous->total;
+    if (total == 0) {
+        return active;
+    }
+    double busy_share = (double)(current->busy - previous->busy) / total;
+    double iowait_share = (double)(current->iowait - previous->iowait) / total;
+    if ((busy_share > DISPATCHER_CPU_HIGH || iowait_share > DISPATCHER_IOWAIT_HIGH) && active > 1) {
+        return active - 1;
+    }
+    if (busy_share + iowait_share < DISPATCHER_CPU_HIGH && active < max_active) {
+        return active + 1;
+    }
+    return active;
+}
+
+/*!
+ * @brief analyze_files_parallel fills the properties of the entries of a list with a pool of analyzer processes
+ * Directories are analyzed directly. Files are handed out one at a time to idle analyzers, largest first (or
+ * in the --io-order order), so that a huge file starts early instead of keeping one analyzer busy long after
+ * the others are done. The number of files in flight, hence of busy analyzers, follows the CPU and I/O wait
+ * utilization of the system, up to processes_count.
+ * @param list is the list to analyze, as built by make_list
+ * @param the_config is a pointer to the program configuration
+ * @return 0 when ok, -1 in case of error
+ */
+int analyze_files_parallel(files_list_t *list, configuration_t *the_config) {
+    size_t entries_count = 0;
+    for (files_list_entry_t *cursor=list->head; cursor!=NULL; cursor=cursor->next) {
+        entries_count++;
+    }
+    bool is_heap = the_config->io_order == IO_ORDER_PATH;
+    size_t schedule_count = 0;
+    files_list_entry_t **entries = is_heap ? NULL : make_io_schedule(list, the_config->io_order, &schedule_count);
+    if (!entries && (entries = malloc((entries_count ? entries_count : 1) * sizeof(files_list_entry_t *))) != NULL) {
+        files_list_entry_t *cursor = list->head;
+        for (size_t i=0; i<entries_count; ++i, cursor=cursor->next) {
+            entries[i] = cursor;
+        }
+    }
+    if (!entries) {
+        return -1;
+    }
+    int result = analyze_entries_parallel(entries, entries_count, is_heap, the_config);
+    free(entries);
+    return result;
+}
+
+/*!
+ * @brief analyze_entries_parallel fills the properties of entries with a pool of analyzer processes (@see analyze_files_parallel)
+ * @param entries is the array of the entries to analyze, which may belong to several lists
+ * @param entries_count is the number of entries
+ * @param is_largest_first is true to hash the largest files first, false to hash them in the order of the array
+ * @param the_config is a pointer to the program configuration
+ * @return 0 when ok, -1 in case of error
+ */
+int analyze_entries_parallel(files_list_entry_t **entries, size_t entries_count, bool is_largest_first, configuration_t *the_config) {
+    files_list_entry_t **jobs = malloc((entries_count ? entries_count : 1) * sizeof(files_list_entry_t *));
+    if (!jobs) {
+        return -1;
+    }
+
+    // Only the size of files is needed to schedule them
+    bool is_heap = is_largest_first;
+    size_t jobs_count = 0;
+    for (size_t i=0; i<entries_count; ++i) {
+        files_list_entry_t *entry = entries[i];
+        struct stat statbuf;
+        if (stat(entry->path_and_name, &statbuf) == -1) {
+            free(jobs);
+            return -1;
+        }
+        if (S_ISREG(statbuf.st_mode)) {
+            entry->size = statbuf.st_size;
+            jobs[jobs_count++] = entry;
+        } else if (get_file_stats(entry) == -1) {
+            free(jobs);
+            return -1;
+        }
+    }
+    if (is_heap) {
+        for (size_t i=jobs_count/2; i-->0;) {
+            sift_down(jobs, jobs_count, i);
+        }
+    }
+
+    int msg_queue = msgget(IPC_PRIVATE, 0600 | IPC_CREAT);
+    if (msg_queue == -1) {
+        perror("ERROR with msgget");
+        free(jobs);
+        return -1;
+    }
+    // A file in flight is at most one message in the MQ, so no send ever blocks if they all fit
+    int max_active = the_config->processes_count > 0 ? the_config->processes_count : 1;
+    struct msqid_ds queue_stats;
+    if (msgctl(msg_queue, IPC_STAT, &queue_stats) == 0) {
+        queue_stats.msg_qbytes = (max_active + 1) * sizeof(files_list_entry_transmit_t);
+        msgctl(msg_queue, IPC_SET, &queue_stats);
+        if (msgctl(msg_queue, IPC_STAT, &queue_stats) == 0 && queue_stats.msg_qbytes / sizeof(files_list_entry_transmit_t) < (size_t)max_active) {
+            max_active = queue_stats.msg_qbytes / sizeof(files_list_entry_transmit_t);
+            max_active = max_active > 0 ? max_active : 1;
+        }
+    }
+
+    analyzer_configuration_t analyzer_config;
+    analyzer_config.my_receiver_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
+    analyzer_config.my_recipient_id = MSG_TYPE_TO_MAIN;
+    analyzer_config.message_queue_id = msg_queue;
+    analyzer_config.use_md5 = the_config->uses_md5;
+    pid_t *analyzers_pids = malloc(max_active * sizeof(pid_t));
+    files_list_entry_t **in_flight = malloc(max_active * sizeof(files_list_entry_t *));
+    int analyzers_count = 0;
+    if (analyzers_pids && in_flight) {
+        process_context_t p_context;
+        p_context.processes_count = 0;
+        fflush(stdout);
+        for (int i=0; i<max_active; ++i) {
+            pid_t pid = make_process(&p_context, analyzer_process_loop, &analyzer_config);
+            if (pid == -1) {
+                break;
+            }
+            analyzers_pids[analyzers_count++] = pid;
+        }
+    }
+    if (analyzers_count == 0) {
+        perror("ERROR with fork, analyzing without analyzer processes");
+    }
+    max_active = analyzers_count;
+
+    long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int active = online_cpus > 0 && online_cpus < max_active ? online_cpus : max_active;
+    int in_flight_count = 0;
+    size_t next = 0;
+    int result = 0;
+    cpu_sample_t last_sample;
+    uint64_t last_sample_time = now_ns();
+    bool can_adapt = read_cpu_sample(&last_sample) == 0;
+
+    while (result == 0) {
+        files_list_entry_t *job = NULL;
+        while (in_flight_count < active && (job = next_job(jobs, &jobs_count, &next, is_heap)) != NULL) {
+            if (send_analyze_file_command(msg_queue, MSG_TYPE_TO_SOURCE_ANALYZERS, job) == -1) {
+                result = -1;
+                break;
+            }
+            in_flight[in_flight_count++] = job;
+        }
+        if (analyzers_count == 0) {
+            // Without analyzers, files are analyzed here in the same order
+            while (result == 0 && (job = next_job(jobs, &jobs_count, &next, is_heap)) != NULL) {
+                result = get_file_stats(job);
+            }
+            break;
+        }
+        if (in_flight_count == 0) {
+            break;
+        }
+
+        any_message_t message;
+        uint64_t trace_start = start_trace_span();
+        ssize_t received = msgrcv(msg_queue, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, 0);
+        end_trace_span(TRACE_MQ_WAIT, "receive", trace_start);
+        if (received == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ERROR receiving analyzed file");
+            result = -1;
+            break;
+        }
+        STATS_ADD(messages_received, 1);
+
+        // Few files are in flight, a linear search finds the entry the answer is about
+        files_list_entry_t *payload = &message.list_entry.payload;
+        for (int i=0; i<in_flight_count; ++i) {
+            if (strcmp(in_flight[i]->path_and_name, payload->path_and_name) == 0) {
+                files_list_entry_t *entry = in_flight[i];
+                entry->mode = payload->mode;
+                entry->mtime = payload->mtime;
+                entry->size = payload->size;
+                entry->entry_type = payload->entry_type;
+                memcpy(entry->md5sum, payload->md5sum, sizeof(entry->md5sum));
+                in_flight[i] = in_flight[--in_flight_count];
+                break;
+            }
+        }
+        if (message.list_entry.op_code != COMMAND_CODE_FILE_ANALYZED) {
+            result = -1;
+        }
+
+        uint64_t now = now_ns();
+        cpu_sample_t sample;
+        if (can_adapt && now - last_sample_time >= DISPATCHER_SAMPLE_NS && read_cpu_sample(&sample) == 0) {
+            int new_active = adapt_analyzers_count(active, max_active, &last_sample, &sample);
+            if (new_active != active && the_config->is_verbose) {
+                printf("\n%d active analyzers", new_active);
+            }
+            active = new_active;
+            last_sample = sample;
+            last_sample_time = now;
+        }
+    }
+
+    // Analyzers finish the files already sent before reading their terminate command
+    for (int i=0; i<analyzers_count; ++i) {
+        send_simple_command(msg_queue, MSG_TYPE_TO_SOURCE_ANALYZERS, COMMAND_CODE_TERMINATE);
+    }
+    for (int i=0; i<analyzers_count; ++i) {
+        waitpid(analyzers_pids[i], NULL, 0);
+    }
+    msgctl(msg_queue, IPC_RMID, NULL);
+    free(analyzers_pids);
+    free(in_flight);
+    free(jobs);
+    return result;
+}
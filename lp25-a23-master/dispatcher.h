@@ -0,0 +1,21 @@
+#pragma once
+
+#include <files-list.h>
+#include <configuration.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DISPATCHER_SAMPLE_NS 250000000ULL // Minimum time between two decisions to add or remove an analyzer
+#define DISPATCHER_CPU_HIGH 0.90 // Share of busy CPU time above which an analyzer is removed
+#define DISPATCHER_IOWAIT_HIGH 0.40 // Share of CPU time waiting for I/O above which storage is considered saturated
+
+typedef struct {
+    uint64_t busy; // Clock ticks spent running code, summed over all CPUs
+    uint64_t iowait;
+    uint64_t total;
+} cpu_sample_t;
+
+int read_cpu_sample(cpu_sample_t *sample);
+int analyze_files_parallel(files_list_t *list, configuration_t *the_config);
+int analyze_entries_parallel(files_list_entry_t **entries, size_t entries_count, bool is_largest_first, configuration_t *the_config);
@@ -0,0 +1,302 @@
+#define _GNU_SOURCE // syncfs
+
+#include <durable.h>
+#include <defines.h>
+#include <stats.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+typedef struct {
+    char *temp_path;
+    char *destination_path;
+    uint64_t *job_failed_copies; // Counter of the batch job of the file, NULL outside a batch
+} pending_rename_t;
+
+typedef struct {
+    char *destination; // Destination directory, as given in the configuration
+    int fd; // The destination directory itself, for syncfs
+    bool is_dirty; // Files were written or renamed there since its last sync
+} sync_target_t;
+
+// Files of the calling process written since its last checkpoint
+static pending_rename_t pending[DURABLE_MAX_PENDING];
+static size_t pending_count = 0;
+static uint64_t pending_bytes = 0;
+static sync_target_t sync_targets[MAX_DESTINATIONS];
+static size_t sync_targets_count = 0;
+static bool is_fork_handler_set = false;
+// Copies that failed in any process, so that the exit status of the run reports them; NULL before init_failed_copies
+static uint64_t *failed_copies = NULL;
+
+static int sync_destinations();
+
+/*!
+ * @brief forget_pending makes a new child process start without the renames of its parent (@see pthread_atfork)
+ * The parent keeps them and is the only one to apply them.
+ */
+static void forget_pending() {
+    pending_count = 0;
+    pending_bytes = 0;
+    for (size_t i=0; i<sync_targets_count; ++i) {
+        sync_targets[i].is_dirty = false;
+    }
+}
+
+/*!
+ * @brief init_failed_copies maps the counter of the failed copies
+ * It must be called before any process is created, so that the copies failing in children are counted too.
+ * @return 0 when ok, -1 if the counter cannot be mapped
+ */
+int init_failed_copies() {
+    void *map = mmap(NULL, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping failed copies counter");
+        return -1;
+    }
+    failed_copies = map;
+    *failed_copies = 0;
+    return 0;
+}
+
+/*!
+ * @brief add_failed_copy counts a failed copy for the run and for its batch job, if any
+ */
+static void add_failed_copy(uint64_t *job_failed_copies) {
+    if (failed_copies) {
+        __atomic_fetch_add(failed_copies, 1, __ATOMIC_RELAXED);
+    }
+    if (job_failed_copies) {
+        __atomic_fetch_add(job_failed_copies, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief count_failed_copy records a file that could not be copied, from any process
+ * @param the_config is the configuration the file was copied with, whose batch job also counts the failure
+ */
+void count_failed_copy(configuration_t *the_config) {
+    add_failed_copy(the_config->job_failed_copies);
+}
+
+/*!
+ * @brief get_failed_copies returns the number of files that could not be copied so far
+ */
+uint64_t get_failed_copies() {
+    return failed_copies ? __atomic_load_n(failed_copies, __ATOMIC_RELAXED) : 0;
+}
+
+/*!
+ * @brief make_temp_path builds the path of the temporary file of a destination file
+ * A name too long to take the prefix and suffix within NAME_MAX is replaced by its FNV-1a hash, which still
+ * only depends on the destination.
+ * @param destination_path is the final path of the file
+ * @param temp_path is a buffer of PATH_SIZE bytes receiving the path of the temporary file
+ * @return 0 when ok, -1 if the path is too long
+ */
+int make_temp_path(char *destination_path, char *temp_path) {
+    char *file_name = strrchr(destination_path, '/');
+    int dir_length = file_name ? (int)(file_name - destination_path + 1) : 0;
+    file_name = file_name ? file_name + 1 : destination_path;
+    if (strlen(file_name) + 1 + strlen(DURABLE_TEMP_SUFFIX) <= NAME_MAX) {
+        return snprintf(temp_path, PATH_SIZE, "%.*s.%s" DURABLE_TEMP_SUFFIX, dir_length, destination_path, file_name) >= PATH_SIZE ? -1 : 0;
+    }
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char *c=file_name; *c; ++c) {
+        hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+    }
+    return snprintf(temp_path, PATH_SIZE, "%.*s" DURABLE_HASHED_NAME_PREFIX "%016llx" DURABLE_TEMP_SUFFIX, dir_length, destination_path, (unsigned long long)hash) >= PATH_SIZE ? -1 : 0;
+}
+
+/*!
+ * @brief open_temp_file creates a temporary file next to a destination file
+ * The name only depends on the destination, so the leftover of an interrupted run is reused by the next copy
+ * of the same file instead of staying in the destination.
+ * @param destination_path is the final path of the file
+ * @param temp_path is a buffer of PATH_SIZE bytes receiving the path of the temporary file
+ * @return the descriptor of the temporary file, opened for writing, -1 in case of error
+ */
+int open_temp_file(char *destination_path, char *temp_path) {
+    if (make_temp_path(destination_path, temp_path) == -1) {
+        return -1;
+    }
+    return open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+}
+
+/*!
+ * @brief get_sync_target returns the destination a file is written to, opening it the first time
+ * @return the destination, NULL if it cannot be opened
+ */
+static sync_target_t *get_sync_target(configuration_t *the_config) {
+    for (size_t i=0; i<sync_targets_count; ++i) {
+        if (strcmp(sync_targets[i].destination, the_config->destination) == 0) {
+            return &sync_targets[i];
+        }
+    }
+    // A batch writes to more destinations than the table holds: they are all made durable, then forgotten
+    if (sync_targets_count == MAX_DESTINATIONS) {
+        if (checkpoint_durable_writes(the_config) == -1 || sync_destinations() == -1) {
+            return NULL;
+        }
+        for (size_t i=0; i<sync_targets_count; ++i) {
+            close(sync_targets[i].fd);
+            free(sync_targets[i].destination);
+        }
+        sync_targets_count = 0;
+    }
+    int fd = open(the_config->destination, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    char *destination = fd == -1 ? NULL : strdup(the_config->destination);
+    if (!destination) {
+        perror("Error opening destination");
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+    sync_targets[sync_targets_count].destination = destination;
+    sync_targets[sync_targets_count].fd = fd;
+    sync_targets[sync_targets_count].is_dirty = false;
+    return &sync_targets[sync_targets_count++];
+}
+
+/*!
+ * @brief sync_destinations flushes the file systems of the destinations written since their last sync
+ * @return 0 when ok, -1 in case of error
+ */
+static int sync_destinations() {
+    int result = 0;
+    for (size_t i=0; i<sync_targets_count; ++i) {
+        if (!sync_targets[i].is_dirty) {
+            continue;
+        }
+        if (syncfs(sync_targets[i].fd) == -1) {
+            perror("Error syncing destination");
+            result = -1;
+            continue;
+        }
+        sync_targets[i].is_dirty = false;
+        STATS_ADD(checkpoints, 1);
+    }
+    return result;
+}
+
+/*!
+ * @brief is_renamed_before tells if a pending file was copied again in the same batch, its temporary file being already renamed
+ */
+static bool is_renamed_before(size_t index) {
+    for (size_t i=0; i<index; ++i) {
+        if (strcmp(pending[i].temp_path, pending[index].temp_path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief checkpoint_durable_writes makes the pending files durable, then renames them into place
+ * One syncfs per destination makes the data of the whole batch durable before any rename, so a crash never leaves a
+ * destination name on incomplete data. The renames themselves are made durable by the next checkpoint
+ * (@see finish_durable_writes); until then, a crash may only leave the previous version of a file.
+ * Each file that cannot be renamed is counted as a failed copy (@see count_failed_copy).
+ * @param the_config is a pointer to the program configuration
+ * @return 0 when ok, -1 if a step failed
+ */
+int checkpoint_durable_writes(configuration_t *the_config) {
+    if (pending_count == 0) {
+        return 0;
+    }
+    bool has_pending[MAX_DESTINATIONS];
+    for (size_t i=0; i<sync_targets_count; ++i) {
+        has_pending[i] = sync_targets[i].is_dirty;
+    }
+    int result = sync_destinations();
+    for (size_t i=0; i<pending_count; ++i) {
+        if (rename(pending[i].temp_path, pending[i].destination_path) == -1 && !is_renamed_before(i)) {
+            perror(pending[i].destination_path);
+            unlink(pending[i].temp_path);
+            add_failed_copy(pending[i].job_failed_copies);
+            result = -1;
+        }
+        free(pending[i].temp_path);
+        free(pending[i].destination_path);
+    }
+    // The renames are made durable by the next sync of their destinations
+    for (size_t i=0; i<sync_targets_count; ++i) {
+        sync_targets[i].is_dirty = sync_targets[i].is_dirty || has_pending[i];
+    }
+    pending_count = 0;
+    pending_bytes = 0;
+    return result;
+}
+
+/*!
+ * @brief commit_temp_file replaces a destination file with its completely written temporary file
+ * With --no-sync, the file is renamed right away. Otherwise it waits for the next checkpoint, made once
+ * DURABLE_MAX_PENDING files or --checkpoint bytes are pending, so durability costs one syncfs per batch
+ * instead of one fsync per file.
+ * @param temp_path is the path of the temporary file, closed by the caller
+ * @param destination_path is the final path of the file
+ * @param size is the size of the file
+ * @param the_config is a pointer to the program configuration
+ * @return 0 when the file is renamed or waits for a checkpoint, -1 in case of error (the temporary file is then removed)
+ */
+int commit_temp_file(char *temp_path, char *destination_path, uint64_t size, configuration_t *the_config) {
+    if (!the_config->is_syncing) {
+        if (rename(temp_path, destination_path) == -1) {
+            perror(destination_path);
+            unlink(temp_path);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!is_fork_handler_set) {
+        pthread_atfork(NULL, NULL, forget_pending);
+        is_fork_handler_set = true;
+    }
+    sync_target_t *target = get_sync_target(the_config);
+    if (!target) {
+        unlink(temp_path);
+        return -1;
+    }
+    target->is_dirty = true;
+    pending[pending_count].temp_path = strdup(temp_path);
+    pending[pending_count].destination_path = strdup(destination_path);
+    pending[pending_count].job_failed_copies = the_config->job_failed_copies;
+    if (!pending[pending_count].temp_path || !pending[pending_count].destination_path) {
+        free(pending[pending_count].temp_path);
+        free(pending[pending_count].destination_path);
+        unlink(temp_path);
+        return -1;
+    }
+    pending_count++;
+    pending_bytes += size;
+    if (pending_count == DURABLE_MAX_PENDING || pending_bytes >= the_config->checkpoint_bytes) {
+        // The files of the batch that cannot be renamed are counted as failed copies by the checkpoint
+        checkpoint_durable_writes(the_config);
+    }
+    return 0;
+}
+
+/*!
+ * @brief finish_durable_writes renames all the pending files and makes every rename durable
+ * It must be called by each process that copied files, once it is done copying.
+ * @param the_config is a pointer to the program configuration
+ * @return 0 when ok, -1 if a step failed
+ */
+int finish_durable_writes(configuration_t *the_config) {
+    if (!the_config->is_syncing || the_config->is_dry_run) {
+        return 0;
+    }
+    int result = checkpoint_durable_writes(the_config);
+    if (sync_destinations() == -1) {
+        result = -1;
+    }
+    return result;
+}
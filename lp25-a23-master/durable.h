@@ -0,0 +1,17 @@
+#pragma once
+
+#include <configuration.h>
+#include <stdint.h>
+
+#define DURABLE_MAX_PENDING 1024 // Files waiting for a checkpoint before they are renamed into place
+#define DURABLE_TEMP_SUFFIX ".lp25-tmp" // Temporary files are named .<name>.lp25-tmp next to their destination
+#define DURABLE_HASHED_NAME_PREFIX ".lp25-" // Or .lp25-<hash of the name>.lp25-tmp when the name is too long for the suffix
+
+int init_failed_copies();
+void count_failed_copy(configuration_t *the_config);
+uint64_t get_failed_copies();
+int make_temp_path(char *destination_path, char *temp_path);
+int open_temp_file(char *destination_path, char *temp_path);
+int commit_temp_file(char *temp_path, char *destination_path, uint64_t size, configuration_t *the_config);
+int checkpoint_durable_writes(configuration_t *the_config);
+int finish_durable_writes(configuration_t *the_config);
@@ -0,0 +1,575 @@
+#include <external-list.h>
+#include <streaming.h>
+#include <processes.h>
+#include <sync.h>
+#include <file-properties.h>
+#include <utility.h>
+#include <stats.h>
+#include <durable.h>
+#include <filter.h>
+#include <trace.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief record_size returns the number of bytes used by a packed record in a run buffer, kept 8-byte aligned
+ */
+static size_t record_size(size_t path_length) {
+    return (sizeof(spill_record_t) + path_length + 1 + 7) & ~(size_t)7;
+}
+
+/*!
+ * @brief init_spill_list initializes an empty list
+ * @param list is a pointer to the list to initialize
+ * @param budget is the memory allowed for the current run before it is spilled to a temporary file
+ * @return 0 when ok, -1 if the run buffer cannot be allocated
+ */
+int init_spill_list(spill_list_t *list, size_t budget) {
+    memset(list, 0, sizeof(spill_list_t));
+    // A run must at least hold one record with the longest path
+    list->budget = budget > 2 * record_size(PATH_SIZE) ? budget : 2 * record_size(PATH_SIZE);
+    list->capacity = list->budget;
+    list->buffer = malloc(list->capacity);
+    if (!list->buffer) {
+        perror("\nFailed allocating memory to run buffer");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief clear_spill_list frees the run buffer and closes (thus deletes) the spilled runs
+ * @param list is a pointer to the list to clear
+ */
+void clear_spill_list(spill_list_t *list) {
+    free(list->buffer);
+    free(list->offsets);
+    for (size_t i=0; i<list->runs_count; ++i) {
+        fclose(list->runs[i]);
+    }
+    free(list->runs);
+    memset(list, 0, sizeof(spill_list_t));
+}
+
+/*!
+ * @brief open_spill_file creates an anonymous temporary file in $TMPDIR (or /tmp)
+ * The file is unlinked immediately, so it disappears when closed or when the program stops.
+ * @return the opened file, NULL in case of error
+ */
+static FILE *open_spill_file(void) {
+    char *temp_dir = getenv("TMPDIR");
+    char template[PATH_SIZE];
+    snprintf(template, sizeof(template), "%s/lp25-spill-XXXXXX", temp_dir && temp_dir[0] ? temp_dir : "/tmp");
+
+    int fd = mkstemp(template);
+    if (fd == -1) {
+        perror("Error creating spill file");
+        return NULL;
+    }
+    unlink(template);
+    FILE *file = fdopen(fd, "w+");
+    if (!file) {
+        close(fd);
+    }
+    return file;
+}
+
+/*!
+ * @brief add_run appends a run to the runs of a list
+ * @return 0 when ok, -1 in case of error
+ */
+static int add_run(spill_list_t *list, FILE *run) {
+    FILE **runs = realloc(list->runs, sizeof(FILE *) * (list->runs_count + 1));
+    if (!runs) {
+        perror("\nFailed allocating memory to runs");
+        return -1;
+    }
+    list->runs = runs;
+    list->runs[list->runs_count++] = run;
+    return 0;
+}
+
+/*!
+ * @brief write_spill_record writes a record followed by its path (without '\0') to a run
+ * @return 0 when ok, -1 in case of error
+ */
+static int write_spill_record(FILE *run, spill_record_t *record, char *path) {
+    if (fwrite(record, sizeof(spill_record_t), 1, run) != 1 || fwrite(path, 1, record->path_length, run) != record->path_length) {
+        perror("Error writing spill file");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_spill_record reads the next record of a run into a cursor
+ * @return 0 when ok, -1 at the end of the run
+ */
+static int read_spill_record(spill_cursor_t *cursor) {
+    if (fread(&cursor->record, sizeof(spill_record_t), 1, cursor->file) != 1 || cursor->record.path_length >= PATH_SIZE
+        || fread(cursor->path, 1, cursor->record.path_length, cursor->file) != cursor->record.path_length) {
+        return -1;
+    }
+    cursor->path[cursor->record.path_length] = '\0';
+    return 0;
+}
+
+static char *sort_buffer; // Run buffer used by compare_offsets (qsort has no context parameter)
+
+/*!
+ * @brief compare_offsets compares two packed records of the run buffer by path, for qsort
+ */
+static int compare_offsets(const void *lhs, const void *rhs) {
+    char *left = sort_buffer + *(const size_t *)lhs + sizeof(spill_record_t);
+    char *right = sort_buffer + *(const size_t *)rhs + sizeof(spill_record_t);
+    return strcmp(left, right);
+}
+
+/*!
+ * @brief spill_current_run sorts the records held in memory and writes them to a new run
+ * @param list is a pointer to the list
+ * @return 0 when ok, -1 in case of error
+ */
+int spill_current_run(spill_list_t *list) {
+    if (list->count == 0) {
+        return 0;
+    }
+
+    sort_buffer = list->buffer;
+    qsort(list->offsets, list->count, sizeof(size_t), compare_offsets);
+
+    FILE *run = open_spill_file();
+    if (!run) {
+        return -1;
+    }
+    for (size_t i=0; i<list->count; ++i) {
+        spill_record_t *record = (spill_record_t *)(list->buffer + list->offsets[i]);
+        if (write_spill_record(run, record, (char *)(record + 1)) == -1) {
+            fclose(run);
+            return -1;
+        }
+    }
+    if (fflush(run) != 0 || add_run(list, run) == -1) {
+        fclose(run);
+        return -1;
+    }
+
+    list->used = 0;
+    list->count = 0;
+    return 0;
+}
+
+/*!
+ * @brief add_spill_record adds a record to the current run, spilling the run first if the budget is reached
+ * @param list is a pointer to the list
+ * @param record is the record to add (its path_length is set here)
+ * @param relative_path is the path of the entry relative to the tree root
+ * @return 0 when ok, -1 in case of error
+ */
+int add_spill_record(spill_list_t *list, spill_record_t *record, char *relative_path) {
+    size_t path_length = strlen(relative_path);
+    if (path_length >= PATH_SIZE) {
+        return -1;
+    }
+    size_t needed = record_size(path_length);
+
+    if (list->used + needed + (list->count + 1) * sizeof(size_t) > list->budget && spill_current_run(list) == -1) {
+        return -1;
+    }
+
+    if (list->count == list->offsets_capacity) {
+        size_t new_capacity = list->offsets_capacity ? list->offsets_capacity * 2 : 1024;
+        size_t *offsets = realloc(list->offsets, sizeof(size_t) * new_capacity);
+        if (!offsets) {
+            perror("\nFailed allocating memory to run offsets");
+            return -1;
+        }
+        list->offsets = offsets;
+        list->offsets_capacity = new_capacity;
+    }
+
+    record->path_length = (uint16_t)path_length;
+    memcpy(list->buffer + list->used, record, sizeof(spill_record_t));
+    memcpy(list->buffer + list->used + sizeof(spill_record_t), relative_path, path_length + 1);
+    list->offsets[list->count++] = list->used;
+    list->used += needed;
+    list->entries_count++;
+    return 0;
+}
+
+/*!
+ * @brief finish_spill_list spills the last run and releases the memory used to build runs
+ * @param list is a pointer to the list
+ * @return 0 when ok, -1 in case of error
+ */
+int finish_spill_list(spill_list_t *list) {
+    int result = spill_current_run(list);
+    free(list->buffer);
+    free(list->offsets);
+    list->buffer = NULL;
+    list->offsets = NULL;
+    list->capacity = 0;
+    list->offsets_capacity = 0;
+    return result;
+}
+
+/*!
+ * @brief make_spill_list lists a tree into a spill list (it recurses in directories)
+ * Like make_list, only regular files and directories are kept; their properties come from lstat, MD5
+ * sums are computed later, only for the files whose size and mtime match on both sides.
+ * @param list is a pointer to the list
+ * @param root is the root of the tree
+ * @param relative_dir is the directory to list, relative to root ("" for the root itself)
+ * @return 0 when ok, -1 if the directory cannot be listed
+ */
+int make_spill_list(spill_list_t *list, char *root, char *relative_dir) {
+    char *dir_path = relative_dir[0] ? concat_path(NULL, root, relative_dir) : strdup(root);
+    if (!dir_path) {
+        return -1;
+    }
+    uint64_t trace_start = start_trace_span();
+    DIR *dir = open_dir(dir_path);
+    if (!dir) {
+        free(dir_path);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = get_next_entry(dir)) != NULL) {
+        char *relative_path = relative_dir[0] ? concat_path(NULL, relative_dir, entry->d_name) : strdup(entry->d_name);
+        char *full_path = concat_path(NULL, dir_path, entry->d_name);
+        if (full_path && is_path_excluded(root, full_path, entry->d_type)) {
+            free(relative_path);
+            free(full_path);
+            continue;
+        }
+        struct stat statbuf;
+        uint64_t stat_start = start_stats_timer();
+        int stat_result = full_path ? lstat(full_path, &statbuf) : -1;
+        stop_stats_timer(STATS_STAT, stat_start);
+        if (!relative_path || stat_result == -1 || !(S_ISREG(statbuf.st_mode) || S_ISDIR(statbuf.st_mode))) {
+            free(relative_path);
+            free(full_path);
+            continue;
+        }
+
+        spill_record_t record;
+        memset(&record, 0, sizeof(record));
+        record.size = S_ISREG(statbuf.st_mode) ? statbuf.st_size : 0;
+        record.mtime_sec = statbuf.st_mtim.tv_sec;
+        record.mtime_nsec = statbuf.st_mtim.tv_nsec;
+        record.mode = statbuf.st_mode;
+        record.entry_type = S_ISDIR(statbuf.st_mode) ? DOSSIER : FICHIER;
+        if (add_spill_record(list, &record, relative_path) == -1) {
+            fprintf(stderr, "Error adding %s to the list\n", full_path);
+        } else if (S_ISDIR(statbuf.st_mode)) {
+            make_spill_list(list, root, relative_path);
+        }
+
+        free(relative_path);
+        free(full_path);
+    }
+
+    closedir(dir);
+    end_trace_span(TRACE_LIST_DIR, dir_path, trace_start);
+    free(dir_path);
+    return 0;
+}
+
+/*!
+ * @brief sift_down restores the heap property from a position of the merger heap
+ */
+static void sift_down(spill_merger_t *merger, size_t position) {
+    while (true) {
+        size_t smallest = position;
+        size_t left = 2 * position + 1;
+        size_t right = left + 1;
+        if (left < merger->heap_size && strcmp(merger->cursors[merger->heap[left]].path, merger->cursors[merger->heap[smallest]].path) < 0) {
+            smallest = left;
+        }
+        if (right < merger->heap_size && strcmp(merger->cursors[merger->heap[right]].path, merger->cursors[merger->heap[smallest]].path) < 0) {
+            smallest = right;
+        }
+        if (smallest == position) {
+            return;
+        }
+        size_t swap = merger->heap[position];
+        merger->heap[position] = merger->heap[smallest];
+        merger->heap[smallest] = swap;
+        position = smallest;
+    }
+}
+
+/*!
+ * @brief open_spill_merger prepares a k-way merge of sorted runs
+ * @param merger is a pointer to the merger to open
+ * @param runs is the array of runs to merge (they are rewound)
+ * @param runs_count is the number of runs
+ * @return 0 when ok, -1 in case of error
+ */
+int open_spill_merger(spill_merger_t *merger, FILE **runs, size_t runs_count) {
+    merger->cursors = malloc(sizeof(spill_cursor_t) * (runs_count + 1));
+    merger->heap = malloc(sizeof(size_t) * (runs_count + 1));
+    merger->heap_size = 0;
+    merger->pending = -1;
+    if (!merger->cursors || !merger->heap) {
+        perror("\nFailed allocating memory to merger");
+        close_spill_merger(merger);
+        return -1;
+    }
+
+    for (size_t i=0; i<runs_count; ++i) {
+        merger->cursors[i].file = runs[i];
+        rewind(runs[i]);
+        if (read_spill_record(&merger->cursors[i]) == 0) {
+            merger->heap[merger->heap_size++] = i;
+        }
+    }
+    for (size_t i=merger->heap_size/2; i>0; --i) {
+        sift_down(merger, i - 1);
+    }
+    return 0;
+}
+
+/*!
+ * @brief next_spill_record returns the cursor holding the smallest record not returned yet
+ * The returned cursor stays valid until the next call.
+ * @param merger is a pointer to the merger
+ * @return a pointer to the cursor, NULL when all the runs are exhausted
+ */
+spill_cursor_t *next_spill_record(spill_merger_t *merger) {
+    if (merger->pending != -1) {
+        if (read_spill_record(&merger->cursors[merger->pending]) == -1) {
+            merger->heap[0] = merger->heap[--merger->heap_size];
+        }
+        sift_down(merger, 0);
+        merger->pending = -1;
+    }
+    if (merger->heap_size == 0) {
+        return NULL;
+    }
+    merger->pending = merger->heap[0];
+    return &merger->cursors[merger->pending];
+}
+
+/*!
+ * @brief close_spill_merger frees a merger (the runs stay open)
+ * @param merger is a pointer to the merger
+ */
+void close_spill_merger(spill_merger_t *merger) {
+    free(merger->cursors);
+    free(merger->heap);
+    merger->cursors = NULL;
+    merger->heap = NULL;
+    merger->heap_size = 0;
+}
+
+/*!
+ * @brief reduce_spill_runs merges runs by groups of SPILL_MAX_FAN_IN until they can be merged at once
+ * This bounds both the open files and the memory used by cursors during the final merge.
+ * @param list is a pointer to the list
+ * @return 0 when ok, -1 in case of error
+ */
+int reduce_spill_runs(spill_list_t *list) {
+    while (list->runs_count > SPILL_MAX_FAN_IN) {
+        size_t merged_count = (list->runs_count + SPILL_MAX_FAN_IN - 1) / SPILL_MAX_FAN_IN;
+        FILE **merged_runs = malloc(sizeof(FILE *) * merged_count);
+        if (!merged_runs) {
+            perror("\nFailed allocating memory to runs");
+            return -1;
+        }
+
+        for (size_t group=0; group<merged_count; ++group) {
+            size_t first = group * SPILL_MAX_FAN_IN;
+            size_t count = list->runs_count - first < SPILL_MAX_FAN_IN ? list->runs_count - first : SPILL_MAX_FAN_IN;
+            spill_merger_t merger;
+            FILE *run = open_spill_file();
+            if (!run || open_spill_merger(&merger, list->runs + first, count) == -1) {
+                if (run) {
+                    fclose(run);
+                }
+                for (size_t i=0; i<group; ++i) {
+                    fclose(merged_runs[i]);
+                }
+                free(merged_runs);
+                return -1;
+            }
+            spill_cursor_t *cursor;
+            while ((cursor = next_spill_record(&merger)) != NULL) {
+                write_spill_record(run, &cursor->record, cursor->path);
+            }
+            close_spill_merger(&merger);
+            fflush(run);
+            for (size_t i=first; i<first + count; ++i) {
+                fclose(list->runs[i]);
+            }
+            merged_runs[group] = run;
+        }
+
+        free(list->runs);
+        list->runs = merged_runs;
+        list->runs_count = merged_count;
+    }
+    return 0;
+}
+
+/*!
+ * @brief fill_entry_from_record builds a files list entry from a spilled record
+ * @param entry is a pointer to the entry to fill
+ * @param root is the root of the tree the record belongs to
+ * @param cursor is the cursor holding the record
+ * @return 0 when ok, -1 if the full path is too long
+ */
+static int fill_entry_from_record(files_list_entry_t *entry, char *root, spill_cursor_t *cursor) {
+    char *full_path = concat_path(NULL, root, cursor->path);
+    if (!full_path) {
+        return -1;
+    }
+    strncpy(entry->path_and_name, full_path, PATH_SIZE - 1);
+    entry->path_and_name[PATH_SIZE - 1] = '\0';
+    free(full_path);
+
+    entry->size = cursor->record.size;
+    entry->mtime.tv_sec = cursor->record.mtime_sec;
+    entry->mtime.tv_nsec = cursor->record.mtime_nsec;
+    entry->mode = cursor->record.mode;
+    entry->entry_type = cursor->record.entry_type;
+    memset(entry->md5sum, 0, sizeof(entry->md5sum));
+    return 0;
+}
+
+/*!
+ * @brief synchronize_external synchronizes trees of any size within a fixed memory budget
+ * Each tree is listed into sorted runs spilled to temporary files whenever the budget is reached.
+ * Both sides are then merged (k-way) and joined in a single sequential pass, streaming the differences
+ * to the copy stage (@see stream_difference).
+ * @param the_config is a pointer to the configuration (memory_limit is the budget)
+ */
+void synchronize_external(configuration_t *the_config) {
+    // Half of the budget builds the runs of one side at a time, the rest is left to the merge and the copies
+    size_t budget = the_config->memory_limit / 2;
+    spill_list_t source_list;
+    spill_list_t destination_list;
+
+    if (init_spill_list(&source_list, budget) == -1) {
+        return;
+    }
+    SET_PROGRESS_PHASE(PROGRESS_STREAMING);
+    make_spill_list(&source_list, the_config->source, "");
+    if (finish_spill_list(&source_list) == -1 || init_spill_list(&destination_list, budget) == -1) {
+        clear_spill_list(&source_list);
+        return;
+    }
+    make_spill_list(&destination_list, the_config->destination, "");
+    if (finish_spill_list(&destination_list) == -1 || reduce_spill_runs(&source_list) == -1 || reduce_spill_runs(&destination_list) == -1) {
+        clear_spill_list(&source_list);
+        clear_spill_list(&destination_list);
+        return;
+    }
+    if (the_config->is_verbose) {
+        printf("\nListed %lu source entries (%lu runs) and %lu destination entries (%lu runs)\n", source_list.entries_count,
+               (unsigned long)source_list.runs_count, destination_list.entries_count, (unsigned long)destination_list.runs_count);
+    }
+
+    spill_merger_t source_merger;
+    spill_merger_t destination_merger;
+    files_list_entry_t *source_entry = malloc(sizeof(files_list_entry_t));
+    files_list_entry_t *destination_entry = malloc(sizeof(files_list_entry_t));
+    if (!source_entry || !destination_entry || open_spill_merger(&source_merger, source_list.runs, source_list.runs_count) == -1) {
+        free(source_entry);
+        free(destination_entry);
+        clear_spill_list(&source_list);
+        clear_spill_list(&destination_list);
+        return;
+    }
+    if (open_spill_merger(&destination_merger, destination_list.runs, destination_list.runs_count) == -1) {
+        close_spill_merger(&source_merger);
+        free(source_entry);
+        free(destination_entry);
+        clear_spill_list(&source_list);
+        clear_spill_list(&destination_list);
+        return;
+    }
+
+    streaming_context_t context;
+    memset(&context, 0, sizeof(context));
+    context.the_config = the_config;
+    context.msg_queue = -1;
+    plan_writer_t plan;
+    if (the_config->plan_output_path[0] != '\0') {
+        if (open_plan(&plan, the_config) == -1) {
+            close_spill_merger(&source_merger);
+            close_spill_merger(&destination_merger);
+            free(source_entry);
+            free(destination_entry);
+            clear_spill_list(&source_list);
+            clear_spill_list(&destination_list);
+            return;
+        }
+        context.plan = &plan;
+    }
+    pid_t copier_pid = -1;
+    copier_configuration_t copier_config;
+    if (the_config->is_parallel && !the_config->is_dry_run && the_config->plan_output_path[0] == '\0') {
+        copier_pid = start_copier_process(the_config, &copier_config, STREAMING_QUEUE_DEPTH);
+        if (copier_pid > 0) {
+            context.msg_queue = copier_config.message_queue_id;
+        }
+    }
+
+    if (the_config->is_verbose || the_config->is_dry_run) {
+        printf("\nDIFFERENCES LIST:\n");
+    }
+    spill_cursor_t *source_cursor = next_spill_record(&source_merger);
+    spill_cursor_t *destination_cursor = next_spill_record(&destination_merger);
+    while (source_cursor) {
+        int comparison = destination_cursor ? strcmp(source_cursor->path, destination_cursor->path) : -1;
+        if (comparison > 0) {
+            destination_cursor = next_spill_record(&destination_merger);
+            continue;
+        }
+
+        bool is_different = true;
+        if (fill_entry_from_record(source_entry, the_config->source, source_cursor) == 0) {
+            if (comparison == 0 && fill_entry_from_record(destination_entry, the_config->destination, destination_cursor) == 0) {
+                // MD5 sums only matter when everything else is equal; a file that cannot be hashed is copied again
+                bool has_md5 = true;
+                if (the_config->uses_md5 && source_entry->entry_type == FICHIER && destination_entry->entry_type == FICHIER
+                    && source_entry->size == destination_entry->size && source_entry->mtime.tv_sec == destination_entry->mtime.tv_sec
+                    && source_entry->mtime.tv_nsec == destination_entry->mtime.tv_nsec) {
+                    has_md5 = compute_file_md5(source_entry) == 0 && compute_file_md5(destination_entry) == 0;
+                }
+                is_different = !has_md5 || mismatch(source_entry, destination_entry, the_config);
+            }
+            if (is_different) {
+                stream_difference(&context, source_entry);
+            }
+        }
+
+        if (comparison == 0) {
+            destination_cursor = next_spill_record(&destination_merger);
+        }
+        source_cursor = next_spill_record(&source_merger);
+    }
+
+    if (copier_pid > 0) {
+        stop_copier_process(&copier_config, copier_pid);
+    }
+    finish_durable_writes(the_config);
+    if (context.plan) {
+        close_plan(context.plan);
+    }
+    if (context.differences_count == 0 && the_config->is_verbose) {
+        printf("\nDifferences list was empty!");
+    }
+
+    close_spill_merger(&source_merger);
+    close_spill_merger(&destination_merger);
+    free(source_entry);
+    free(destination_entry);
+    clear_spill_list(&source_list);
+    clear_spill_list(&destination_list);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <configuration.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <defines.h>
+
+#define SPILL_MAX_FAN_IN 64 // Runs merged at once; beyond that, runs are first merged into bigger runs
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t mode;
+    uint16_t path_length;
+    uint8_t entry_type;
+} spill_record_t; // Followed by the path relative to the tree root (path_length bytes, '\0' added in memory)
+
+typedef struct {
+    char *buffer; // Packed records of the current run, each followed by its path and a '\0'
+    size_t used;
+    size_t capacity;
+    size_t *offsets; // Position of each record of the current run in buffer
+    size_t count;
+    size_t offsets_capacity;
+    size_t budget; // Bytes of buffer and offsets allowed before the run is spilled
+    FILE **runs; // Sorted runs spilled to temporary files
+    size_t runs_count;
+    unsigned long entries_count;
+} spill_list_t;
+
+typedef struct {
+    FILE *file;
+    spill_record_t record;
+    char path[PATH_SIZE];
+} spill_cursor_t;
+
+typedef struct {
+    spill_cursor_t *cursors;
+    size_t *heap; // Indices of the cursors that still have a record, ordered as a min-heap on path
+    size_t heap_size;
+    long pending; // Cursor returned by the last call to next_spill_record, advanced on the next call
+} spill_merger_t;
+
+int init_spill_list(spill_list_t *list, size_t budget);
+void clear_spill_list(spill_list_t *list);
+int add_spill_record(spill_list_t *list, spill_record_t *record, char *relative_path);
+int spill_current_run(spill_list_t *list);
+int finish_spill_list(spill_list_t *list);
+int make_spill_list(spill_list_t *list, char *root, char *relative_dir);
+int reduce_spill_runs(spill_list_t *list);
+int open_spill_merger(spill_merger_t *merger, FILE **runs, size_t runs_count);
+spill_cursor_t *next_spill_record(spill_merger_t *merger);
+void close_spill_merger(spill_merger_t *merger);
+void synchronize_external(configuration_t *the_config);
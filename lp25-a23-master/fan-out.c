@@ -0,0 +1,297 @@
+#define _DEFAULT_SOURCE // posix_fadvise is not exposed by strict compilers
+
+#include <fan-out.h>
+#include <sync.h>
+#include <durable.h>
+#include <files-list.h>
+#include <link-dest.h>
+#include <file-copy.h>
+#include <stats.h>
+#include <throttle.h>
+#include <trace.h>
+#include <utility.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief relative_path_of returns the path of an entry relative to the source
+ */
+static char *relative_path_of(files_list_entry_t *entry, configuration_t *the_config) {
+    char *relative_path = entry->path_and_name + strlen(the_config->source);
+    while (*relative_path == '/') {
+        relative_path++;
+    }
+    return relative_path;
+}
+
+/*!
+ * @brief write_all writes a whole buffer, retrying on short writes
+ * @return 0 when ok, -1 in case of error
+ */
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        throttle_io(THROTTLE_WRITE_BYTES, length);
+        ssize_t written = write(fd, data, length);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/*!
+ * @brief fan_out_copy_file copies a file to several destinations, reading it only once
+ * Each part of the file is read into a buffer, then written to the temporary file of every destination.
+ * A destination whose write fails is dropped, the others go on.
+ * @param entry is the source entry to copy
+ * @param configs is the array of the configurations of the destinations
+ * @param targets is the mask of the destinations to copy the file to
+ * @param buffer is a buffer of FAN_OUT_BUFFER_SIZE bytes
+ */
+static void fan_out_copy_file(files_list_entry_t *entry, configuration_t *configs, uint32_t targets, char *buffer) {
+    static char temp_paths[MAX_DESTINATIONS][PATH_SIZE];
+    char *destination_paths[MAX_DESTINATIONS] = {NULL};
+    int fds[MAX_DESTINATIONS];
+
+    // Every destination not committed at the end counts as a failed copy
+    int failed_count = __builtin_popcount(targets);
+    int source_fd = open(entry->path_and_name, O_RDONLY);
+    if (source_fd == -1) {
+        perror(entry->path_and_name);
+        for (int i=0; i<failed_count; ++i) {
+            count_failed_copy(configs);
+        }
+        return;
+    }
+    posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (int d=0; d<MAX_DESTINATIONS; ++d) {
+        if (!(targets & (1u << d))) {
+            continue;
+        }
+        destination_paths[d] = concat_path(NULL, configs[d].destination, relative_path_of(entry, &configs[d]));
+        fds[d] = destination_paths[d] ? open_temp_file(destination_paths[d], temp_paths[d]) : -1;
+        if (fds[d] == -1) {
+            perror(destination_paths[d] ? destination_paths[d] : entry->path_and_name);
+            targets &= ~(1u << d);
+        } else if (preallocate_file(fds[d], entry->size) == -1) {
+            close(fds[d]);
+            unlink(temp_paths[d]);
+            targets &= ~(1u << d);
+        }
+    }
+
+    uint64_t copied = 0;
+    while (targets && copied < entry->size) {
+        size_t chunk = entry->size - copied < FAN_OUT_BUFFER_SIZE ? entry->size - copied : FAN_OUT_BUFFER_SIZE;
+        throttle_io(THROTTLE_READ_BYTES, chunk);
+        ssize_t bytes_read = read(source_fd, buffer, chunk);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read == -1) {
+            perror(entry->path_and_name);
+            for (int d=0; d<MAX_DESTINATIONS; ++d) {
+                if (targets & (1u << d)) {
+                    close(fds[d]);
+                    unlink(temp_paths[d]);
+                }
+            }
+            targets = 0;
+            break;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        for (int d=0; d<MAX_DESTINATIONS; ++d) {
+            if ((targets & (1u << d)) && write_all(fds[d], buffer, bytes_read) == -1) {
+                perror(destination_paths[d]);
+                close(fds[d]);
+                unlink(temp_paths[d]);
+                targets &= ~(1u << d);
+            }
+        }
+        copied += bytes_read;
+    }
+    close(source_fd);
+
+    struct timespec times[2] = {entry->mtime, entry->mtime};
+    for (int d=0; d<MAX_DESTINATIONS; ++d) {
+        if (targets & (1u << d)) {
+            // The source got shorter since it was listed: the end of the preallocated size is cut
+            if (copied < entry->size && ftruncate(fds[d], copied) == -1) {
+                perror("Error writing destination file");
+            }
+            if (fchmod(fds[d], entry->mode & 07777) == -1) {
+                perror("Error setting access modes");
+            }
+            if (futimens(fds[d], times) == -1) {
+                perror("Error setting modification time");
+            }
+            if (close(fds[d]) == -1) {
+                perror("Error writing destination file");
+                unlink(temp_paths[d]);
+            } else if (commit_temp_file(temp_paths[d], destination_paths[d], copied, &configs[d]) == 0) {
+                STATS_ADD(copies[STATS_COPY_FULL], 1);
+                STATS_ADD(copied_bytes[STATS_COPY_FULL], copied);
+                STATS_ADD(bytes_copied, copied);
+                failed_count--;
+            }
+        }
+        free(destination_paths[d]);
+    }
+    for (int i=0; i<failed_count; ++i) {
+        count_failed_copy(configs);
+    }
+}
+
+/*!
+ * @brief fan_out_entry copies a difference to all the destinations that need it
+ * Large files updated with a block delta are copied to each destination on its own, since the delta
+ * depends on the destination, and files linked to the previous snapshot need no copy; all the others are read
+ * once for all the destinations.
+ * @param entry is the source entry to copy
+ * @param configs is the array of the configurations of the destinations
+ * @param targets is the mask of the destinations to copy the entry to
+ * @param buffer is a buffer of FAN_OUT_BUFFER_SIZE bytes
+ */
+static void fan_out_entry(files_list_entry_t *entry, configuration_t *configs, uint32_t targets, char *buffer) {
+    for (int d=0; d<MAX_DESTINATIONS; ++d) {
+        if (!(targets & (1u << d))) {
+            continue;
+        }
+        if (entry->entry_type == FICHIER && configs[d].link_dest_path[0] != '\0') {
+            char *destination_path = concat_path(NULL, configs[d].destination, relative_path_of(entry, &configs[d]));
+            bool is_linked = destination_path && link_previous_version(entry, destination_path, &configs[d]) == 0;
+            free(destination_path);
+            if (is_linked) {
+                targets &= ~(1u << d);
+                continue;
+            }
+        }
+        bool is_delta = false;
+        if (entry->entry_type == FICHIER && configs[d].delta_threshold > 0 && entry->size >= configs[d].delta_threshold) {
+            char *destination_path = concat_path(NULL, configs[d].destination, relative_path_of(entry, &configs[d]));
+            is_delta = destination_path && access(destination_path, F_OK) == 0;
+            free(destination_path);
+        }
+        if (entry->entry_type == DOSSIER || is_delta) {
+            copy_entry_to_destination(entry, &configs[d]);
+            targets &= ~(1u << d);
+        }
+    }
+    if (targets == 0) {
+        return;
+    }
+
+    uint64_t copy_start = start_stats_timer();
+    uint64_t trace_start = start_trace_span();
+    fan_out_copy_file(entry, configs, targets, buffer);
+    end_trace_span(TRACE_COPY_FILE, entry->path_and_name, trace_start);
+    stop_stats_timer(STATS_COPY, copy_start);
+}
+
+/*!
+ * @brief synchronize_fan_out synchronizes several destinations with the source, listing and reading it once
+ * The source is listed and analyzed once, then diffed against the list of each destination. Each
+ * difference is copied once to every destination that needs it, from a single read of the source.
+ * @param the_config is a pointer to the configuration, with the destinations after the first one in extra_destinations
+ */
+void synchronize_fan_out(configuration_t *the_config) {
+    int destinations_count = 1 + the_config->extra_destinations_count;
+    configuration_t *configs = malloc(destinations_count * sizeof(configuration_t));
+    files_list_t source = {NULL, NULL};
+    if (!configs) {
+        perror("Failed allocating memory to the destinations");
+        return;
+    }
+    // Each destination is synchronized with its own configuration, as if it was the only one
+    for (int d=0; d<destinations_count; ++d) {
+        configs[d] = *the_config;
+        configs[d].extra_destinations_count = 0;
+        if (d > 0) {
+            strcpy(configs[d].destination, the_config->extra_destinations[d - 1]);
+        }
+    }
+
+    make_files_list(&source, the_config->source, the_config);
+    if (the_config->is_verbose || the_config->is_dry_run) {
+        printf("\nSOURCE LIST:\n");
+        display_files_list(&source);
+    }
+    size_t entries_count = 0;
+    for (files_list_entry_t *cursor=source.head; cursor!=NULL; cursor=cursor->next) {
+        entries_count++;
+    }
+    // Bit d of the mask of an entry is set when destination d needs it
+    uint32_t *targets = calloc(entries_count ? entries_count : 1, sizeof(uint32_t));
+    if (!targets) {
+        clear_files_list(&source);
+        free(configs);
+        return;
+    }
+
+    for (int d=0; d<destinations_count; ++d) {
+        files_list_t destination = {NULL, NULL};
+        make_files_list(&destination, configs[d].destination, &configs[d]);
+        SET_PROGRESS_PHASE(PROGRESS_COMPARING);
+        size_t i = 0;
+        for (files_list_entry_t *cursor=source.head; cursor!=NULL; cursor=cursor->next, ++i) {
+            char *destination_path = concat_path(NULL, configs[d].destination, relative_path_of(cursor, &configs[d]));
+            uint64_t lookup_start = start_stats_timer();
+            files_list_entry_t *destination_entry = destination_path ? find_entry_by_name(&destination, destination_path) : NULL;
+            if (!destination_entry || mismatch(cursor, destination_entry, &configs[d])) {
+                targets[i] |= 1u << d;
+            }
+            stop_stats_timer(STATS_DIFF, lookup_start);
+            free(destination_path);
+        }
+        clear_files_list(&destination);
+
+        if (the_config->is_verbose || the_config->is_dry_run) {
+            printf("\nDIFFERENCES LIST OF %s:\n", configs[d].destination);
+            i = 0;
+            for (files_list_entry_t *cursor=source.head; cursor!=NULL; cursor=cursor->next, ++i) {
+                if (targets[i] & (1u << d)) {
+                    printf("%s\n", cursor->path_and_name);
+                }
+            }
+        }
+    }
+
+    char *buffer = the_config->is_dry_run ? NULL : malloc(FAN_OUT_BUFFER_SIZE);
+    if (buffer) {
+        uint64_t total_size = 0;
+        size_t i = 0;
+        for (files_list_entry_t *cursor=source.head; cursor!=NULL; cursor=cursor->next, ++i) {
+            total_size += cursor->entry_type == FICHIER ? cursor->size * __builtin_popcount(targets[i]) : 0;
+        }
+        STATS_ADD(bytes_to_copy, total_size);
+        SET_PROGRESS_PHASE(PROGRESS_COPYING);
+
+        // Source order creates the directories before their files
+        i = 0;
+        for (files_list_entry_t *cursor=source.head; cursor!=NULL; cursor=cursor->next, ++i) {
+            if (targets[i]) {
+                fan_out_entry(cursor, configs, targets[i], buffer);
+            }
+        }
+        finish_durable_writes(the_config);
+        free(buffer);
+    } else if (!the_config->is_dry_run) {
+        perror("Failed allocating memory to the copy buffer");
+    }
+
+    free(targets);
+    clear_files_list(&source);
+    free(configs);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <configuration.h>
+
+#define FAN_OUT_BUFFER_SIZE (1 << 20) // Part of a file read once, then written to every destination needing it
+
+void synchronize_fan_out(configuration_t *the_config);
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE // fallocate is not exposed by strict compilers
+
+#include <file-copy.h>
+#include <processes.h>
+#include <throttle.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/wait.h>
+
+/*!
+ * @brief preallocate_file allocates the final size of a file before it is written
+ * The file system can then give it contiguous extents, instead of interleaving them with those of the
+ * files copied at the same time. File systems without fallocate are written as before.
+ * @param fd is the file, opened for writing
+ * @param size is the final size of the file, which it gets right away
+ * @return 0 when ok, -1 if the space is missing
+ */
+int preallocate_file(int fd, uint64_t size) {
+    if (size == 0 || fallocate(fd, 0, 0, size) == 0) {
+        return 0;
+    }
+    if (errno == EOPNOTSUPP || errno == ENOSYS || errno == EINVAL) {
+        return 0;
+    }
+    perror("Error allocating destination file");
+    return -1;
+}
+
+/*!
+ * @brief get_write_chunk_size returns the size of the writes to a file, a multiple of the blocks of its file system
+ * @param fd is the file
+ * @return FILE_COPY_BLOCKS_PER_CHUNK blocks, kept between FILE_COPY_MIN_CHUNK and FILE_COPY_MAX_CHUNK
+ */
+size_t get_write_chunk_size(int fd) {
+    size_t block_size = 4096;
+    struct stat statbuf;
+    struct statfs fs_stats;
+    if (fstat(fd, &statbuf) == 0 && statbuf.st_blksize > 0) {
+        block_size = statbuf.st_blksize;
+    }
+    if (fstatfs(fd, &fs_stats) == 0 && fs_stats.f_bsize > 0 && (size_t)fs_stats.f_bsize > block_size) {
+        block_size = fs_stats.f_bsize;
+    }
+    size_t chunk_size = block_size * FILE_COPY_BLOCKS_PER_CHUNK;
+    if (chunk_size < FILE_COPY_MIN_CHUNK) {
+        chunk_size = (FILE_COPY_MIN_CHUNK + block_size - 1) / block_size * block_size;
+    }
+    if (chunk_size > FILE_COPY_MAX_CHUNK) {
+        chunk_size = FILE_COPY_MAX_CHUNK / block_size > 0 ? FILE_COPY_MAX_CHUNK / block_size * block_size : block_size;
+    }
+    return chunk_size;
+}
+
+/*!
+ * @brief copy_range copies a part of a file with pread and pwrite, which leave the offsets of the descriptors alone
+ * When I/O is limited, reads are cut to THROTTLE_CHUNK_SIZE like those of sendfile.
+ * @param range is the part to copy, whose copied field receives the number of bytes copied
+ * @return 0 when ok, -1 in case of error
+ */
+static int copy_range(file_range_t *range) {
+    range->copied = 0;
+    char *buffer = malloc(range->chunk_size);
+    if (!buffer) {
+        return -1;
+    }
+    size_t max_chunk = the_throttle && range->chunk_size > THROTTLE_CHUNK_SIZE ? THROTTLE_CHUNK_SIZE : range->chunk_size;
+    int result = 0;
+    while (range->copied < range->length) {
+        size_t chunk = range->length - range->copied < max_chunk ? range->length - range->copied : max_chunk;
+        throttle_io(THROTTLE_READ_BYTES, chunk);
+        ssize_t bytes_read = pread(range->source_fd, buffer, chunk, range->offset + range->copied);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            result = bytes_read == 0 ? 0 : -1;
+            break;
+        }
+        throttle_io(THROTTLE_WRITE_BYTES, bytes_read);
+        for (ssize_t written = 0; written < bytes_read && result == 0; ) {
+            ssize_t bytes_written = pwrite(range->destination_fd, buffer + written, bytes_read - written, range->offset + range->copied + written);
+            if (bytes_written == -1 && errno != EINTR) {
+                result = -1;
+            }
+            written += bytes_written > 0 ? bytes_written : 0;
+        }
+        if (result == -1) {
+            break;
+        }
+        range->copied += bytes_read;
+    }
+    free(buffer);
+    return result;
+}
+
+/*!
+ * @brief range_copier_loop is the function of a process copying one part of a file (@see make_process)
+ * @param parameters is a pointer to the part to copy, to be cast to a file_range_t shared with the parent
+ */
+static void range_copier_loop(void *parameters) {
+    exit(copy_range((file_range_t *)parameters) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*!
+ * @brief copy_ranges_parallel copies a file split in ranges, each one by its own process
+ * The ranges are contiguous and start on chunk boundaries, so each process writes whole blocks of the
+ * preallocated file. The caller copies the first range, and the ranges whose process cannot be created.
+ * The ranges are shared with the processes, which report there the bytes they copied.
+ * @param copied receives the number of bytes copied up to the first range cut short by a shorter source
+ * @return 0 when ok, -1 in case of error
+ */
+static int copy_ranges_parallel(int source_fd, int destination_fd, uint64_t size, size_t chunk_size, int ranges_count, uint64_t *copied) {
+    uint64_t range_size = (size / ranges_count + chunk_size - 1) / chunk_size * chunk_size;
+    file_range_t *ranges = mmap(NULL, FILE_COPY_MAX_WORKERS * sizeof(file_range_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ranges == MAP_FAILED) {
+        perror("Error mapping file ranges");
+        return -1;
+    }
+    pid_t pids[FILE_COPY_MAX_WORKERS];
+    process_context_t p_context;
+    p_context.processes_count = 0;
+    fflush(stdout);
+
+    int result = 0;
+    for (int r=0; r<ranges_count; ++r) {
+        ranges[r].source_fd = source_fd;
+        ranges[r].destination_fd = destination_fd;
+        ranges[r].offset = r * range_size < size ? r * range_size : size;
+        ranges[r].length = size - ranges[r].offset < range_size ? size - ranges[r].offset : range_size;
+        ranges[r].chunk_size = chunk_size;
+        ranges[r].copied = 0;
+        pids[r] = r > 0 && ranges[r].length > 0 ? make_process(&p_context, range_copier_loop, &ranges[r]) : -1;
+    }
+    for (int r=0; r<ranges_count; ++r) {
+        if (pids[r] == -1 && copy_range(&ranges[r]) == -1) {
+            result = -1;
+        }
+    }
+    for (int r=0; r<ranges_count; ++r) {
+        int status;
+        if (pids[r] != -1 && (waitpid(pids[r], &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)) {
+            result = -1;
+        }
+    }
+    // Past a range cut short, the source got shorter: the copy ends there, as with sendfile
+    *copied = 0;
+    for (int r=0; r<ranges_count && result == 0; ++r) {
+        *copied += ranges[r].copied;
+        if (ranges[r].copied < ranges[r].length) {
+            break;
+        }
+    }
+    munmap(ranges, FILE_COPY_MAX_WORKERS * sizeof(file_range_t));
+    return result;
+}
+
+/*!
+ * @brief copy_file_data copies the data of a file to a new file
+ * The destination is preallocated first. Files of at least FILE_COPY_PARALLEL_THRESHOLD bytes are split in
+ * up to FILE_COPY_MAX_WORKERS ranges copied at once, so a single huge file can use all the bandwidth of fast
+ * storage. Smaller files are copied by the kernel with sendfile, in chunks when I/O is limited.
+ * @param source_fd is the source file
+ * @param destination_fd is the destination file, empty
+ * @param size is the size of the source file when it was listed
+ * @param copied receives the number of bytes copied
+ * @return 0 when ok, -1 in case of error
+ */
+int copy_file_data(int source_fd, int destination_fd, uint64_t size, uint64_t *copied) {
+    *copied = 0;
+    if (preallocate_file(destination_fd, size) == -1) {
+        return -1;
+    }
+    size_t chunk_size = get_write_chunk_size(destination_fd);
+
+    int result = 0;
+    int ranges_count = size >= FILE_COPY_PARALLEL_THRESHOLD ? (int)(size / FILE_COPY_MIN_RANGE) : 1;
+    ranges_count = ranges_count < FILE_COPY_MAX_WORKERS ? ranges_count : FILE_COPY_MAX_WORKERS;
+    if (ranges_count > 1) {
+        result = copy_ranges_parallel(source_fd, destination_fd, size, chunk_size, ranges_count, copied);
+    } else {
+        // Copied until the end since sendfile may stop short
+        off_t offset = 0;
+        while ((uint64_t)offset < size) {
+            size_t chunk = size - offset;
+            if (the_throttle && chunk > chunk_size) {
+                chunk = chunk_size < THROTTLE_CHUNK_SIZE ? chunk_size : THROTTLE_CHUNK_SIZE;
+            }
+            throttle_io(THROTTLE_READ_BYTES, chunk);
+            throttle_io(THROTTLE_WRITE_BYTES, chunk);
+            ssize_t sent = sendfile(destination_fd, source_fd, &offset, chunk);
+            if (sent == -1 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                result = sent == 0 ? 0 : -1;
+                break;
+            }
+            *copied += sent;
+        }
+    }
+    // The source got shorter since it was listed: the end of the preallocated size is cut
+    if (result == 0 && *copied < size && ftruncate(destination_fd, *copied) == -1) {
+        result = -1;
+    }
+    return result;
+}
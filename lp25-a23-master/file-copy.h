@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FILE_COPY_PARALLEL_THRESHOLD (256ULL << 20) // Files at least this large are copied by several processes at once
+#define FILE_COPY_MIN_RANGE (64ULL << 20) // Smallest part of a file given to one process
+#define FILE_COPY_MAX_WORKERS 4 // Processes copying the parts of a file, including the caller
+#define FILE_COPY_BLOCKS_PER_CHUNK 256 // A write covers this many blocks of the destination file system
+#define FILE_COPY_MIN_CHUNK (64 << 10)
+#define FILE_COPY_MAX_CHUNK (8 << 20)
+
+typedef struct {
+    int source_fd;
+    int destination_fd;
+    uint64_t offset;
+    uint64_t length;
+    size_t chunk_size;
+    uint64_t copied; // Bytes copied, less than the length if the source got shorter
+} file_range_t;
+
+int preallocate_file(int fd, uint64_t size);
+size_t get_write_chunk_size(int fd);
+int copy_file_data(int source_fd, int destination_fd, uint64_t size, uint64_t *copied);
@@ -1,3 +1,5 @@
+#define _DEFAULT_SOURCE // st_mtim is not exposed by strict -std=c11
+
 #include <file-properties.h>
 #include <openssl/md5.h>
 #include <sys/stat.h>
@@ -11,7 +13,12 @@
 #include <stdio.h>
 #include <utility.h>
 #include <ctype.h>
+#include <stats.h>
+#include <trace.h>
+#include <throttle.h>
+
 
+static int read_file_stats(files_list_entry_t *entry);
 
 /*!
  * @brief get_file_stats gets all of the required information for a file (inc. directories)
@@ -29,14 +36,27 @@
  * @return -1 in case of error, 0 else
  */
 int get_file_stats(files_list_entry_t *entry) {
+    uint64_t trace_start = start_trace_span();
+    int result = read_file_stats(entry);
+    end_trace_span(TRACE_ANALYZE_FILE, entry->path_and_name, trace_start);
+    return result;
+}
+
+/*!
+ * @brief read_file_stats fills an entry for get_file_stats, which records it in the trace
+ */
+static int read_file_stats(files_list_entry_t *entry) {
     struct stat statbuf;
 
-    if (stat(entry->path_and_name, &statbuf) == -1) {       
+    uint64_t stat_start = start_stats_timer();
+    int stat_result = stat(entry->path_and_name, &statbuf);
+    stop_stats_timer(STATS_STAT, stat_start);
+    if (stat_result == -1) {       
         return -1;
     }
 
     entry->mode = statbuf.st_mode;
-    entry->mtime.tv_sec = statbuf.st_mtime;
+    entry->mtime = statbuf.st_mtim;
 
 
     if (S_ISREG(statbuf.st_mode)) {
@@ -61,6 +81,7 @@ int get_file_stats(files_list_entry_t *entry) {
  * Use libcrypto functions from openssl/evp.h
  */
 int compute_file_md5(files_list_entry_t *entry) {
+    uint64_t hashing_start = start_stats_timer();
     FILE *file = fopen(entry->path_and_name, "rb");
     if (!file) {
         return -1;
@@ -70,25 +91,26 @@ int compute_file_md5(files_list_entry_t *entry) {
     EVP_MD_CTX *mdContext;
     const EVP_MD *md = EVP_md5(); // Use MD5 algorithm
     int bytes;
-    unsigned char data[1024];
+    unsigned char data[MD5_BUFFER_SIZE];
 
     mdContext = EVP_MD_CTX_new();
     EVP_DigestInit_ex(mdContext, md, NULL);
 
-    while ((bytes = fread(data, 1, 1024, file)) != 0) {
+    while ((bytes = fread(data, 1, sizeof(data), file)) != 0) {
         EVP_DigestUpdate(mdContext, data, bytes);
+        STATS_ADD(bytes_hashed, bytes);
+        throttle_io(THROTTLE_READ_BYTES, bytes);
     }
 
     EVP_DigestFinal_ex(mdContext, c, NULL);
     EVP_MD_CTX_free(mdContext);
 
-    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
-        // Convert two hexadecimal characters to one byte
-        sscanf((char*)&c[i * 2], "%2hhx", &entry->md5sum[i]);
-    }
+    // The digest is already binary, it only needs to be copied
+    memcpy(entry->md5sum, c, MD5_DIGEST_LENGTH);
     entry->md5sum[MD5_DIGEST_LENGTH] = '\0';  // Add null terminator
 
     fclose(file);
+    stop_stats_timer(STATS_HASHING, hashing_start);
     return 0;
 }
 
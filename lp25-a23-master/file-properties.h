@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <configuration.h>
 
+#define MD5_BUFFER_SIZE 65536 // Large enough for fread to read straight from the file, one operation per buffer
+
 int get_file_stats(files_list_entry_t *entry);   
 int compute_file_md5(files_list_entry_t *entry);
 bool directory_exists(char *path_to_dir);
@@ -1,4 +1,5 @@
 #include <files-list.h>
+#include <list-arena.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,6 +14,10 @@
  * This function is provided, you don't need to implement nor modify it
  */
 void clear_files_list(files_list_t *list) {
+    // A list built by a lister in shared memory is released with its arena
+    if (list->head && release_arena_list(list)) {
+        return;
+    }
     while (list->head) {
         files_list_entry_t *tmp = list->head;
         list->head = tmp->next;
@@ -37,9 +42,12 @@ int add_file_entry(files_list_t *list, char *file_path) {     //ask about the ty
         return 0;
     }
 
-    files_list_entry_t *new_entry = (files_list_entry_t*)malloc(sizeof(files_list_entry_t));
+    files_list_entry_t *new_entry = new_files_list_entry();
 
     if (!new_entry) {
+        if (the_list_arena && the_list_arena->has_overflowed) {
+            return -1;
+        }
         perror("\nFAILED TO ALLOCATE MEMORY FOR NEW_ENTRY");
         return -1;
     }
@@ -131,8 +139,6 @@ int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
  *  The function uses the ordering of the entries to interrupt its search
  *  @param list the list to look into
  *  @param file_path the full path of the file to look for
- *  @param start_of_src the position of the name of the file in the source directory (removing the source path)
- *  @param start_of_dest the position of the name of the file in the destination dir (removing the dest path)
  *  @return a pointer to the element found, NULL if none were found.
  */
 files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path) {    //MOVED BOTH OF SIZE_T VARIABLES
@@ -141,25 +147,16 @@ files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path) {
         return NULL;
     }
     
+    // Full paths are compared: files with the same name in different directories are different entries
     files_list_entry_t *current = list->head;
-    char current_name[PATH_SIZE];
-    char file_path_name[PATH_SIZE];
-    if (!current_name || !file_path_name) {
-        perror("\nFAILED ALLOCATING MEMORY TO FILE NAME VARIABLES");
-        free(current_name);
-        free(file_path_name);   
-        return NULL;
-    }
-    strncpy(file_path_name, get_file_name_from_path(file_path), PATH_SIZE);
-    file_path_name[PATH_SIZE - 1] = '\0';
-   
     while (current) {
-        strncpy(current_name, get_file_name_from_path(current->path_and_name), PATH_SIZE);
-        current_name[PATH_SIZE - 1] = '\0';
-
-        if (strcmp(current_name, file_path_name) == 0) {
+        int comparison = strcmp(current->path_and_name, file_path);
+        if (comparison == 0) {
            return current;
         }
+        if (comparison > 0) {
+            break;
+        }
 
         current = current->next;
     }
@@ -0,0 +1,434 @@
+#define _DEFAULT_SOURCE // DT_DIR and getline with strict compilers
+
+#include <filter.h>
+#include <stats.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+filter_t *the_filter = NULL;
+
+/*!
+ * @brief add_token appends a token to the compiled form of a glob
+ * @return 0 when ok, -1 in case of error
+ */
+static int add_token(filter_rule_t *rule, glob_token_t *token) {
+    glob_token_t *tokens = realloc(rule->tokens, (rule->tokens_count + 1) * sizeof(glob_token_t));
+    if (!tokens) {
+        return -1;
+    }
+    rule->tokens = tokens;
+    rule->tokens[rule->tokens_count++] = *token;
+    return 0;
+}
+
+/*!
+ * @brief add_literal_token appends the pending literal characters of a glob as a token, if there are some
+ * @return 0 when ok, -1 in case of error
+ */
+static int add_literal_token(filter_rule_t *rule, char *literal, size_t *length) {
+    if (*length == 0) {
+        return 0;
+    }
+    glob_token_t token;
+    memset(&token, 0, sizeof(token));
+    token.type = GLOB_LITERAL;
+    token.literal = strndup(literal, *length);
+    token.length = *length;
+    *length = 0;
+    if (!token.literal || add_token(rule, &token) == -1) {
+        free(token.literal);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief parse_class parses a [...] set of characters, with ranges and ! or ^ negation
+ * @param start is a pointer to the opening bracket
+ * @param bits receives one bit per character of the set, / is never part of it
+ * @return a pointer past the closing bracket, NULL if there is none (the bracket is then a literal)
+ */
+static char *parse_class(char *start, uint8_t bits[32]) {
+    char *cursor = start + 1;
+    bool is_negated = *cursor == '!' || *cursor == '^';
+    cursor += is_negated;
+    memset(bits, 0, 32);
+    // A ] right after the opening bracket is part of the set
+    for (bool is_first=true; *cursor && (*cursor != ']' || is_first); is_first=false) {
+        unsigned char low = *cursor++;
+        if (low == '\\' && *cursor) {
+            low = *cursor++;
+        }
+        unsigned char high = low;
+        if (cursor[0] == '-' && cursor[1] && cursor[1] != ']') {
+            cursor++;
+            high = *cursor++;
+            if (high == '\\' && *cursor) {
+                high = *cursor++;
+            }
+        }
+        for (int character=low; character<=high; ++character) {
+            bits[character >> 3] |= 1 << (character & 7);
+        }
+    }
+    if (*cursor != ']') {
+        return NULL;
+    }
+    if (is_negated) {
+        for (int i=0; i<32; ++i) {
+            bits[i] = ~bits[i];
+        }
+        bits[0] &= ~1; // The end of the string
+    }
+    bits['/' >> 3] &= ~(1 << ('/' & 7));
+    return cursor + 1;
+}
+
+/*!
+ * @brief compile_glob turns a glob into tokens, once, so that matching never parses the pattern again
+ * Wildcards are * (any characters but /), ** (any characters), ? (any character but /) and [...] sets;
+ * a backslash makes the next character literal.
+ * @return 0 when ok, -1 in case of error
+ */
+static int compile_glob(filter_rule_t *rule, char *pattern) {
+    char *literal = malloc(strlen(pattern) + 1);
+    size_t literal_length = 0;
+    if (!literal) {
+        return -1;
+    }
+    int result = 0;
+    for (char *cursor=pattern; *cursor && result == 0; ) {
+        glob_token_t token;
+        memset(&token, 0, sizeof(token));
+        char *class_end = NULL;
+        if (*cursor == '*') {
+            token.type = cursor[1] == '*' ? GLOB_DOUBLE_STAR : GLOB_STAR;
+            while (*cursor == '*') {
+                cursor++;
+            }
+        } else if (*cursor == '?') {
+            token.type = GLOB_ANY_CHAR;
+            cursor++;
+        } else if (*cursor == '[' && (class_end = parse_class(cursor, token.class_bits)) != NULL) {
+            token.type = GLOB_CLASS;
+            cursor = class_end;
+        } else {
+            if (*cursor == '\\' && cursor[1]) {
+                cursor++;
+            }
+            literal[literal_length++] = *cursor++;
+            continue;
+        }
+        result = add_literal_token(rule, literal, &literal_length) == 0 && add_token(rule, &token) == 0 ? 0 : -1;
+    }
+    if (result == 0) {
+        result = add_literal_token(rule, literal, &literal_length);
+    }
+    free(literal);
+    return result;
+}
+
+/*!
+ * @brief match_tokens tells if a compiled glob matches a whole string
+ */
+static bool match_tokens(glob_token_t *tokens, size_t count, const char *text) {
+    for (; count > 0; ++tokens, --count) {
+        unsigned char character = *text;
+        switch (tokens->type) {
+            case GLOB_LITERAL:
+            if (strncmp(text, tokens->literal, tokens->length) != 0) {
+                return false;
+            }
+            text += tokens->length;
+            break;
+            case GLOB_ANY_CHAR:
+            if (character == '\0' || character == '/') {
+                return false;
+            }
+            text++;
+            break;
+            case GLOB_CLASS:
+            if (character == '\0' || !(tokens->class_bits[character >> 3] & (1 << (character & 7)))) {
+                return false;
+            }
+            text++;
+            break;
+            case GLOB_STAR:
+            case GLOB_DOUBLE_STAR:
+            if (count == 1) {
+                return tokens->type == GLOB_DOUBLE_STAR || !strchr(text, '/');
+            }
+            for (const char *rest=text; ; ++rest) {
+                if (match_tokens(tokens + 1, count - 1, rest)) {
+                    return true;
+                }
+                if (*rest == '\0' || (*rest == '/' && tokens->type == GLOB_STAR)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return *text == '\0';
+}
+
+/*!
+ * @brief rule_matches tells if a rule matches an entry
+ * @param rule is the rule to try
+ * @param relative_path is the path of the entry, relative to the root of its tree
+ * @param name is the name of the entry, the last component of relative_path
+ * @param is_directory is true if the entry is a directory
+ */
+static bool rule_matches(filter_rule_t *rule, char *relative_path, char *name, bool is_directory) {
+    if (rule->is_directory_only && !is_directory) {
+        return false;
+    }
+    if (rule->kind == FILTER_ANCHORED) {
+        return match_tokens(rule->tokens, rule->tokens_count, relative_path);
+    }
+    if (rule->kind == FILTER_NAME) {
+        return match_tokens(rule->tokens, rule->tokens_count, name);
+    }
+    for (char *suffix=relative_path; ; ++suffix) {
+        if (match_tokens(rule->tokens, rule->tokens_count, suffix)) {
+            return true;
+        }
+        if ((suffix = strchr(suffix, '/')) == NULL) {
+            return false;
+        }
+    }
+}
+
+/*!
+ * @brief add_to_trie records an anchored rule under the literal prefix of its pattern
+ * @return 0 when ok, -1 in case of error
+ */
+static int add_to_trie(filter_trie_node_t *node, filter_rule_t *rule, size_t rule_index) {
+    char *prefix = rule->tokens_count > 0 && rule->tokens[0].type == GLOB_LITERAL ? rule->tokens[0].literal : "";
+    for (; *prefix; ++prefix) {
+        filter_trie_node_t *child = node->first_child;
+        while (child && child->character != *prefix) {
+            child = child->next_sibling;
+        }
+        if (!child) {
+            child = calloc(1, sizeof(filter_trie_node_t));
+            if (!child) {
+                return -1;
+            }
+            child->character = *prefix;
+            child->next_sibling = node->first_child;
+            node->first_child = child;
+        }
+        node = child;
+    }
+    size_t *rules = realloc(node->rules, (node->rules_count + 1) * sizeof(size_t));
+    if (!rules) {
+        return -1;
+    }
+    node->rules = rules;
+    node->rules[node->rules_count++] = rule_index;
+    return 0;
+}
+
+/*!
+ * @brief add_filter_rule compiles a rule and adds it after the existing ones
+ * Like rsync, a pattern starting with / is anchored at the root of the trees, a pattern ending with /
+ * only matches directories, a pattern with no other / matches names at any depth, and other patterns
+ * match the last components of paths. An excluded directory is never opened, so its whole subtree is skipped.
+ * @param pattern is the pattern of the rule
+ * @param is_include is true for an include rule, false for an exclude rule
+ * @return 0 when ok, -1 if the pattern is empty or in case of error
+ */
+int add_filter_rule(char *pattern, bool is_include) {
+    if (!the_filter && (the_filter = calloc(1, sizeof(filter_t))) == NULL) {
+        return -1;
+    }
+    filter_rule_t *rules = realloc(the_filter->rules, (the_filter->rules_count + 1) * sizeof(filter_rule_t));
+    if (!rules) {
+        return -1;
+    }
+    the_filter->rules = rules;
+    size_t rule_index = the_filter->rules_count;
+    filter_rule_t *rule = &the_filter->rules[rule_index];
+    memset(rule, 0, sizeof(filter_rule_t));
+    rule->is_include = is_include;
+    rule->pattern = strdup(pattern);
+    if (!rule->pattern) {
+        return -1;
+    }
+
+    char *start = rule->pattern;
+    size_t length = strlen(start);
+    while (length > 0 && start[length - 1] == '/') {
+        rule->is_directory_only = true;
+        start[--length] = '\0';
+    }
+    rule->kind = *start == '/' ? FILTER_ANCHORED : strchr(start, '/') || strstr(start, "**") ? FILTER_TRAILING : FILTER_NAME;
+    while (*start == '/') {
+        start++;
+    }
+    if (*start == '\0' || compile_glob(rule, start) == -1) {
+        fprintf(stderr, "Error: invalid filter pattern %s\n", pattern);
+        free(rule->pattern);
+        return -1;
+    }
+    // The pattern is kept whole for messages
+    strcpy(rule->pattern, pattern);
+
+    int result = 0;
+    if (rule->kind == FILTER_ANCHORED) {
+        result = add_to_trie(&the_filter->trie, rule, rule_index);
+    } else if (rule->kind == FILTER_NAME && rule->tokens_count == 1 && rule->tokens[0].type == GLOB_LITERAL) {
+        filter_name_t *names = realloc(the_filter->names, (the_filter->names_count + 1) * sizeof(filter_name_t));
+        result = names ? 0 : -1;
+        if (names) {
+            // Kept sorted by name, then by rule since rules are added in order
+            size_t position = the_filter->names_count;
+            while (position > 0 && strcmp(names[position - 1].name, rule->tokens[0].literal) > 0) {
+                position--;
+            }
+            memmove(&names[position + 1], &names[position], (the_filter->names_count - position) * sizeof(filter_name_t));
+            names[position].name = rule->tokens[0].literal;
+            names[position].rule = rule_index;
+            the_filter->names = names;
+            the_filter->names_count++;
+        }
+    } else {
+        size_t *globs = realloc(the_filter->globs, (the_filter->globs_count + 1) * sizeof(size_t));
+        result = globs ? 0 : -1;
+        if (globs) {
+            globs[the_filter->globs_count++] = rule_index;
+            the_filter->globs = globs;
+        }
+    }
+    if (result == -1) {
+        return -1;
+    }
+    the_filter->rules_count++;
+    the_filter->has_directory_rules = the_filter->has_directory_rules || rule->is_directory_only;
+    return 0;
+}
+
+/*!
+ * @brief load_filter_rules adds the rules of a file, one per line
+ * Lines are "+ pattern" for an include rule, "- pattern" or a bare pattern for an exclude rule; empty lines
+ * and lines starting with # or ; are ignored.
+ * @param path is the path of the file
+ * @return 0 when ok, -1 if the file cannot be read or has an invalid rule
+ */
+int load_filter_rules(char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+    char *line = NULL;
+    size_t line_size = 0;
+    int result = 0;
+    while (result == 0 && getline(&line, &line_size, file) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#' || line[0] == ';') {
+            continue;
+        }
+        if ((line[0] == '+' || line[0] == '-') && line[1] == ' ') {
+            result = add_filter_rule(line + 2, line[0] == '+');
+        } else {
+            result = add_filter_rule(line, false);
+        }
+    }
+    free(line);
+    fclose(file);
+    return result;
+}
+
+/*!
+ * @brief is_excluded applies the rules to an entry: the first matching rule decides, entries matching none are included
+ * Only the rules that can match are tried: name rules without wildcards are found by a binary search on
+ * the name, anchored rules by walking the trie of their literal prefixes along the path.
+ * @param relative_path is the path of the entry, relative to the root of its tree
+ * @param is_directory is true if the entry is a directory
+ * @return true if the entry must be skipped
+ */
+bool is_excluded(char *relative_path, bool is_directory) {
+    if (!the_filter || relative_path[0] == '\0') {
+        return false;
+    }
+    char *name = strrchr(relative_path, '/');
+    name = name ? name + 1 : relative_path;
+    filter_rule_t *rules = the_filter->rules;
+    size_t decision = SIZE_MAX;
+
+    size_t low = 0;
+    size_t high = the_filter->names_count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (strcmp(the_filter->names[middle].name, name) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    for (size_t i=low; i<the_filter->names_count && the_filter->names[i].rule < decision && strcmp(the_filter->names[i].name, name) == 0; ++i) {
+        if (rule_matches(&rules[the_filter->names[i].rule], relative_path, name, is_directory)) {
+            decision = the_filter->names[i].rule;
+        }
+    }
+
+    for (size_t i=0; i<the_filter->globs_count && the_filter->globs[i] < decision; ++i) {
+        if (rule_matches(&rules[the_filter->globs[i]], relative_path, name, is_directory)) {
+            decision = the_filter->globs[i];
+        }
+    }
+
+    filter_trie_node_t *node = &the_filter->trie;
+    for (char *cursor=relative_path; node; ++cursor) {
+        for (size_t i=0; i<node->rules_count && node->rules[i] < decision; ++i) {
+            if (rule_matches(&rules[node->rules[i]], relative_path, name, is_directory)) {
+                decision = node->rules[i];
+            }
+        }
+        if (*cursor == '\0') {
+            break;
+        }
+        node = node->first_child;
+        while (node && node->character != *cursor) {
+            node = node->next_sibling;
+        }
+    }
+
+    return decision != SIZE_MAX && !rules[decision].is_include;
+}
+
+/*!
+ * @brief is_path_excluded applies the rules to an entry found while walking a tree
+ * @param root is the root of the tree
+ * @param path is the full path of the entry
+ * @param d_type is the type of the entry from its directory entry, DT_UNKNOWN if it is not known
+ * @return true if the entry must be skipped
+ */
+bool is_path_excluded(char *root, char *path, unsigned char d_type) {
+    if (!the_filter) {
+        return false;
+    }
+    size_t root_length = strlen(root);
+    if (strncmp(path, root, root_length) != 0) {
+        return false;
+    }
+    char *relative_path = path + root_length;
+    while (*relative_path == '/') {
+        relative_path++;
+    }
+    bool is_directory = d_type == DT_DIR;
+    // The type is only needed by directory rules
+    if (d_type == DT_UNKNOWN && the_filter->has_directory_rules) {
+        struct stat statbuf;
+        is_directory = lstat(path, &statbuf) == 0 && S_ISDIR(statbuf.st_mode);
+    }
+    if (!is_excluded(relative_path, is_directory)) {
+        return false;
+    }
+    STATS_ADD(filtered_entries, 1);
+    return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum { GLOB_LITERAL, GLOB_ANY_CHAR, GLOB_STAR, GLOB_DOUBLE_STAR, GLOB_CLASS } glob_token_type_t;
+
+typedef struct {
+    glob_token_type_t type;
+    char *literal; // GLOB_LITERAL only
+    size_t length;
+    uint8_t class_bits[32]; // GLOB_CLASS only, one bit per byte value
+} glob_token_t;
+
+typedef enum {
+    FILTER_ANCHORED, // Starts with /: matched against the whole path, from the root of the tree
+    FILTER_NAME, // No / but a trailing one: matched against the name of the entries at any depth
+    FILTER_TRAILING, // Other patterns with a /: matched against the last components of the path
+} filter_rule_kind_t;
+
+typedef struct {
+    char *pattern; // As given, for messages
+    bool is_include;
+    bool is_directory_only; // The pattern ends with a /
+    filter_rule_kind_t kind;
+    glob_token_t *tokens;
+    size_t tokens_count;
+} filter_rule_t;
+
+typedef struct _filter_trie_node {
+    char character;
+    struct _filter_trie_node *first_child;
+    struct _filter_trie_node *next_sibling;
+    size_t *rules; // Anchored rules whose literal prefix ends at this node
+    size_t rules_count;
+} filter_trie_node_t;
+
+typedef struct {
+    char *name; // Whole pattern of a name rule without wildcards
+    size_t rule;
+} filter_name_t;
+
+typedef struct {
+    filter_rule_t *rules; // In the order they were given: the first matching rule decides
+    size_t rules_count;
+    filter_trie_node_t trie; // Anchored rules by literal prefix, so only the rules that can match a path are tried
+    filter_name_t *names; // Name rules without wildcards, sorted by name then rule
+    size_t names_count;
+    size_t *globs; // Other name rules and trailing rules, in rule order
+    size_t globs_count;
+    bool has_directory_rules;
+} filter_t;
+
+// Rules of --exclude, --include and --filter-from, NULL when there are none
+extern filter_t *the_filter;
+
+int add_filter_rule(char *pattern, bool is_include);
+int load_filter_rules(char *path);
+bool is_excluded(char *relative_path, bool is_directory);
+bool is_path_excluded(char *root, char *path, unsigned char d_type);
@@ -0,0 +1,131 @@
+#include <io-order.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+
+typedef struct {
+    files_list_entry_t *entry;
+    uint64_t physical; // Disk offset of the first extent, 0 when unknown
+    uint64_t inode;
+    size_t position; // Position in the list, so that equal keys keep the path order
+} io_key_t;
+
+/*!
+ * @brief parse_io_order converts the value of --io-order
+ * @param text is "path", "inode" or "extent"
+ * @param order is a pointer to the variable receiving the order
+ * @return 0 when ok, -1 if text is not a known order
+ */
+int parse_io_order(char *text, io_order_t *order) {
+    if (strcmp(text, "path") == 0) {
+        *order = IO_ORDER_PATH;
+    } else if (strcmp(text, "inode") == 0) {
+        *order = IO_ORDER_INODE;
+    } else if (strcmp(text, "extent") == 0) {
+        *order = IO_ORDER_EXTENT;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief first_extent returns the disk offset of the first extent of a file with FIEMAP
+ * @param path is the path to the file
+ * @return the offset, 0 if the file has no data or the file system cannot tell
+ */
+static uint64_t first_extent(char *path) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1) {
+        return 0;
+    }
+    union {
+        struct fiemap map;
+        char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.map.fm_length = FIEMAP_MAX_OFFSET;
+    request.map.fm_extent_count = 1;
+    uint64_t physical = 0;
+    if (ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents > 0) {
+        physical = request.map.fm_extents[0].fe_physical;
+    }
+    close(fd);
+    return physical;
+}
+
+static int compare_io_keys(const void *lhs, const void *rhs) {
+    const io_key_t *left = lhs;
+    const io_key_t *right = rhs;
+    if (left->physical != right->physical) {
+        return left->physical < right->physical ? -1 : 1;
+    }
+    if (left->inode != right->inode) {
+        return left->inode < right->inode ? -1 : 1;
+    }
+    return left->position < right->position ? -1 : left->position > right->position;
+}
+
+/*!
+ * @brief make_io_schedule lists the entries of a list in the order their data should be read
+ * On rotational disks, reading files in the order of their inodes (which most file systems allocate close
+ * to their data) or of their first extent turns the seeks of the path order into a mostly forward sweep.
+ * Only the order of the work changes: the list itself stays sorted by path. Entries that cannot be
+ * examined are scheduled first, by path, and file systems without FIEMAP fall back to the inode order.
+ * @param list is the list of entries to schedule
+ * @param order is the order to use, IO_ORDER_PATH keeps the list order
+ * @param count is a pointer receiving the number of entries
+ * @return an array of the entries to be freed by the caller, NULL in case of error or if the list is empty
+ */
+files_list_entry_t **make_io_schedule(files_list_t *list, io_order_t order, size_t *count) {
+    *count = 0;
+    for (files_list_entry_t *cursor=list->head; cursor!=NULL; cursor=cursor->next) {
+        (*count)++;
+    }
+    if (*count == 0) {
+        return NULL;
+    }
+
+    files_list_entry_t **schedule = malloc(*count * sizeof(files_list_entry_t *));
+    io_key_t *keys = order == IO_ORDER_PATH ? NULL : malloc(*count * sizeof(io_key_t));
+    if (!schedule || (order != IO_ORDER_PATH && !keys)) {
+        free(schedule);
+        free(keys);
+        return NULL;
+    }
+
+    size_t position = 0;
+    for (files_list_entry_t *cursor=list->head; cursor!=NULL; cursor=cursor->next) {
+        if (!keys) {
+            schedule[position++] = cursor;
+            continue;
+        }
+        io_key_t *key = &keys[position];
+        key->entry = cursor;
+        key->position = position++;
+        key->inode = 0;
+        key->physical = 0;
+        struct stat statbuf;
+        if (lstat(cursor->path_and_name, &statbuf) == 0) {
+            key->inode = statbuf.st_ino;
+            if (order == IO_ORDER_EXTENT && S_ISREG(statbuf.st_mode) && statbuf.st_size > 0) {
+                key->physical = first_extent(cursor->path_and_name);
+            }
+        }
+    }
+
+    if (keys) {
+        qsort(keys, *count, sizeof(io_key_t), compare_io_keys);
+        for (size_t i=0; i<*count; ++i) {
+            schedule[i] = keys[i].entry;
+        }
+        free(keys);
+    }
+    return schedule;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <files-list.h>
+#include <stddef.h>
+
+typedef enum { IO_ORDER_PATH, IO_ORDER_INODE, IO_ORDER_EXTENT } io_order_t;
+
+int parse_io_order(char *text, io_order_t *order);
+files_list_entry_t **make_io_schedule(files_list_t *list, io_order_t order, size_t *count);
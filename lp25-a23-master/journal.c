@@ -0,0 +1,358 @@
+#define _DEFAULT_SOURCE // st_mtim and fdatasync with strict compilers
+
+#include <journal.h>
+#include <durable.h>
+#include <file-properties.h>
+#include <utility.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+typedef enum { JOURNAL_PENDING, JOURNAL_STARTED, JOURNAL_DONE, JOURNAL_CHECKPOINTED } journal_state_t;
+
+typedef struct {
+    files_list_entry_t *entry;
+    char *relative_path;
+    journal_state_t state;
+} journal_record_t;
+
+/*!
+ * @brief relative_path_of returns the path of an entry relative to the source
+ */
+static char *relative_path_of(files_list_entry_t *entry, configuration_t *the_config) {
+    char *relative_path = entry->path_and_name + strlen(the_config->source);
+    while (*relative_path == '/') {
+        relative_path++;
+    }
+    return relative_path;
+}
+
+/*!
+ * @brief write_escaped_path writes a path with its backslashes and newlines escaped, then ends the line
+ */
+static void write_escaped_path(FILE *file, const char *path) {
+    for (; *path; ++path) {
+        if (*path == '\\') {
+            fputs("\\\\", file);
+        } else if (*path == '\n') {
+            fputs("\\n", file);
+        } else {
+            fputc(*path, file);
+        }
+    }
+    fputc('\n', file);
+}
+
+/*!
+ * @brief unescape_path reverts write_escaped_path in place, dropping the end of line
+ */
+static void unescape_path(char *path) {
+    char *output = path;
+    for (char *input=path; *input && *input != '\n'; ++input) {
+        if (*input == '\\' && input[1] != '\0') {
+            input++;
+            *output++ = *input == 'n' ? '\n' : *input;
+        } else {
+            *output++ = *input;
+        }
+    }
+    *output = '\0';
+}
+
+/*!
+ * @brief journal_checkpoint makes the copies journaled so far durable, then the journal itself
+ * Copies are only renamed into place at durable checkpoints (@see checkpoint_durable_writes), so a
+ * checkpoint record guarantees that every copy recorded before it is complete in the destination.
+ */
+static void journal_checkpoint(journal_t *journal) {
+    checkpoint_durable_writes(journal->the_config);
+    // Once a copy failed, even its rename, no record vouches for the copies: --resume checks them against the destination
+    if (get_failed_copies() == journal->failed_copies_before) {
+        fprintf(journal->file, "C\n");
+    }
+    fflush(journal->file);
+    fdatasync(fileno(journal->file));
+    journal->done_since_checkpoint = 0;
+}
+
+/*!
+ * @brief open_journal starts a new journal in the destination with the plan of the run
+ * @param journal is a pointer to the journal to open
+ * @param the_config is a pointer to the program configuration
+ * @param differences is the list of the differences to apply
+ * @return 0 when ok, -1 if the journal cannot be written (the run continues without it)
+ */
+int open_journal(journal_t *journal, configuration_t *the_config, files_list_t *differences) {
+    journal->the_config = the_config;
+    journal->done_since_checkpoint = 0;
+    journal->failed_copies_before = get_failed_copies();
+    if (snprintf(journal->path, sizeof(journal->path), "%s/%s", the_config->destination, JOURNAL_FILE_NAME) >= (int)sizeof(journal->path)) {
+        journal->file = NULL;
+        return -1;
+    }
+    journal->file = fopen(journal->path, "w");
+    if (!journal->file) {
+        perror("Error creating journal");
+        return -1;
+    }
+
+    fprintf(journal->file, "%s\n", JOURNAL_MAGIC);
+    write_escaped_path(journal->file, the_config->source);
+    for (files_list_entry_t *entry=differences->head; entry!=NULL; entry=entry->next) {
+        fprintf(journal->file, "P %d %lu %ld %ld %o ", entry->entry_type, (unsigned long)entry->size, (long)entry->mtime.tv_sec,
+                entry->mtime.tv_nsec, (unsigned int)entry->mode);
+        for (int i=0; i<16; ++i) {
+            fprintf(journal->file, "%02x", entry->md5sum[i]);
+        }
+        fputc(' ', journal->file);
+        write_escaped_path(journal->file, relative_path_of(entry, the_config));
+    }
+    // The plan is only used by --resume once it is complete
+    fprintf(journal->file, "B\n");
+    if (fflush(journal->file) != 0 || fdatasync(fileno(journal->file)) == -1) {
+        perror("Error writing journal");
+        fclose(journal->file);
+        unlink(journal->path);
+        journal->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief journal_copy_started records that a copy is about to start
+ */
+void journal_copy_started(journal_t *journal, files_list_entry_t *entry) {
+    if (!journal || !journal->file) {
+        return;
+    }
+    fputs("S ", journal->file);
+    write_escaped_path(journal->file, relative_path_of(entry, journal->the_config));
+    fflush(journal->file);
+}
+
+/*!
+ * @brief journal_copy_done records that a copy is finished, with a checkpoint every JOURNAL_CHECKPOINT_INTERVAL copies
+ */
+void journal_copy_done(journal_t *journal, files_list_entry_t *entry) {
+    if (!journal || !journal->file) {
+        return;
+    }
+    fputs("D ", journal->file);
+    write_escaped_path(journal->file, relative_path_of(entry, journal->the_config));
+    fflush(journal->file);
+    if (++journal->done_since_checkpoint == JOURNAL_CHECKPOINT_INTERVAL) {
+        journal_checkpoint(journal);
+    }
+}
+
+/*!
+ * @brief close_journal closes a journal, compacting it away when the run completed
+ * @param journal is a pointer to the journal
+ * @param is_complete is true when all the plan was applied, and the copies made durable
+ */
+void close_journal(journal_t *journal, bool is_complete) {
+    if (!journal->file) {
+        return;
+    }
+    if (!is_complete) {
+        journal_checkpoint(journal);
+    }
+    fclose(journal->file);
+    journal->file = NULL;
+    // Nothing is left to resume once the plan is applied
+    if (is_complete) {
+        unlink(journal->path);
+    }
+}
+
+/*!
+ * @brief discard_journal removes the journal of a previous run, which a completed run makes obsolete
+ * @param the_config is a pointer to the program configuration
+ */
+void discard_journal(configuration_t *the_config) {
+    char path[PATH_SIZE];
+    if (snprintf(path, sizeof(path), "%s/%s", the_config->destination, JOURNAL_FILE_NAME) < (int)sizeof(path)) {
+        unlink(path);
+    }
+}
+
+static int compare_records(const void *lhs, const void *rhs) {
+    return strcmp((*(journal_record_t * const *)lhs)->relative_path, (*(journal_record_t * const *)rhs)->relative_path);
+}
+
+/*!
+ * @brief is_copy_complete checks that a copy recorded in the journal is really in the destination
+ * @param entry is the planned entry
+ * @param destination_path is the path of the copy
+ * @param checks_content is true to compare MD5 sums too, for a copy that was in progress
+ */
+static bool is_copy_complete(files_list_entry_t *entry, char *destination_path, bool checks_content) {
+    struct stat statbuf;
+    if (stat(destination_path, &statbuf) == -1) {
+        return false;
+    }
+    if (entry->entry_type == DOSSIER) {
+        return S_ISDIR(statbuf.st_mode);
+    }
+    if (!S_ISREG(statbuf.st_mode) || (uint64_t)statbuf.st_size != entry->size || statbuf.st_mtim.tv_sec != entry->mtime.tv_sec
+        || statbuf.st_mtim.tv_nsec != entry->mtime.tv_nsec) {
+        return false;
+    }
+    if (!checks_content) {
+        return true;
+    }
+    files_list_entry_t copy;
+    strncpy(copy.path_and_name, destination_path, PATH_SIZE - 1);
+    copy.path_and_name[PATH_SIZE - 1] = '\0';
+    return compute_file_md5(&copy) == 0 && memcmp(copy.md5sum, entry->md5sum, 16) == 0;
+}
+
+/*!
+ * @brief resume_journal reloads the plan of an interrupted run and keeps what remains to be done
+ * Copies recorded before the last checkpoint are known to be complete. Those recorded after it are checked
+ * against the destination (size and mtime, and MD5 sum for the copy that was in progress), and planned
+ * entries with no record are kept as they are. The journal is then reopened to record the resumed copies.
+ * @param journal is a pointer to the journal to reopen
+ * @param the_config is a pointer to the program configuration
+ * @param remaining is the list receiving the entries still to copy, in plan order
+ * @return 0 when ok, -1 if there is no complete plan for this source (a full run is then needed)
+ */
+int resume_journal(journal_t *journal, configuration_t *the_config, files_list_t *remaining) {
+    journal->the_config = the_config;
+    journal->done_since_checkpoint = 0;
+    journal->failed_copies_before = get_failed_copies();
+    journal->file = NULL;
+    if (snprintf(journal->path, sizeof(journal->path), "%s/%s", the_config->destination, JOURNAL_FILE_NAME) >= (int)sizeof(journal->path)) {
+        return -1;
+    }
+    FILE *file = fopen(journal->path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    static char line[2 * PATH_SIZE + 128];
+    journal_record_t *records = NULL;
+    journal_record_t **sorted = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    bool has_plan = false;
+    bool is_valid = fgets(line, sizeof(line), file) && strncmp(line, JOURNAL_MAGIC "\n", sizeof(JOURNAL_MAGIC)) == 0;
+    if (is_valid && fgets(line, sizeof(line), file)) {
+        unescape_path(line);
+        is_valid = strcmp(line, the_config->source) == 0;
+    }
+
+    while (is_valid && fgets(line, sizeof(line), file)) {
+        if (line[0] == 'P' && !has_plan) {
+            files_list_entry_t *entry = calloc(1, sizeof(files_list_entry_t));
+            int type;
+            unsigned long size;
+            long seconds, nanoseconds;
+            unsigned int mode;
+            char md5[33];
+            int path_offset = 0;
+            if (!entry || sscanf(line, "P %d %lu %ld %ld %o %32s %n", &type, &size, &seconds, &nanoseconds, &mode, md5, &path_offset) != 6 || path_offset == 0) {
+                free(entry);
+                is_valid = false;
+                break;
+            }
+            entry->entry_type = type;
+            entry->size = size;
+            entry->mtime.tv_sec = seconds;
+            entry->mtime.tv_nsec = nanoseconds;
+            entry->mode = mode;
+            for (int i=0; i<16; ++i) {
+                unsigned int byte;
+                sscanf(md5 + 2 * i, "%2x", &byte);
+                entry->md5sum[i] = byte;
+            }
+            unescape_path(line + path_offset);
+            if (count == capacity) {
+                capacity = capacity ? 2 * capacity : 256;
+                journal_record_t *grown = realloc(records, capacity * sizeof(journal_record_t));
+                if (!grown) {
+                    free(entry);
+                    is_valid = false;
+                    break;
+                }
+                records = grown;
+            }
+            char *source_path = concat_path(NULL, the_config->source, line + path_offset);
+            strncpy(entry->path_and_name, source_path ? source_path : "", PATH_SIZE - 1);
+            free(source_path);
+            records[count].entry = entry;
+            records[count].relative_path = strdup(line + path_offset);
+            records[count].state = JOURNAL_PENDING;
+            count++;
+        } else if (line[0] == 'B' && !has_plan) {
+            has_plan = true;
+            // Copies are recorded by path, looked up in a sorted copy of the plan
+            sorted = malloc((count ? count : 1) * sizeof(journal_record_t *));
+            for (size_t i=0; sorted && i<count; ++i) {
+                sorted[i] = &records[i];
+            }
+            if (sorted) {
+                qsort(sorted, count, sizeof(journal_record_t *), compare_records);
+            }
+        } else if ((line[0] == 'S' || line[0] == 'D') && has_plan && sorted && line[1] == ' ') {
+            unescape_path(line + 2);
+            journal_record_t key = {.relative_path=line + 2};
+            journal_record_t *key_pointer = &key;
+            journal_record_t **found = bsearch(&key_pointer, sorted, count, sizeof(journal_record_t *), compare_records);
+            if (found && line[0] == 'S' && (*found)->state == JOURNAL_PENDING) {
+                (*found)->state = JOURNAL_STARTED;
+            } else if (found && line[0] == 'D') {
+                (*found)->state = JOURNAL_DONE;
+            }
+        } else if (line[0] == 'C' && has_plan) {
+            for (size_t i=0; i<count; ++i) {
+                if (records[i].state == JOURNAL_DONE) {
+                    records[i].state = JOURNAL_CHECKPOINTED;
+                }
+            }
+        }
+    }
+    fclose(file);
+    free(sorted);
+
+    size_t skipped = 0;
+    for (size_t i=0; i<count; ++i) {
+        files_list_entry_t *entry = records[i].entry;
+        bool is_done = records[i].state == JOURNAL_CHECKPOINTED;
+        if (is_valid && has_plan && (records[i].state == JOURNAL_DONE || records[i].state == JOURNAL_STARTED)) {
+            char *destination_path = concat_path(NULL, the_config->destination, records[i].relative_path);
+            is_done = destination_path && is_copy_complete(entry, destination_path, records[i].state == JOURNAL_STARTED && the_config->uses_md5);
+            free(destination_path);
+        }
+        // The source may have changed since the plan: the copy gets the properties of what is copied
+        struct stat source_stat;
+        if (is_valid && has_plan && !is_done && stat(entry->path_and_name, &source_stat) == 0) {
+            entry->size = S_ISREG(source_stat.st_mode) ? source_stat.st_size : 0;
+            entry->mtime = source_stat.st_mtim;
+            entry->mode = source_stat.st_mode;
+            entry->next = NULL;
+            entry->prev = NULL;
+            add_entry_to_tail(remaining, entry);
+        } else {
+            skipped += is_done;
+            free(entry);
+        }
+        free(records[i].relative_path);
+    }
+    free(records);
+    if (!is_valid || !has_plan) {
+        return -1;
+    }
+
+    if (the_config->is_verbose) {
+        printf("\nResuming: %lu of %lu planned entries already copied\n", (unsigned long)skipped, (unsigned long)count);
+    }
+    journal->file = fopen(journal->path, "a");
+    if (!journal->file) {
+        perror("Error reopening journal");
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <files-list.h>
+#include <configuration.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <defines.h>
+
+#define JOURNAL_FILE_NAME ".lp25-journal" // In the destination directory
+#define JOURNAL_MAGIC "LP25JOURNAL 1"
+#define JOURNAL_CHECKPOINT_INTERVAL 256 // Completed copies between two checkpoints
+
+typedef struct {
+    FILE *file;
+    char path[PATH_SIZE];
+    configuration_t *the_config;
+    size_t done_since_checkpoint;
+    uint64_t failed_copies_before; // Failed copies counted before the journal was opened (@see get_failed_copies)
+} journal_t;
+
+int open_journal(journal_t *journal, configuration_t *the_config, files_list_t *differences);
+int resume_journal(journal_t *journal, configuration_t *the_config, files_list_t *remaining);
+void journal_copy_started(journal_t *journal, files_list_entry_t *entry);
+void journal_copy_done(journal_t *journal, files_list_entry_t *entry);
+void close_journal(journal_t *journal, bool is_complete);
+void discard_journal(configuration_t *the_config);
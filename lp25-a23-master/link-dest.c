@@ -0,0 +1,114 @@
+#include <link-dest.h>
+#include <defines.h>
+#include <durable.h>
+#include <file-properties.h>
+#include <stats.h>
+#include <sync.h>
+#include <utility.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief has_md5 tells if the MD5 sum of an entry was computed
+ * Entries of the streaming and external-memory modes only get it when it is needed to compare them.
+ */
+static bool has_md5(files_list_entry_t *entry) {
+    for (size_t i=0; i<sizeof(entry->md5sum) - 1; ++i) {
+        if (entry->md5sum[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief is_previous_version_unchanged compares a source file with its version in the previous snapshot
+ * Size, modification time and modes are compared first, the MD5 sums are only computed when they are equal.
+ * Modes are compared too, since the hard link shares them with the previous snapshot.
+ * @param source_entry is the source file
+ * @param previous is the entry receiving the file of the previous snapshot, whose path is already set
+ * @param the_config is the configuration, for the mismatch criteria
+ * @return true when the file of the previous snapshot can be linked
+ */
+static bool is_previous_version_unchanged(files_list_entry_t *source_entry, files_list_entry_t *previous, configuration_t *the_config) {
+    struct stat previous_stat;
+    if (lstat(previous->path_and_name, &previous_stat) == -1 || !S_ISREG(previous_stat.st_mode)) {
+        return false;
+    }
+    previous->entry_type = FICHIER;
+    previous->size = previous_stat.st_size;
+    previous->mtime = previous_stat.st_mtim;
+    previous->mode = previous_stat.st_mode;
+    if (previous->size != source_entry->size || previous->mtime.tv_sec != source_entry->mtime.tv_sec
+        || previous->mtime.tv_nsec != source_entry->mtime.tv_nsec || (previous->mode & 07777) != (source_entry->mode & 07777)) {
+        return false;
+    }
+    if (the_config->uses_md5) {
+        if (!has_md5(source_entry) && compute_file_md5(source_entry) == -1) {
+            return false;
+        }
+        if (compute_file_md5(previous) == -1) {
+            return false;
+        }
+    }
+    return !mismatch(source_entry, previous, the_config);
+}
+
+/*!
+ * @brief link_previous_version creates a destination file as a hard link to its version in the previous snapshot
+ * The link is made under the temporary name of the file, then renamed into place like a copy.
+ * @param source_entry is the source file
+ * @param destination_path is the path of the file in the destination
+ * @param the_config is the configuration, with the previous snapshot in link_dest_path
+ * @return 0 when the file was linked, -1 when it must be copied
+ */
+int link_previous_version(files_list_entry_t *source_entry, char *destination_path, configuration_t *the_config) {
+    // Warned once: a snapshot on another file system cannot be linked at all
+    static bool has_warned = false;
+    if (the_config->link_dest_path[0] == '\0' || source_entry->entry_type != FICHIER) {
+        return -1;
+    }
+    char *relative_path = get_path_from_full_path(source_entry->path_and_name, the_config->source);
+    if (!relative_path) {
+        return -1;
+    }
+    files_list_entry_t *previous = malloc(sizeof(files_list_entry_t));
+    char *previous_path = concat_path(NULL, the_config->link_dest_path, relative_path);
+    free(relative_path);
+    if (!previous || !previous_path || strlen(previous_path) >= PATH_SIZE) {
+        free(previous);
+        free(previous_path);
+        return -1;
+    }
+    strcpy(previous->path_and_name, previous_path);
+    free(previous_path);
+    memset(previous->md5sum, 0, sizeof(previous->md5sum));
+
+    int result = -1;
+    char temp_path[PATH_SIZE];
+    if (is_previous_version_unchanged(source_entry, previous, the_config) && make_temp_path(destination_path, temp_path) == 0) {
+        unlink(temp_path); // Leftover of an interrupted run
+        if (linkat(AT_FDCWD, previous->path_and_name, AT_FDCWD, temp_path, 0) == -1) {
+            if (!has_warned) {
+                fprintf(stderr, "Cannot link %s, copying instead: %s\n", previous->path_and_name, strerror(errno));
+                has_warned = true;
+            }
+        } else if (commit_temp_file(temp_path, destination_path, 0, the_config) == 0) {
+            STATS_ADD(copies[STATS_COPY_LINK], 1);
+            // Linked bytes are not copied: the progress report only waits for the copied ones
+            STATS_ADD(bytes_to_copy, -source_entry->size);
+            if (the_config->is_verbose) {
+                printf("\nLinked %s to %s", destination_path, previous->path_and_name);
+            }
+            result = 0;
+        }
+    }
+    free(previous);
+    return result;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <configuration.h>
+#include <files-list.h>
+
+int link_previous_version(files_list_entry_t *source_entry, char *destination_path, configuration_t *the_config);
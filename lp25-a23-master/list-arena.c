@@ -0,0 +1,123 @@
+#include <list-arena.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+list_arena_t *the_list_arena = NULL;
+
+// Arenas mapped by this process or inherited from its parent, to tell their entries from malloc ones
+static list_arena_t *arenas[LIST_ARENA_MAX] = {NULL};
+
+/*!
+ * @brief create_list_arena maps a shared memory arena for the entries of a list
+ * The arena is mapped before the lister is created, so it has the same address in the lister and in the
+ * main process: the entries keep their usual pointer links, and the main process adopts the list as it is.
+ * Only the pages written by the lister are allocated.
+ * @return a pointer to the arena, NULL in case of error
+ */
+list_arena_t *create_list_arena() {
+    int slot = 0;
+    for (; slot<LIST_ARENA_MAX && arenas[slot]; ++slot);
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (slot == LIST_ARENA_MAX || pages <= 0 || page_size <= 0) {
+        return NULL;
+    }
+    size_t map_size = (size_t)pages * page_size / LIST_ARENA_MEMORY_SHARE;
+    if (map_size < sizeof(list_arena_t) + sizeof(files_list_entry_t)) {
+        return NULL;
+    }
+    list_arena_t *arena = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena == MAP_FAILED) {
+        perror("Error mapping list arena");
+        return NULL;
+    }
+    arena->owner_pid = getpid();
+    arena->map_size = map_size;
+    arena->capacity = (map_size - sizeof(list_arena_t)) / sizeof(files_list_entry_t);
+    arena->used = 0;
+    arena->has_overflowed = false;
+    arena->head = NULL;
+    arena->tail = NULL;
+    arenas[slot] = arena;
+    return arena;
+}
+
+/*!
+ * @brief new_files_list_entry allocates an entry, in the_list_arena when it is set
+ * @return a pointer to the entry, NULL if there is no memory left (or no room left in the arena)
+ */
+files_list_entry_t *new_files_list_entry() {
+    if (!the_list_arena) {
+        return (files_list_entry_t *)malloc(sizeof(files_list_entry_t));
+    }
+    if (the_list_arena->used == the_list_arena->capacity) {
+        the_list_arena->has_overflowed = true;
+        return NULL;
+    }
+    return &the_list_arena->entries[the_list_arena->used++];
+}
+
+/*!
+ * @brief publish_arena_list records the list built in an arena, for the main process to adopt it
+ * @param arena is the arena the entries of the list were allocated in
+ * @param list is the finished list
+ */
+void publish_arena_list(list_arena_t *arena, files_list_t *list) {
+    arena->head = list->head;
+    arena->tail = list->tail;
+}
+
+/*!
+ * @brief adopt_arena_list makes a list of the list published in an arena, without copying any entry
+ * The list must be given back with clear_files_list, which unmaps the arena.
+ * @param arena is the arena, whose lister has sent its completion message
+ * @param list is the list to set
+ * @return 0 when ok, -1 if the list did not fit in the arena
+ */
+int adopt_arena_list(list_arena_t *arena, files_list_t *list) {
+    if (arena->has_overflowed) {
+        return -1;
+    }
+    list->head = arena->head;
+    list->tail = arena->tail;
+    return 0;
+}
+
+/*!
+ * @brief release_arena_list empties a list whose entries live in an arena, at once
+ * The arena is unmapped by the process that created it; other processes only forget the list.
+ * @param list is the list
+ * @return true if the list was in an arena, false if its entries must be freed one by one
+ */
+bool release_arena_list(files_list_t *list) {
+    for (int i=0; i<LIST_ARENA_MAX; ++i) {
+        list_arena_t *arena = arenas[i];
+        if (arena && list->head >= arena->entries && list->head < arena->entries + arena->capacity) {
+            list->head = NULL;
+            list->tail = NULL;
+            if (arena->owner_pid == getpid()) {
+                destroy_list_arena(arena);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief destroy_list_arena unmaps an arena, the lists built in it must not be used anymore
+ * @param arena is the arena
+ */
+void destroy_list_arena(list_arena_t *arena) {
+    for (int i=0; i<LIST_ARENA_MAX; ++i) {
+        if (arenas[i] == arena) {
+            arenas[i] = NULL;
+        }
+    }
+    if (the_list_arena == arena) {
+        the_list_arena = NULL;
+    }
+    munmap(arena, arena->map_size);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <files-list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define LIST_ARENA_MEMORY_SHARE 4 // An arena reserves at most this fraction of the physical memory
+#define LIST_ARENA_MAX 8 // Arenas mapped at once by a process
+
+typedef struct {
+    pid_t owner_pid; // Process that mapped the arena, the only one to unmap it
+    size_t map_size;
+    size_t capacity; // Entries that fit in the arena
+    size_t used; // Written only by the lister
+    bool has_overflowed; // Set when an entry did not fit: the list is incomplete
+    files_list_entry_t *head; // List published by the lister before its completion message
+    files_list_entry_t *tail;
+    files_list_entry_t entries[];
+} list_arena_t;
+
+// Arena the entries of this process are allocated in, NULL to allocate them with malloc
+extern list_arena_t *the_list_arena;
+
+list_arena_t *create_list_arena();
+files_list_entry_t *new_files_list_entry();
+void publish_arena_list(list_arena_t *arena, files_list_t *list);
+int adopt_arena_list(list_arena_t *arena, files_list_t *list);
+bool release_arena_list(files_list_t *list);
+void destroy_list_arena(list_arena_t *arena);
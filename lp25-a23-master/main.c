@@ -4,6 +4,17 @@
 #include <configuration.h>
 #include <file-properties.h>
 #include <processes.h>
+#include <watch.h>
+#include <server.h>
+#include <batch.h>
+#include <compare.h>
+#include <plan.h>
+#include <durable.h>
+#include <stats.h>
+#include <trace.h>
+#include <progress.h>
+#include <throttle.h>
+#include <time.h>
 #include <unistd.h>
 
 /*!
@@ -25,27 +36,105 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    // Check directories
-    if (!directory_exists(my_config.source) || !directory_exists(my_config.destination)) {
+    if (my_config.connect_path[0] != '\0') {
+        return run_client(my_config.connect_path, my_config.client_request);
+    }
+
+    // Check directories, a batch checks those of each job
+    bool is_batch = my_config.batch_path[0] != '\0';
+    if (!is_batch && (!directory_exists(my_config.source) || !directory_exists(my_config.destination))) {
         printf("Either source or destination directory do not exist\nAborting\n");
         return -1;
     }
-    // Is destination writable?
-    if (!is_directory_writable(my_config.destination)) {
+    // Is destination writable? A comparison only reads it
+    if (!is_batch && !my_config.is_comparing_only && !is_directory_writable(my_config.destination)) {
         printf("Destination directory %s is not writable\n", my_config.destination);
         return -1;
     }
+    if (my_config.link_dest_path[0] != '\0' && !directory_exists(my_config.link_dest_path)) {
+        printf("Previous snapshot %s does not exist\nAborting\n", my_config.link_dest_path);
+        return -1;
+    }
+    for (int i=0; i<my_config.extra_destinations_count; ++i) {
+        if (!directory_exists(my_config.extra_destinations[i]) || !is_directory_writable(my_config.extra_destinations[i])) {
+            printf("Destination directory %s does not exist or is not writable\nAborting\n", my_config.extra_destinations[i]);
+            return -1;
+        }
+    }
+
+    // Statistics and trace buffers are shared with the processes created later
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    if ((my_config.stats_path[0] != '\0' || my_config.is_reporting_progress) && init_stats() == -1) {
+        return -1;
+    }
+    if (my_config.trace_path[0] != '\0' && init_trace() == -1) {
+        return -1;
+    }
+    if (init_failed_copies() == -1) {
+        return -1;
+    }
+
+    // I/O limits and priority apply to all the processes created later
+    if (my_config.io_class[0] != '\0' && set_io_priority(my_config.io_class) == -1) {
+        fprintf(stderr, "Error: invalid I/O class %s\n", my_config.io_class);
+        return -1;
+    }
+    uint64_t io_rates[THROTTLE_BUCKETS_COUNT] = {my_config.read_limit, my_config.write_limit, my_config.read_iops, my_config.write_iops};
+    if ((my_config.read_limit || my_config.write_limit || my_config.read_iops || my_config.write_iops || my_config.io_limits_path[0] != '\0')
+        && init_throttle(io_rates, my_config.io_limits_path) == -1) {
+        return -1;
+    }
 
     // Prepare (fork, MQ) if parallel
     process_context_t processes_context;
     //comme on a pas reussi a implementer la version parallele on nutilise pas les fonctions liees aux processus
     //prepare(&my_config, &processes_context);
 
-    // Run synchronize:
-    synchronize(&my_config, &processes_context);
+    // The reporter only reads the shared counters
+    pid_t reporter_pid = -1;
+    progress_configuration_t progress_config = {
+        .is_line_mode = my_config.is_progress_line_mode || !isatty(STDERR_FILENO),
+        .interval_ms = my_config.progress_interval_ms,
+    };
+    if (my_config.is_reporting_progress) {
+        reporter_pid = start_progress_reporter(&progress_config);
+    }
+
+    // Run synchronize, then keep synchronizing in watch mode, or on request in server mode; a batch runs all its jobs, a plan is applied without listing the trees, a comparison only reports the differences:
+    int result = 0;
+    if (is_batch) {
+        result = run_batch(&my_config);
+    } else if (my_config.is_comparing_only) {
+        result = compare_trees(&my_config);
+    } else if (my_config.serve_path[0] != '\0') {
+        result = serve(&my_config);
+    } else if (my_config.is_watching) {
+        result = watch_source(&my_config, &processes_context);
+    } else if (my_config.apply_path[0] != '\0') {
+        result = apply_plan(&my_config);
+    } else {
+        synchronize(&my_config, &processes_context);
+    }
+    stop_progress_reporter(reporter_pid);
+    // Files that could not be copied are only reported as they fail: the run fails with them
+    if (result == 0 && get_failed_copies() > 0) {
+        fprintf(stderr, "Error: %lu files could not be copied\n", (unsigned long)get_failed_copies());
+        result = -1;
+    }
     
+    if (my_config.stats_path[0] != '\0') {
+        struct timespec end_time;
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        save_stats(my_config.stats_path, (end_time.tv_sec - start_time.tv_sec) * 1000000000ULL + end_time.tv_nsec - start_time.tv_nsec);
+    }
+
+    if (the_trace) {
+        save_trace(my_config.trace_path);
+    }
+
     // Clean resources
     //clean_processes(&my_config, &processes_context);
 
-    return 0;
+    return result;
 }
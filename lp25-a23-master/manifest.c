@@ -0,0 +1,331 @@
+#include <manifest.h>
+#include <defines.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief relative_path_of returns the part of a full path that follows the tree root
+ * @param path is the full path of an entry
+ * @param root_length is the length of the tree root
+ * @return a pointer inside path, without leading '/'
+ */
+static char *relative_path_of(char *path, size_t root_length) {
+    char *relative_path = path + root_length;
+    while (*relative_path == '/') {
+        relative_path++;
+    }
+    return relative_path;
+}
+
+static size_t sort_root_length; // Root length used by compare_relative_paths (qsort has no context parameter)
+
+/*!
+ * @brief compare_relative_paths compares two entries by their path relative to the root, for qsort
+ */
+static int compare_relative_paths(const void *lhs, const void *rhs) {
+    files_list_entry_t *left = *(files_list_entry_t * const *)lhs;
+    files_list_entry_t *right = *(files_list_entry_t * const *)rhs;
+    return strcmp(relative_path_of(left->path_and_name, sort_root_length), relative_path_of(right->path_and_name, sort_root_length));
+}
+
+/*!
+ * @brief put_varint appends an unsigned LEB128 integer to a buffer
+ * @return the number of bytes written (at most 10)
+ */
+static size_t put_varint(uint8_t *buffer, uint64_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t)value;
+    return length;
+}
+
+/*!
+ * @brief get_varint reads an unsigned LEB128 integer
+ * @param data is the start of the path table
+ * @param size is the size of the path table
+ * @param offset is a pointer to the position to read from, moved after the integer
+ * @param value receives the integer
+ * @return 0 when ok, -1 if the integer overflows the table
+ */
+static int get_varint(const uint8_t *data, uint64_t size, uint64_t *offset, uint64_t *value) {
+    *value = 0;
+    for (int shift=0; shift<64; shift+=7) {
+        if (*offset >= size) {
+            return -1;
+        }
+        uint8_t byte = data[(*offset)++];
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief save_manifest serializes a files list into a binary manifest
+ * The file holds a header, one fixed-width record per entry sorted by relative path, and a path table
+ * where each path is stored as the length of the prefix it shares with the previous path followed by the
+ * rest of it. Every MANIFEST_RESTART_INTERVAL paths, a path is stored in full so lookups can bisect.
+ * @param list is the list to save
+ * @param root is the root of the tree the list was built from, removed from the stored paths
+ * @param manifest_path is the path of the manifest to write (replaced atomically)
+ * @return 0 when ok, -1 in case of error
+ */
+int save_manifest(files_list_t *list, char *root, char *manifest_path) {
+    if (!list || !root || !manifest_path) {
+        return -1;
+    }
+
+    size_t count = 0;
+    for (files_list_entry_t *cursor=list->head; cursor!=NULL; cursor=cursor->next) {
+        count++;
+    }
+
+    files_list_entry_t **entries = malloc(sizeof(files_list_entry_t *) * (count + 1));
+    manifest_record_t *records = calloc(count + 1, sizeof(manifest_record_t));
+    size_t paths_capacity = 4096;
+    uint8_t *paths = malloc(paths_capacity);
+    if (!entries || !records || !paths) {
+        perror("\nFailed allocating memory to manifest");
+        free(entries);
+        free(records);
+        free(paths);
+        return -1;
+    }
+
+    size_t i = 0;
+    for (files_list_entry_t *cursor=list->head; cursor!=NULL; cursor=cursor->next) {
+        entries[i++] = cursor;
+    }
+    sort_root_length = strlen(root);
+    qsort(entries, count, sizeof(files_list_entry_t *), compare_relative_paths);
+
+    size_t paths_size = 0;
+    char *previous_path = "";
+    for (i=0; i<count; ++i) {
+        char *path = relative_path_of(entries[i]->path_and_name, sort_root_length);
+        size_t length = strlen(path);
+        size_t shared = 0;
+        if (i % MANIFEST_RESTART_INTERVAL != 0) {
+            while (path[shared] != '\0' && path[shared] == previous_path[shared]) {
+                shared++;
+            }
+        }
+
+        if (paths_size + length + 20 > paths_capacity) {
+            while (paths_size + length + 20 > paths_capacity) {
+                paths_capacity *= 2;
+            }
+            uint8_t *bigger = realloc(paths, paths_capacity);
+            if (!bigger) {
+                perror("\nFailed allocating memory to manifest paths");
+                free(entries);
+                free(records);
+                free(paths);
+                return -1;
+            }
+            paths = bigger;
+        }
+
+        records[i].path_offset = paths_size;
+        paths_size += put_varint(paths + paths_size, shared);
+        paths_size += put_varint(paths + paths_size, length - shared);
+        memcpy(paths + paths_size, path + shared, length - shared);
+        paths_size += length - shared;
+        previous_path = path;
+
+        records[i].size = entries[i]->entry_type == FICHIER ? entries[i]->size : 0;
+        records[i].mtime_sec = entries[i]->mtime.tv_sec;
+        records[i].mtime_nsec = entries[i]->mtime.tv_nsec;
+        records[i].mode = entries[i]->mode;
+        records[i].entry_type = entries[i]->entry_type;
+        memcpy(records[i].md5sum, entries[i]->md5sum, sizeof(records[i].md5sum));
+    }
+
+    manifest_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = MANIFEST_VERSION;
+    header.restart_interval = MANIFEST_RESTART_INTERVAL;
+    header.entries_count = count;
+    header.records_offset = sizeof(header);
+    header.paths_offset = header.records_offset + count * sizeof(manifest_record_t);
+    header.paths_size = paths_size;
+
+    char temp_path[PATH_SIZE];
+    int result = -1;
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", manifest_path) < (int)sizeof(temp_path)) {
+        FILE *file = fopen(temp_path, "wb");
+        if (file) {
+            bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                && fwrite(records, sizeof(manifest_record_t), count, file) == count
+                && fwrite(paths, 1, paths_size, file) == paths_size;
+            if (fclose(file) == 0 && written && rename(temp_path, manifest_path) == 0) {
+                result = 0;
+            } else {
+                unlink(temp_path);
+            }
+        }
+    }
+    if (result == -1) {
+        perror("Error writing manifest");
+    }
+
+    free(entries);
+    free(records);
+    free(paths);
+    return result;
+}
+
+/*!
+ * @brief open_manifest maps a manifest read-only; nothing is copied or decoded until looked up
+ * @param manifest is a pointer to the manifest to open
+ * @param manifest_path is the path of the manifest file
+ * @return 0 when ok, -1 if the file cannot be mapped or is not a valid manifest
+ */
+int open_manifest(manifest_t *manifest, char *manifest_path) {
+    memset(manifest, 0, sizeof(manifest_t));
+
+    int fd = open(manifest_path, O_RDONLY);
+    if (fd == -1) {
+        perror("Error opening manifest");
+        return -1;
+    }
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1 || (size_t)statbuf.st_size < sizeof(manifest_header_t)) {
+        fprintf(stderr, "Manifest %s is invalid\n", manifest_path);
+        close(fd);
+        return -1;
+    }
+
+    manifest->map_size = statbuf.st_size;
+    manifest->map = mmap(NULL, manifest->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (manifest->map == MAP_FAILED) {
+        perror("Error mapping manifest");
+        manifest->map = NULL;
+        return -1;
+    }
+
+    const manifest_header_t *header = manifest->map;
+    if (memcmp(header->magic, MANIFEST_MAGIC, sizeof(header->magic)) != 0 || header->version != MANIFEST_VERSION || header->restart_interval == 0
+        || header->records_offset + header->entries_count * sizeof(manifest_record_t) > manifest->map_size
+        || header->paths_offset + header->paths_size > manifest->map_size) {
+        fprintf(stderr, "Manifest %s is invalid\n", manifest_path);
+        close_manifest(manifest);
+        return -1;
+    }
+
+    manifest->header = header;
+    manifest->records = (const manifest_record_t *)((const uint8_t *)manifest->map + header->records_offset);
+    manifest->paths = (const uint8_t *)manifest->map + header->paths_offset;
+    return 0;
+}
+
+/*!
+ * @brief close_manifest unmaps a manifest
+ * @param manifest is a pointer to the manifest to close
+ */
+void close_manifest(manifest_t *manifest) {
+    if (manifest && manifest->map) {
+        munmap(manifest->map, manifest->map_size);
+    }
+    if (manifest) {
+        memset(manifest, 0, sizeof(manifest_t));
+    }
+}
+
+/*!
+ * @brief decode_path rebuilds the path of a record from the previous path of the same block
+ * @param manifest is a pointer to the manifest
+ * @param index is the index of the record
+ * @param path contains the previous path on input (ignored for restart records) and receives the path
+ * @return the length of the path, -1 if the manifest is corrupted
+ */
+static int decode_path(manifest_t *manifest, uint64_t index, char *path) {
+    uint64_t offset = manifest->records[index].path_offset;
+    uint64_t shared = 0;
+    uint64_t length = 0;
+    if (get_varint(manifest->paths, manifest->header->paths_size, &offset, &shared) == -1
+        || get_varint(manifest->paths, manifest->header->paths_size, &offset, &length) == -1
+        || shared + length >= PATH_SIZE || offset + length > manifest->header->paths_size) {
+        return -1;
+    }
+    memcpy(path + shared, manifest->paths + offset, length);
+    path[shared + length] = '\0';
+    return (int)(shared + length);
+}
+
+/*!
+ * @brief find_manifest_entry looks up an entry by its path relative to the tree root
+ * The restart paths are bisected, then at most one block of front-coded paths is decoded.
+ * @param manifest is a pointer to the opened manifest
+ * @param relative_path is the path to look for, without leading '/'
+ * @param entry receives the entry properties; its path_and_name is set to the relative path
+ * @return 0 when found, -1 else
+ */
+int find_manifest_entry(manifest_t *manifest, char *relative_path, files_list_entry_t *entry) {
+    if (!manifest || !manifest->header || !relative_path || !entry || manifest->header->entries_count == 0) {
+        return -1;
+    }
+
+    uint64_t count = manifest->header->entries_count;
+    uint64_t interval = manifest->header->restart_interval;
+    uint64_t blocks_count = (count + interval - 1) / interval;
+    char path[PATH_SIZE];
+
+    // Find the last block whose first path is lower or equal to the searched one
+    uint64_t low = 0;
+    uint64_t high = blocks_count;
+    while (low < high) {
+        uint64_t middle = (low + high) / 2;
+        if (decode_path(manifest, middle * interval, path) == -1) {
+            return -1;
+        }
+        if (strcmp(path, relative_path) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0) {
+        return -1;
+    }
+
+    uint64_t block = low - 1;
+    uint64_t end = (block + 1) * interval < count ? (block + 1) * interval : count;
+    for (uint64_t i=block*interval; i<end; ++i) {
+        if (decode_path(manifest, i, path) == -1) {
+            return -1;
+        }
+        int comparison = strcmp(path, relative_path);
+        if (comparison > 0) {
+            return -1;
+        }
+        if (comparison == 0) {
+            const manifest_record_t *record = &manifest->records[i];
+            strncpy(entry->path_and_name, path, PATH_SIZE - 1);
+            entry->path_and_name[PATH_SIZE - 1] = '\0';
+            entry->size = record->size;
+            entry->mtime.tv_sec = record->mtime_sec;
+            entry->mtime.tv_nsec = record->mtime_nsec;
+            entry->mode = record->mode;
+            entry->entry_type = record->entry_type;
+            memcpy(entry->md5sum, record->md5sum, sizeof(record->md5sum));
+            entry->md5sum[sizeof(record->md5sum)] = '\0';  // Compared with the sums of listed entries, which end with it
+            entry->next = NULL;
+            entry->prev = NULL;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <files-list.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MANIFEST_MAGIC "LP25MAN1"
+#define MANIFEST_VERSION 1
+#define MANIFEST_RESTART_INTERVAL 16 // Every 16th path is stored in full, the others share a prefix with the previous one
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t restart_interval;
+    uint64_t entries_count;
+    uint64_t records_offset;
+    uint64_t paths_offset;
+    uint64_t paths_size;
+} manifest_header_t;
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t mode;
+    uint64_t path_offset; // Offset of the front-coded path in the path table
+    uint8_t md5sum[16];
+    uint8_t entry_type;
+    uint8_t padding[7];
+} manifest_record_t;
+
+typedef struct {
+    void *map;
+    size_t map_size;
+    const manifest_header_t *header;
+    const manifest_record_t *records;
+    const uint8_t *paths;
+} manifest_t;
+
+int save_manifest(files_list_t *list, char *root, char *manifest_path);
+int open_manifest(manifest_t *manifest, char *manifest_path);
+void close_manifest(manifest_t *manifest);
+int find_manifest_entry(manifest_t *manifest, char *relative_path, files_list_entry_t *entry);
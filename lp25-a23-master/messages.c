@@ -1,9 +1,28 @@
 #include <messages.h>
+#include <stats.h>
+#include <trace.h>
 #include <sys/msg.h>
 #include <string.h>
 
 // Functions in this file are required for inter processes communication
 
+/*!
+ * @brief send_message sends a message and counts it in the statistics
+ * @return the result of msgsnd
+ */
+static int send_message(int msg_queue, const void *message, size_t size) {
+    uint64_t trace_start = start_trace_span();
+    int result = msgsnd(msg_queue, message, size, 0);
+    if (result == 0) {
+        STATS_ADD(messages_sent, 1);
+    }
+    // Only sends that waited for room in the MQ are worth showing
+    if (the_trace && start_trace_span() - trace_start >= TRACE_BLOCKED_SEND_NS) {
+        end_trace_span(TRACE_MQ_WAIT, "send", trace_start);
+    }
+    return result;
+}
+
 /*!
  * @brief send_file_entry sends a file entry, with a given command code
  * @param msg_queue the MQ identifier through which to send the entry
@@ -17,9 +36,10 @@ int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry
     any_message_t message;
     message.list_entry.payload = *file_entry;
     message.list_entry.reply_to = msg_queue;
+    message.list_entry.job = 0;
     message.list_entry.mtype = recipient;
     message.list_entry.op_code = cmd_code;
-    return msgsnd(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long), 0);
+    return send_message(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long));
 }
 
 /*!
@@ -35,7 +55,7 @@ int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir) {
     strncpy(cmd.target, target_dir, sizeof(cmd.target) - 1);
     cmd.target[sizeof(cmd.target) - 1] = '\0'; // Assurez-vous que la chaîne est terminée correctement.
     cmd.op_code = COMMAND_CODE_ANALYZE_DIR;
-    return msgsnd(msg_queue, &cmd, sizeof(cmd) - sizeof(long), 0);
+    return send_message(msg_queue, &cmd, sizeof(cmd) - sizeof(long));
 }
 
 // The 3 following functions are one-liners
@@ -97,7 +117,7 @@ int send_list_end(int msg_queue, int recipient) {
     message.simple_command.message = COMMAND_CODE_LIST_COMPLETE;
 
     // Envoyer le message
-    int result = msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+    int result = send_message(msg_queue, &message, sizeof(simple_command_t) - sizeof(long));
 
     if (result == -1) {
         perror("Erreur lors de l'envoi du message avec msgsnd dans send_list_end");
@@ -130,7 +150,7 @@ int send_terminate_command(int msg_queue, int recipient) {
     message.simple_command.mtype = (long)recipient; // Type de message = destinataire
     message.simple_command.message = COMMAND_CODE_TERMINATE; // Code de commande pour la terminaison (défini dans message.h)
     // Envoi du message à la file de messages
-    int result = msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+    int result = send_message(msg_queue, &message, sizeof(simple_command_t) - sizeof(long));
 
     // Indique la réussite ou non de l'envoi du message
     if (result != -1) {
@@ -174,7 +194,7 @@ int send_terminate_confirm(int msg_queue, int recipient) {
     message.simple_command.mtype = (long)recipient; 
     message.simple_command.message = COMMAND_CODE_TERMINATE_OK; 
 
-     int result = msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+     int result = send_message(msg_queue, &message, sizeof(simple_command_t) - sizeof(long));
 
     if (result != -1) {
         printf("Confimation de terminaison envoyée avec succès");
@@ -184,3 +204,47 @@ int send_terminate_confirm(int msg_queue, int recipient) {
 
     return result;
 }
+
+/*!
+ * @brief send_copy_entry_command sends a difference to be applied by a copier process
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the source entry to copy (must be copied)
+ * @return the result of the send_file_entry function
+ * msgsnd blocks while the MQ is full, which bounds the number of differences waiting to be copied
+ */
+int send_copy_entry_command(int msg_queue, int recipient, files_list_entry_t *file_entry) {
+    return send_file_entry(msg_queue, recipient, file_entry, COMMAND_CODE_COPY_ENTRY);
+}
+
+/*!
+ * @brief send_job_copy_command sends a difference of one job of a batch to be applied by the copier pool of the batch
+ * @param msg_queue the MQ identifier through which to send the entry
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param file_entry is a pointer to the source entry to copy (must be copied)
+ * @param job is the index of the job, whose configuration gives the destination
+ * @return the result of msgsnd, which blocks while the MQ is full
+ */
+int send_job_copy_command(int msg_queue, int recipient, files_list_entry_t *file_entry, int job) {
+    any_message_t message;
+    message.list_entry.payload = *file_entry;
+    message.list_entry.reply_to = msg_queue;
+    message.list_entry.job = job;
+    message.list_entry.mtype = recipient;
+    message.list_entry.op_code = COMMAND_CODE_COPY_ENTRY;
+    return send_message(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long));
+}
+
+/*!
+ * @brief send_simple_command sends a command without payload
+ * @param msg_queue is the id of the MQ used to send the command
+ * @param recipient is the destination of the message
+ * @param cmd_code is the command code to send
+ * @return the result of msgsnd
+ */
+int send_simple_command(int msg_queue, int recipient, char cmd_code) {
+    simple_command_t message;
+    message.mtype = recipient;
+    message.message = cmd_code;
+    return send_message(msg_queue, &message, sizeof(simple_command_t) - sizeof(long));
+}
@@ -7,15 +7,18 @@
 #define COMMAND_CODE_TERMINATE_OK 0x10
 #define COMMAND_CODE_ANALYZE_FILE 0x01
 #define COMMAND_CODE_FILE_ANALYZED 0x11
+#define COMMAND_CODE_FILE_ANALYZE_FAILED 0x21
 #define COMMAND_CODE_ANALYZE_DIR 0x02
 #define COMMAND_CODE_FILE_ENTRY 0x12
 #define COMMAND_CODE_LIST_COMPLETE 0x22
+#define COMMAND_CODE_COPY_ENTRY 0x03
 
 #define MSG_TYPE_TO_MAIN 1
 #define MSG_TYPE_TO_SOURCE_LISTER 2
 #define MSG_TYPE_TO_DESTINATION_LISTER 3
 #define MSG_TYPE_TO_SOURCE_ANALYZERS 4
 #define MSG_TYPE_TO_DESTINATION_ANALYZERS 5
+#define MSG_TYPE_TO_COPIERS 6
 
 typedef struct {
     long mtype;
@@ -33,6 +36,7 @@ typedef struct {
     char op_code; // Contains the analyze file opcode
     files_list_entry_t payload;
     int reply_to; // MQ id of the sender, to build either source or destination list
+    int job; // Job of a batch a copy command belongs to, 0 otherwise
 } files_list_entry_transmit_t;
 
 typedef struct {
@@ -55,4 +59,7 @@ int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t
 int send_files_list_element(int msg_queue, int recipient, files_list_entry_t *file_entry);
 int send_list_end(int msg_queue, int recipient);
 int send_terminate_command(int msg_queue, int recipient);
-int send_terminate_confirm(int msg_queue, int recipient);
\ No newline at end of file
+int send_terminate_confirm(int msg_queue, int recipient);
+int send_copy_entry_command(int msg_queue, int recipient, files_list_entry_t *file_entry);
+int send_job_copy_command(int msg_queue, int recipient, files_list_entry_t *file_entry, int job);
+int send_simple_command(int msg_queue, int recipient, char cmd_code);
\ No newline at end of file
@@ -0,0 +1,547 @@
+#define _DEFAULT_SOURCE // mkstemp
+
+#include <files-list.h>
+#include <file-properties.h>
+#include <utility.h>
+#include <defines.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MICROBENCH_MAX_SIZES 16
+#define MICROBENCH_MAX_LOOKUPS 1000 // find_entry_by_name is timed on this many lookups, whatever the list size
+
+typedef enum {SIZES, FILE_SIZES, REPETITIONS, WARMUP, TIME_CAP, MEMORY_CAP, ONLY} microbench_opt_values;
+
+typedef struct {
+    uint64_t sizes[MICROBENCH_MAX_SIZES]; // Numbers of entries for list and path primitives
+    int sizes_count;
+    uint64_t file_sizes[MICROBENCH_MAX_SIZES]; // Bytes hashed by compute_file_md5
+    int file_sizes_count;
+    int repetitions;
+    int warmup;
+    double time_cap; // Seconds spent at most on one primitive and size; bigger sizes are skipped when a single run would exceed it
+    uint64_t memory_cap; // Sizes needing more memory are skipped
+    char *only; // Name of the only primitive to run, NULL for all
+} microbench_configuration_t;
+
+typedef struct {
+    char **paths; // Paths of the entries, in a shuffled order
+    char *root;
+    char *file_path; // File hashed by compute_file_md5
+} microbench_input_t;
+
+typedef int (*microbench_run_t)(microbench_input_t *input, uint64_t size, uint64_t *operations, double *seconds);
+
+typedef struct {
+    char *name;
+    microbench_run_t run;
+    bool uses_file; // size is a file size instead of a number of entries
+    uint64_t bytes_per_unit; // Memory needed per entry or per byte of file
+} microbench_primitive_t;
+
+/*!
+ * @brief now returns a monotonic time in seconds
+ */
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/*!
+ * @brief next_random is a xorshift64 generator, so inputs are the same from a run to the next
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/*!
+ * @brief make_paths builds size paths spread over directories, in a shuffled order
+ * @return the array of paths, NULL on allocation failure
+ */
+static char **make_paths(char *root, uint64_t size) {
+    char **paths = malloc(sizeof(char *) * size);
+    if (!paths) {
+        return NULL;
+    }
+    char path[PATH_SIZE];
+    for (uint64_t i=0; i<size; ++i) {
+        snprintf(path, sizeof(path), "%s/d%04lu/d%04lu/f%010lu.dat", root, (unsigned long)(i % 1000), (unsigned long)(i / 1000 % 1000), (unsigned long)i);
+        paths[i] = strdup(path);
+        if (!paths[i]) {
+            for (uint64_t j=0; j<i; ++j) {
+                free(paths[j]);
+            }
+            free(paths);
+            return NULL;
+        }
+    }
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+    for (uint64_t i=size; i>1; --i) {
+        uint64_t j = next_random(&state) % i;
+        char *swap = paths[i - 1];
+        paths[i - 1] = paths[j];
+        paths[j] = swap;
+    }
+    return paths;
+}
+
+/*!
+ * @brief free_paths frees the paths built by make_paths
+ */
+static void free_paths(char **paths, uint64_t size) {
+    if (!paths) {
+        return;
+    }
+    for (uint64_t i=0; i<size; ++i) {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+/*!
+ * @brief compare_paths compares two paths for qsort
+ */
+static int compare_paths(const void *lhs, const void *rhs) {
+    return strcmp(*(char * const *)lhs, *(char * const *)rhs);
+}
+
+/*!
+ * @brief new_entry allocates a list entry for a path
+ */
+static files_list_entry_t *new_entry(char *path) {
+    files_list_entry_t *entry = calloc(1, sizeof(files_list_entry_t));
+    if (entry) {
+        strncpy(entry->path_and_name, path, sizeof(entry->path_and_name) - 1);
+    }
+    return entry;
+}
+
+/*!
+ * @brief run_add_file_entry times inserting all the paths, in a shuffled order, into a sorted list
+ */
+static int run_add_file_entry(microbench_input_t *input, uint64_t size, uint64_t *operations, double *seconds) {
+    files_list_t list = {.head=NULL, .tail=NULL};
+    int result = 0;
+    double start = now();
+    for (uint64_t i=0; i<size && result==0; ++i) {
+        result = add_file_entry(&list, input->paths[i]);
+    }
+    *seconds = now() - start;
+    *operations = size;
+    clear_files_list(&list);
+    return result;
+}
+
+/*!
+ * @brief run_add_entry_to_tail times appending already allocated entries to a list
+ */
+static int run_add_entry_to_tail(microbench_input_t *input, uint64_t size, uint64_t *operations, double *seconds) {
+    files_list_entry_t **entries = malloc(sizeof(files_list_entry_t *) * size);
+    if (!entries) {
+        return -1;
+    }
+    for (uint64_t i=0; i<size; ++i) {
+        entries[i] = new_entry(input->paths[i]);
+        if (!entries[i]) {
+            for (uint64_t j=0; j<i; ++j) {
+                free(entries[j]);
+            }
+            free(entries);
+            return -1;
+        }
+    }
+
+    files_list_t list = {.head=NULL, .tail=NULL};
+    double start = now();
+    for (uint64_t i=0; i<size; ++i) {
+        add_entry_to_tail(&list, entries[i]);
+    }
+    *seconds = now() - start;
+    *operations = size;
+    clear_files_list(&list);
+    free(entries);
+    return 0;
+}
+
+/*!
+ * @brief run_find_entry_by_name times looking up existing paths in a sorted list of size entries
+ */
+static int run_find_entry_by_name(microbench_input_t *input, uint64_t size, uint64_t *operations, double *seconds) {
+    char **sorted = malloc(sizeof(char *) * size);
+    if (!sorted) {
+        return -1;
+    }
+    memcpy(sorted, input->paths, sizeof(char *) * size);
+    qsort(sorted, size, sizeof(char *), compare_paths);
+    files_list_t list = {.head=NULL, .tail=NULL};
+    for (uint64_t i=0; i<size; ++i) {
+        files_list_entry_t *entry = new_entry(sorted[i]);
+        if (!entry) {
+            clear_files_list(&list);
+            free(sorted);
+            return -1;
+        }
+        add_entry_to_tail(&list, entry);
+    }
+    free(sorted);
+
+    uint64_t lookups = size < MICROBENCH_MAX_LOOKUPS ? size : MICROBENCH_MAX_LOOKUPS;
+    uint64_t found = 0;
+    double start = now();
+    for (uint64_t i=0; i<lookups; ++i) {
+        if (find_entry_by_name(&list, input->paths[i])) {
+            found++;
+        }
+    }
+    *seconds = now() - start;
+    *operations = lookups;
+    clear_files_list(&list);
+    return found == lookups ? 0 : -1;
+}
+
+/*!
+ * @brief run_concat_path times building size paths from a root and a relative path
+ */
+static int run_concat_path(microbench_input_t *input, uint64_t size, uint64_t *operations, double *seconds) {
+    size_t root_length = strlen(input->root) + 1;
+    int result = 0;
+    double start = now();
+    for (uint64_t i=0; i<size; ++i) {
+        char *path = concat_path(NULL, "/backup/destination", input->paths[i] + root_length);
+        if (!path) {
+            result = -1;
+        }
+        free(path);
+    }
+    *seconds = now() - start;
+    *operations = size;
+    return result;
+}
+
+/*!
+ * @brief run_get_path_from_full_path times removing the root from size paths
+ */
+static int run_get_path_from_full_path(microbench_input_t *input, uint64_t size, uint64_t *operations, double *seconds) {
+    int result = 0;
+    double start = now();
+    for (uint64_t i=0; i<size; ++i) {
+        char *path = get_path_from_full_path(input->paths[i], input->root);
+        if (!path) {
+            result = -1;
+        }
+        free(path);
+    }
+    *seconds = now() - start;
+    *operations = size;
+    return result;
+}
+
+/*!
+ * @brief run_compute_file_md5 times hashing a file of size bytes (from the page cache after the warm-up)
+ */
+static int run_compute_file_md5(microbench_input_t *input, uint64_t size, uint64_t *operations, double *seconds) {
+    files_list_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.path_and_name, input->file_path, sizeof(entry.path_and_name) - 1);
+    double start = now();
+    int result = compute_file_md5(&entry);
+    *seconds = now() - start;
+    *operations = 1;
+    return result;
+}
+
+static microbench_primitive_t primitives[] = {
+    {.name="add_file_entry", .run=run_add_file_entry, .uses_file=false, .bytes_per_unit=sizeof(files_list_entry_t) + 64},
+    {.name="add_entry_to_tail", .run=run_add_entry_to_tail, .uses_file=false, .bytes_per_unit=sizeof(files_list_entry_t) + 64},
+    {.name="find_entry_by_name", .run=run_find_entry_by_name, .uses_file=false, .bytes_per_unit=sizeof(files_list_entry_t) + 64},
+    {.name="concat_path", .run=run_concat_path, .uses_file=false, .bytes_per_unit=64},
+    {.name="get_path_from_full_path", .run=run_get_path_from_full_path, .uses_file=false, .bytes_per_unit=64},
+    {.name="compute_file_md5", .run=run_compute_file_md5, .uses_file=true, .bytes_per_unit=0},
+};
+
+/*!
+ * @brief make_file creates a temporary file of size pseudo-random bytes
+ * @return 0 when ok, -1 in case of error
+ */
+static int make_file(char *path, size_t path_size, uint64_t size) {
+    char *temp_dir = getenv("TMPDIR");
+    snprintf(path, path_size, "%s/lp25-microbench.XXXXXX", temp_dir && temp_dir[0] ? temp_dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("Error creating benchmark file");
+        return -1;
+    }
+    uint64_t buffer[8192];
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (uint64_t written=0; written<size; ) {
+        for (size_t i=0; i<sizeof(buffer)/sizeof(buffer[0]); ++i) {
+            buffer[i] = next_random(&state);
+        }
+        size_t length = size - written < sizeof(buffer) ? size - written : sizeof(buffer);
+        if (write(fd, buffer, length) != (ssize_t)length) {
+            perror("Error writing benchmark file");
+            close(fd);
+            unlink(path);
+            return -1;
+        }
+        written += length;
+    }
+    close(fd);
+    return 0;
+}
+
+/*!
+ * @brief compare_times compares two durations for qsort
+ */
+static int compare_times(const void *lhs, const void *rhs) {
+    double left = *(const double *)lhs;
+    double right = *(const double *)rhs;
+    return (left > right) - (left < right);
+}
+
+/*!
+ * @brief percentile returns the nearest-rank percentile of sorted values
+ */
+static double percentile(double *sorted, int count, int percent) {
+    int rank = (percent * count + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/*!
+ * @brief run_primitive runs the warm-up and the timed repetitions of one primitive at one size, then prints its line
+ * @return the duration of the slowest repetition in seconds, -1 in case of error
+ */
+static double run_primitive(microbench_configuration_t *config, microbench_primitive_t *primitive, microbench_input_t *input, uint64_t size) {
+    double *times = malloc(sizeof(double) * config->repetitions);
+    if (!times) {
+        return -1;
+    }
+    uint64_t operations = 0;
+    double seconds = 0;
+    double budget_start = now();
+    for (int i=0; i<config->warmup; ++i) {
+        if (primitive->run(input, size, &operations, &seconds) == -1) {
+            free(times);
+            return -1;
+        }
+        if (now() - budget_start > config->time_cap) {
+            break;
+        }
+    }
+
+    int count = 0;
+    budget_start = now();
+    while (count < config->repetitions && (count == 0 || now() - budget_start < config->time_cap)) {
+        if (primitive->run(input, size, &operations, &seconds) == -1) {
+            free(times);
+            return -1;
+        }
+        times[count++] = seconds / (operations ? operations : 1);
+    }
+    qsort(times, count, sizeof(double), compare_times);
+
+    printf("%s,%lu,%d,%lu,%.1f,%.1f,%.1f,%.1f,%.1f,", primitive->name, (unsigned long)size, count, (unsigned long)operations,
+           times[0] * 1e9, percentile(times, count, 50) * 1e9, percentile(times, count, 90) * 1e9, percentile(times, count, 99) * 1e9, times[count - 1] * 1e9);
+    if (primitive->uses_file) {
+        printf("%.1f", size / percentile(times, count, 50) / 1e6);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    double slowest = times[count - 1] * (operations ? operations : 1);
+    free(times);
+    return slowest;
+}
+
+/*!
+ * @brief predict_seconds extrapolates the duration of a run from the two previous sizes
+ * The growth measured between them beyond linear is applied again, so an O(n²) primitive is stopped
+ * before a single run takes far longer than the time cap.
+ * @return the predicted duration in seconds, 0 when there is no previous size
+ */
+static double predict_seconds(uint64_t size, uint64_t last_size, double last_seconds, uint64_t before_size, double before_seconds) {
+    if (last_size == 0 || size <= last_size) {
+        return 0;
+    }
+    double factor = 1;
+    if (before_size > 0 && before_seconds > 0) {
+        double superlinear = (last_seconds / before_seconds) / ((double)last_size / before_size);
+        factor = superlinear > 1 ? superlinear : 1;
+    }
+    return last_seconds * ((double)size / last_size) * factor;
+}
+
+/*!
+ * @brief parse_size_list reads a comma-separated list of sizes
+ * @return the number of sizes, -1 if the list is invalid
+ */
+static int parse_size_list(char *text, uint64_t *sizes) {
+    int count = 0;
+    char *copy = strdup(text);
+    if (!copy) {
+        return -1;
+    }
+    char *save = NULL;
+    for (char *token=strtok_r(copy, ",", &save); token; token=strtok_r(NULL, ",", &save)) {
+        if (count == MICROBENCH_MAX_SIZES || parse_size(token, &sizes[count]) == -1 || sizes[count] == 0) {
+            free(copy);
+            return -1;
+        }
+        count++;
+    }
+    free(copy);
+    return count > 0 ? count : -1;
+}
+
+/*!
+ * @brief display_microbench_help displays a brief manual for the micro-benchmarks usage
+ * @param my_name is the name of the binary file
+ */
+void display_microbench_help(char *my_name) {
+    printf("%s [options]\n", my_name);
+    printf("Times the files list, path and hashing primitives and writes one CSV line per primitive and size on stdout.\n");
+    printf("Durations are per operation, in nanoseconds; compute_file_md5 also gives its median throughput.\n");
+    printf("Options: \t--sizes=<n,...> numbers of entries (K and M are powers of 1024, default 1000,10000,100000,1000000,10000000)\n");
+    printf("         \t--file-sizes=<size,...> sizes of the hashed files (default 1K,1M,64M; 1G is possible)\n");
+    printf("         \t--repetitions=<n> timed runs of each case (default 10)\n");
+    printf("         \t--warmup=<n> untimed runs before them (default 2)\n");
+    printf("         \t--time-cap=<seconds> time spent at most on a case; bigger sizes are skipped when a single run is predicted to exceed it (default 10)\n");
+    printf("         \t--memory-cap=<size> skips the sizes needing more memory (default 2G)\n");
+    printf("         \t--only=<primitive> runs a single primitive\n");
+}
+
+/*!
+ * @brief main runs every primitive at every size, from the smallest to the biggest
+ * @return 0 when ok, 1 in case of error
+ */
+int main(int argc, char *argv[]) {
+    microbench_configuration_t config = {
+        .sizes={1000, 10000, 100000, 1000000, 10000000}, .sizes_count=5,
+        .file_sizes={1 << 10, 1 << 20, 64 << 20}, .file_sizes_count=3,
+        .repetitions=10, .warmup=2, .time_cap=10, .memory_cap=2ULL << 30, .only=NULL,
+    };
+
+    static struct option my_opts[] = {
+    {.name="sizes",.has_arg=1,.flag=0,.val=SIZES},
+    {.name="file-sizes",.has_arg=1,.flag=0,.val=FILE_SIZES},
+    {.name="repetitions",.has_arg=1,.flag=0,.val=REPETITIONS},
+    {.name="warmup",.has_arg=1,.flag=0,.val=WARMUP},
+    {.name="time-cap",.has_arg=1,.flag=0,.val=TIME_CAP},
+    {.name="memory-cap",.has_arg=1,.flag=0,.val=MEMORY_CAP},
+    {.name="only",.has_arg=1,.flag=0,.val=ONLY},
+    {.name=0,.has_arg=0,.flag=0,.val=0},
+    };
+
+    bool is_valid = true;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", my_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'h':
+            display_microbench_help(argv[0]);
+            return 0;
+            case SIZES:
+            config.sizes_count = parse_size_list(optarg, config.sizes);
+            is_valid = is_valid && config.sizes_count > 0;
+            break;
+            case FILE_SIZES:
+            config.file_sizes_count = parse_size_list(optarg, config.file_sizes);
+            is_valid = is_valid && config.file_sizes_count > 0;
+            break;
+            case REPETITIONS:
+            config.repetitions = atoi(optarg);
+            break;
+            case WARMUP:
+            config.warmup = atoi(optarg);
+            break;
+            case TIME_CAP:
+            config.time_cap = atof(optarg);
+            break;
+            case MEMORY_CAP:
+            is_valid = is_valid && parse_size(optarg, &config.memory_cap) == 0;
+            break;
+            case ONLY:
+            config.only = optarg;
+            break;
+            default:
+            is_valid = false;
+        }
+    }
+    if (!is_valid || optind != argc || config.repetitions < 1 || config.warmup < 0 || config.time_cap <= 0) {
+        display_microbench_help(argv[0]);
+        return 1;
+    }
+
+    microbench_input_t input = {.paths=NULL, .root="/backup/source", .file_path=NULL};
+    uint64_t paths_count = 0;
+    int result = 0;
+    printf("primitive,size,repetitions,operations,min_ns,p50_ns,p90_ns,p99_ns,max_ns,mb_per_second\n");
+    for (size_t p=0; p<sizeof(primitives)/sizeof(primitives[0]); ++p) {
+        microbench_primitive_t *primitive = &primitives[p];
+        if (config.only && strcmp(config.only, primitive->name) != 0) {
+            continue;
+        }
+        uint64_t *sizes = primitive->uses_file ? config.file_sizes : config.sizes;
+        int sizes_count = primitive->uses_file ? config.file_sizes_count : config.sizes_count;
+        uint64_t last_size = 0;
+        double last_seconds = 0;
+        uint64_t before_size = 0;
+        double before_seconds = 0;
+        for (int s=0; s<sizes_count; ++s) {
+            uint64_t size = sizes[s];
+            if (predict_seconds(size, last_size, last_seconds, before_size, before_seconds) > config.time_cap) {
+                fprintf(stderr, "%s: skipping %lu, a single run would exceed the time cap\n", primitive->name, (unsigned long)size);
+                continue;
+            }
+            if (size * primitive->bytes_per_unit > config.memory_cap) {
+                fprintf(stderr, "%s: skipping %lu, more than the memory cap\n", primitive->name, (unsigned long)size);
+                continue;
+            }
+
+            char file_path[PATH_SIZE];
+            if (primitive->uses_file) {
+                if (make_file(file_path, sizeof(file_path), size) == -1) {
+                    result = 1;
+                    continue;
+                }
+                input.file_path = file_path;
+            } else if (size > paths_count) {
+                // Paths are built once for the biggest size needed so far and shared by all primitives
+                free_paths(input.paths, paths_count);
+                paths_count = size;
+                input.paths = make_paths(input.root, paths_count);
+                if (!input.paths) {
+                    perror("\nFailed allocating memory to benchmark paths");
+                    paths_count = 0;
+                    result = 1;
+                    continue;
+                }
+            }
+
+            double slowest = run_primitive(&config, primitive, &input, size);
+            if (slowest < 0) {
+                fprintf(stderr, "%s: failed at size %lu\n", primitive->name, (unsigned long)size);
+                result = 1;
+            } else {
+                before_size = last_size;
+                before_seconds = last_seconds;
+                last_size = size;
+                last_seconds = slowest;
+            }
+            if (primitive->uses_file) {
+                unlink(file_path);
+                input.file_path = NULL;
+            }
+        }
+    }
+    free_paths(input.paths, paths_count);
+    return result;
+}
@@ -0,0 +1,664 @@
+#define _DEFAULT_SOURCE // st_mtim and getline with strict compilers
+
+#include <plan.h>
+#include <sync.h>
+#include <durable.h>
+#include <messages.h>
+#include <processes.h>
+#include <stats.h>
+#include <utility.h>
+#include <defines.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char *op_names[] = {"mkdir", "create", "update"};
+
+typedef struct {
+    bool is_header; // "plan":"lp25" line
+    bool is_end; // Last line, missing from a truncated plan
+    long version;
+    char op[16];
+    char path[PATH_SIZE];
+    uint64_t size;
+    mode_t mode;
+    struct timespec mtime;
+    uint8_t md5sum[16];
+    bool has_md5;
+    uint64_t entries_count;
+} plan_record_t;
+
+/*!
+ * @brief relative_path_of returns the path of an entry relative to the source
+ */
+static char *relative_path_of(files_list_entry_t *entry, configuration_t *the_config) {
+    char *relative_path = entry->path_and_name + strlen(the_config->source);
+    while (*relative_path == '/') {
+        relative_path++;
+    }
+    return relative_path;
+}
+
+/*!
+ * @brief write_json_string writes a string as a JSON string, escaping quotes, backslashes and control characters
+ */
+static void write_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for (; *text; ++text) {
+        unsigned char character = *text;
+        if (character == '"' || character == '\\') {
+            fputc('\\', file);
+            fputc(character, file);
+        } else if (character < 0x20) {
+            fprintf(file, "\\u%04x", character);
+        } else {
+            fputc(character, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/*!
+ * @brief open_plan creates the plan file and writes its header
+ * The plan is written as JSON lines: a header, one object per difference, then an end line with the totals,
+ * so it can be filtered line by line with standard tools.
+ * @param plan is a pointer to the plan writer to initialize
+ * @param the_config is a pointer to the program configuration, with the path of the plan
+ * @return 0 when ok, -1 if the plan cannot be created
+ */
+int open_plan(plan_writer_t *plan, configuration_t *the_config) {
+    plan->the_config = the_config;
+    plan->entries_count = 0;
+    plan->bytes_count = 0;
+    plan->file = fopen(the_config->plan_output_path, "w");
+    if (!plan->file) {
+        perror(the_config->plan_output_path);
+        return -1;
+    }
+    fprintf(plan->file, "{\"plan\":\"lp25\",\"version\":%d,\"source\":", PLAN_FORMAT_VERSION);
+    write_json_string(plan->file, the_config->source);
+    fputs(",\"destination\":", plan->file);
+    write_json_string(plan->file, the_config->destination);
+    fputs("}\n", plan->file);
+    return 0;
+}
+
+/*!
+ * @brief write_plan_entry writes a difference to the plan
+ * Files are planned as an update when the destination already has them, as a creation otherwise.
+ * @param plan is a pointer to the plan writer
+ * @param entry is the source entry to copy
+ */
+void write_plan_entry(plan_writer_t *plan, files_list_entry_t *entry) {
+    if (!plan->file) {
+        return;
+    }
+    char *relative_path = relative_path_of(entry, plan->the_config);
+    plan_op_t op = PLAN_OP_MKDIR;
+    if (entry->entry_type == FICHIER) {
+        char *destination_path = concat_path(NULL, plan->the_config->destination, relative_path);
+        op = destination_path && access(destination_path, F_OK) == 0 ? PLAN_OP_UPDATE : PLAN_OP_CREATE;
+        free(destination_path);
+    }
+
+    fprintf(plan->file, "{\"op\":\"%s\",\"path\":", op_names[op]);
+    write_json_string(plan->file, relative_path);
+    if (entry->entry_type == FICHIER) {
+        fprintf(plan->file, ",\"size\":%lu", (unsigned long)entry->size);
+        plan->bytes_count += entry->size;
+    }
+    fprintf(plan->file, ",\"mode\":\"%04o\",\"mtime\":[%ld,%ld]", (unsigned int)(entry->mode & 07777), (long)entry->mtime.tv_sec, entry->mtime.tv_nsec);
+    // Streaming modes only hash files whose size and mtime are equal on both sides
+    static const uint8_t no_md5[16] = {0};
+    if (entry->entry_type == FICHIER && plan->the_config->uses_md5 && memcmp(entry->md5sum, no_md5, sizeof(no_md5)) != 0) {
+        fputs(",\"md5\":\"", plan->file);
+        for (int i=0; i<16; ++i) {
+            fprintf(plan->file, "%02x", entry->md5sum[i]);
+        }
+        fputc('"', plan->file);
+    }
+    fputs("}\n", plan->file);
+    plan->entries_count++;
+}
+
+/*!
+ * @brief close_plan writes the end line of the plan and closes it
+ * @param plan is a pointer to the plan writer
+ * @return 0 when ok, -1 if the plan could not be written completely
+ */
+int close_plan(plan_writer_t *plan) {
+    if (!plan->file) {
+        return -1;
+    }
+    fprintf(plan->file, "{\"end\":true,\"entries\":%lu,\"bytes\":%lu}\n", plan->entries_count, (unsigned long)plan->bytes_count);
+    bool has_failed = ferror(plan->file);
+    if (fclose(plan->file) != 0 || has_failed) {
+        perror(plan->the_config->plan_output_path);
+        plan->file = NULL;
+        return -1;
+    }
+    plan->file = NULL;
+    return 0;
+}
+
+/*!
+ * @brief skip_spaces moves a cursor past JSON white spaces
+ */
+static void skip_spaces(char **cursor) {
+    while (**cursor == ' ' || **cursor == '\t' || **cursor == '\r' || **cursor == '\n') {
+        (*cursor)++;
+    }
+}
+
+/*!
+ * @brief append_utf8 appends a code point to a string in UTF-8
+ * @return the number of bytes appended, 0 if they do not fit
+ */
+static size_t append_utf8(char *output, size_t available, unsigned long code_point) {
+    if (code_point < 0x80 && available >= 1) {
+        output[0] = code_point;
+        return 1;
+    }
+    if (code_point < 0x800 && available >= 2) {
+        output[0] = 0xc0 | (code_point >> 6);
+        output[1] = 0x80 | (code_point & 0x3f);
+        return 2;
+    }
+    if (code_point < 0x10000 && available >= 3) {
+        output[0] = 0xe0 | (code_point >> 12);
+        output[1] = 0x80 | ((code_point >> 6) & 0x3f);
+        output[2] = 0x80 | (code_point & 0x3f);
+        return 3;
+    }
+    if (code_point >= 0x10000 && available >= 4) {
+        output[0] = 0xf0 | (code_point >> 18);
+        output[1] = 0x80 | ((code_point >> 12) & 0x3f);
+        output[2] = 0x80 | ((code_point >> 6) & 0x3f);
+        output[3] = 0x80 | (code_point & 0x3f);
+        return 4;
+    }
+    return 0;
+}
+
+/*!
+ * @brief parse_hex4 parses the 4 hexadecimal digits of a \u escape
+ * @return the value, -1 if they are not 4 hexadecimal digits
+ */
+static long parse_hex4(char *text) {
+    long value = 0;
+    for (int i=0; i<4; ++i) {
+        char digit = text[i];
+        if (digit >= '0' && digit <= '9') {
+            value = 16 * value + digit - '0';
+        } else if ((digit | 0x20) >= 'a' && (digit | 0x20) <= 'f') {
+            value = 16 * value + (digit | 0x20) - 'a' + 10;
+        } else {
+            return -1;
+        }
+    }
+    return value;
+}
+
+/*!
+ * @brief parse_json_string parses a JSON string and moves the cursor past it
+ * @param cursor is a pointer to the cursor, on the opening quote
+ * @param output is the buffer receiving the string, NULL to skip it
+ * @param size is the size of the buffer
+ * @return 0 when ok, -1 if the string is invalid, contains a nul character or does not fit
+ */
+static int parse_json_string(char **cursor, char *output, size_t size) {
+    char *input = *cursor;
+    size_t length = 0;
+    if (*input++ != '"') {
+        return -1;
+    }
+    while (*input != '"') {
+        char buffer[4];
+        size_t count = 1;
+        if (*input == '\0' || (unsigned char)*input < 0x20) {
+            return -1;
+        }
+        if (*input != '\\') {
+            buffer[0] = *input++;
+        } else {
+            input++;
+            const char *escapes = "\"\"\\\\//b\bf\fn\nr\rt\t";
+            char *escape = *input && *input != 'u' ? strchr(escapes, *input) : NULL;
+            if (escape && (escape - escapes) % 2 == 0) {
+                buffer[0] = escape[1];
+                input++;
+            } else if (*input == 'u') {
+                long code_point = parse_hex4(input + 1);
+                if (code_point == -1) {
+                    return -1;
+                }
+                input += 5;
+                if (code_point >= 0xd800 && code_point < 0xdc00 && input[0] == '\\' && input[1] == 'u') {
+                    long low = parse_hex4(input + 2);
+                    if (low < 0xdc00 || low >= 0xe000) {
+                        return -1;
+                    }
+                    code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+                    input += 6;
+                }
+                if (code_point <= 0 || (code_point >= 0xd800 && code_point < 0xe000)) {
+                    return -1;
+                }
+                count = append_utf8(buffer, sizeof(buffer), code_point);
+            } else {
+                return -1;
+            }
+        }
+        if (output) {
+            if (length + count >= size) {
+                return -1;
+            }
+            memcpy(output + length, buffer, count);
+        }
+        length += count;
+    }
+    if (output) {
+        output[length] = '\0';
+    }
+    *cursor = input + 1;
+    return 0;
+}
+
+/*!
+ * @brief parse_json_number parses a non negative JSON integer and moves the cursor past it
+ * @return 0 when ok, -1 if there is no integer at the cursor
+ */
+static int parse_json_number(char **cursor, uint64_t *value) {
+    if (**cursor < '0' || **cursor > '9') {
+        return -1;
+    }
+    *value = strtoull(*cursor, cursor, 10);
+    return 0;
+}
+
+/*!
+ * @brief skip_json_value moves the cursor past any JSON value, for the keys a plan reader does not need
+ * @return 0 when ok, -1 if the value is invalid
+ */
+static int skip_json_value(char **cursor) {
+    int depth = 0;
+    do {
+        skip_spaces(cursor);
+        if (**cursor == '"') {
+            if (parse_json_string(cursor, NULL, 0) == -1) {
+                return -1;
+            }
+        } else if (**cursor == '{' || **cursor == '[') {
+            depth++;
+            (*cursor)++;
+        } else if (**cursor == '}' || **cursor == ']') {
+            if (depth == 0) {
+                return -1;
+            }
+            depth--;
+            (*cursor)++;
+        } else if (**cursor == ',' || **cursor == ':') {
+            if (depth == 0) {
+                return -1;
+            }
+            (*cursor)++;
+        } else if (**cursor != '\0' && strchr("-0123456789.eEtruefalsn+", **cursor)) {
+            while (**cursor != '\0' && strchr("-0123456789.eEtruefalsn+", **cursor)) {
+                (*cursor)++;
+            }
+        } else {
+            return -1;
+        }
+    } while (depth > 0);
+    return 0;
+}
+
+/*!
+ * @brief parse_plan_record parses a line of a plan
+ * Keys may come in any order, and unknown keys are ignored, so that a plan edited by other tools stays readable.
+ * @param line is the line to parse
+ * @param record is a pointer to the record receiving the values
+ * @return 0 when ok, -1 if the line is not a valid JSON object
+ */
+static int parse_plan_record(char *line, plan_record_t *record) {
+    memset(record, 0, sizeof(plan_record_t));
+    char *cursor = line;
+    skip_spaces(&cursor);
+    if (*cursor++ != '{') {
+        return -1;
+    }
+    skip_spaces(&cursor);
+    while (*cursor != '}') {
+        char key[16];
+        if (parse_json_string(&cursor, key, sizeof(key)) == -1) {
+            // Keys longer than any plan key are only skipped
+            key[0] = '\0';
+            if (parse_json_string(&cursor, NULL, 0) == -1) {
+                return -1;
+            }
+        }
+        skip_spaces(&cursor);
+        if (*cursor++ != ':') {
+            return -1;
+        }
+        skip_spaces(&cursor);
+
+        int result = 0;
+        uint64_t number = 0;
+        char text[64];
+        if (strcmp(key, "op") == 0) {
+            result = parse_json_string(&cursor, record->op, sizeof(record->op));
+        } else if (strcmp(key, "path") == 0) {
+            result = parse_json_string(&cursor, record->path, sizeof(record->path));
+        } else if (strcmp(key, "plan") == 0) {
+            result = parse_json_string(&cursor, text, sizeof(text));
+            record->is_header = result == 0 && strcmp(text, "lp25") == 0;
+        } else if (strcmp(key, "version") == 0) {
+            result = parse_json_number(&cursor, &number);
+            record->version = number;
+        } else if (strcmp(key, "size") == 0) {
+            result = parse_json_number(&cursor, &record->size);
+        } else if (strcmp(key, "entries") == 0) {
+            result = parse_json_number(&cursor, &record->entries_count);
+        } else if (strcmp(key, "mode") == 0) {
+            char *end = NULL;
+            result = parse_json_string(&cursor, text, sizeof(text));
+            if (result == 0) {
+                record->mode = strtoul(text, &end, 8);
+                result = end != text && *end == '\0' ? 0 : -1;
+            }
+        } else if (strcmp(key, "mtime") == 0) {
+            uint64_t seconds = 0, nanoseconds = 0;
+            result = -1;
+            if (*cursor++ == '[') {
+                skip_spaces(&cursor);
+                if (parse_json_number(&cursor, &seconds) == 0) {
+                    skip_spaces(&cursor);
+                    if (*cursor++ == ',') {
+                        skip_spaces(&cursor);
+                        if (parse_json_number(&cursor, &nanoseconds) == 0) {
+                            skip_spaces(&cursor);
+                            result = *cursor++ == ']' && nanoseconds < 1000000000 ? 0 : -1;
+                        }
+                    }
+                }
+            }
+            record->mtime.tv_sec = seconds;
+            record->mtime.tv_nsec = nanoseconds;
+        } else if (strcmp(key, "md5") == 0) {
+            result = parse_json_string(&cursor, text, sizeof(text));
+            if (result == 0 && strlen(text) == 32) {
+                for (int i=0; i<16; ++i) {
+                    unsigned int byte;
+                    if (sscanf(text + 2 * i, "%2x", &byte) != 1) {
+                        result = -1;
+                    }
+                    record->md5sum[i] = byte;
+                }
+                record->has_md5 = result == 0;
+            }
+        } else if (strcmp(key, "end") == 0) {
+            record->is_end = strncmp(cursor, "true", 4) == 0;
+            result = skip_json_value(&cursor);
+        } else {
+            result = skip_json_value(&cursor);
+        }
+        if (result == -1) {
+            return -1;
+        }
+
+        skip_spaces(&cursor);
+        if (*cursor == ',') {
+            cursor++;
+            skip_spaces(&cursor);
+        } else if (*cursor != '}') {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief is_safe_relative_path tells if a planned path stays inside the source and the destination
+ * A plan is a file that may come from elsewhere: absolute paths and .. components are refused.
+ */
+static bool is_safe_relative_path(char *path) {
+    if (path[0] == '\0' || path[0] == '/') {
+        return false;
+    }
+    for (char *component=path; component; component=strchr(component, '/')) {
+        component += component[0] == '/';
+        if (strncmp(component, "..", 2) == 0 && (component[2] == '/' || component[2] == '\0')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief is_already_applied tells if a planned creation is already in the destination, from an earlier apply
+ * Updates are always applied: their destination had the planned size and mtime too when it was found different.
+ */
+static bool is_already_applied(files_list_entry_t *entry, plan_op_t op, char *relative_path, configuration_t *the_config) {
+    if (op == PLAN_OP_UPDATE) {
+        return false;
+    }
+    char *destination_path = concat_path(NULL, the_config->destination, relative_path);
+    struct stat statbuf;
+    bool is_applied = destination_path && stat(destination_path, &statbuf) == 0;
+    free(destination_path);
+    if (!is_applied || entry->entry_type == DOSSIER) {
+        return is_applied && S_ISDIR(statbuf.st_mode);
+    }
+    return S_ISREG(statbuf.st_mode) && (uint64_t)statbuf.st_size == entry->size && statbuf.st_mtim.tv_sec == entry->mtime.tv_sec
+        && statbuf.st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+
+/*!
+ * @brief compare_sizes orders files from the largest to the smallest
+ */
+static int compare_sizes(const void *lhs, const void *rhs) {
+    uint64_t lhs_size = (*(files_list_entry_t **)lhs)->size;
+    uint64_t rhs_size = (*(files_list_entry_t **)rhs)->size;
+    return lhs_size < rhs_size ? 1 : lhs_size > rhs_size ? -1 : 0;
+}
+
+/*!
+ * @brief load_plan reads a whole plan into lists of directories and files to copy
+ * Entries are refreshed from the source, which may have changed since the plan, and planned creations
+ * already made by an earlier apply of the same plan are left out.
+ * @param the_config is a pointer to the program configuration, with the path of the plan
+ * @param directories is the list receiving the directories, in plan order
+ * @param files is the list receiving the files, in plan order
+ * @return 0 when ok, -1 if the plan is invalid or truncated (nothing must be applied then)
+ */
+static int load_plan(configuration_t *the_config, files_list_t *directories, files_list_t *files) {
+    FILE *file = fopen(the_config->apply_path, "r");
+    if (!file) {
+        perror(the_config->apply_path);
+        return -1;
+    }
+    plan_record_t *record = malloc(sizeof(plan_record_t));
+    char *line = NULL;
+    size_t line_size = 0;
+    unsigned long line_number = 1;
+    unsigned long entries_count = 0;
+    unsigned long changed_count = 0;
+    unsigned long applied_count = 0;
+    bool has_end = false;
+    int result = 0;
+
+    if (!record || getline(&line, &line_size, file) == -1 || parse_plan_record(line, record) == -1 || !record->is_header) {
+        fprintf(stderr, "Error: %s is not a plan\n", the_config->apply_path);
+        result = -1;
+    } else if (record->version != PLAN_FORMAT_VERSION) {
+        fprintf(stderr, "Error: unsupported version %ld of plan %s\n", record->version, the_config->apply_path);
+        result = -1;
+    }
+
+    while (result == 0 && !has_end && getline(&line, &line_size, file) != -1) {
+        line_number++;
+        if (parse_plan_record(line, record) == -1) {
+            fprintf(stderr, "Error: invalid line %lu in plan %s\n", line_number, the_config->apply_path);
+            result = -1;
+            break;
+        }
+        if (record->is_end) {
+            has_end = true;
+            if (record->entries_count != entries_count) {
+                // Lines removed on purpose are fine, but the count shows that the plan was filtered
+                fprintf(stderr, "Warning: plan %s has %lu entries instead of %lu\n", the_config->apply_path, entries_count, (unsigned long)record->entries_count);
+            }
+            break;
+        }
+        plan_op_t op;
+        for (op=PLAN_OP_MKDIR; op<=PLAN_OP_UPDATE && strcmp(record->op, op_names[op]) != 0; ++op);
+        if (op > PLAN_OP_UPDATE || !is_safe_relative_path(record->path)) {
+            fprintf(stderr, "Error: invalid entry at line %lu in plan %s\n", line_number, the_config->apply_path);
+            result = -1;
+            break;
+        }
+        entries_count++;
+
+        files_list_entry_t *entry = calloc(1, sizeof(files_list_entry_t));
+        char *source_path = concat_path(NULL, the_config->source, record->path);
+        if (!entry || !source_path || strlen(source_path) >= PATH_SIZE) {
+            free(entry);
+            free(source_path);
+            result = -1;
+            break;
+        }
+        strcpy(entry->path_and_name, source_path);
+        free(source_path);
+        entry->entry_type = op == PLAN_OP_MKDIR ? DOSSIER : FICHIER;
+        entry->size = record->size;
+        entry->mode = record->mode;
+        entry->mtime = record->mtime;
+        memcpy(entry->md5sum, record->md5sum, sizeof(record->md5sum));
+
+        // The copy gets the properties of what is really copied
+        struct stat source_stat;
+        if (stat(entry->path_and_name, &source_stat) == -1 || (S_ISDIR(source_stat.st_mode) != (entry->entry_type == DOSSIER))) {
+            fprintf(stderr, "Warning: %s changed type or disappeared since the plan, skipped\n", entry->path_and_name);
+            free(entry);
+            continue;
+        }
+        if ((entry->entry_type == FICHIER && (uint64_t)source_stat.st_size != entry->size) || source_stat.st_mtim.tv_sec != entry->mtime.tv_sec
+            || source_stat.st_mtim.tv_nsec != entry->mtime.tv_nsec) {
+            changed_count++;
+            if (the_config->is_verbose) {
+                printf("\n%s changed since the plan", entry->path_and_name);
+            }
+        }
+        entry->size = entry->entry_type == FICHIER ? source_stat.st_size : 0;
+        entry->mtime = source_stat.st_mtim;
+        entry->mode = source_stat.st_mode;
+
+        if (is_already_applied(entry, op, record->path, the_config)) {
+            applied_count++;
+            free(entry);
+            continue;
+        }
+        add_entry_to_tail(entry->entry_type == DOSSIER ? directories : files, entry);
+    }
+
+    if (result == 0 && !has_end) {
+        fprintf(stderr, "Error: plan %s is truncated\n", the_config->apply_path);
+        result = -1;
+    }
+    if (result == 0 && changed_count > 0) {
+        fprintf(stderr, "Warning: %lu entries changed in the source since the plan, their current version is copied\n", changed_count);
+    }
+    if (result == 0 && the_config->is_verbose) {
+        printf("\nPlan of %lu entries, %lu already applied\n", entries_count, applied_count);
+    }
+    free(line);
+    free(record);
+    fclose(file);
+    return result;
+}
+
+/*!
+ * @brief apply_plan executes a plan written by --plan-out, without listing nor comparing the trees
+ * Directories are created first, in plan order, so that files always have a parent. Files are then
+ * copied by a pool of copier processes, largest first (or in the --io-order order) so that a huge file
+ * does not start last and keep one copier busy long after the others are done.
+ * @param the_config is a pointer to the program configuration, with the path of the plan
+ * @return 0 when ok, -1 if the plan could not be applied
+ */
+int apply_plan(configuration_t *the_config) {
+    files_list_t directories = {NULL, NULL};
+    files_list_t files = {NULL, NULL};
+    if (load_plan(the_config, &directories, &files) == -1) {
+        clear_files_list(&directories);
+        clear_files_list(&files);
+        return -1;
+    }
+
+    if (the_config->is_dry_run) {
+        printf("\nDIFFERENCES LIST:\n");
+        display_files_list(&directories);
+        display_files_list(&files);
+        clear_files_list(&directories);
+        clear_files_list(&files);
+        return 0;
+    }
+
+    size_t files_count = 0;
+    uint64_t total_size = 0;
+    for (files_list_entry_t *cursor=files.head; cursor!=NULL; cursor=cursor->next) {
+        files_count++;
+        total_size += cursor->size;
+    }
+    STATS_ADD(bytes_to_copy, total_size);
+    SET_PROGRESS_PHASE(PROGRESS_COPYING);
+
+    for (files_list_entry_t *cursor=directories.head; cursor!=NULL; cursor=cursor->next) {
+        copy_entry_to_destination(cursor, the_config);
+    }
+
+    size_t schedule_count = files_count;
+    files_list_entry_t **schedule = NULL;
+    if (the_config->io_order != IO_ORDER_PATH) {
+        schedule = make_io_schedule(&files, the_config->io_order, &schedule_count);
+    } else if ((schedule = malloc((files_count ? files_count : 1) * sizeof(files_list_entry_t *))) != NULL) {
+        files_list_entry_t *cursor = files.head;
+        for (size_t i=0; i<files_count; ++i, cursor=cursor->next) {
+            schedule[i] = cursor;
+        }
+        qsort(schedule, files_count, sizeof(files_list_entry_t *), compare_sizes);
+    }
+    if (!schedule) {
+        clear_files_list(&directories);
+        clear_files_list(&files);
+        return -1;
+    }
+
+    int copiers_count = 0;
+    copier_configuration_t copier_config;
+    pid_t *copiers_pids = NULL;
+    if (the_config->is_parallel && files_count > 1) {
+        int max_copiers = the_config->processes_count > 0 ? the_config->processes_count : 1;
+        max_copiers = (size_t)max_copiers < files_count ? max_copiers : (int)files_count;
+        copiers_pids = malloc(max_copiers * sizeof(pid_t));
+        copiers_count = copiers_pids ? start_copier_pool(the_config, &copier_config, copiers_pids, max_copiers, PLAN_QUEUE_DEPTH) : 0;
+    }
+    for (size_t i=0; i<schedule_count; ++i) {
+        if (copiers_count > 0 && send_copy_entry_command(copier_config.message_queue_id, MSG_TYPE_TO_COPIERS, schedule[i]) != -1) {
+            continue;
+        }
+        copy_entry_to_destination(schedule[i], the_config);
+    }
+    if (copiers_count > 0) {
+        stop_copier_pool(&copier_config, copiers_pids, copiers_count);
+    }
+    int result = finish_durable_writes(the_config);
+
+    free(copiers_pids);
+    free(schedule);
+    clear_files_list(&directories);
+    clear_files_list(&files);
+    return result;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <files-list.h>
+#include <configuration.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PLAN_FORMAT_VERSION 1
+#define PLAN_QUEUE_DEPTH 64 // Files waiting in the MQ of the copier pool before the applier blocks
+
+typedef enum { PLAN_OP_MKDIR, PLAN_OP_CREATE, PLAN_OP_UPDATE } plan_op_t;
+
+typedef struct {
+    FILE *file;
+    configuration_t *the_config;
+    unsigned long entries_count;
+    uint64_t bytes_count; // Size of the files to copy
+} plan_writer_t;
+
+int open_plan(plan_writer_t *plan, configuration_t *the_config);
+void write_plan_entry(plan_writer_t *plan, files_list_entry_t *entry);
+int close_plan(plan_writer_t *plan);
+int apply_plan(configuration_t *the_config);
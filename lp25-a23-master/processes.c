@@ -8,6 +8,12 @@
 #include <sync.h>
 #include <string.h>
 #include <errno.h>
+#include <stats.h>
+#include <trace.h>
+#include <durable.h>
+#include <list-arena.h>
+#include <sys/wait.h>
+#include <time.h>
 
 /*!
  * @brief prepare prepares (only when parallel is enabled) the processes used for the synchronization.
@@ -53,6 +59,7 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
 
         analyzer_configuration_t cfg_src_analyser;
         cfg_src_analyser.mq_key = p_context->shared_key;
+        cfg_src_analyser.message_queue_id = p_context->message_queue_id;
         cfg_src_analyser.my_recipient_id = MSG_TYPE_TO_SOURCE_LISTER;
         cfg_src_analyser.my_receiver_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
         cfg_src_analyser.use_md5 = the_config->uses_md5;   
@@ -63,6 +70,7 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
 
         analyzer_configuration_t cfg_dest_analyser;
         cfg_dest_analyser.mq_key = p_context->shared_key;
+        cfg_dest_analyser.message_queue_id = p_context->message_queue_id;
         cfg_dest_analyser.my_recipient_id = MSG_TYPE_TO_DESTINATION_LISTER;
         cfg_dest_analyser.my_receiver_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;
         cfg_dest_analyser.use_md5 = the_config->uses_md5;   
@@ -101,22 +109,23 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
 
 /*!
  * @brief lister_process_loop is the lister process function (@see make_process)
+ * It lists and analyzes its tree into its shared memory arena, publishes the list there, then sends a
+ * single completion message to the main process, which adopts the list without copying it.
  * @param parameters is a pointer to its parameters, to be cast to a lister_configuration_t
  */
 void lister_process_loop(void *parameters) {
     lister_configuration_t *config = (lister_configuration_t *)parameters;
-    analyze_dir_command_t message; 
-    any_message_t terminate_message;
+    set_trace_worker_name("lister");
 
-    int mq_id = msgget(config->mq_key, 0666);
+    // The listers run at once, each with its share of the analyzers
+    configuration_t lister_config = *config->the_config;
+    lister_config.processes_count = config->analyzers_count > 0 ? config->analyzers_count : 1;
+    the_list_arena = config->arena;
+    files_list_t list = {NULL, NULL};
+    make_files_list(&list, config->target_path, &lister_config);
+    publish_arena_list(config->arena, &list);
 
-    while (terminate_message.simple_command.message != COMMAND_CODE_TERMINATE) {
-       
-    }
-
-
-    return 0; 
-    
+    exit(send_list_end(config->message_queue_id, config->my_recipient_id) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
 /*!
@@ -124,7 +133,176 @@ void lister_process_loop(void *parameters) {
  * @param parameters is a pointer to its parameters, to be cast to an analyzer_configuration_t
  */
 void analyzer_process_loop(void *parameters) {
-    return 0;
+    analyzer_configuration_t *config = (analyzer_configuration_t *)parameters;
+    any_message_t message;
+    set_trace_worker_name("analyzer");
+
+    while (true) {
+        ssize_t received = msgrcv(config->message_queue_id, &message, sizeof(any_message_t) - sizeof(long), config->my_receiver_id, 0);
+        if (received == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ERROR receiving analyze command");
+            break;
+        }
+        STATS_ADD(messages_received, 1);
+        if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
+            break;
+        }
+        if (message.analyze_file_command.op_code == COMMAND_CODE_ANALYZE_FILE) {
+            files_list_entry_t *entry = &message.analyze_file_command.payload;
+            int cmd_code = get_file_stats(entry) == 0 ? COMMAND_CODE_FILE_ANALYZED : COMMAND_CODE_FILE_ANALYZE_FAILED;
+            send_file_entry(config->message_queue_id, config->my_recipient_id, entry, cmd_code);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+/*!
+ * @brief copier_process_loop is the copier process function (@see make_process)
+ * It applies the differences it receives until it gets a terminate command, then exits.
+ * @param parameters is a pointer to its parameters, to be cast to a copier_configuration_t
+ */
+void copier_process_loop(void *parameters) {
+    copier_configuration_t *config = (copier_configuration_t *)parameters;
+    any_message_t message;
+    set_trace_worker_name("copier");
+
+    while (true) {
+        uint64_t trace_start = start_trace_span();
+        ssize_t received = msgrcv(config->message_queue_id, &message, sizeof(any_message_t) - sizeof(long), config->my_receiver_id, 0);
+        end_trace_span(TRACE_MQ_WAIT, "receive", trace_start);
+        if (received == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ERROR receiving copy command");
+            break;
+        }
+        STATS_ADD(messages_received, 1);
+        if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
+            break;
+        }
+        if (message.list_entry.op_code == COMMAND_CODE_COPY_ENTRY && config->job_configs) {
+            files_list_entry_t *entry = &message.list_entry.payload;
+            copy_entry_to_destination(entry, &config->job_configs[message.list_entry.job]);
+            job_counters_t *counters = &config->job_counters[message.list_entry.job];
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            __atomic_fetch_add(&counters->copied_entries, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&counters->copied_bytes, entry->entry_type == FICHIER ? entry->size : 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&counters->finished_ns, (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec, __ATOMIC_RELAXED);
+        } else if (message.list_entry.op_code == COMMAND_CODE_COPY_ENTRY) {
+            copy_entry_to_destination(&message.list_entry.payload, config->the_config);
+        }
+    }
+
+    finish_durable_writes(config->the_config);
+    exit(EXIT_SUCCESS);
+}
+
+/*!
+ * @brief start_copier_pool creates a private MQ and copier processes sharing the differences sent to it
+ * Each difference is applied by the first copier that reads it, so the pool balances itself.
+ * @param the_config is a pointer to the program configuration
+ * @param copier_config is a pointer to the copier configuration to fill, it must live until the pool is stopped
+ * @param copiers_pids is an array receiving the PIDs of the copiers
+ * @param copiers_count is the number of copiers to create, the size of copiers_pids
+ * @param queue_depth is the number of differences that may wait in the MQ before senders block
+ * @return the number of copiers created, 0 if none could be (differences must then be copied directly)
+ */
+int start_copier_pool(configuration_t *the_config, copier_configuration_t *copier_config, pid_t *copiers_pids, int copiers_count, int queue_depth) {
+    return start_job_copier_pool(the_config, NULL, NULL, copier_config, copiers_pids, copiers_count, queue_depth);
+}
+
+/*!
+ * @brief start_job_copier_pool creates a copier pool shared by the jobs of a batch (@see start_copier_pool)
+ * Copy commands sent with send_job_copy_command are applied with the configuration of their job.
+ * @param the_config is a pointer to the program configuration
+ * @param job_configs is the array of the configurations of the jobs, NULL for a pool of a single run
+ * @param job_counters is an array of counters in shared memory, one per job, NULL for a pool of a single run
+ * @param copier_config is a pointer to the copier configuration to fill, it must live until the pool is stopped
+ * @param copiers_pids is an array receiving the PIDs of the copiers
+ * @param copiers_count is the number of copiers to create, the size of copiers_pids
+ * @param queue_depth is the number of differences that may wait in the MQ before senders block
+ * @return the number of copiers created, 0 if none could be (differences must then be copied directly)
+ */
+int start_job_copier_pool(configuration_t *the_config, configuration_t *job_configs, job_counters_t *job_counters, copier_configuration_t *copier_config, pid_t *copiers_pids, int copiers_count, int queue_depth) {
+    int msg_queue = msgget(IPC_PRIVATE, 0600 | IPC_CREAT);
+    if (msg_queue == -1) {
+        perror("ERROR with msgget, copying without copier process");
+        return 0;
+    }
+
+    // Raising the queue size may be refused by the system limits, the default size is then kept
+    struct msqid_ds queue_stats;
+    if (msgctl(msg_queue, IPC_STAT, &queue_stats) == 0) {
+        queue_stats.msg_qbytes = queue_depth * sizeof(files_list_entry_transmit_t);
+        msgctl(msg_queue, IPC_SET, &queue_stats);
+    }
+
+    copier_config->my_receiver_id = MSG_TYPE_TO_COPIERS;
+    copier_config->message_queue_id = msg_queue;
+    copier_config->the_config = the_config;
+    copier_config->job_configs = job_configs;
+    copier_config->job_counters = job_counters;
+
+    process_context_t p_context;
+    p_context.processes_count = 0;
+    fflush(stdout);
+    int started_count = 0;
+    while (started_count < copiers_count) {
+        pid_t copier_pid = make_process(&p_context, copier_process_loop, copier_config);
+        if (copier_pid == -1) {
+            perror("ERROR with fork of a copier process");
+            break;
+        }
+        copiers_pids[started_count++] = copier_pid;
+    }
+    if (started_count == 0) {
+        msgctl(msg_queue, IPC_RMID, NULL);
+    }
+    return started_count;
+}
+
+/*!
+ * @brief stop_copier_pool waits for the copiers to apply all the pending differences, then removes their MQ
+ * Terminate commands are queued after the differences, so each copier reads one once there is nothing left.
+ * @param copier_config is a pointer to the configuration of the copiers
+ * @param copiers_pids is the array of the PIDs of the copiers
+ * @param copiers_count is the number of copiers
+ */
+void stop_copier_pool(copier_configuration_t *copier_config, pid_t *copiers_pids, int copiers_count) {
+    for (int i=0; i<copiers_count; ++i) {
+        send_simple_command(copier_config->message_queue_id, copier_config->my_receiver_id, COMMAND_CODE_TERMINATE);
+    }
+    for (int i=0; i<copiers_count; ++i) {
+        waitpid(copiers_pids[i], NULL, 0);
+    }
+    msgctl(copier_config->message_queue_id, IPC_RMID, NULL);
+}
+
+/*!
+ * @brief start_copier_process creates a private MQ and a copier process reading its differences from it
+ * @param the_config is a pointer to the program configuration
+ * @param copier_config is a pointer to the copier configuration to fill, it must live until the copier is stopped
+ * @param queue_depth is the number of differences that may wait in the MQ before senders block
+ * @return the PID of the copier, -1 if it could not be created (differences must then be copied directly)
+ */
+pid_t start_copier_process(configuration_t *the_config, copier_configuration_t *copier_config, int queue_depth) {
+    pid_t copier_pid = -1;
+    return start_copier_pool(the_config, copier_config, &copier_pid, 1, queue_depth) == 1 ? copier_pid : -1;
+}
+
+/*!
+ * @brief stop_copier_process waits for a copier to apply all its pending differences, then removes its MQ
+ * @param copier_config is a pointer to the configuration of the copier
+ * @param copier_pid is the PID of the copier
+ */
+void stop_copier_process(copier_configuration_t *copier_config, pid_t copier_pid) {
+    stop_copier_pool(copier_config, &copier_pid, 1);
 }
 
 /*!
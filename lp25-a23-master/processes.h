@@ -4,6 +4,7 @@
 #include <sys/ipc.h>
 #include <sys/types.h>
 #include <files-list.h>
+#include <list-arena.h>
 #include <stdbool.h>
 
 typedef struct {
@@ -22,20 +23,46 @@ typedef struct {
     int my_receiver_id; // Id of MQ topic to listen to
     int analyzers_count; // Number of analyzers available
     key_t mq_key;
+    int message_queue_id; // Id of the MQ the completion message is sent to, inherited from the parent
+    char *target_path; // Tree to list
+    configuration_t *the_config;
+    list_arena_t *arena; // Shared memory the list is built in, mapped by the parent
 } lister_configuration_t;
 
 typedef struct {
     int my_recipient_id; // Id of my lister
     int my_receiver_id; // Id I must listen to
     key_t mq_key;
+    int message_queue_id; // Id of the MQ, inherited from the parent
     bool use_md5; // Set to true when computing MD5sum for files
 } analyzer_configuration_t;
 
+typedef struct {
+    uint64_t copied_entries;
+    uint64_t copied_bytes;
+    uint64_t failed_copies; // Counted through the configuration of the job (@see count_failed_copy)
+    uint64_t finished_ns; // Monotonic time at which the last copy of the job ended
+} job_counters_t; // Copies of one job of a batch, counted by the copiers in shared memory
+
+typedef struct {
+    int my_receiver_id; // Id of MQ topic to listen to
+    int message_queue_id; // Id of the MQ, inherited from the parent
+    configuration_t *the_config; // Configuration of the parent, used to build destination paths
+    configuration_t *job_configs; // Configurations of the jobs of a batch, used instead of the_config by copy commands of a job; NULL otherwise
+    job_counters_t *job_counters; // Shared counters of the jobs of a batch, NULL otherwise
+} copier_configuration_t;
+
 typedef void (*process_loop_t)(void *);
 
 int prepare(configuration_t *the_config, process_context_t *p_context);
 int make_process(process_context_t *p_context, process_loop_t func, void *parameters);
 void lister_process_loop(void *parameters);
 void analyzer_process_loop(void *parameters);
+void copier_process_loop(void *parameters);
+int start_copier_pool(configuration_t *the_config, copier_configuration_t *copier_config, pid_t *copiers_pids, int copiers_count, int queue_depth);
+int start_job_copier_pool(configuration_t *the_config, configuration_t *job_configs, job_counters_t *job_counters, copier_configuration_t *copier_config, pid_t *copiers_pids, int copiers_count, int queue_depth);
+void stop_copier_pool(copier_configuration_t *copier_config, pid_t *copiers_pids, int copiers_count);
+pid_t start_copier_process(configuration_t *the_config, copier_configuration_t *copier_config, int queue_depth);
+void stop_copier_process(copier_configuration_t *copier_config, pid_t copier_pid);
 void clean_processes(configuration_t *the_config, process_context_t *p_context);
 void request_element_details(int msg_queue, files_list_entry_t *entry, lister_configuration_t *cfg, int *current_analyzers);
\ No newline at end of file
@@ -0,0 +1,149 @@
+#define _DEFAULT_SOURCE // nanosleep and sigaction with strict compilers
+
+#include <progress.h>
+#include <processes.h>
+#include <stats.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+static const char *progress_phase_names[PROGRESS_PHASES_COUNT] = {"starting", "listing", "analyzing", "comparing", "copying", "streaming", "watching"};
+
+static volatile sig_atomic_t is_progress_stopped = 0;
+
+/*!
+ * @brief stop_progress is the SIGTERM handler of the reporter: it prints a last report, then exits
+ */
+static void stop_progress(int signal_number) {
+    is_progress_stopped = 1;
+}
+
+/*!
+ * @brief format_bytes writes a size with a binary unit
+ */
+static char *format_bytes(char *buffer, size_t size, uint64_t bytes) {
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    double value = bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+    snprintf(buffer, size, unit ? "%.1f %s" : "%.0f %s", value, units[unit]);
+    return buffer;
+}
+
+/*!
+ * @brief print_progress prints one report
+ * @param config is a pointer to the reporter configuration
+ * @param counters is a snapshot of the shared counters
+ * @param rate is the smoothed throughput in bytes per second (hashed plus copied bytes)
+ * @param copy_rate is the smoothed copy throughput in bytes per second, used for the ETA
+ * @param is_final is true for the report printed when the reporter stops
+ */
+static void print_progress(progress_configuration_t *config, stats_counters_t *counters, double rate, double copy_rate, bool is_final) {
+    uint32_t phase = counters->progress_phase < PROGRESS_PHASES_COUNT ? counters->progress_phase : PROGRESS_STARTING;
+    uint64_t entries = counters->files_scanned + counters->directories_scanned;
+    uint64_t remaining = counters->bytes_to_copy > counters->bytes_copied ? counters->bytes_to_copy - counters->bytes_copied : 0;
+    // The copy total is only complete once every difference has been found
+    bool has_eta = phase == PROGRESS_COPYING && copy_rate > 0;
+    long eta = has_eta ? (long)(remaining / copy_rate) : -1;
+
+    if (config->is_line_mode) {
+        fprintf(stderr, "progress phase=%s entries=%lu bytes_hashed=%lu bytes_copied=%lu bytes_to_copy=%lu mb_per_second=%.2f eta_seconds=%ld%s\n",
+                progress_phase_names[phase], (unsigned long)entries, (unsigned long)counters->bytes_hashed, (unsigned long)counters->bytes_copied,
+                (unsigned long)counters->bytes_to_copy, rate / 1e6, eta, is_final ? " final=1" : "");
+    } else {
+        char hashed[32], copied[32], to_copy[32];
+        char eta_text[32] = "--";
+        if (eta >= 0) {
+            snprintf(eta_text, sizeof(eta_text), "%ld:%02ld:%02ld", eta / 3600, eta / 60 % 60, eta % 60);
+        }
+        int percent = counters->bytes_to_copy ? (int)(counters->bytes_copied * 100 / counters->bytes_to_copy) : 0;
+        fprintf(stderr, "\r[%s] %lu entries, %s hashed, %s of %s copied (%d%%), %.1f MB/s, ETA %s\033[K%s", progress_phase_names[phase],
+                (unsigned long)entries, format_bytes(hashed, sizeof(hashed), counters->bytes_hashed), format_bytes(copied, sizeof(copied), counters->bytes_copied),
+                format_bytes(to_copy, sizeof(to_copy), counters->bytes_to_copy), percent, rate / 1e6, eta_text, is_final ? "\n" : "");
+    }
+    fflush(stderr);
+}
+
+/*!
+ * @brief progress_process_loop is the reporter process function (@see make_process)
+ * It samples the shared counters at a fixed rate, so the processes doing the work never write to the terminal.
+ * It exits on SIGTERM, or when the main process dies.
+ * @param parameters is a pointer to its parameters, to be cast to a progress_configuration_t
+ */
+void progress_process_loop(void *parameters) {
+    progress_configuration_t *config = (progress_configuration_t *)parameters;
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    double rate = 0;
+    double copy_rate = 0;
+    stats_counters_t previous;
+    memcpy(&previous, the_stats, sizeof(previous));
+    struct timespec interval = {.tv_sec=config->interval_ms / 1000, .tv_nsec=(config->interval_ms % 1000) * 1000000L};
+    double interval_seconds = config->interval_ms / 1000.0;
+
+    while (!is_progress_stopped) {
+        nanosleep(&interval, NULL);
+
+        stats_counters_t counters;
+        memcpy(&counters, the_stats, sizeof(counters));
+        double last_rate = ((counters.bytes_hashed - previous.bytes_hashed) + (counters.bytes_copied - previous.bytes_copied)) / interval_seconds;
+        double last_copy_rate = (counters.bytes_copied - previous.bytes_copied) / interval_seconds;
+        rate = PROGRESS_RATE_SMOOTHING * last_rate + (1 - PROGRESS_RATE_SMOOTHING) * rate;
+        copy_rate = PROGRESS_RATE_SMOOTHING * last_copy_rate + (1 - PROGRESS_RATE_SMOOTHING) * copy_rate;
+        print_progress(config, &counters, rate, copy_rate, is_progress_stopped);
+        previous = counters;
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+/*!
+ * @brief start_progress_reporter creates the reporter process
+ * The shared counters must already be mapped (@see init_stats).
+ * @param progress_config is a pointer to the reporter configuration, it must live until the reporter is stopped
+ * @return the PID of the reporter, -1 if it could not be created
+ */
+pid_t start_progress_reporter(progress_configuration_t *progress_config) {
+    if (!the_stats || progress_config->interval_ms == 0) {
+        return -1;
+    }
+
+    // The handler is installed before the fork, so a stop request can never be missed by the reporter
+    struct sigaction action;
+    struct sigaction previous_action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_progress;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, &previous_action);
+
+    process_context_t p_context;
+    p_context.processes_count = 0;
+    fflush(stdout);
+    fflush(stderr);
+    pid_t reporter_pid = make_process(&p_context, progress_process_loop, progress_config);
+    sigaction(SIGTERM, &previous_action, NULL);
+    if (reporter_pid == -1) {
+        perror("ERROR with fork, no progress report");
+    }
+    return reporter_pid;
+}
+
+/*!
+ * @brief stop_progress_reporter makes the reporter print its last report and waits for it
+ * @param reporter_pid is the PID returned by start_progress_reporter
+ */
+void stop_progress_reporter(pid_t reporter_pid) {
+    if (reporter_pid <= 0) {
+        return;
+    }
+    kill(reporter_pid, SIGTERM);
+    waitpid(reporter_pid, NULL, 0);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define PROGRESS_RATE_SMOOTHING 0.3 // Weight of the last interval in the displayed throughput
+
+typedef struct {
+    bool is_line_mode; // One key=value line per refresh instead of a single updated terminal line
+    unsigned int interval_ms;
+} progress_configuration_t;
+
+void progress_process_loop(void *parameters);
+pid_t start_progress_reporter(progress_configuration_t *progress_config);
+void stop_progress_reporter(pid_t reporter_pid);
@@ -0,0 +1,629 @@
+#define _GNU_SOURCE // accept4, st_mtim and st_ctim are not exposed by strict compilers
+
+#include <server.h>
+#include <sync.h>
+#include <streaming.h>
+#include <file-properties.h>
+#include <utility.h>
+#include <stats.h>
+#include <durable.h>
+#include <filter.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+typedef struct {
+    server_t *server;
+    streaming_context_t *context;
+} sync_request_t;
+
+/*!
+ * @brief same_time tests if two timestamps are equal
+ */
+static bool same_time(struct timespec lhs, struct timespec rhs) {
+    return lhs.tv_sec == rhs.tv_sec && lhs.tv_nsec == rhs.tv_nsec;
+}
+
+/*!
+ * @brief hash_path returns the FNV-1a hash of a path
+ */
+static uint64_t hash_path(const char *path) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *path; ++path) {
+        hash ^= (uint8_t)*path;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief init_warm_index allocates an empty index
+ * @return 0 when ok, -1 on allocation failure
+ */
+static int init_warm_index(warm_index_t *index) {
+    index->slots = calloc(WARM_INDEX_INITIAL_CAPACITY, sizeof(warm_entry_t));
+    index->capacity = WARM_INDEX_INITIAL_CAPACITY;
+    index->count = 0;
+    if (!index->slots) {
+        perror("Failed allocating memory to the index");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief clear_warm_index frees an index and its entries
+ */
+static void clear_warm_index(warm_index_t *index) {
+    for (size_t i=0; i<index->capacity && index->slots; ++i) {
+        free(index->slots[i].path);
+    }
+    free(index->slots);
+    memset(index, 0, sizeof(warm_index_t));
+}
+
+/*!
+ * @brief find_warm_slot returns the slot of a path, or the free slot where it would be added
+ * The index is never more than half full, so a free slot is always found.
+ */
+static warm_entry_t *find_warm_slot(warm_index_t *index, const char *path) {
+    size_t mask = index->capacity - 1;
+    for (size_t i=hash_path(path) & mask; ; i=(i + 1) & mask) {
+        if (!index->slots[i].path || strcmp(index->slots[i].path, path) == 0) {
+            return &index->slots[i];
+        }
+    }
+}
+
+/*!
+ * @brief put_warm_entry returns the slot of a path, adding it to the index if needed
+ * @return the slot, whose content is left to the caller, NULL on allocation failure
+ */
+static warm_entry_t *put_warm_entry(warm_index_t *index, char *path) {
+    if ((index->count + 1) * 2 > index->capacity) {
+        warm_entry_t *slots = calloc(index->capacity * 2, sizeof(warm_entry_t));
+        if (!slots) {
+            return NULL;
+        }
+        warm_entry_t *old_slots = index->slots;
+        size_t old_capacity = index->capacity;
+        index->slots = slots;
+        index->capacity *= 2;
+        for (size_t i=0; i<old_capacity; ++i) {
+            if (old_slots[i].path) {
+                *find_warm_slot(index, old_slots[i].path) = old_slots[i];
+            }
+        }
+        free(old_slots);
+    }
+    warm_entry_t *slot = find_warm_slot(index, path);
+    if (!slot->path) {
+        slot->path = strdup(path);
+        if (!slot->path) {
+            return NULL;
+        }
+        index->count++;
+    }
+    return slot;
+}
+
+/*!
+ * @brief remove_warm_entry removes a path from an index
+ * The entries following it in its probe sequence are shifted back, so they can still be found.
+ */
+static void remove_warm_entry(warm_index_t *index, char *path) {
+    warm_entry_t *slot = find_warm_slot(index, path);
+    if (!slot->path) {
+        return;
+    }
+    free(slot->path);
+    slot->path = NULL;
+    index->count--;
+
+    size_t mask = index->capacity - 1;
+    size_t hole = slot - index->slots;
+    for (size_t i=(hole + 1) & mask; index->slots[i].path; i=(i + 1) & mask) {
+        size_t home = hash_path(index->slots[i].path) & mask;
+        // The entry may fill the hole when the hole is between its home slot and its slot
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            index->slots[hole] = index->slots[i];
+            index->slots[i].path = NULL;
+            hole = i;
+        }
+    }
+}
+
+/*!
+ * @brief stat_entry fills an entry from the file system, taking the MD5 sum of a file from the index while it is unchanged
+ * A file is unchanged when its size and mtime are those of the index, and so are its inode and ctime
+ * once it has been checked. Stale files are removed from the index.
+ * @param index is the index of the tree of the entry
+ * @param entry is the entry, whose path is set
+ * @param statbuf receives the status of the entry
+ * @param has_md5 is set to true when the MD5 sum of the entry was found in the index
+ * @return 0 when ok, -1 if the entry does not exist
+ */
+static int stat_entry(warm_index_t *index, files_list_entry_t *entry, struct stat *statbuf, bool *has_md5) {
+    *has_md5 = false;
+    uint64_t stat_start = start_stats_timer();
+    int stat_result = stat(entry->path_and_name, statbuf);
+    stop_stats_timer(STATS_STAT, stat_start);
+    if (stat_result == -1) {
+        remove_warm_entry(index, entry->path_and_name);
+        return -1;
+    }
+    entry->mode = statbuf->st_mode;
+    entry->mtime = statbuf->st_mtim;
+    entry->size = S_ISREG(statbuf->st_mode) ? statbuf->st_size : 0;
+    entry->entry_type = S_ISDIR(statbuf->st_mode) ? DOSSIER : FICHIER;
+    memset(entry->md5sum, 0, sizeof(entry->md5sum));
+    if (!S_ISREG(statbuf->st_mode)) {
+        remove_warm_entry(index, entry->path_and_name);
+        return 0;
+    }
+
+    warm_entry_t *slot = find_warm_slot(index, entry->path_and_name);
+    if (!slot->path) {
+        return 0;
+    }
+    if (slot->size != entry->size || !same_time(slot->mtime, statbuf->st_mtim)
+        || (slot->inode != 0 && (slot->inode != statbuf->st_ino || !same_time(slot->ctime, statbuf->st_ctim)))) {
+        remove_warm_entry(index, entry->path_and_name);
+        return 0;
+    }
+    slot->inode = statbuf->st_ino;
+    slot->ctime = statbuf->st_ctim;
+    memcpy(entry->md5sum, slot->md5sum, sizeof(slot->md5sum));
+    *has_md5 = true;
+    return 0;
+}
+
+/*!
+ * @brief hash_entry computes the MD5 sum of a file and records it in the index
+ * @param server is the server, counting the hashed files
+ * @param index is the index of the tree of the entry
+ * @param entry is the file, filled by stat_entry
+ * @param statbuf is the status of the file given by stat_entry
+ * @return 0 when ok, -1 if the file cannot be read
+ */
+static int hash_entry(server_t *server, warm_index_t *index, files_list_entry_t *entry, struct stat *statbuf) {
+    if (compute_file_md5(entry) == -1) {
+        return -1;
+    }
+    server->hashed_files++;
+    warm_entry_t *slot = put_warm_entry(index, entry->path_and_name);
+    if (slot) {
+        slot->size = entry->size;
+        slot->mtime = entry->mtime;
+        slot->ctime = statbuf->st_ctim;
+        slot->inode = statbuf->st_ino;
+        memcpy(slot->md5sum, entry->md5sum, sizeof(slot->md5sum));
+    }
+    return 0;
+}
+
+/*!
+ * @brief record_copy records a copied file in the index of the destination, with the MD5 sum of its source
+ * Its inode is not known until the copy is renamed into place, so it is set by the next check.
+ */
+static void record_copy(server_t *server, files_list_entry_t *source_entry, char *destination_path) {
+    warm_entry_t *slot = put_warm_entry(&server->destination_index, destination_path);
+    if (slot) {
+        slot->size = source_entry->size;
+        slot->mtime = source_entry->mtime;
+        slot->inode = 0;
+        memcpy(slot->md5sum, source_entry->md5sum, sizeof(slot->md5sum));
+    }
+}
+
+static void sync_tree(server_t *server, streaming_context_t *context, char *source_dir);
+
+/*!
+ * @brief sync_path synchronizes one path of the source to the destination, using the indexes
+ * MD5 sums are only needed, as with mismatch, for files of the same size and mtime; they are taken from
+ * the indexes when the files did not change since they were hashed.
+ * @param server is the server
+ * @param context is the streaming context used for the copies
+ * @param source_path is the full path in the source
+ * @param is_subtree is true when the whole content of a directory must be synchronized
+ */
+static void sync_path(server_t *server, streaming_context_t *context, char *source_path, bool is_subtree) {
+    configuration_t *the_config = server->the_config;
+    char *relative_path = source_path + strlen(the_config->source);
+    while (*relative_path == '/') {
+        relative_path++;
+    }
+    char *destination_path = concat_path(NULL, the_config->destination, relative_path);
+    files_list_entry_t *source_entry = malloc(sizeof(files_list_entry_t));
+    files_list_entry_t *destination_entry = malloc(sizeof(files_list_entry_t));
+    if (!destination_path || !source_entry || !destination_entry || strlen(source_path) >= PATH_SIZE || strlen(destination_path) >= PATH_SIZE) {
+        free(destination_path);
+        free(source_entry);
+        free(destination_entry);
+        return;
+    }
+    memset(source_entry, 0, sizeof(files_list_entry_t));
+    memset(destination_entry, 0, sizeof(files_list_entry_t));
+    strcpy(source_entry->path_and_name, source_path);
+    strcpy(destination_entry->path_and_name, destination_path);
+
+    // A path removed or replaced by another type of entry is skipped: deletions are not propagated
+    struct stat source_stat, destination_stat;
+    bool source_has_md5, destination_has_md5;
+    if (stat_entry(&server->source_index, source_entry, &source_stat, &source_has_md5) == 0
+        && (S_ISREG(source_stat.st_mode) || S_ISDIR(source_stat.st_mode))) {
+        bool destination_exists = stat_entry(&server->destination_index, destination_entry, &destination_stat, &destination_has_md5) == 0;
+        bool is_file = source_entry->entry_type == FICHIER;
+        bool needs_md5 = the_config->uses_md5 && is_file && destination_exists && destination_entry->entry_type == FICHIER
+            && source_entry->size == destination_entry->size && same_time(source_entry->mtime, destination_entry->mtime);
+        bool is_readable = true;
+        if (needs_md5 && !source_has_md5) {
+            is_readable = hash_entry(server, &server->source_index, source_entry, &source_stat) == 0;
+        }
+        if (needs_md5 && !destination_has_md5 && hash_entry(server, &server->destination_index, destination_entry, &destination_stat) == -1) {
+            destination_exists = false;
+        }
+
+        if (is_readable && (!destination_exists || mismatch(source_entry, destination_entry, the_config))) {
+            // The source is hashed before its copy, which then reads it from the cache, so both indexes know the copy
+            if (is_file && the_config->uses_md5 && !source_has_md5 && !needs_md5) {
+                is_readable = hash_entry(server, &server->source_index, source_entry, &source_stat) == 0;
+            }
+            if (is_readable) {
+                // A failed copy leaves the destination as it was, so the index keeps what it knew of it
+                uint64_t failed_before = get_failed_copies();
+                stream_difference(context, source_entry);
+                if (is_file && !the_config->is_dry_run && get_failed_copies() == failed_before) {
+                    record_copy(server, source_entry, destination_path);
+                }
+            }
+        }
+        if (is_subtree && source_entry->entry_type == DOSSIER) {
+            sync_tree(server, context, source_path);
+        }
+    }
+
+    free(destination_path);
+    free(source_entry);
+    free(destination_entry);
+}
+
+/*!
+ * @brief sync_tree synchronizes the content of a directory of the source
+ * @param server is the server
+ * @param context is the streaming context used for the copies
+ * @param source_dir is the full path of the directory in the source
+ */
+static void sync_tree(server_t *server, streaming_context_t *context, char *source_dir) {
+    char **names = NULL;
+    int count = list_sorted_entries(source_dir, &names);
+    for (int i=0; i<count; ++i) {
+        char *path = concat_path(NULL, source_dir, names[i]);
+        if (path && !is_path_excluded(server->the_config->source, path, DT_UNKNOWN)) {
+            sync_path(server, context, path, true);
+        }
+        free(path);
+    }
+    if (count >= 0) {
+        free_sorted_entries(names, count);
+    }
+}
+
+/*!
+ * @brief sync_dirty_path synchronizes a dirty path for process_dirty_paths
+ */
+static void sync_dirty_path(dirty_path_t *dirty, void *data) {
+    sync_request_t *request = (sync_request_t *)data;
+    sync_path(request->server, request->context, dirty->path, dirty->is_subtree);
+}
+
+/*!
+ * @brief run_sync synchronizes the changes of the source seen since the last sync
+ * A full sync checks the whole source instead, with a stat per entry while the indexes are valid.
+ * It is also done after an overflow of the inotify queue, and after a sync whose copies failed, so that they are tried again.
+ * @param server is the server
+ * @param is_full is true to check the whole source
+ * @return the number of copies that failed
+ */
+static uint64_t run_sync(server_t *server, bool is_full) {
+    configuration_t *the_config = server->the_config;
+    uint64_t failed_before = get_failed_copies();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    streaming_context_t context;
+    memset(&context, 0, sizeof(context));
+    context.the_config = the_config;
+    context.msg_queue = -1;
+
+    read_watch_events(&server->watch);
+    if (is_full || server->watch.needs_rescan) {
+        add_watch_tree(&server->watch, the_config->source);
+        clear_dirty_paths(&server->watch);
+        sync_tree(server, &context, the_config->source);
+    } else {
+        sync_request_t request = {server, &context};
+        process_dirty_paths(&server->watch, sync_dirty_path, &request);
+    }
+    finish_durable_writes(the_config);
+    uint64_t failed_count = get_failed_copies() - failed_before;
+    server->watch.needs_rescan = failed_count > 0;
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    server->syncs_count++;
+    server->last_synchronized = context.differences_count;
+    server->last_sync_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    if (the_config->is_verbose) {
+        printf("%lu entries synchronized in %.3f ms\n", context.differences_count, server->last_sync_ms);
+    }
+    fflush(stdout);
+    return failed_count;
+}
+
+/*!
+ * @brief open_server_socket creates the listening socket of the server
+ * A socket left by a server that did not stop cleanly is replaced, one that still accepts connections is not.
+ * @param socket_path is the path of the socket
+ * @return the socket, -1 in case of error
+ */
+static int open_server_socket(char *socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe_fd != -1 && connect(probe_fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+        fprintf(stderr, "A server already listens on %s\n", socket_path);
+        close(probe_fd);
+        return -1;
+    }
+    if (probe_fd != -1) {
+        close(probe_fd);
+    }
+    struct stat statbuf;
+    if (lstat(socket_path, &statbuf) == 0 && S_ISSOCK(statbuf.st_mode)) {
+        unlink(socket_path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("Error creating server socket");
+        return -1;
+    }
+    // Only the user running the server may send it requests
+    mode_t previous_umask = umask(077);
+    int bind_result = bind(fd, (struct sockaddr *)&address, sizeof(address));
+    umask(previous_umask);
+    if (bind_result == -1 || listen(fd, SERVER_BACKLOG) == -1) {
+        perror(socket_path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*!
+ * @brief handle_client answers the request of a client
+ * Requests are single lines: sync (changes since the last sync), rescan (whole source), status or stop.
+ * Replies are single lines starting with ok or error, followed by key=value pairs.
+ * @param server is the server
+ * @param client_fd is the connection to the client, closed here
+ * @return true when the server must stop
+ */
+static bool handle_client(server_t *server, int client_fd) {
+    struct timeval timeout = {.tv_sec=SERVER_REQUEST_TIMEOUT_MS / 1000, .tv_usec=(SERVER_REQUEST_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char request[SERVER_REQUEST_SIZE];
+    size_t length = 0;
+    while (length < sizeof(request) - 1) {
+        ssize_t received = recv(client_fd, request + length, sizeof(request) - 1 - length, 0);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        length += received;
+        if (memchr(request + length - received, '\n', received)) {
+            break;
+        }
+    }
+    request[length] = '\0';
+    request[strcspn(request, "\r\n")] = '\0';
+
+    char reply[SERVER_REPLY_SIZE];
+    bool is_stopping = false;
+    if (strcmp(request, "sync") == 0 || strcmp(request, "rescan") == 0) {
+        uint64_t failed_count = run_sync(server, strcmp(request, "rescan") == 0);
+        if (failed_count > 0) {
+            snprintf(reply, sizeof(reply), "error failed=%lu synchronized=%lu elapsed_ms=%.3f\n", (unsigned long)failed_count,
+                     server->last_synchronized, server->last_sync_ms);
+        } else {
+            snprintf(reply, sizeof(reply), "ok synchronized=%lu elapsed_ms=%.3f\n", server->last_synchronized, server->last_sync_ms);
+        }
+    } else if (strcmp(request, "status") == 0) {
+        read_watch_events(&server->watch);
+        int watched_directories = 0;
+        for (int i=0; i<server->watch.watched_capacity; ++i) {
+            watched_directories += server->watch.watched_paths[i] != NULL;
+        }
+        snprintf(reply, sizeof(reply), "ok pending=%lu rescan=%d watched_directories=%d source_files=%lu destination_files=%lu syncs=%lu last_synchronized=%lu last_sync_ms=%.3f hashed_files=%lu\n",
+                 (unsigned long)server->watch.dirty_count, server->watch.needs_rescan, watched_directories,
+                 (unsigned long)server->source_index.count, (unsigned long)server->destination_index.count,
+                 server->syncs_count, server->last_synchronized, server->last_sync_ms, server->hashed_files);
+    } else if (strcmp(request, "stop") == 0) {
+        snprintf(reply, sizeof(reply), "ok stopping\n");
+        is_stopping = true;
+    } else {
+        snprintf(reply, sizeof(reply), "error unknown request: %.64s\n", request);
+    }
+    send(client_fd, reply, strlen(reply), MSG_NOSIGNAL);
+    close(client_fd);
+    return is_stopping;
+}
+
+/*!
+ * @brief serve keeps the source and destination indexed in memory and synchronizes them on request
+ * The source is watched with inotify from the start, then both trees are checked once, which fills the
+ * indexes. Afterwards, a sync request only checks the paths changed since the previous sync, so it
+ * answers in about the time needed to copy them. SIGINT, SIGTERM and a stop request stop the server
+ * between two requests.
+ * @param the_config is a pointer to the configuration, with the socket path in serve_path
+ * @return 0 when stopped, -1 in case of error
+ */
+int serve(configuration_t *the_config) {
+    server_t server;
+    memset(&server, 0, sizeof(server));
+    server.the_config = the_config;
+    if (init_watch(&server.watch) == -1) {
+        return -1;
+    }
+    server.watch.source = the_config->source;
+    int listen_fd = -1;
+    if (init_warm_index(&server.source_index) == -1 || init_warm_index(&server.destination_index) == -1
+        || (listen_fd = open_server_socket(the_config->serve_path)) == -1
+        || (add_watch_tree(&server.watch, the_config->source) == -1 && server.watch.watched_capacity == 0)) {
+        if (listen_fd != -1) {
+            close(listen_fd);
+            unlink(the_config->serve_path);
+        }
+        clear_warm_index(&server.source_index);
+        clear_warm_index(&server.destination_index);
+        clear_watch(&server.watch);
+        return -1;
+    }
+
+    run_sync(&server, true);
+
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop_signals, NULL);
+    int signal_fd = signalfd(-1, &stop_signals, SFD_CLOEXEC);
+    int result = 0;
+    if (signal_fd == -1) {
+        perror("Error creating signal descriptor");
+        result = -1;
+    } else if (the_config->is_verbose) {
+        printf("\nServing %s on %s\n", the_config->source, the_config->serve_path);
+        fflush(stdout);
+    }
+    SET_PROGRESS_PHASE(PROGRESS_WATCHING);
+
+    bool is_stopped = signal_fd == -1;
+    while (!is_stopped) {
+        struct pollfd descriptors[3] = {
+            {.fd=server.watch.inotify_fd, .events=POLLIN, .revents=0},
+            {.fd=signal_fd, .events=POLLIN, .revents=0},
+            {.fd=listen_fd, .events=POLLIN, .revents=0},
+        };
+        if (poll(descriptors, 3, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error waiting for requests");
+            result = -1;
+            break;
+        }
+        // Events are read as they come, so the inotify queue does not overflow between two syncs
+        if ((descriptors[0].revents & POLLIN) && read_watch_events(&server.watch) == -1) {
+            result = -1;
+            break;
+        }
+        if (descriptors[1].revents & POLLIN) {
+            // Consumed, so it is not delivered when the signals are unblocked
+            struct signalfd_siginfo signal_info;
+            if (read(signal_fd, &signal_info, sizeof(signal_info)) == -1) {
+                perror("Error reading signal");
+            }
+            is_stopped = true;
+        }
+        if (!is_stopped && (descriptors[2].revents & POLLIN)) {
+            int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (client_fd != -1) {
+                is_stopped = handle_client(&server, client_fd);
+            }
+        }
+    }
+
+    if (signal_fd != -1) {
+        close(signal_fd);
+    }
+    sigprocmask(SIG_UNBLOCK, &stop_signals, NULL);
+    close(listen_fd);
+    unlink(the_config->serve_path);
+    clear_warm_index(&server.source_index);
+    clear_warm_index(&server.destination_index);
+    clear_watch(&server.watch);
+    return result;
+}
+
+/*!
+ * @brief run_client sends a request to a server and prints its reply
+ * @param socket_path is the path of the socket of the server
+ * @param request is the request: sync, rescan, status or stop
+ * @return 0 when the server accepted the request, -1 otherwise
+ */
+int run_client(char *socket_path, char *request) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    char line[SERVER_REQUEST_SIZE];
+    if (strlen(socket_path) >= sizeof(address.sun_path) || snprintf(line, sizeof(line), "%s\n", request) >= (int)sizeof(line)) {
+        fprintf(stderr, "Socket path or request too long\n");
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        perror(socket_path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    if (send(fd, line, strlen(line), MSG_NOSIGNAL) != (ssize_t)strlen(line)) {
+        perror("Error sending request");
+        close(fd);
+        return -1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    char reply[SERVER_REPLY_SIZE];
+    size_t length = 0;
+    while (length < sizeof(reply) - 1) {
+        ssize_t received = recv(fd, reply + length, sizeof(reply) - 1 - length, 0);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        length += received;
+    }
+    close(fd);
+    reply[length] = '\0';
+    if (length == 0) {
+        fprintf(stderr, "No reply from the server\n");
+        return -1;
+    }
+    fputs(reply, stdout);
+    return strncmp(reply, "ok", 2) == 0 ? 0 : -1;
+}
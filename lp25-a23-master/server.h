@@ -0,0 +1,45 @@
+#pragma once
+
+#include <configuration.h>
+#include <files-list.h>
+#include <watch.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define WARM_INDEX_INITIAL_CAPACITY 1024 // Slots of a warm index, doubled when it gets more than half full
+#define SERVER_REQUEST_SIZE 256 // Longest request line, with its newline
+#define SERVER_REPLY_SIZE 512
+#define SERVER_REQUEST_TIMEOUT_MS 1000 // A client must send its request within this delay
+#define SERVER_BACKLOG 16
+
+typedef struct {
+    char *path; // Full path of a regular file, NULL for a free slot
+    uint64_t size;
+    struct timespec mtime;
+    struct timespec ctime; // Catches a file replaced by another one with the same size and mtime
+    ino_t inode; // 0 when the entry was written by the server and not checked since
+    uint8_t md5sum[16];
+} warm_entry_t;
+
+typedef struct {
+    warm_entry_t *slots; // Open addressing with linear probing
+    size_t capacity; // Power of 2
+    size_t count;
+} warm_index_t;
+
+typedef struct {
+    configuration_t *the_config;
+    watch_context_t watch; // Changes of the source since the last sync
+    warm_index_t source_index; // Entries of both trees as of their last check: a stat tells if they are still valid
+    warm_index_t destination_index;
+    unsigned long syncs_count;
+    unsigned long last_synchronized; // Entries copied by the last sync
+    double last_sync_ms;
+    unsigned long hashed_files; // Files whose MD5 sum was computed, i.e. not found valid in an index
+} server_t;
+
+int serve(configuration_t *the_config);
+int run_client(char *socket_path, char *request);
@@ -0,0 +1,101 @@
+#include <stats.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+stats_counters_t *the_stats = NULL;
+
+static const char *phase_names[STATS_PHASES_COUNT] = {"listing", "stat", "hashing", "diff", "copy"};
+static const char *strategy_names[STATS_COPY_STRATEGIES_COUNT] = {"full", "delta", "directory", "link"};
+
+/*!
+ * @brief init_stats maps the shared counters
+ * It must be called before any process is created, so that children inherit the same mapping and their
+ * counts add up with the main process' ones.
+ * @return 0 when ok, -1 if the counters cannot be mapped
+ */
+int init_stats() {
+    void *map = mmap(NULL, sizeof(stats_counters_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping statistics");
+        return -1;
+    }
+    memset(map, 0, sizeof(stats_counters_t));
+    the_stats = map;
+    return 0;
+}
+
+/*!
+ * @brief start_stats_timer starts timing a phase
+ * @return the current monotonic time in nanoseconds, 0 when stats are disabled (the clock is then not read)
+ */
+uint64_t start_stats_timer() {
+    if (!the_stats) {
+        return 0;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief stop_stats_timer adds the time elapsed since start_stats_timer to a phase
+ * @param phase is the phase to account the time to
+ * @param start is the value returned by start_stats_timer
+ */
+void stop_stats_timer(stats_phase_t phase, uint64_t start) {
+    if (!the_stats) {
+        return;
+    }
+    uint64_t end = start_stats_timer();
+    __atomic_fetch_add(&the_stats->phase_ns[phase], end - start, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&the_stats->phase_calls[phase], 1, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief save_stats writes the counters as JSON
+ * @param stats_path is the path of the file to write
+ * @param wall_ns is the duration of the whole run in nanoseconds
+ * @return 0 when ok, -1 in case of error
+ */
+int save_stats(char *stats_path, uint64_t wall_ns) {
+    if (!the_stats) {
+        return -1;
+    }
+    FILE *file = fopen(stats_path, "w");
+    if (!file) {
+        perror("Error writing statistics");
+        return -1;
+    }
+
+    stats_counters_t counters;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    memcpy(&counters, the_stats, sizeof(counters));
+
+    fprintf(file, "{\n  \"wall_seconds\": %.6f,\n  \"phases\": {", wall_ns / 1e9);
+    for (int i=0; i<STATS_PHASES_COUNT; ++i) {
+        fprintf(file, "%s\n    \"%s\": {\"seconds\": %.6f, \"calls\": %lu}", i ? "," : "", phase_names[i],
+                counters.phase_ns[i] / 1e9, (unsigned long)counters.phase_calls[i]);
+    }
+    fprintf(file, "\n  },\n");
+    fprintf(file, "  \"files_scanned\": %lu,\n  \"directories_scanned\": %lu,\n", (unsigned long)counters.files_scanned, (unsigned long)counters.directories_scanned);
+    fprintf(file, "  \"bytes_hashed\": %lu,\n  \"bytes_copied\": %lu,\n", (unsigned long)counters.bytes_hashed, (unsigned long)counters.bytes_copied);
+    fprintf(file, "  \"cache_hits\": {\"dir_index\": %lu, \"manifest\": %lu},\n", (unsigned long)counters.dir_index_hits, (unsigned long)counters.manifest_hits);
+    fprintf(file, "  \"mq_messages\": {\"sent\": %lu, \"received\": %lu},\n", (unsigned long)counters.messages_sent, (unsigned long)counters.messages_received);
+    fprintf(file, "  \"throttled_seconds\": %.6f,\n", counters.throttled_ns / 1e9);
+    fprintf(file, "  \"checkpoints\": %lu,\n", (unsigned long)counters.checkpoints);
+    fprintf(file, "  \"filtered_entries\": %lu,\n", (unsigned long)counters.filtered_entries);
+    fprintf(file, "  \"copies\": {");
+    for (int i=0; i<STATS_COPY_STRATEGIES_COUNT; ++i) {
+        fprintf(file, "%s\n    \"%s\": {\"count\": %lu, \"bytes\": %lu}", i ? "," : "", strategy_names[i],
+                (unsigned long)counters.copies[i], (unsigned long)counters.copied_bytes[i]);
+    }
+    fprintf(file, "\n  }\n}\n");
+
+    if (fclose(file) != 0) {
+        perror("Error writing statistics");
+        return -1;
+    }
+    return 0;
+}
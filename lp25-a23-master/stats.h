@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum { STATS_LISTING, STATS_STAT, STATS_HASHING, STATS_DIFF, STATS_COPY, STATS_PHASES_COUNT } stats_phase_t;
+
+typedef enum { PROGRESS_STARTING, PROGRESS_LISTING, PROGRESS_ANALYZING, PROGRESS_COMPARING, PROGRESS_COPYING, PROGRESS_STREAMING, PROGRESS_WATCHING, PROGRESS_PHASES_COUNT } progress_phase_t;
+
+typedef enum { STATS_COPY_FULL, STATS_COPY_DELTA, STATS_COPY_DIRECTORY, STATS_COPY_LINK, STATS_COPY_STRATEGIES_COUNT } stats_copy_strategy_t;
+
+typedef struct {
+    uint64_t phase_ns[STATS_PHASES_COUNT]; // Summed over all processes, so phases running in parallel may add up to more than the wall time
+    uint64_t phase_calls[STATS_PHASES_COUNT];
+    uint64_t files_scanned;
+    uint64_t directories_scanned;
+    uint64_t bytes_hashed;
+    uint64_t bytes_copied;
+    uint64_t dir_index_hits; // Directories whose entries were not read thanks to the directory index
+    uint64_t manifest_hits; // Destination entries found in the manifest instead of the destination tree
+    uint64_t messages_sent;
+    uint64_t messages_received;
+    uint64_t copies[STATS_COPY_STRATEGIES_COUNT];
+    uint64_t copied_bytes[STATS_COPY_STRATEGIES_COUNT];
+    uint64_t bytes_to_copy; // Size of the differences found so far
+    uint32_t progress_phase; // Current progress_phase_t of the main process
+    uint64_t throttled_ns; // Time spent waiting for the I/O limits, summed over all processes
+    uint64_t checkpoints; // syncfs calls making copied files durable
+    uint64_t filtered_entries; // Entries skipped by the filter rules, an excluded directory counting for its whole subtree
+} stats_counters_t;
+
+// Counters shared by the main process and its children, NULL when neither --stats nor --progress is used
+extern stats_counters_t *the_stats;
+
+// Adds to a counter from any process; does nothing when stats are disabled
+#define STATS_ADD(counter, value) do { if (the_stats) { __atomic_fetch_add(&the_stats->counter, (value), __ATOMIC_RELAXED); } } while (0)
+
+// Sets the current phase shown by the progress reporter
+#define SET_PROGRESS_PHASE(phase) do { if (the_stats) { __atomic_store_n(&the_stats->progress_phase, (phase), __ATOMIC_RELAXED); } } while (0)
+
+int init_stats();
+uint64_t start_stats_timer();
+void stop_stats_timer(stats_phase_t phase, uint64_t start);
+int save_stats(char *stats_path, uint64_t wall_ns);
@@ -0,0 +1,446 @@
+#include <streaming.h>
+#include <sync.h>
+#include <processes.h>
+#include <messages.h>
+#include <file-properties.h>
+#include <utility.h>
+#include <stats.h>
+#include <durable.h>
+#include <filter.h>
+#include <trace.h>
+#include <dirent.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+/*!
+ * @brief compare_names compares two names for qsort
+ */
+static int compare_names(const void *lhs, const void *rhs) {
+    return strcmp(*(char * const *)lhs, *(char * const *)rhs);
+}
+
+/*!
+ * @brief list_sorted_entries reads the names of the relevant entries of a single directory
+ * Relevant entries are regular files and directories (@see get_next_entry). Names are sorted with strcmp
+ * so that the source and destination directories can be merged in one pass.
+ * @param path is the path to the directory
+ * @param names is a pointer receiving the array of names (@see free_sorted_entries)
+ * @return the number of names, -1 if the directory cannot be read
+ */
+int list_sorted_entries(char *path, char ***names) {
+    uint64_t trace_start = start_trace_span();
+    DIR *dir = open_dir(path);
+    if (!dir) {
+        return -1;
+    }
+
+    int count = 0;
+    int capacity = 16;
+    *names = malloc(sizeof(char *) * capacity);
+    if (!*names) {
+        perror("\nFailed allocating memory to directory entries");
+        closedir(dir);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = get_next_entry(dir)) != NULL) {
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            char *entry_path = concat_path(NULL, path, entry->d_name);
+            struct stat statbuf;
+            if (entry_path && lstat(entry_path, &statbuf) == 0) {
+                type = S_ISDIR(statbuf.st_mode) ? DT_DIR : (S_ISREG(statbuf.st_mode) ? DT_REG : DT_UNKNOWN);
+            }
+            free(entry_path);
+        }
+        if (type != DT_REG && type != DT_DIR) {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            char **bigger = realloc(*names, sizeof(char *) * capacity);
+            if (!bigger) {
+                perror("\nFailed allocating memory to directory entries");
+                break;
+            }
+            *names = bigger;
+        }
+        (*names)[count] = strdup(entry->d_name);
+        if ((*names)[count]) {
+            count++;
+        }
+    }
+    closedir(dir);
+
+    qsort(*names, count, sizeof(char *), compare_names);
+    end_trace_span(TRACE_LIST_DIR, path, trace_start);
+    return count;
+}
+
+/*!
+ * @brief free_sorted_entries frees an array of names built by list_sorted_entries
+ * @param names is the array to free
+ * @param count is the number of names in the array
+ */
+void free_sorted_entries(char **names, int count) {
+    if (!names) {
+        return;
+    }
+    for (int i=0; i<count; ++i) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+/*!
+ * @brief stream_difference hands a difference over to the copy stage as soon as it is found
+ * @param context is a pointer to the streaming context
+ * @param entry is the source entry to copy
+ */
+void stream_difference(streaming_context_t *context, files_list_entry_t *entry) {
+    configuration_t *the_config = context->the_config;
+
+    context->differences_count++;
+    STATS_ADD(bytes_to_copy, entry->entry_type == FICHIER ? entry->size : 0);
+    if (the_config->is_verbose || the_config->is_dry_run) {
+        printf("%s\n", entry->path_and_name);
+    }
+    if (context->plan) {
+        write_plan_entry(context->plan, entry);
+        return;
+    }
+    if (the_config->is_dry_run) {
+        return;
+    }
+
+    if (context->msg_queue != -1 && send_copy_entry_command(context->msg_queue, MSG_TYPE_TO_COPIERS, entry) != -1) {
+        return;
+    }
+    copy_entry_to_destination(entry, the_config);
+}
+
+/*!
+ * @brief same_time tests if two timestamps are equal
+ */
+static bool same_time(struct timespec lhs, struct timespec rhs) {
+    return lhs.tv_sec == rhs.tv_sec && lhs.tv_nsec == rhs.tv_nsec;
+}
+
+/*!
+ * @brief finalize_summary computes the summary of a directory and records it in the current index
+ * The summary is the hash of the files digest followed by the names and summaries of the subdirectories,
+ * so that two directories with the same summary have identical subtrees.
+ * @param context is a pointer to the streaming context
+ * @param record is the record to add, with its path, mtime and files digest already set
+ * @param directories_context is the hash of the names and summaries of the subdirectories (freed here)
+ * @param summary receives the summary of the directory
+ */
+static void finalize_summary(streaming_context_t *context, dir_index_record_t *record, EVP_MD_CTX *directories_context, uint8_t *summary) {
+    uint8_t directories_digest[EVP_MAX_MD_SIZE];
+    EVP_DigestFinal_ex(directories_context, directories_digest, NULL);
+    EVP_MD_CTX_free(directories_context);
+
+    EVP_MD_CTX *summary_context = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(summary_context, EVP_md5(), NULL);
+    EVP_DigestUpdate(summary_context, record->files_digest, DIGEST_SIZE);
+    EVP_DigestUpdate(summary_context, directories_digest, DIGEST_SIZE);
+    EVP_DigestFinal_ex(summary_context, summary, NULL);
+    EVP_MD_CTX_free(summary_context);
+
+    memcpy(record->summary, summary, DIGEST_SIZE);
+    add_dir_index_record(context->current_index, record);
+}
+
+/*!
+ * @brief stream_unchanged_directory walks a directory whose mtime did not change on either side since the last run
+ * Its entries are not read: its files are considered identical, and only the subdirectories known by the
+ * index are visited, because a change below them does not update the mtime of this directory.
+ * @param context is a pointer to the streaming context
+ * @param previous is the record of the directory in the index of the last run
+ * @param source_dir is the path of the directory in the source
+ * @param destination_dir is the path of the same directory in the destination
+ * @param summary receives the summary of the directory
+ * @return 0
+ */
+static int stream_unchanged_directory(streaming_context_t *context, dir_index_record_t *previous, char *source_dir, char *destination_dir, uint8_t *summary) {
+    context->pruned_directories++;
+    STATS_ADD(dir_index_hits, 1);
+
+    EVP_MD_CTX *directories_context = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(directories_context, EVP_md5(), NULL);
+
+    size_t first = 0;
+    size_t count = find_dir_index_children(context->previous_index, previous->path, &first);
+    size_t prefix_length = previous->path[0] ? strlen(previous->path) + 1 : 0;
+    for (size_t i=first; i<first + count; ++i) {
+        char *name = context->previous_index->records[i].path + prefix_length;
+        if (strchr(name, '/')) {
+            continue;
+        }
+
+        char *child_source = concat_path(NULL, source_dir, name);
+        char *child_destination = concat_path(NULL, destination_dir, name);
+        uint8_t child_summary[DIGEST_SIZE];
+        if (child_source && child_destination && stream_directory(context, child_source, child_destination, child_summary) == 0) {
+            EVP_DigestUpdate(directories_context, name, strlen(name) + 1);
+            EVP_DigestUpdate(directories_context, child_summary, DIGEST_SIZE);
+        }
+        free(child_source);
+        free(child_destination);
+    }
+
+    dir_index_record_t record = *previous;
+    finalize_summary(context, &record, directories_context, summary);
+    return 0;
+}
+
+/*!
+ * @brief stream_directory diffs one directory of the source against the same directory of the destination
+ * Both sides are listed, sorted and merged, each difference is streamed to the copy stage immediately,
+ * then the function recurses in the subdirectories. Only the names of the directories on the current
+ * path are kept in memory.
+ * When a directory index is used, directories unchanged on both sides since the last run are not read
+ * (@see stream_unchanged_directory) and the summary of each directory is computed for the next run.
+ * @param context is a pointer to the streaming context
+ * @param source_dir is the path of the directory in the source
+ * @param destination_dir is the path of the same directory in the destination, NULL if it does not exist
+ * @param summary receives the summary of the directory when an index is used, may be NULL otherwise
+ * @return 0 when ok, -1 if the source directory cannot be listed
+ */
+int stream_directory(streaming_context_t *context, char *source_dir, char *destination_dir, uint8_t *summary) {
+    bool uses_index = context->current_index != NULL && summary != NULL;
+    dir_index_record_t record;
+    EVP_MD_CTX *files_context = NULL;
+    EVP_MD_CTX *directories_context = NULL;
+
+    if (uses_index) {
+        record.path = source_dir + strlen(context->the_config->source);
+        while (*record.path == '/') {
+            record.path++;
+        }
+
+        // The mtimes are taken before listing, so that a change during the walk is seen by the next run
+        struct stat source_dir_stat;
+        struct stat destination_dir_stat;
+        if (stat(source_dir, &source_dir_stat) == -1) {
+            return -1;
+        }
+        record.source_mtime = source_dir_stat.st_mtim;
+        record.destination_mtime.tv_sec = 0;
+        record.destination_mtime.tv_nsec = 0;
+
+        dir_index_record_t *previous = destination_dir ? find_dir_index_record(context->previous_index, record.path) : NULL;
+        if (previous && stat(destination_dir, &destination_dir_stat) == 0 && same_time(previous->source_mtime, source_dir_stat.st_mtim)
+            && same_time(previous->destination_mtime, destination_dir_stat.st_mtim)) {
+            return stream_unchanged_directory(context, previous, source_dir, destination_dir, summary);
+        }
+
+        files_context = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(files_context, EVP_md5(), NULL);
+        directories_context = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(directories_context, EVP_md5(), NULL);
+    }
+
+    char **source_names = NULL;
+    int source_count = list_sorted_entries(source_dir, &source_names);
+    if (source_count == -1) {
+        if (uses_index) {
+            EVP_MD_CTX_free(files_context);
+            EVP_MD_CTX_free(directories_context);
+        }
+        return -1;
+    }
+
+    char **destination_names = NULL;
+    int destination_count = 0;
+    if (destination_dir) {
+        destination_count = list_sorted_entries(destination_dir, &destination_names);
+        if (destination_count == -1) {
+            destination_count = 0;
+        }
+    }
+
+    files_list_entry_t *source_entry = malloc(sizeof(files_list_entry_t));
+    files_list_entry_t *destination_entry = malloc(sizeof(files_list_entry_t));
+    if (!source_entry || !destination_entry) {
+        perror("\nFailed allocating memory to streamed entries");
+        free(source_entry);
+        free(destination_entry);
+        free_sorted_entries(source_names, source_count);
+        free_sorted_entries(destination_names, destination_count);
+        return -1;
+    }
+
+    int j = 0;
+    for (int i=0; i<source_count; ++i) {
+        while (j < destination_count && strcmp(destination_names[j], source_names[i]) < 0) {
+            j++;
+        }
+        bool in_destination = j < destination_count && strcmp(destination_names[j], source_names[i]) == 0;
+
+        char *source_path = concat_path(NULL, source_dir, source_names[i]);
+        if (!source_path || is_path_excluded(context->the_config->source, source_path, DT_UNKNOWN)) {
+            free(source_path);
+            continue;
+        }
+        strncpy(source_entry->path_and_name, source_path, PATH_SIZE - 1);
+        source_entry->path_and_name[PATH_SIZE - 1] = '\0';
+        if (get_file_stats(source_entry) == -1) {
+            perror(source_path);
+            free(source_path);
+            continue;
+        }
+
+        char *destination_path = in_destination ? concat_path(NULL, destination_dir, source_names[i]) : NULL;
+        bool is_different = true;
+        bool destination_is_dir = false;
+        if (destination_path) {
+            strncpy(destination_entry->path_and_name, destination_path, PATH_SIZE - 1);
+            destination_entry->path_and_name[PATH_SIZE - 1] = '\0';
+            if (get_file_stats(destination_entry) == 0) {
+                is_different = mismatch(source_entry, destination_entry, context->the_config);
+                destination_is_dir = destination_entry->entry_type == DOSSIER;
+            }
+        }
+
+        if (is_different) {
+            stream_difference(context, source_entry);
+        }
+        if (source_entry->entry_type == DOSSIER) {
+            uint8_t child_summary[DIGEST_SIZE];
+            if (stream_directory(context, source_path, destination_is_dir ? destination_path : NULL, uses_index ? child_summary : NULL) == 0 && uses_index) {
+                EVP_DigestUpdate(directories_context, source_names[i], strlen(source_names[i]) + 1);
+                EVP_DigestUpdate(directories_context, child_summary, DIGEST_SIZE);
+            }
+        } else if (uses_index) {
+            EVP_DigestUpdate(files_context, source_names[i], strlen(source_names[i]) + 1);
+            EVP_DigestUpdate(files_context, &source_entry->size, sizeof(source_entry->size));
+            EVP_DigestUpdate(files_context, &source_entry->mtime.tv_sec, sizeof(source_entry->mtime.tv_sec));
+            EVP_DigestUpdate(files_context, &source_entry->mtime.tv_nsec, sizeof(source_entry->mtime.tv_nsec));
+            EVP_DigestUpdate(files_context, source_entry->md5sum, DIGEST_SIZE);
+        }
+
+        free(source_path);
+        free(destination_path);
+    }
+
+    free(source_entry);
+    free(destination_entry);
+    free_sorted_entries(source_names, source_count);
+    free_sorted_entries(destination_names, destination_count);
+
+    if (uses_index) {
+        EVP_DigestFinal_ex(files_context, record.files_digest, NULL);
+        EVP_MD_CTX_free(files_context);
+        finalize_summary(context, &record, directories_context, summary);
+    }
+    return 0;
+}
+
+/*!
+ * @brief save_streaming_index completes the index built by the walk and saves it for the next run
+ * The destination mtimes are read once all the copies are done, since copies modify them.
+ * @param context is a pointer to the streaming context
+ * @param index_path is the path to the index file
+ */
+static void save_streaming_index(streaming_context_t *context, char *index_path) {
+    dir_index_t *index = context->current_index;
+    for (size_t i=0; i<index->count; ++i) {
+        char *destination_dir = concat_path(NULL, context->the_config->destination, index->records[i].path);
+        struct stat destination_dir_stat;
+        if (destination_dir && stat(destination_dir, &destination_dir_stat) == 0) {
+            index->records[i].destination_mtime = destination_dir_stat.st_mtim;
+        }
+        free(destination_dir);
+    }
+    sort_dir_index(index);
+    save_dir_index(index, index_path);
+}
+
+/*!
+ * @brief synchronize_streaming synchronizes the source and the destination without building full lists
+ * Both trees are walked in the same sorted order and each directory is diffed as soon as both sides are
+ * listed. In parallel mode, differences go through a bounded MQ to a copier process, so copies start
+ * with the first difference found and the walk goes on while they run.
+ * @param the_config is a pointer to the configuration
+ */
+void synchronize_streaming(configuration_t *the_config) {
+    streaming_context_t context;
+    context.the_config = the_config;
+    context.msg_queue = -1;
+    context.differences_count = 0;
+    context.previous_index = NULL;
+    context.current_index = NULL;
+    context.pruned_directories = 0;
+    context.plan = NULL;
+
+    plan_writer_t plan;
+    if (the_config->plan_output_path[0] != '\0') {
+        if (open_plan(&plan, the_config) == -1) {
+            return;
+        }
+        context.plan = &plan;
+    }
+
+    dir_index_t previous_index;
+    dir_index_t current_index;
+    uint8_t root_summary[DIGEST_SIZE];
+    if (the_config->dir_index_path[0] != '\0') {
+        init_dir_index(&previous_index);
+        init_dir_index(&current_index);
+        load_dir_index(&previous_index, the_config->dir_index_path);
+        context.previous_index = &previous_index;
+        context.current_index = &current_index;
+    }
+
+    pid_t copier_pid = -1;
+    copier_configuration_t copier_config;
+    if (the_config->is_parallel && !the_config->is_dry_run && !context.plan) {
+        copier_pid = start_copier_process(the_config, &copier_config, STREAMING_QUEUE_DEPTH);
+        if (copier_pid > 0) {
+            context.msg_queue = copier_config.message_queue_id;
+        }
+    }
+
+    if (the_config->is_verbose || the_config->is_dry_run) {
+        printf("\nDIFFERENCES LIST:\n");
+    }
+    SET_PROGRESS_PHASE(PROGRESS_STREAMING);
+    if (stream_directory(&context, the_config->source, the_config->destination, context.current_index ? root_summary : NULL) == -1) {
+        perror("ERROR listing source directory");
+    }
+
+    if (copier_pid > 0) {
+        stop_copier_process(&copier_config, copier_pid);
+    }
+    finish_durable_writes(the_config);
+    if (context.plan) {
+        close_plan(context.plan);
+    }
+
+    if (context.differences_count == 0 && the_config->is_verbose) {
+        printf("\nDifferences list was empty!");
+    }
+
+    if (context.current_index) {
+        if (the_config->is_verbose) {
+            printf("\nDirectory index: %lu directories pruned, tree summary ", context.pruned_directories);
+            for (int i=0; i<DIGEST_SIZE; ++i) {
+                printf("%02x", root_summary[i]);
+            }
+            printf("\n");
+        }
+        // A planned run leaves the destination as it was, the index of the last copies stays valid
+        if (!the_config->is_dry_run && !context.plan) {
+            save_streaming_index(&context, the_config->dir_index_path);
+        }
+        clear_dir_index(&previous_index);
+        clear_dir_index(&current_index);
+    }
+}
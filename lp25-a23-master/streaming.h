@@ -0,0 +1,24 @@
+#pragma once
+
+#include <configuration.h>
+#include <files-list.h>
+#include <dir-index.h>
+#include <plan.h>
+
+#define STREAMING_QUEUE_DEPTH 64 // Differences waiting in the MQ before the walker blocks
+
+typedef struct {
+    configuration_t *the_config;
+    int msg_queue; // MQ to the copier process, -1 when the walker copies the differences itself
+    unsigned long differences_count;
+    dir_index_t *previous_index; // Index of the last run, NULL when --dir-index is not used
+    dir_index_t *current_index; // Index being built by this run
+    unsigned long pruned_directories; // Directories whose entries were not read thanks to the index
+    plan_writer_t *plan; // Plan receiving the differences instead of copying them, NULL without --plan-out
+} streaming_context_t;
+
+void synchronize_streaming(configuration_t *the_config);
+void stream_difference(streaming_context_t *context, files_list_entry_t *entry);
+int stream_directory(streaming_context_t *context, char *source_dir, char *destination_dir, uint8_t *summary);
+int list_sorted_entries(char *path, char ***names);
+void free_sorted_entries(char **names, int count);
@@ -5,14 +5,38 @@
 #include <utility.h>
 #include <messages.h>
 #include <file-properties.h>
+#include <delta.h>
+#include <streaming.h>
+#include <manifest.h>
+#include <external-list.h>
+#include <stats.h>
+#include <throttle.h>
+#include <dispatcher.h>
+#include <durable.h>
+#include <journal.h>
+#include <plan.h>
+#include <fan-out.h>
+#include <filter.h>
+#include <link-dest.h>
+#include <list-arena.h>
+#include <trace.h>
+#include <file-copy.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <sys/sendfile.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/msg.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+static bool entries_mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, configuration_t *the_config);
+static void copy_entry(files_list_entry_t *source_entry, configuration_t *the_config);
+static void apply_differences(files_list_t *differences, configuration_t *the_config, journal_t *journal);
+static void apply_difference(files_list_entry_t *entry, configuration_t *the_config, journal_t *journal);
+static int resume_synchronize(configuration_t *the_config);
+static void make_tree_list(files_list_t *list, char *root, char *target);
+
 /*!
  * @brief synchronize is the main function for synchronization
  * It will build the lists (source and destination), then make a third list with differences, and apply differences to the destination
@@ -21,7 +45,31 @@
  * @param p_context is a pointer to the processes context
  */
 void synchronize(configuration_t *the_config, process_context_t *p_context) {
-    
+
+    if (the_config->apply_path[0] != '\0') {
+        apply_plan(the_config);
+        return;
+    }
+
+    if (the_config->memory_limit > 0) {
+        synchronize_external(the_config);
+        return;
+    }
+
+    if (the_config->is_streaming) {
+        synchronize_streaming(the_config);
+        return;
+    }
+
+    if (the_config->is_resuming && !the_config->is_dry_run && resume_synchronize(the_config) == 0) {
+        return;
+    }
+
+    if (the_config->extra_destinations_count > 0) {
+        synchronize_fan_out(the_config);
+        return;
+    }
+
     files_list_t *destination = (files_list_t *)malloc(sizeof(files_list_t));
     destination->head = NULL;
     destination->tail = NULL;
@@ -44,24 +92,56 @@ void synchronize(configuration_t *the_config, process_context_t *p_context) {
         return;
     }
 
-    make_files_list(source, the_config->source);
+    // A manifest written by a previous run replaces the walk of the destination
+    manifest_t destination_manifest;
+    files_list_entry_t manifest_entry;
+    bool uses_manifest = the_config->destination_manifest_path[0] != '\0' && open_manifest(&destination_manifest, the_config->destination_manifest_path) == 0;
+    // In parallel mode both trees are listed at once, by listers whose lists are adopted without copies
+    if (!the_config->is_parallel || make_files_lists_parallel(source, uses_manifest ? NULL : destination, the_config) == -1) {
+        make_files_list(source, the_config->source, the_config);
+        if (!uses_manifest) {
+            make_files_list(destination, the_config->destination, the_config);
+        }
+    }
     if (the_config->is_verbose || the_config->is_dry_run) {
         printf("\nSOURCE LIST:\n");
         display_files_list(source);
-    }
-    make_files_list(destination, the_config->destination);
-    if (the_config->is_verbose || the_config->is_dry_run) {
-        printf("\nDESTINATION LIST:\n");
-        display_files_list(destination);
+        if (!uses_manifest) {
+            printf("\nDESTINATION LIST:\n");
+            display_files_list(destination);
+        }
     }
     
+    SET_PROGRESS_PHASE(PROGRESS_COMPARING);
     files_list_entry_t *source_element = source->head;
     
     files_list_entry_t *checkelem;
 
     while (source_element) {
 
-        checkelem = find_entry_by_name(destination, source_element->path_and_name); 
+        if (uses_manifest) {
+            char *relative_path = source_element->path_and_name + strlen(the_config->source);
+            while (*relative_path == '/') {
+                relative_path++;
+            }
+            uint64_t lookup_start = start_stats_timer();
+            checkelem = find_manifest_entry(&destination_manifest, relative_path, &manifest_entry) == 0 ? &manifest_entry : NULL;
+            stop_stats_timer(STATS_DIFF, lookup_start);
+            if (checkelem) {
+                STATS_ADD(manifest_hits, 1);
+            }
+        } else {
+            // The destination list holds destination paths: look for the same relative path there
+            char *relative_path = source_element->path_and_name + strlen(the_config->source);
+            while (*relative_path == '/') {
+                relative_path++;
+            }
+            char *destination_path = concat_path(NULL, the_config->destination, relative_path);
+            uint64_t lookup_start = start_stats_timer();
+            checkelem = destination_path ? find_entry_by_name(destination, destination_path) : NULL;
+            stop_stats_timer(STATS_DIFF, lookup_start);
+            free(destination_path);
+        }
         if (!checkelem) {
             files_list_entry_t *temp = (files_list_entry_t*)malloc(sizeof(files_list_entry_t));
             if (!temp) {
@@ -96,7 +176,20 @@ void synchronize(configuration_t *the_config, process_context_t *p_context) {
         source_element = source_element->next;
     }
    
-    if (differences->head) {
+    // Copies that fail during this run leave the destination different from the source list
+    uint64_t failed_before = get_failed_copies();
+
+    // With --plan-out, the differences are only written for a later --apply
+    bool is_copying = !the_config->is_dry_run && the_config->plan_output_path[0] == '\0';
+    if (the_config->plan_output_path[0] != '\0') {
+        plan_writer_t plan;
+        if (open_plan(&plan, the_config) == 0) {
+            for (files_list_entry_t *cursor=differences->head; cursor!=NULL; cursor=cursor->next) {
+                write_plan_entry(&plan, cursor);
+            }
+            close_plan(&plan);
+        }
+    } else if (differences->head) {
 
         if (the_config->is_verbose || the_config->is_dry_run) {
         printf("\nDIFFERENCES LIST:\n");
@@ -105,17 +198,37 @@ void synchronize(configuration_t *the_config, process_context_t *p_context) {
 
         if (!the_config->is_dry_run) {
         
-            files_list_entry_t *diftemp = differences->head;
-
-            while (diftemp) {
-                copy_entry_to_destination(diftemp, the_config);
-                diftemp = diftemp->next;
-            } 
+            // The whole size to copy is known before the first copy, for the progress report
+            // The plan is journaled first, so that an interrupted run can be resumed
+            journal_t journal;
+            bool has_journal = open_journal(&journal, the_config, differences) == 0;
+            apply_differences(differences, the_config, has_journal ? &journal : NULL);
+            finish_durable_writes(the_config);
+            // After a failed copy, the journal is kept for --resume
+            if (has_journal) {
+                close_journal(&journal, get_failed_copies() == failed_before);
+            }
         }
     
     } else if (the_config->is_verbose) {
         printf("\nDifferences list was empty!");
     }
+    if (!differences->head && is_copying) {
+        discard_journal(the_config);
+    }
+
+    // Once the differences are applied, the destination matches the source list, unless a copy failed:
+    // a manifest left from a previous run would then describe files that are not in the destination
+    if (the_config->manifest_output_path[0] != '\0' && is_copying) {
+        if (get_failed_copies() == failed_before) {
+            save_manifest(source, the_config->source, the_config->manifest_output_path);
+        } else if (unlink(the_config->manifest_output_path) == -1 && errno != ENOENT) {
+            perror("Error removing the stale manifest");
+        }
+    }
+    if (uses_manifest) {
+        close_manifest(&destination_manifest);
+    }
 
     clear_files_list(differences);
     clear_files_list(destination);
@@ -125,6 +238,80 @@ void synchronize(configuration_t *the_config, process_context_t *p_context) {
     
 }
 
+/*!
+ * @brief apply_differences copies the differences to the destination, recording each copy in the journal
+ * @param differences is the list of the entries to copy
+ * @param the_config is a pointer to the program configuration
+ * @param journal is a pointer to the journal of the run, NULL when there is none
+ */
+static void apply_differences(files_list_t *differences, configuration_t *the_config, journal_t *journal) {
+    // The whole size to copy is known before the first copy, for the progress report
+    uint64_t total_size = 0;
+    for (files_list_entry_t *cursor=differences->head; cursor!=NULL; cursor=cursor->next) {
+        total_size += cursor->entry_type == FICHIER ? cursor->size : 0;
+    }
+    STATS_ADD(bytes_to_copy, total_size);
+    SET_PROGRESS_PHASE(PROGRESS_COPYING);
+
+    files_list_entry_t *diftemp = differences->head;
+
+    // Out of the path order, directories are all created first so that files always have a parent
+    size_t schedule_count = 0;
+    files_list_entry_t **schedule = the_config->io_order == IO_ORDER_PATH ? NULL : make_io_schedule(differences, the_config->io_order, &schedule_count);
+    while (diftemp) {
+        if (!schedule || diftemp->entry_type == DOSSIER) {
+            apply_difference(diftemp, the_config, journal);
+        }
+        diftemp = diftemp->next;
+    } 
+    for (size_t i=0; i<schedule_count && schedule; ++i) {
+        if (schedule[i]->entry_type != DOSSIER) {
+            apply_difference(schedule[i], the_config, journal);
+        }
+    }
+    free(schedule);
+}
+
+/*!
+ * @brief apply_difference copies one difference, recording it as done in the journal only when the copy succeeded
+ * A failed copy keeps its start record alone, so that --resume makes it again.
+ */
+static void apply_difference(files_list_entry_t *entry, configuration_t *the_config, journal_t *journal) {
+    uint64_t failed_before = get_failed_copies();
+    journal_copy_started(journal, entry);
+    copy_entry_to_destination(entry, the_config);
+    if (get_failed_copies() == failed_before) {
+        journal_copy_done(journal, entry);
+    }
+}
+
+/*!
+ * @brief resume_synchronize finishes the run recorded in the journal of the destination
+ * Nothing is listed nor compared: only the planned copies that are not complete are made.
+ * @param the_config is a pointer to the program configuration
+ * @return 0 when the journal was resumed, -1 if there is no journal to resume (a full run is then needed)
+ */
+static int resume_synchronize(configuration_t *the_config) {
+    files_list_t remaining = {NULL, NULL};
+    journal_t journal;
+    if (resume_journal(&journal, the_config, &remaining) == -1) {
+        if (the_config->is_verbose) {
+            printf("\nNo journal to resume, synchronizing everything\n");
+        }
+        return -1;
+    }
+    if (the_config->manifest_output_path[0] != '\0') {
+        fprintf(stderr, "Warning: no manifest is written by a resumed run\n");
+    }
+
+    uint64_t failed_before = get_failed_copies();
+    apply_differences(&remaining, the_config, &journal);
+    finish_durable_writes(the_config);
+    close_journal(&journal, get_failed_copies() == failed_before);
+    clear_files_list(&remaining);
+    return 0;
+}
+
 /*!
  * @brief mismatch tests if two files with the same name (one in source, one in destination) are equal
  * @param lhd a files list entry from the source
@@ -132,7 +319,17 @@ void synchronize(configuration_t *the_config, process_context_t *p_context) {
  * @has_md5 a value to enable or disable MD5 sum check
  * @return true if both files are not equal, false else
  */
-bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, configuration_t *the_config) {            
+bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, configuration_t *the_config) {
+    uint64_t diff_start = start_stats_timer();
+    bool is_different = entries_mismatch(lhd, rhd, the_config);
+    stop_stats_timer(STATS_DIFF, diff_start);
+    return is_different;
+}
+
+/*!
+ * @brief entries_mismatch compares two entries for mismatch, which accounts its time in the statistics
+ */
+static bool entries_mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, configuration_t *the_config) {            
     //its an invalid input
     if (!lhd || !rhd) {
         return true;
@@ -174,109 +371,255 @@ bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, configuration_t
 }
 
 /*!
- * @brief make_files_list buils a files list in no parallel mode
+ * @brief make_files_list buils a files list, analyzing files with a pool of processes in parallel mode
  * @param list is a pointer to the list that will be built
  * @param target_path is the path whose files to list
+ * @param the_config is a pointer to the program configuration (parallel mode and I/O order)
  */
-void make_files_list(files_list_t *list, char *target_path) {
+void make_files_list(files_list_t *list, char *target_path, configuration_t *the_config) {
 
     if (!list) {
         perror("\nNULL LIST WAS PROVIDED!");
         return;
     }
 
+    SET_PROGRESS_PHASE(PROGRESS_LISTING);
     make_list(list, target_path);
 
+    SET_PROGRESS_PHASE(PROGRESS_ANALYZING);
+    if (the_config->is_parallel) {
+        if (analyze_files_parallel(list, the_config) == -1) {
+            perror("\nFAILED TO ANALYZE FILES!");
+            clear_files_list(list);
+        }
+        return;
+    }
+
     files_list_entry_t *temp = list->head;
+    io_order_t io_order = the_config->io_order;
 
-    while (temp) {
-        if (get_file_stats(temp) == -1) {
+    // Files are read in the requested order, the list order is used if the schedule cannot be made
+    size_t schedule_count = 0;
+    files_list_entry_t **schedule = io_order == IO_ORDER_PATH ? NULL : make_io_schedule(list, io_order, &schedule_count);
+    for (size_t i=0; temp; ++i) {
+        if (get_file_stats(schedule ? schedule[i] : temp) == -1) {
         perror("\nFAILED TO ASSIGN VALUES TO new_entry!");
+        free(schedule);
         clear_files_list(list);
         return -1;
     	}
         temp = temp->next;
     }
+    free(schedule);
 }
 
 /*!
  * @brief make_files_lists_parallel makes both (src and dest) files list with parallel processing
+ * Each tree is listed and analyzed by its own lister process, in a shared memory arena mapped here
+ * beforehand. A lister sends a single completion message once its list is published in the arena, and
+ * the list is adopted as it is: no entry is sent through the MQ nor copied.
  * @param src_list is a pointer to the source list to build
- * @param dst_list is a pointer to the destination list to build
+ * @param dst_list is a pointer to the destination list to build, NULL to list only the source
  * @param the_config is a pointer to the program configuration
- * @param msg_queue is the id of the MQ used for communication
+ * @return 0 when both lists were built, -1 if they must be built without listers (nothing is adopted then)
  */
-void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue) {
-   
+int make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config) {
+    int msg_queue = msgget(IPC_PRIVATE, 0600 | IPC_CREAT);
+    if (msg_queue == -1) {
+        perror("ERROR with msgget");
+        return -1;
+    }
+
+    files_list_t *lists[2] = {src_list, dst_list};
+    char *targets[2] = {the_config->source, the_config->destination};
+    lister_configuration_t listers[2];
+    pid_t listers_pids[2] = {-1, -1};
+    int listers_count = dst_list ? 2 : 1;
+    process_context_t p_context;
+    p_context.processes_count = 0;
+    fflush(stdout);
+    for (int i=0; i<listers_count; ++i) {
+        listers[i].my_recipient_id = MSG_TYPE_TO_MAIN;
+        listers[i].analyzers_count = the_config->processes_count / listers_count;
+        listers[i].message_queue_id = msg_queue;
+        listers[i].target_path = targets[i];
+        listers[i].the_config = the_config;
+        listers[i].arena = create_list_arena();
+        if (listers[i].arena) {
+            listers_pids[i] = make_process(&p_context, lister_process_loop, &listers[i]);
+        }
+    }
+
+    // Completion messages carry no list: each one only tells that an arena holds a finished list
+    int result = 0;
+    for (int i=0; i<listers_count; ++i) {
+        int status;
+        any_message_t message;
+        if (listers_pids[i] == -1 || waitpid(listers_pids[i], &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS
+            || msgrcv(msg_queue, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, IPC_NOWAIT) == -1
+            || message.simple_command.message != COMMAND_CODE_LIST_COMPLETE) {
+            result = -1;
+        }
+    }
+    for (int i=0; i<listers_count; ++i) {
+        if (result == 0 && adopt_arena_list(listers[i].arena, lists[i]) == -1) {
+            fprintf(stderr, "Warning: the list of %s does not fit in shared memory, listing it again\n", targets[i]);
+            result = -1;
+        }
+    }
+    // The entries of an adopted list live in its arena: the list is forgotten and the arena unmapped once
+    for (int i=0; i<listers_count && result == -1; ++i) {
+        lists[i]->head = NULL;
+        lists[i]->tail = NULL;
+        if (listers[i].arena) {
+            destroy_list_arena(listers[i].arena);
+            listers[i].arena = NULL;
+        }
+    }
+    msgctl(msg_queue, IPC_RMID, NULL);
+    return result;
 }
 
 /*!
  * @brief copy_entry_to_destination copies a file from the source to the destination
  * It keeps access modes and mtime (@see utimensat)
  * Pay attention to the path so that the prefixes are not repeated from the source to the destination
- * Use sendfile to copy the file, mkdir to create the directory
+ * Use copy_file_data to copy the file, mkdir to create the directory
  */
-void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {         
-    if (!source_entry) {
+void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
+    uint64_t copy_start = start_stats_timer();
+    uint64_t trace_start = start_trace_span();
+    copy_entry(source_entry, the_config);
+    end_trace_span(TRACE_COPY_FILE, source_entry ? source_entry->path_and_name : NULL, trace_start);
+    stop_stats_timer(STATS_COPY, copy_start);
+}
+
+/*!
+ * @brief copy_entry copies an entry for copy_entry_to_destination, which accounts its time in the statistics
+ */
+static void copy_entry(files_list_entry_t *source_entry, configuration_t *the_config) {         
+    if (!source_entry || !the_config) {
         printf("\nInvalid Input");
+        return;
     }
     
     char destination_path[PATH_SIZE];
     char filename[PATH_SIZE];
     strncpy(destination_path, the_config->destination, PATH_SIZE - 1);
-    strncpy(filename, get_path_from_full_path(source_entry->path_and_name, the_config->source), PATH_SIZE - 1);                      
+    destination_path[PATH_SIZE - 1] = '\0';
+    char *relative_path = get_path_from_full_path(source_entry->path_and_name, the_config->source);
+    if (!relative_path) {
+        return;
+    }
+    strncpy(filename, relative_path, PATH_SIZE - 1);
+    filename[PATH_SIZE - 1] = '\0';
+    free(relative_path);
     char *destination = NULL;
     destination = concat_path(destination, destination_path, filename);
-    destination[PATH_SIZE - 1] = '\0';
-    
+    if (!destination) {
+        return;
+    }
 
     files_list_entry_t *destination_entry = (files_list_entry_t *)malloc(sizeof(files_list_entry_t));
+    if (!destination_entry) {
+        perror("\nFailed allocating memory to destination_entry");
+        free(destination);
+        return;
+    }
     
-    strncpy(destination_entry->path_and_name, destination, PATH_SIZE - 1) ;
-    
+    strncpy(destination_entry->path_and_name, destination, PATH_SIZE - 1);
+    destination_entry->path_and_name[PATH_SIZE - 1] = '\0';
+    free(destination);
     
     destination_entry->mode = source_entry->mode;
 
     if (source_entry->entry_type == FICHIER) {
-        
+
+        // Files unchanged since the previous snapshot are hard links to it instead of copies
+        if (link_previous_version(source_entry, destination_entry->path_and_name, the_config) == 0) {
+            free(destination_entry);
+            return;
+        }
+
+        // Large files that already exist in the destination only get their changed blocks rewritten
+        if (the_config->delta_threshold > 0 && source_entry->size >= the_config->delta_threshold && access(destination_entry->path_and_name, F_OK) == 0) {
+            uint64_t written_bytes = 0;
+            if (delta_copy_file(source_entry->path_and_name, destination_entry->path_and_name, source_entry->size, destination_entry->mode, &written_bytes) == 0) {
+                STATS_ADD(copies[STATS_COPY_DELTA], 1);
+                STATS_ADD(copied_bytes[STATS_COPY_DELTA], written_bytes);
+                STATS_ADD(bytes_copied, written_bytes);
+                if (the_config->is_verbose) {
+                    printf("\nDelta update of %s: %lu of %lu bytes written", destination_entry->path_and_name, (unsigned long)written_bytes, (unsigned long)source_entry->size);
+                }
+                struct timespec times[2];
+                times[0] = source_entry->mtime;
+                times[1] = source_entry->mtime;
+                if (utimensat(AT_FDCWD, destination_entry->path_and_name, times, 0) == -1) {
+                    perror("Error setting modification time");
+                }
+                free(destination_entry);
+                return;
+            }
+        }
+
+            // The file is written under a temporary name, so the destination name never shows a partial copy
+            char temp_path[PATH_SIZE];
             int source_fd = open(source_entry->path_and_name, O_RDONLY); 
-            int dest_fd = open(destination_entry->path_and_name, O_WRONLY | O_CREAT | O_TRUNC, destination_entry->mode);
-            //int dest_fd = open(destination_entry->path_and_name, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG | S_IRWXO);
+            int dest_fd = source_fd == -1 ? -1 : open_temp_file(destination_entry->path_and_name, temp_path);
             if (source_fd == -1 || dest_fd == -1) {
                 if (source_fd == -1) printf("\nSOURCE FIND == -1");
-                if (dest_fd == -1) printf("\nDEST FIND == -1");
+                if (dest_fd == -1) perror(destination_entry->path_and_name);
                 printf("\nERROR OPENING FILES!!!!");
+                if (source_fd != -1) close(source_fd);
+                count_failed_copy(the_config);
                 free(destination_entry);
                 return;
             }
 
-            off_t offset = 0;
-            ssize_t bytes_copied = sendfile(dest_fd, source_fd, &offset, source_entry->size);
+            // Preallocated, written in chunks sized for the destination, and by several processes for huge files
+            uint64_t copied = 0;
+            ssize_t bytes_copied = copy_file_data(source_fd, dest_fd, source_entry->size, &copied) == -1 ? -1 : (ssize_t)copied;
 
             if (bytes_copied == -1) {
                 printf("\nERROR WHEN WRITTING IN THE DESTINATION FILE!");
                 close(source_fd);
                 close(dest_fd);
+                unlink(temp_path);
+                count_failed_copy(the_config);
                 free(destination_entry);
                 return;
             }
+            STATS_ADD(copies[STATS_COPY_FULL], 1);
+            STATS_ADD(copied_bytes[STATS_COPY_FULL], bytes_copied);
+            STATS_ADD(bytes_copied, bytes_copied);
 
             struct timespec times[2];
             times[0] = source_entry->mtime;  // atime
             times[1] = source_entry->mtime;  // mtime
 
-            if (utimensat(AT_FDCWD, destination_entry->path_and_name, times, 0) == -1) {   
+            if (fchmod(dest_fd, destination_entry->mode & 07777) == -1) {
+                perror("Error setting access modes");
+            }
+            if (futimens(dest_fd, times) == -1) {   
                 perror("Error setting modification time");
             }
 
             close(source_fd);
-            close(dest_fd);
+            if (close(dest_fd) == -1) {
+                perror("Error writing destination file");
+                unlink(temp_path);
+                count_failed_copy(the_config);
+            } else if (commit_temp_file(temp_path, destination_entry->path_and_name, bytes_copied, the_config) == -1) {
+                count_failed_copy(the_config);
+            }
         
     } else if (source_entry->entry_type == DOSSIER) {
             if (mkdir(destination_entry->path_and_name, S_IRWXU | S_IRWXG | S_IRWXO) == -1) {  
                 perror("Error creating directory");
+                free(destination_entry);
                 return;
             }
+            STATS_ADD(copies[STATS_COPY_DIRECTORY], 1);
 
             struct timespec times[2];
             times[0] = source_entry->mtime;
@@ -291,6 +634,7 @@ void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t
         
     }
 
+    free(destination_entry);
 }
 
 /*!
@@ -302,12 +646,24 @@ void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t
  */
 //have to take care when initialising the tial of the list!!!
 void make_list(files_list_t *list, char *target) {
+    make_tree_list(list, target, target);
+}
+
+/*!
+ * @brief make_tree_list lists a directory of a tree for make_list, skipping the entries excluded by the filter rules
+ * An excluded directory is neither added nor opened, so nothing in its subtree is listed nor analyzed.
+ * @param list is a pointer to the list that will be built
+ * @param root is the root of the tree, filter rules apply to the paths relative to it
+ * @param target is the dir whose content must be listed
+ */
+static void make_tree_list(files_list_t *list, char *root, char *target) {
     // Verification de la liste afin de voir si elle est vide
     if (!list) {
         perror("\nNULL LIST WAS PROVIDED!");
         return;
     }
 
+    uint64_t trace_start = start_trace_span();
     DIR *dir = open_dir(target);
     
     if (dir == NULL) {
@@ -323,28 +679,28 @@ void make_list(files_list_t *list, char *target) {
         }
 
         char *file_path = concat_path(file_path, target, entry->d_name);
-
-        files_list_entry_t *new_entry = (files_list_entry_t *)malloc(sizeof(files_list_entry_t));
-
-        if (!new_entry) {
-            perror("Error allocating memory for new_entry");
-            closedir(dir);
-            return;
+        if (!file_path || is_path_excluded(root, file_path, entry->d_type)) {
+            free(file_path);
+            continue;
         }
 
-        strcpy(new_entry->path_and_name, file_path);
-
-
-        if (add_file_entry(list, new_entry->path_and_name) == -1) {
+        // A list that no longer fits in its arena is listed again by the main process
+        if (add_file_entry(list, file_path) == -1) {
+            if (the_list_arena && the_list_arena->has_overflowed) {
+                free(file_path);
+                break;
+            }
             perror("\nERROR IN FUCNTION add_file_entry!");
         }
         
         if (entry->d_type == DT_DIR) {
-            make_list(list, file_path);
+            make_tree_list(list, root, file_path);
         }
+        free(file_path);
         
     }
     closedir(dir);
+    end_trace_span(TRACE_LIST_DIR, target, trace_start);
 }
 
 /*!
@@ -354,7 +710,9 @@ void make_list(files_list_t *list, char *target) {
  */
 
 DIR *open_dir(char *path) {
+    uint64_t listing_start = start_stats_timer();
     DIR *dir = opendir(path); 
+    stop_stats_timer(STATS_LISTING, listing_start);
 
     if (dir == NULL) {
         perror("Erreur lors de l'ouverture du répertoire"); 
@@ -371,14 +729,22 @@ DIR *open_dir(char *path) {
  */
 struct dirent *get_next_entry(DIR *dir) {
     struct dirent *entry;
+    uint64_t listing_start = start_stats_timer();
 
     while ((entry = readdir(dir)) != NULL) {
         // Ignore les entrées '.' et '..'
         if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            if (entry->d_type == DT_DIR) {
+                STATS_ADD(directories_scanned, 1);
+            } else {
+                STATS_ADD(files_scanned, 1);
+            }
+            stop_stats_timer(STATS_LISTING, listing_start);
             return entry; // Renvoie l'entrée valide
         }
     }
 
+    stop_stats_timer(STATS_LISTING, listing_start);
     return NULL; // Fin du répertoire ou erreur
 }
 
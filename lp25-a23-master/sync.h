@@ -3,13 +3,14 @@
 #include <stdbool.h>
 #include <files-list.h>
 #include <configuration.h>
+#include <io-order.h>
 #include <processes.h>
 #include <dirent.h>
 
 void synchronize(configuration_t *the_config, process_context_t *p_context);
-void make_files_list(files_list_t *list, char *target_path);
+void make_files_list(files_list_t *list, char *target_path, configuration_t *the_config);
 bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, configuration_t *the_config);  //moved the bool from the arguments
-void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue);         
+int make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config);         
 void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config);
 void make_list(files_list_t *list, char *target);
 DIR *open_dir(char *path);
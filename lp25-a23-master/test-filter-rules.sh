@@ -0,0 +1,60 @@
+#!/bin/sh
+# Filter rules select the same entries in the listing of the trees and in the streaming walk, which does not
+# know the type of an entry before it looks at it: anchored, name and directory-only rules, * and **, and the
+# first matching rule deciding between an include and an exclude.
+set -e
+
+BACKUP=${1:-./lp25-backup}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/source/sub/cache" "$WORK/source/cache" "$WORK/source/a/b/c" "$WORK/source/other"
+mkdir -p "$WORK/listed" "$WORK/streamed" "$WORK/options" "$WORK/reversed"
+for file in top.log sub/top.log sub/scratch.tmp keep.tmp a/b/x a/b/c/x a/b/y a/b/c/y sub/cache/data cache/data other/cache; do
+    echo "$file" > "$WORK/source/$file"
+done
+cat > "$WORK/rules" << EOF
+# Anchored at the root of the trees
+- /top.log
++ keep.tmp
+- *.tmp
+- cache/
+- /a/*/x
+- /a/**/y
+EOF
+
+# Each entry is expected to be either copied or skipped
+check() {
+    destination=$1
+    mode=$2
+    for file in sub/top.log keep.tmp a/b/c/x other/cache; do
+        if [ ! -f "$destination/$file" ]; then
+            echo "FAIL: $file was not copied$mode"
+            exit 1
+        fi
+    done
+    for file in top.log sub/scratch.tmp a/b/x a/b/y a/b/c/y cache sub/cache; do
+        if [ -e "$destination/$file" ]; then
+            echo "FAIL: $file was copied$mode"
+            exit 1
+        fi
+    done
+}
+
+"$BACKUP" --filter-from="$WORK/rules" "$WORK/source" "$WORK/listed" > /dev/null
+check "$WORK/listed" ""
+"$BACKUP" --streaming --filter-from="$WORK/rules" "$WORK/source" "$WORK/streamed" > /dev/null
+check "$WORK/streamed" " with --streaming"
+
+# The same rules given on the command line, in the same order
+"$BACKUP" --exclude=/top.log --include=keep.tmp --exclude='*.tmp' --exclude=cache/ --exclude='/a/*/x' --exclude='/a/**/y' \
+    "$WORK/source" "$WORK/options" > /dev/null
+check "$WORK/options" " with command line rules"
+
+# An exclude given before the include wins
+"$BACKUP" --exclude='*.tmp' --include=keep.tmp "$WORK/source" "$WORK/reversed" > /dev/null
+if [ -e "$WORK/reversed/keep.tmp" ]; then
+    echo "FAIL: keep.tmp was copied although its exclude rule comes first"
+    exit 1
+fi
+echo "PASS: filter rules"
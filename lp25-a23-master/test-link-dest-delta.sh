@@ -0,0 +1,36 @@
+#!/bin/sh
+# A snapshot made with --link-dest shares the inodes of its unchanged files with the previous one: a later
+# --delta-threshold run into the new snapshot must not rewrite those files in place, which would change the
+# previous snapshot too.
+set -e
+
+BACKUP=${1:-./lp25-backup}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/source/a" "$WORK/s1" "$WORK/s2"
+head -c 4M /dev/urandom > "$WORK/source/a/huge"
+echo small > "$WORK/source/a/small"
+
+"$BACKUP" "$WORK/source" "$WORK/s1" > /dev/null
+"$BACKUP" --link-dest="$WORK/s1" "$WORK/source" "$WORK/s2" > /dev/null
+if [ "$(stat -c %i "$WORK/s1/a/huge")" != "$(stat -c %i "$WORK/s2/a/huge")" ]; then
+    echo "FAIL: a/huge was not linked to the previous snapshot"
+    exit 1
+fi
+previous_sum=$(md5sum < "$WORK/s1/a/huge")
+
+# One block changed in place, with a new mtime, so that the delta would be applied in place
+printf 'changed' | dd of="$WORK/source/a/huge" bs=1 seek=65536 conv=notrunc 2> /dev/null
+touch -d '+1 minute' "$WORK/source/a/huge"
+"$BACKUP" --delta-threshold=1M "$WORK/source" "$WORK/s2" > /dev/null
+
+if [ "$(md5sum < "$WORK/s1/a/huge")" != "$previous_sum" ]; then
+    echo "FAIL: the delta run changed the previous snapshot"
+    exit 1
+fi
+if ! cmp -s "$WORK/source/a/huge" "$WORK/s2/a/huge"; then
+    echo "FAIL: the new snapshot does not match the source"
+    exit 1
+fi
+echo "PASS: link-dest then delta"
@@ -0,0 +1,60 @@
+#!/bin/sh
+# A plan written by --plan-out copies nothing, and --apply makes the destination match the source from it
+# alone. The reader accepts plans edited by other tools (keys in any order, unknown keys, spaces, \u escapes),
+# and refuses invalid or truncated plans and paths leaving the trees without copying anything.
+set -e
+
+BACKUP=${1:-./lp25-backup}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/source/d/e" "$WORK/destination" "$WORK/edited" "$WORK/refused"
+echo b > "$WORK/source/d/b"
+echo quoted > "$WORK/source/d/e/we\"ird\\name"
+head -c 1M /dev/urandom > "$WORK/source/large"
+printf 'x' > "$WORK/source/caf$(printf '\303\251')"
+
+"$BACKUP" --plan-out="$WORK/plan" "$WORK/source" "$WORK/destination" > /dev/null
+if [ -n "$(ls -A "$WORK/destination")" ]; then
+    echo "FAIL: --plan-out copied files"
+    exit 1
+fi
+if ! tail -n 1 "$WORK/plan" | grep -q '"end":true,"entries":6'; then
+    echo "FAIL: the plan does not end with its 6 entries"
+    exit 1
+fi
+"$BACKUP" --apply="$WORK/plan" "$WORK/source" "$WORK/destination" > /dev/null
+if ! diff -r "$WORK/source" "$WORK/destination" > /dev/null; then
+    echo "FAIL: the applied plan does not match the source"
+    exit 1
+fi
+
+# Written by hand: keys in another order, an unknown key holding braces and quotes, spaces, an escaped name
+mtime=$(stat -c %Y "$WORK/source/caf$(printf '\303\251')")
+cat > "$WORK/edited.plan" << EOF
+{ "version" : 1, "plan" : "lp25" }
+{ "mtime" : [ $mtime, 0 ], "note" : { "list" : [ 1, "}\"]" ] }, "mode" : "0644", "path" : "caf\u00e9", "op" : "create", "size" : 1 }
+{"end":true,"entries":1}
+EOF
+"$BACKUP" --apply="$WORK/edited.plan" "$WORK/source" "$WORK/edited" > /dev/null 2>&1
+if [ "$(ls "$WORK/edited")" != "caf$(printf '\303\251')" ]; then
+    echo "FAIL: the edited plan was not applied"
+    exit 1
+fi
+
+# Nothing is applied from a plan with a path leaving the trees, nor from a truncated plan
+head -n 1 "$WORK/plan" > "$WORK/unsafe.plan"
+echo '{"op":"create","path":"../outside","size":1,"mode":"0644","mtime":[0,0]}' >> "$WORK/unsafe.plan"
+echo '{"end":true,"entries":1}' >> "$WORK/unsafe.plan"
+head -n 3 "$WORK/plan" > "$WORK/truncated.plan"
+for plan in unsafe truncated; do
+    if "$BACKUP" --apply="$WORK/$plan.plan" "$WORK/source" "$WORK/refused" > /dev/null 2>&1; then
+        echo "FAIL: the $plan plan was accepted"
+        exit 1
+    fi
+    if [ -n "$(ls -A "$WORK/refused")" ] || [ -e "$WORK/outside" ]; then
+        echo "FAIL: the $plan plan was partly applied"
+        exit 1
+    fi
+done
+echo "PASS: plan then apply"
@@ -0,0 +1,60 @@
+#!/bin/sh
+# A run whose copies fail keeps its journal without vouching for the failed copies: they are not recorded as
+# done, and with durable writes, whose renames fail later, no checkpoint follows them. --resume then only makes
+# the copies left, and removes the journal once the destination matches the source.
+set -e
+
+BACKUP=${1:-./lp25-backup}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/source"
+for file in a b c; do
+    echo "$file" > "$WORK/source/$file"
+done
+
+for mode in durable no-sync; do
+    destination="$WORK/$mode"
+    options=$([ "$mode" = no-sync ] && echo --no-sync || true)
+    # A directory in the way of b makes its copy fail
+    mkdir -p "$destination/b/blocker"
+    if "$BACKUP" $options "$WORK/source" "$destination" > /dev/null 2>&1; then
+        echo "FAIL: the run succeeded although b could not be copied ($mode)"
+        exit 1
+    fi
+    if [ ! -f "$destination/.lp25-journal" ]; then
+        echo "FAIL: the journal was removed after a failed copy ($mode)"
+        exit 1
+    fi
+    if grep -q '^C$' "$destination/.lp25-journal"; then
+        echo "FAIL: a checkpoint vouches for the failed copy of b ($mode)"
+        exit 1
+    fi
+    if [ "$mode" = no-sync ] && grep -q '^D b$' "$destination/.lp25-journal"; then
+        echo "FAIL: the failed copy of b was recorded as done ($mode)"
+        exit 1
+    fi
+
+    rm -r "$destination/b"
+    if ! "$BACKUP" $options --resume -v "$WORK/source" "$destination" | grep -q 'Resuming: 2 of 3 planned entries already copied'; then
+        echo "FAIL: the resumed run did not keep the copies already made ($mode)"
+        exit 1
+    fi
+    if [ -e "$destination/.lp25-journal" ]; then
+        echo "FAIL: the journal was kept after a complete resumed run ($mode)"
+        exit 1
+    fi
+    if ! diff -r "$WORK/source" "$destination" > /dev/null; then
+        echo "FAIL: the destination does not match the source after --resume ($mode)"
+        exit 1
+    fi
+done
+
+# Without a journal, --resume synchronizes everything
+echo changed > "$WORK/source/a"
+"$BACKUP" --resume "$WORK/source" "$WORK/durable" > /dev/null
+if ! diff -r "$WORK/source" "$WORK/durable" > /dev/null; then
+    echo "FAIL: --resume without a journal did not synchronize"
+    exit 1
+fi
+echo "PASS: resume from the journal"
@@ -0,0 +1,247 @@
+#define _DEFAULT_SOURCE // nanosleep and sigaction with strict compilers
+
+#include <throttle.h>
+#include <stats.h>
+#include <utility.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// Not exported by the C library
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+
+throttle_state_t *the_throttle = NULL;
+
+static const char *bucket_names[THROTTLE_BUCKETS_COUNT] = {"read", "write", "read-iops", "write-iops"};
+
+/*!
+ * @brief now_ns returns the monotonic time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief request_reload is the SIGHUP handler: the control file is read again before the next I/O
+ */
+static void request_reload(int signal_number) {
+    if (the_throttle) {
+        __atomic_store_n(&the_throttle->is_reload_requested, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief load_throttle_limits reads the limits from a control file
+ * The file has one "name=value" line per limit, names being read, write (bytes per second, with the
+ * suffixes of parse_size), read-iops and write-iops. A value of 0 removes the limit, lines starting
+ * with # are ignored, and limits not present in the file are left unchanged.
+ * @param control_path is the path of the file
+ * @param rates is the array of limits to update
+ * @return 0 when ok, -1 if the file cannot be read or has an invalid line
+ */
+int load_throttle_limits(char *control_path, uint64_t rates[THROTTLE_BUCKETS_COUNT]) {
+    FILE *file = fopen(control_path, "r");
+    if (!file) {
+        perror("Error reading I/O limits");
+        return -1;
+    }
+
+    uint64_t new_rates[THROTTLE_BUCKETS_COUNT];
+    memcpy(new_rates, rates, sizeof(new_rates));
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *name = line + strspn(line, " \t");
+        if (*name == '\0' || *name == '#') {
+            continue;
+        }
+        char *value = strchr(name, '=');
+        int bucket = THROTTLE_BUCKETS_COUNT;
+        if (value) {
+            *value++ = '\0';
+            name[strcspn(name, " \t")] = '\0';
+            for (bucket=0; bucket<THROTTLE_BUCKETS_COUNT && strcmp(name, bucket_names[bucket]) != 0; ++bucket);
+        }
+        if (bucket == THROTTLE_BUCKETS_COUNT || parse_size(value + strspn(value, " \t"), &new_rates[bucket]) == -1) {
+            fprintf(stderr, "Error: invalid I/O limit at %s:%d\n", control_path, line_number);
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+
+    memcpy(rates, new_rates, sizeof(new_rates));
+    return 0;
+}
+
+/*!
+ * @brief init_throttle maps the shared limits and installs the SIGHUP handler
+ * It must be called before any process is created, so that all the workers draw from the same budget.
+ * @param rates are the initial limits, in units per second (0 for no limit)
+ * @param control_path is the control file, read at start and again when it changes or on SIGHUP; NULL or empty for none
+ * @return 0 when ok, -1 in case of error
+ */
+int init_throttle(uint64_t rates[THROTTLE_BUCKETS_COUNT], char *control_path) {
+    void *map = mmap(NULL, sizeof(throttle_state_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping I/O limits");
+        return -1;
+    }
+    memset(map, 0, sizeof(throttle_state_t));
+    throttle_state_t *state = map;
+    memcpy(state->rates, rates, sizeof(state->rates));
+
+    if (control_path && control_path[0] != '\0') {
+        strncpy(state->control_path, control_path, sizeof(state->control_path) - 1);
+        struct stat control_stat;
+        if (stat(control_path, &control_stat) == -1) {
+            perror("Error reading I/O limits");
+            munmap(map, sizeof(throttle_state_t));
+            return -1;
+        }
+        if (load_throttle_limits(control_path, state->rates) == -1) {
+            munmap(map, sizeof(throttle_state_t));
+            return -1;
+        }
+        state->control_mtime_ns = (int64_t)control_stat.st_mtim.tv_sec * 1000000000LL + control_stat.st_mtim.tv_nsec;
+    }
+    state->last_check_ns = now_ns();
+    the_throttle = state;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_reload;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, NULL);
+    return 0;
+}
+
+/*!
+ * @brief check_control_file reads the control file again when it changed or a reload was requested
+ * Only one process does the check at a time, the others keep the current limits.
+ * @param now is the current monotonic time
+ */
+static void check_control_file(uint64_t now) {
+    uint64_t last_check = __atomic_load_n(&the_throttle->last_check_ns, __ATOMIC_RELAXED);
+    bool is_requested = __atomic_load_n(&the_throttle->is_reload_requested, __ATOMIC_RELAXED);
+    if ((!is_requested && now - last_check < THROTTLE_CHECK_NS)
+        || !__atomic_compare_exchange_n(&the_throttle->last_check_ns, &last_check, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    __atomic_store_n(&the_throttle->is_reload_requested, 0, __ATOMIC_RELAXED);
+    if (the_throttle->control_path[0] == '\0') {
+        return;
+    }
+
+    struct stat control_stat;
+    if (stat(the_throttle->control_path, &control_stat) == -1) {
+        return;
+    }
+    int64_t mtime_ns = (int64_t)control_stat.st_mtim.tv_sec * 1000000000LL + control_stat.st_mtim.tv_nsec;
+    if (!is_requested && mtime_ns == the_throttle->control_mtime_ns) {
+        return;
+    }
+    the_throttle->control_mtime_ns = mtime_ns;
+
+    uint64_t rates[THROTTLE_BUCKETS_COUNT];
+    for (int i=0; i<THROTTLE_BUCKETS_COUNT; ++i) {
+        rates[i] = __atomic_load_n(&the_throttle->rates[i], __ATOMIC_RELAXED);
+    }
+    if (load_throttle_limits(the_throttle->control_path, rates) == 0) {
+        for (int i=0; i<THROTTLE_BUCKETS_COUNT; ++i) {
+            __atomic_store_n(&the_throttle->rates[i], rates[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*!
+ * @brief reserve_budget takes units from a bucket
+ * Each bucket only keeps the time at which all the units handed out so far are paid back at the current
+ * rate, so it is updated with a single compare and swap and works across processes.
+ * @param bucket is the bucket to draw from
+ * @param units is the number of units to take
+ * @param now is the current monotonic time
+ * @return the time at which the caller may proceed
+ */
+static uint64_t reserve_budget(throttle_bucket_t bucket, uint64_t units, uint64_t now) {
+    uint64_t rate = __atomic_load_n(&the_throttle->rates[bucket], __ATOMIC_RELAXED);
+    if (rate == 0 || units == 0) {
+        return now;
+    }
+    uint64_t cost = (uint64_t)((double)units * 1e9 / rate);
+    uint64_t next_free = __atomic_load_n(&the_throttle->next_free_ns[bucket], __ATOMIC_RELAXED);
+    uint64_t start;
+    do {
+        // Budget left unused for longer than the burst allowance is lost
+        start = next_free + THROTTLE_BURST_NS > now ? next_free : now - THROTTLE_BURST_NS;
+    } while (!__atomic_compare_exchange_n(&the_throttle->next_free_ns[bucket], &next_free, start + cost, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return start + cost > now + THROTTLE_BURST_NS ? start + cost - THROTTLE_BURST_NS : now;
+}
+
+/*!
+ * @brief throttle_io waits until one more read or write operation of a given size fits in the limits
+ * Callers shall split their I/O in chunks of at most THROTTLE_CHUNK_SIZE, so that waits stay short
+ * and the budget is shared fairly between workers. Does nothing when I/O is not limited.
+ * @param bytes_bucket is THROTTLE_READ_BYTES or THROTTLE_WRITE_BYTES
+ * @param bytes is the size of the operation
+ */
+void throttle_io(throttle_bucket_t bytes_bucket, uint64_t bytes) {
+    if (!the_throttle) {
+        return;
+    }
+    uint64_t now = now_ns();
+    check_control_file(now);
+
+    throttle_bucket_t ops_bucket = bytes_bucket == THROTTLE_READ_BYTES ? THROTTLE_READ_OPS : THROTTLE_WRITE_OPS;
+    uint64_t bytes_time = reserve_budget(bytes_bucket, bytes, now);
+    uint64_t ops_time = reserve_budget(ops_bucket, 1, now);
+    uint64_t wake_time = bytes_time > ops_time ? bytes_time : ops_time;
+    if (wake_time > now) {
+        uint64_t wait = wake_time - now;
+        struct timespec delay = {.tv_sec=wait / 1000000000ULL, .tv_nsec=wait % 1000000000ULL};
+        while (nanosleep(&delay, &delay) == -1);
+        STATS_ADD(throttled_ns, wait);
+    }
+}
+
+/*!
+ * @brief set_io_priority sets the I/O scheduling class of the calling process, inherited by the processes it creates
+ * @param io_class is "idle", or "best-effort" with an optional level from 0 (highest) to 7, e.g. "best-effort:7"
+ * @return 0 when ok, -1 if the class is invalid or cannot be set
+ */
+int set_io_priority(char *io_class) {
+    int class_value;
+    int level = 0;
+    if (strcmp(io_class, "idle") == 0) {
+        class_value = IOPRIO_CLASS_IDLE;
+    } else if (strncmp(io_class, "best-effort", 11) == 0 && (io_class[11] == '\0' || io_class[11] == ':')) {
+        class_value = IOPRIO_CLASS_BE;
+        level = io_class[11] == ':' ? atoi(io_class + 12) : 4;
+        if (level < 0 || level > 7) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (class_value << IOPRIO_CLASS_SHIFT) | level) == -1) {
+        perror("Error setting I/O priority");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+#define THROTTLE_CHUNK_SIZE (1 << 20) // Largest read or write issued at once when I/O is limited
+#define THROTTLE_BURST_NS 100000000ULL // Unused budget kept for bursts, as a duration at the current rate
+#define THROTTLE_CHECK_NS 1000000000ULL // Delay between two checks of the control file for changes
+
+typedef enum { THROTTLE_READ_BYTES, THROTTLE_WRITE_BYTES, THROTTLE_READ_OPS, THROTTLE_WRITE_OPS, THROTTLE_BUCKETS_COUNT } throttle_bucket_t;
+
+typedef struct {
+    uint64_t rates[THROTTLE_BUCKETS_COUNT]; // Units per second, 0 for no limit
+    uint64_t next_free_ns[THROTTLE_BUCKETS_COUNT]; // Time at which all the budget handed out so far is paid back
+    uint64_t last_check_ns; // Last check of the control file, claimed by one process at a time
+    int64_t control_mtime_ns; // Modification time of the control file when it was last read
+    uint32_t is_reload_requested; // Set by SIGHUP
+    char control_path[1024]; // Empty when limits are only set on the command line
+} throttle_state_t;
+
+// Limits shared by the main process and its children, NULL when I/O is not limited
+extern throttle_state_t *the_throttle;
+
+int init_throttle(uint64_t rates[THROTTLE_BUCKETS_COUNT], char *control_path);
+int load_throttle_limits(char *control_path, uint64_t rates[THROTTLE_BUCKETS_COUNT]);
+void throttle_io(throttle_bucket_t bytes_bucket, uint64_t bytes);
+int set_io_priority(char *io_class);
@@ -0,0 +1,189 @@
+#include <trace.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+trace_buffer_t *the_trace = NULL;
+
+static trace_worker_t *my_worker = NULL; // Buffer of this process, claimed on its first event
+static char my_worker_name[sizeof(((trace_worker_t *)0)->name)] = "main";
+
+static const char *category_names[TRACE_CATEGORIES_COUNT] = {"list_dir", "analyze_file", "copy_file", "mq_wait"};
+
+/*!
+ * @brief now_ns returns the monotonic time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief forget_worker makes a new child process claim its own buffer (@see pthread_atfork)
+ */
+static void forget_worker() {
+    my_worker = NULL;
+    strcpy(my_worker_name, "worker");
+}
+
+/*!
+ * @brief init_trace maps the shared event buffers
+ * It must be called before any process is created. Pages are only allocated when events are written.
+ * @return 0 when ok, -1 if the buffers cannot be mapped
+ */
+int init_trace() {
+    void *map = mmap(NULL, sizeof(trace_buffer_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping trace buffers");
+        return -1;
+    }
+    the_trace = map;
+    the_trace->origin_ns = now_ns();
+    pthread_atfork(NULL, NULL, forget_worker);
+    return 0;
+}
+
+/*!
+ * @brief claim_worker returns the buffer of the calling process, claiming a free one the first time
+ * @return the buffer, NULL when all of them are used
+ */
+static trace_worker_t *claim_worker() {
+    if (!my_worker) {
+        uint32_t index = __atomic_fetch_add(&the_trace->next_worker, 1, __ATOMIC_RELAXED);
+        if (index >= TRACE_MAX_WORKERS) {
+            return NULL;
+        }
+        my_worker = &the_trace->workers[index];
+        my_worker->pid = getpid();
+        strcpy(my_worker->name, my_worker_name);
+    }
+    return my_worker;
+}
+
+/*!
+ * @brief set_trace_worker_name names the calling process in the trace
+ * @param name is the name, e.g. "copier"
+ */
+void set_trace_worker_name(char *name) {
+    strncpy(my_worker_name, name, sizeof(my_worker_name) - 1);
+    if (my_worker) {
+        strcpy(my_worker->name, my_worker_name);
+    }
+}
+
+/*!
+ * @brief start_trace_span starts timing an event
+ * @return the current time, 0 when tracing is disabled (the clock is then not read)
+ */
+uint64_t start_trace_span() {
+    return the_trace ? now_ns() : 0;
+}
+
+/*!
+ * @brief end_trace_span records an event in the buffer of the calling process
+ * Each process only writes its own buffer, so no lock nor atomic operation is needed past the first event.
+ * @param category is the kind of event
+ * @param name is the path the event is about, only its end is kept if it is too long
+ * @param start is the value returned by start_trace_span
+ */
+void end_trace_span(trace_category_t category, char *name, uint64_t start) {
+    if (!the_trace) {
+        return;
+    }
+    uint64_t end = now_ns();
+    trace_worker_t *worker = claim_worker();
+    if (!worker) {
+        return;
+    }
+    if (worker->count == TRACE_EVENTS_PER_WORKER) {
+        worker->dropped++;
+        return;
+    }
+
+    trace_event_t *event = &worker->events[worker->count];
+    event->start_ns = start - the_trace->origin_ns;
+    event->duration_ns = end - start;
+    event->category = category;
+    size_t length = name ? strlen(name) : 0;
+    char *tail = length >= TRACE_NAME_SIZE ? name + length - (TRACE_NAME_SIZE - 1) : name;
+    strncpy(event->name, tail ? tail : "", TRACE_NAME_SIZE - 1);
+    event->name[TRACE_NAME_SIZE - 1] = '\0';
+    // The event is complete before it is counted, so a reader never sees a half-written event
+    __atomic_store_n(&worker->count, worker->count + 1, __ATOMIC_RELEASE);
+}
+
+/*!
+ * @brief write_json_string writes a string with JSON escaping
+ */
+static void write_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for (const unsigned char *cursor=(const unsigned char *)text; *cursor; ++cursor) {
+        if (*cursor == '"' || *cursor == '\\') {
+            fputc('\\', file);
+            fputc(*cursor, file);
+        } else if (*cursor < 0x20) {
+            fprintf(file, "\\u%04x", *cursor);
+        } else {
+            fputc(*cursor, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/*!
+ * @brief save_trace writes all the recorded events in the Chrome trace event format
+ * The file can be opened with chrome://tracing or https://ui.perfetto.dev. Each process is shown as a
+ * thread of the main process, named after its role.
+ * @param trace_path is the path of the file to write
+ * @return 0 when ok, -1 in case of error
+ */
+int save_trace(char *trace_path) {
+    if (!the_trace) {
+        return -1;
+    }
+    FILE *file = fopen(trace_path, "w");
+    if (!file) {
+        perror("Error writing trace");
+        return -1;
+    }
+
+    pid_t main_pid = getpid();
+    uint32_t workers_count = __atomic_load_n(&the_trace->next_worker, __ATOMIC_ACQUIRE);
+    if (workers_count > TRACE_MAX_WORKERS) {
+        workers_count = TRACE_MAX_WORKERS;
+    }
+    unsigned long dropped = 0;
+    bool is_first = true;
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (uint32_t i=0; i<workers_count; ++i) {
+        trace_worker_t *worker = &the_trace->workers[i];
+        uint32_t count = __atomic_load_n(&worker->count, __ATOMIC_ACQUIRE);
+        dropped += worker->dropped;
+
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": ", is_first ? "" : ",\n", main_pid, worker->pid);
+        write_json_string(file, worker->name);
+        fprintf(file, "}}");
+        is_first = false;
+
+        for (uint32_t j=0; j<count; ++j) {
+            trace_event_t *event = &worker->events[j];
+            fprintf(file, ",\n{\"name\": ");
+            write_json_string(file, event->name);
+            fprintf(file, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d}",
+                    category_names[event->category < TRACE_CATEGORIES_COUNT ? event->category : 0], event->start_ns / 1e3,
+                    event->duration_ns / 1e3, main_pid, worker->pid);
+        }
+    }
+    fprintf(file, "\n], \"otherData\": {\"dropped_events\": \"%lu\"}}\n", dropped);
+
+    if (fclose(file) != 0) {
+        perror("Error writing trace");
+        return -1;
+    }
+    return 0;
+}
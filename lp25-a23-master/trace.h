@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TRACE_MAX_WORKERS 32 // Processes that can record events; later ones are not traced
+#define TRACE_EVENTS_PER_WORKER 65536 // Events kept per process, the following ones are dropped
+#define TRACE_NAME_SIZE 104
+#define TRACE_BLOCKED_SEND_NS 50000 // MQ sends taking longer than this are recorded as waits
+
+typedef enum { TRACE_LIST_DIR, TRACE_ANALYZE_FILE, TRACE_COPY_FILE, TRACE_MQ_WAIT, TRACE_CATEGORIES_COUNT } trace_category_t;
+
+typedef struct {
+    uint64_t start_ns; // Since the start of the trace
+    uint64_t duration_ns;
+    uint32_t category;
+    char name[TRACE_NAME_SIZE]; // End of the path the event is about
+} trace_event_t;
+
+typedef struct {
+    pid_t pid;
+    char name[28];
+    uint32_t count; // Written only by the owner of the buffer
+    uint32_t dropped;
+    trace_event_t events[TRACE_EVENTS_PER_WORKER];
+} trace_worker_t;
+
+typedef struct {
+    uint64_t origin_ns; // Monotonic time of the start of the trace
+    uint32_t next_worker; // Claimed atomically by each process on its first event
+    uint32_t padding;
+    trace_worker_t workers[TRACE_MAX_WORKERS];
+} trace_buffer_t;
+
+// Buffer shared by the main process and its children, NULL when --trace is not used
+extern trace_buffer_t *the_trace;
+
+int init_trace();
+void set_trace_worker_name(char *name);
+uint64_t start_trace_span();
+void end_trace_span(trace_category_t category, char *name, uint64_t start);
+int save_trace(char *trace_path);
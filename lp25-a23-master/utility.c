@@ -1,4 +1,4 @@
-#include <defines.h>
+#include <utility.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -55,3 +55,50 @@ char *concat_path(char *result, char *prefix, char *suffix) {
     return result;
 }
 
+
+
+/*!
+ * @brief parse_size converts a human readable size into a number of bytes
+ * Accepted suffixes are K, M, G and T (powers of 1024), case insensitive, with an optional trailing B
+ * @param text the string to convert, e.g. "64M" or "2G"
+ * @param size a pointer to the variable receiving the number of bytes
+ * @return 0 when ok, -1 if text is not a valid size
+ */
+int parse_size(char *text, uint64_t *size) {
+    if (!text || !size) {
+        return -1;
+    }
+
+    char *end = NULL;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text) {
+        return -1;
+    }
+
+    switch (*end) {
+        case 'T': case 't':
+        value *= 1024;
+        /* fall through */
+        case 'G': case 'g':
+        value *= 1024;
+        /* fall through */
+        case 'M': case 'm':
+        value *= 1024;
+        /* fall through */
+        case 'K': case 'k':
+        value *= 1024;
+        end++;
+        break;
+        default:
+        break;
+    }
+    if (*end == 'B' || *end == 'b') {
+        end++;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+
+    *size = (uint64_t)value;
+    return 0;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
 #include <defines.h>
+#include <stdint.h>
 
-char *concat_path(char *result, char *prefix, char *suffix);
\ No newline at end of file
+char *concat_path(char *result, char *prefix, char *suffix);
+int parse_size(char *text, uint64_t *size);
\ No newline at end of file
@@ -0,0 +1,462 @@
+#include <watch.h>
+#include <sync.h>
+#include <streaming.h>
+#include <file-properties.h>
+#include <utility.h>
+#include <stats.h>
+#include <durable.h>
+#include <filter.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief init_watch creates the inotify instance of a watch context
+ * @param watch is a pointer to the context to initialize
+ * @return 0 when ok, -1 if inotify is not available
+ */
+int init_watch(watch_context_t *watch) {
+    memset(watch, 0, sizeof(watch_context_t));
+    watch->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->inotify_fd == -1) {
+        perror("Error creating inotify instance");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief clear_watch releases the watches and the pending dirty paths
+ * @param watch is a pointer to the context to clear
+ */
+void clear_watch(watch_context_t *watch) {
+    if (watch->inotify_fd != -1) {
+        close(watch->inotify_fd);
+    }
+    for (int i=0; i<watch->watched_capacity; ++i) {
+        free(watch->watched_paths[i]);
+    }
+    free(watch->watched_paths);
+    for (size_t i=0; i<watch->dirty_count; ++i) {
+        free(watch->dirty_paths[i].path);
+    }
+    free(watch->dirty_paths);
+    memset(watch, 0, sizeof(watch_context_t));
+    watch->inotify_fd = -1;
+}
+
+/*!
+ * @brief elapsed_ms returns the number of milliseconds elapsed since a monotonic time
+ */
+static long elapsed_ms(struct timespec since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since.tv_sec) * 1000 + (now.tv_nsec - since.tv_nsec) / 1000000;
+}
+
+/*!
+ * @brief has_pending_changes tests if changes wait to be applied
+ */
+static bool has_pending_changes(watch_context_t *watch) {
+    return watch->dirty_count > 0 || watch->needs_rescan;
+}
+
+/*!
+ * @brief mark_pending starts the delay of the oldest pending change
+ */
+static void mark_pending(watch_context_t *watch) {
+    if (!has_pending_changes(watch)) {
+        clock_gettime(CLOCK_MONOTONIC, &watch->first_dirty);
+    }
+}
+
+/*!
+ * @brief add_dirty_path records a path to synchronize; duplicates are removed when the paths are applied
+ * @param watch is a pointer to the watch context
+ * @param path is the full path in the source, copied
+ * @param is_subtree is true when the whole content of the directory must be synchronized
+ */
+static void add_dirty_path(watch_context_t *watch, char *path, bool is_subtree) {
+    if (watch->dirty_count == watch->dirty_capacity) {
+        size_t capacity = watch->dirty_capacity ? watch->dirty_capacity * 2 : 64;
+        dirty_path_t *bigger = realloc(watch->dirty_paths, sizeof(dirty_path_t) * capacity);
+        if (!bigger) {
+            perror("\nFailed allocating memory to dirty paths");
+            watch->needs_rescan = true;
+            return;
+        }
+        watch->dirty_paths = bigger;
+        watch->dirty_capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (!copy) {
+        watch->needs_rescan = true;
+        return;
+    }
+    mark_pending(watch);
+    watch->dirty_paths[watch->dirty_count].path = copy;
+    watch->dirty_paths[watch->dirty_count].is_subtree = is_subtree;
+    watch->dirty_count++;
+}
+
+/*!
+ * @brief set_watched_path remembers the directory of a watch descriptor
+ * @return 0 when ok, -1 on allocation failure
+ */
+static int set_watched_path(watch_context_t *watch, int wd, char *path) {
+    if (wd >= watch->watched_capacity) {
+        int capacity = watch->watched_capacity ? watch->watched_capacity : 64;
+        while (wd >= capacity) {
+            capacity *= 2;
+        }
+        char **bigger = realloc(watch->watched_paths, sizeof(char *) * capacity);
+        if (!bigger) {
+            perror("\nFailed allocating memory to watched paths");
+            return -1;
+        }
+        memset(bigger + watch->watched_capacity, 0, sizeof(char *) * (capacity - watch->watched_capacity));
+        watch->watched_paths = bigger;
+        watch->watched_capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (!copy) {
+        return -1;
+    }
+    free(watch->watched_paths[wd]);
+    watch->watched_paths[wd] = copy;
+    return 0;
+}
+
+/*!
+ * @brief add_watch_tree watches a directory and all its subdirectories
+ * A directory already watched keeps its watch descriptor, only its path is updated (e.g. after a rename).
+ * @param watch is a pointer to the watch context
+ * @param path is the path to the directory
+ * @return 0 when ok, -1 if some directory could not be watched
+ */
+int add_watch_tree(watch_context_t *watch, char *path) {
+    int wd = inotify_add_watch(watch->inotify_fd, path, WATCH_EVENTS_MASK | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if (wd == -1) {
+        if (errno == ENOSPC) {
+            fprintf(stderr, "Cannot watch %s: inotify watches limit reached (see /proc/sys/fs/inotify/max_user_watches)\n", path);
+        } else if (errno != ENOENT && errno != ENOTDIR) {
+            perror("Error watching directory");
+        }
+        return -1;
+    }
+    if (set_watched_path(watch, wd, path) == -1) {
+        return -1;
+    }
+
+    DIR *dir = open_dir(path);
+    if (!dir) {
+        return -1;
+    }
+    int result = 0;
+    struct dirent *entry;
+    while ((entry = get_next_entry(dir)) != NULL) {
+        if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
+        char *child_path = concat_path(NULL, path, entry->d_name);
+        if (!child_path) {
+            continue;
+        }
+        struct stat statbuf;
+        bool is_directory = entry->d_type == DT_DIR || (lstat(child_path, &statbuf) == 0 && S_ISDIR(statbuf.st_mode));
+        if (is_directory && !(watch->source && is_path_excluded(watch->source, child_path, DT_DIR))) {
+            if (add_watch_tree(watch, child_path) == -1) {
+                result = -1;
+            }
+        }
+        free(child_path);
+    }
+    closedir(dir);
+    return result;
+}
+
+/*!
+ * @brief read_watch_events drains the pending inotify events into the dirty paths
+ * New directories are watched right away, then synchronized as a whole since files may have been
+ * created in them before their watch was added.
+ * @param watch is a pointer to the watch context
+ * @return the number of events read, -1 in case of error
+ */
+int read_watch_events(watch_context_t *watch) {
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int events_count = 0;
+
+    while (true) {
+        ssize_t length = read(watch->inotify_fd, buffer, sizeof(buffer));
+        if (length == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return events_count;
+            }
+            perror("Error reading inotify events");
+            return -1;
+        }
+
+        for (char *cursor=buffer; cursor<buffer+length; ) {
+            struct inotify_event *event = (struct inotify_event *)cursor;
+            cursor += sizeof(struct inotify_event) + event->len;
+            events_count++;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                mark_pending(watch);
+                watch->needs_rescan = true;
+                continue;
+            }
+            if (event->wd < 0 || event->wd >= watch->watched_capacity || !watch->watched_paths[event->wd]) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                free(watch->watched_paths[event->wd]);
+                watch->watched_paths[event->wd] = NULL;
+                continue;
+            }
+            if (event->len == 0) {
+                continue;
+            }
+
+            char *path = concat_path(NULL, watch->watched_paths[event->wd], event->name);
+            if (!path || (watch->source && is_path_excluded(watch->source, path, (event->mask & IN_ISDIR) ? DT_DIR : DT_REG))) {
+                free(path);
+                continue;
+            }
+            bool is_subtree = (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO));
+            if (is_subtree) {
+                add_watch_tree(watch, path);
+            }
+            add_dirty_path(watch, path, is_subtree);
+            free(path);
+        }
+    }
+}
+
+/*!
+ * @brief clear_dirty_paths forgets the pending changes, e.g. when the whole source is synchronized
+ * @param watch is a pointer to the watch context
+ */
+void clear_dirty_paths(watch_context_t *watch) {
+    for (size_t i=0; i<watch->dirty_count; ++i) {
+        free(watch->dirty_paths[i].path);
+    }
+    watch->dirty_count = 0;
+}
+
+/*!
+ * @brief compare_dirty_paths orders dirty paths by path for qsort, so that duplicates are adjacent and
+ * a directory comes right before its content
+ */
+static int compare_dirty_paths(const void *lhs, const void *rhs) {
+    return strcmp(((const dirty_path_t *)lhs)->path, ((const dirty_path_t *)rhs)->path);
+}
+
+/*!
+ * @brief apply_dirty_path synchronizes one path of the source to the destination
+ * @param context is a pointer to the streaming context used for the copies
+ * @param dirty is the path to synchronize
+ */
+static void apply_dirty_path(streaming_context_t *context, dirty_path_t *dirty) {
+    configuration_t *the_config = context->the_config;
+    char *relative_path = dirty->path + strlen(the_config->source);
+    while (*relative_path == '/') {
+        relative_path++;
+    }
+    char *destination_path = concat_path(NULL, the_config->destination, relative_path);
+    files_list_entry_t *source_entry = malloc(sizeof(files_list_entry_t));
+    files_list_entry_t *destination_entry = malloc(sizeof(files_list_entry_t));
+    if (!destination_path || !source_entry || !destination_entry) {
+        free(destination_path);
+        free(source_entry);
+        free(destination_entry);
+        return;
+    }
+
+    // A path removed or replaced since the event is simply skipped: deletions are not propagated
+    memset(source_entry, 0, sizeof(files_list_entry_t));
+    strncpy(source_entry->path_and_name, dirty->path, sizeof(source_entry->path_and_name) - 1);
+    if (get_file_stats(source_entry) == 0 && (S_ISREG(source_entry->mode) || S_ISDIR(source_entry->mode))) {
+        memset(destination_entry, 0, sizeof(files_list_entry_t));
+        strncpy(destination_entry->path_and_name, destination_path, sizeof(destination_entry->path_and_name) - 1);
+        bool destination_exists = get_file_stats(destination_entry) == 0;
+        if (!destination_exists || mismatch(source_entry, destination_entry, the_config)) {
+            stream_difference(context, source_entry);
+        }
+        if (dirty->is_subtree && source_entry->entry_type == DOSSIER) {
+            bool destination_is_dir = directory_exists(destination_path);
+            stream_directory(context, dirty->path, destination_is_dir ? destination_path : NULL, NULL);
+        }
+    }
+
+    free(destination_path);
+    free(source_entry);
+    free(destination_entry);
+}
+
+/*!
+ * @brief process_dirty_paths calls a handler once for each pending change and empties the dirty paths
+ * Duplicates are merged and paths inside a directory handled as a whole are skipped.
+ * @param watch is a pointer to the watch context
+ * @param handler is called for each path to synchronize
+ * @param data is passed to the handler
+ */
+void process_dirty_paths(watch_context_t *watch, dirty_path_handler_t handler, void *data) {
+    qsort(watch->dirty_paths, watch->dirty_count, sizeof(dirty_path_t), compare_dirty_paths);
+    char *subtree = NULL;
+    size_t subtree_length = 0;
+    for (size_t i=0; i<watch->dirty_count; ++i) {
+        dirty_path_t *dirty = &watch->dirty_paths[i];
+        if (subtree && strncmp(dirty->path, subtree, subtree_length) == 0
+            && (dirty->path[subtree_length] == '/' || dirty->path[subtree_length] == '\0')) {
+            continue;
+        }
+        // Merge the duplicates of this path
+        while (i + 1 < watch->dirty_count && strcmp(watch->dirty_paths[i + 1].path, dirty->path) == 0) {
+            watch->dirty_paths[i + 1].is_subtree |= dirty->is_subtree;
+            dirty = &watch->dirty_paths[++i];
+        }
+        handler(dirty, data);
+        if (dirty->is_subtree) {
+            subtree = dirty->path;
+            subtree_length = strlen(subtree);
+        }
+    }
+    clear_dirty_paths(watch);
+}
+
+/*!
+ * @brief apply_dirty_path_handler applies a dirty path for process_dirty_paths
+ */
+static void apply_dirty_path_handler(dirty_path_t *dirty, void *data) {
+    apply_dirty_path((streaming_context_t *)data, dirty);
+}
+
+/*!
+ * @brief apply_dirty_paths synchronizes all the pending changes and empties the dirty paths
+ * Each path is applied once; paths inside a directory synchronized as a whole are skipped. After an
+ * overflow of the inotify queue, the whole source is rescanned and watched again instead.
+ * @param watch is a pointer to the watch context
+ * @param the_config is a pointer to the configuration
+ */
+void apply_dirty_paths(watch_context_t *watch, configuration_t *the_config) {
+    streaming_context_t context;
+    memset(&context, 0, sizeof(context));
+    context.the_config = the_config;
+    context.msg_queue = -1;
+
+    if (watch->needs_rescan) {
+        if (the_config->is_verbose) {
+            printf("\nEvents were lost, rescanning %s\n", the_config->source);
+        }
+        add_watch_tree(watch, the_config->source);
+        stream_directory(&context, the_config->source, the_config->destination, NULL);
+        clear_dirty_paths(watch);
+    } else {
+        process_dirty_paths(watch, apply_dirty_path_handler, &context);
+    }
+
+    if (the_config->is_verbose && context.differences_count > 0) {
+        printf("%lu entries synchronized\n", context.differences_count);
+    }
+    fflush(stdout);
+    watch->needs_rescan = false;
+}
+
+/*!
+ * @brief watch_source synchronizes the source and the destination, then keeps them synchronized
+ * The watches are added before the first synchronization so no change is missed. Afterwards, changes are
+ * applied once the source has been quiet for the debounce delay, or at the latest after
+ * WATCH_MAX_DELAY_FACTOR delays when changes keep coming. SIGINT and SIGTERM stop the loop between
+ * two batches, so no copy is interrupted.
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @return 0 when stopped by a signal, -1 in case of error
+ */
+int watch_source(configuration_t *the_config, process_context_t *p_context) {
+    watch_context_t watch;
+    if (init_watch(&watch) == -1) {
+        return -1;
+    }
+    watch.source = the_config->source;
+    if (add_watch_tree(&watch, the_config->source) == -1 && watch.watched_capacity == 0) {
+        clear_watch(&watch);
+        return -1;
+    }
+
+    synchronize(the_config, p_context);
+
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop_signals, NULL);
+    int signal_fd = signalfd(-1, &stop_signals, SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror("Error creating signal descriptor");
+        clear_watch(&watch);
+        return -1;
+    }
+
+    if (the_config->is_verbose) {
+        printf("\nWatching %s\n", the_config->source);
+    }
+    fflush(stdout);
+    SET_PROGRESS_PHASE(PROGRESS_WATCHING);
+
+    int result = 0;
+    bool is_stopped = false;
+    while (!is_stopped) {
+        int timeout = -1;
+        if (has_pending_changes(&watch)) {
+            timeout = elapsed_ms(watch.first_dirty) >= (long)the_config->debounce_ms * WATCH_MAX_DELAY_FACTOR ? 0 : (int)the_config->debounce_ms;
+        }
+
+        struct pollfd descriptors[2] = {
+            {.fd=watch.inotify_fd, .events=POLLIN, .revents=0},
+            {.fd=signal_fd, .events=POLLIN, .revents=0},
+        };
+        int ready = poll(descriptors, 2, timeout);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error waiting for changes");
+            result = -1;
+            break;
+        }
+        if (descriptors[1].revents & POLLIN) {
+            // Consumed, so it is not delivered when the signals are unblocked
+            struct signalfd_siginfo signal_info;
+            if (read(signal_fd, &signal_info, sizeof(signal_info)) == -1) {
+                perror("Error reading signal");
+            }
+            is_stopped = true;
+        }
+        if ((descriptors[0].revents & POLLIN) && read_watch_events(&watch) == -1) {
+            result = -1;
+            break;
+        }
+
+        if (has_pending_changes(&watch)
+            && (ready == 0 || is_stopped || elapsed_ms(watch.first_dirty) >= (long)the_config->debounce_ms * WATCH_MAX_DELAY_FACTOR)) {
+            apply_dirty_paths(&watch, the_config);
+            finish_durable_writes(the_config);
+        }
+    }
+
+    close(signal_fd);
+    sigprocmask(SIG_UNBLOCK, &stop_signals, NULL);
+    clear_watch(&watch);
+    return result;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <configuration.h>
+#include <processes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS_MASK (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB)
+#define WATCH_MAX_DELAY_FACTOR 10 // Dirty paths are applied at the latest after 10 debounce periods
+
+typedef struct {
+    char *path; // Full path in the source
+    bool is_subtree; // The path is a new directory whose whole content must be synchronized
+} dirty_path_t;
+
+typedef struct {
+    int inotify_fd;
+    char *source; // Root of the watched tree, filter rules apply to the paths relative to it
+    char **watched_paths; // Directory watched by each watch descriptor
+    int watched_capacity;
+    dirty_path_t *dirty_paths;
+    size_t dirty_count;
+    size_t dirty_capacity;
+    bool needs_rescan; // Events were lost (queue overflow), the whole source must be rescanned
+    struct timespec first_dirty; // Time of the oldest pending change
+} watch_context_t;
+
+typedef void (*dirty_path_handler_t)(dirty_path_t *dirty, void *data);
+
+int init_watch(watch_context_t *watch);
+void clear_watch(watch_context_t *watch);
+int add_watch_tree(watch_context_t *watch, char *path);
+int read_watch_events(watch_context_t *watch);
+void clear_dirty_paths(watch_context_t *watch);
+void process_dirty_paths(watch_context_t *watch, dirty_path_handler_t handler, void *data);
+void apply_dirty_paths(watch_context_t *watch, configuration_t *the_config);
+int watch_source(configuration_t *the_config, process_context_t *p_context);